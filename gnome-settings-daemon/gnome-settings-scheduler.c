@@ -0,0 +1,454 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "gnome-settings-scheduler.h"
+
+/*
+ * Periodic jobs from all the plugins share a single timer. Each job
+ * becomes due one period after it last ran, and may be run up to its
+ * slack later; the timer fires at the earliest such deadline and runs
+ * every job that is due by then, so that jobs with some slack piggyback
+ * on each other's wakeups instead of waking the system up separately.
+ *
+ * Jobs can ask to be held back while the machine is on battery or the
+ * session is idle. They are then run as soon as that is no longer the
+ * case, but never more than one extra period late.
+ */
+
+#define UPOWER_DBUS_NAME                "org.freedesktop.UPower"
+#define UPOWER_DBUS_PATH                "/org/freedesktop/UPower"
+#define UPOWER_DBUS_INTERFACE           "org.freedesktop.UPower"
+
+#define GNOME_SESSION_DBUS_NAME         "org.gnome.SessionManager"
+#define GNOME_SESSION_PRESENCE_PATH     "/org/gnome/SessionManager/Presence"
+#define GNOME_SESSION_PRESENCE_IFACE    "org.gnome.SessionManager.Presence"
+
+#define PRESENCE_STATUS_IDLE            3
+
+typedef struct {
+        guint                    id;
+        gint                     ref_count;
+        gboolean                 removed;
+
+        char                    *name;
+        gint64                   period;        /* all times in µs */
+        gint64                   slack;
+        GnomeSettingsJobPolicy   policy;
+        GSourceFunc              func;
+        gpointer                 data;
+        GDestroyNotify           notify;
+
+        gint64                   next_run;
+        gboolean                 deferred;
+
+        guint                    n_runs;
+        guint                    n_deferrals;
+        gint64                   total_time;
+        gint64                   max_time;
+} Job;
+
+typedef struct {
+        GHashTable              *jobs;          /* key = id, value = Job */
+        guint                    next_id;
+        guint                    timeout_id;
+        gint64                   wakeup;
+
+        GDBusProxy              *upower_proxy;
+        GDBusProxy              *presence_proxy;
+        gboolean                 on_battery;
+        gboolean                 session_idle;
+} Scheduler;
+
+static Scheduler *scheduler = NULL;
+
+static void scheduler_reschedule (void);
+
+static Job *
+job_ref (Job *job)
+{
+        job->ref_count++;
+        return job;
+}
+
+static void
+job_unref (Job *job)
+{
+        if (--job->ref_count > 0)
+                return;
+
+        if (job->notify != NULL)
+                job->notify (job->data);
+        g_free (job->name);
+        g_free (job);
+}
+
+static void
+job_remove (Job *job)
+{
+        if (job->removed)
+                return;
+
+        job->removed = TRUE;
+        g_hash_table_remove (scheduler->jobs, GUINT_TO_POINTER (job->id));
+}
+
+static gboolean
+job_is_held (Job *job)
+{
+        if ((job->policy & GNOME_SETTINGS_JOB_DEFER_ON_BATTERY) && scheduler->on_battery)
+                return TRUE;
+        if ((job->policy & GNOME_SETTINGS_JOB_DEFER_WHEN_IDLE) && scheduler->session_idle)
+                return TRUE;
+        return FALSE;
+}
+
+static gint64
+job_get_deadline (Job *job)
+{
+        if (job_is_held (job))
+                return job->next_run + job->period;
+        return job->next_run + job->slack;
+}
+
+static void
+job_run (Job    *job,
+         gint64  now)
+{
+        gboolean keep;
+        gint64 start, elapsed;
+
+        start = g_get_monotonic_time ();
+        keep = job->func (job->data);
+        elapsed = g_get_monotonic_time () - start;
+
+        job->n_runs++;
+        job->total_time += elapsed;
+        job->max_time = MAX (job->max_time, elapsed);
+        job->deferred = FALSE;
+        job->next_run = now + job->period;
+
+        g_debug ("Ran job '%s' in %" G_GINT64_FORMAT " us", job->name, elapsed);
+
+        if (!keep)
+                job_remove (job);
+}
+
+static gboolean
+scheduler_dispatch_cb (gpointer user_data)
+{
+        GPtrArray *due;
+        GHashTableIter iter;
+        Job *job;
+        gint64 now;
+        guint i;
+
+        scheduler->timeout_id = 0;
+        now = g_get_monotonic_time ();
+
+        /* Jobs may add or remove jobs while they run */
+        due = g_ptr_array_new_with_free_func ((GDestroyNotify) job_unref);
+        g_hash_table_iter_init (&iter, scheduler->jobs);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &job)) {
+                if (job->next_run <= now)
+                        g_ptr_array_add (due, job_ref (job));
+        }
+
+        for (i = 0; i < due->len; i++) {
+                job = g_ptr_array_index (due, i);
+                if (job->removed)
+                        continue;
+
+                if (job_is_held (job) && now < job->next_run + job->period) {
+                        if (!job->deferred) {
+                                g_debug ("Deferring job '%s'", job->name);
+                                job->deferred = TRUE;
+                                job->n_deferrals++;
+                        }
+                        continue;
+                }
+
+                job_run (job, now);
+        }
+
+        g_ptr_array_unref (due);
+
+        scheduler_reschedule ();
+
+        return FALSE;
+}
+
+static void
+scheduler_reschedule (void)
+{
+        GHashTableIter iter;
+        Job *job;
+        gint64 earliest = G_MAXINT64;
+        gint64 delay;
+
+        g_hash_table_iter_init (&iter, scheduler->jobs);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &job))
+                earliest = MIN (earliest, job_get_deadline (job));
+
+        if (scheduler->timeout_id != 0) {
+                if (earliest == scheduler->wakeup)
+                        return;
+                g_source_remove (scheduler->timeout_id);
+                scheduler->timeout_id = 0;
+        }
+
+        if (earliest == G_MAXINT64)
+                return;
+
+        /* Whole seconds, so that we also line up with the other
+         * g_timeout_add_seconds() users in the session */
+        delay = MAX (0, earliest - g_get_monotonic_time ());
+        scheduler->wakeup = earliest;
+        scheduler->timeout_id = g_timeout_add_seconds ((delay + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC,
+                                                       scheduler_dispatch_cb, NULL);
+        g_source_set_name_by_id (scheduler->timeout_id, "[gnome-settings-daemon] scheduler_dispatch_cb");
+}
+
+static void
+upower_properties_changed_cb (GDBusProxy *proxy,
+                              GVariant   *changed_properties,
+                              GStrv       invalidated_properties,
+                              gpointer    user_data)
+{
+        GVariant *v;
+
+        v = g_dbus_proxy_get_cached_property (proxy, "OnBattery");
+        if (v == NULL)
+                return;
+
+        if (scheduler->on_battery != g_variant_get_boolean (v)) {
+                scheduler->on_battery = g_variant_get_boolean (v);
+                g_debug ("Scheduler: on battery %i", scheduler->on_battery);
+                scheduler_reschedule ();
+        }
+        g_variant_unref (v);
+}
+
+static void
+upower_ready_cb (GObject      *source_object,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+        GError *error = NULL;
+
+        scheduler->upower_proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+        if (scheduler->upower_proxy == NULL) {
+                g_debug ("Scheduler: no power state available: %s", error->message);
+                g_error_free (error);
+                return;
+        }
+
+        g_signal_connect (scheduler->upower_proxy, "g-properties-changed",
+                          G_CALLBACK (upower_properties_changed_cb), NULL);
+        upower_properties_changed_cb (scheduler->upower_proxy, NULL, NULL, NULL);
+}
+
+static void
+presence_set_status (guint status)
+{
+        gboolean idle;
+
+        idle = (status == PRESENCE_STATUS_IDLE);
+        if (scheduler->session_idle == idle)
+                return;
+
+        scheduler->session_idle = idle;
+        g_debug ("Scheduler: session idle %i", scheduler->session_idle);
+        scheduler_reschedule ();
+}
+
+static void
+presence_signal_cb (GDBusProxy *proxy,
+                    gchar      *sender_name,
+                    gchar      *signal_name,
+                    GVariant   *parameters,
+                    gpointer    user_data)
+{
+        guint status;
+
+        if (g_strcmp0 (signal_name, "StatusChanged") != 0)
+                return;
+
+        g_variant_get (parameters, "(u)", &status);
+        presence_set_status (status);
+}
+
+static void
+presence_ready_cb (GObject      *source_object,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+        GError *error = NULL;
+        GVariant *v;
+
+        scheduler->presence_proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+        if (scheduler->presence_proxy == NULL) {
+                g_debug ("Scheduler: no session presence available: %s", error->message);
+                g_error_free (error);
+                return;
+        }
+
+        g_signal_connect (scheduler->presence_proxy, "g-signal",
+                          G_CALLBACK (presence_signal_cb), NULL);
+
+        v = g_dbus_proxy_get_cached_property (scheduler->presence_proxy, "status");
+        if (v != NULL) {
+                presence_set_status (g_variant_get_uint32 (v));
+                g_variant_unref (v);
+        }
+}
+
+static Scheduler *
+scheduler_get (void)
+{
+        if (scheduler != NULL)
+                return scheduler;
+
+        scheduler = g_new0 (Scheduler, 1);
+        scheduler->jobs = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                 NULL, (GDestroyNotify) job_unref);
+        scheduler->next_id = 1;
+
+        g_dbus_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
+                                  G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                                  NULL,
+                                  UPOWER_DBUS_NAME,
+                                  UPOWER_DBUS_PATH,
+                                  UPOWER_DBUS_INTERFACE,
+                                  NULL,
+                                  upower_ready_cb,
+                                  NULL);
+        g_dbus_proxy_new_for_bus (G_BUS_TYPE_SESSION,
+                                  G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                                  NULL,
+                                  GNOME_SESSION_DBUS_NAME,
+                                  GNOME_SESSION_PRESENCE_PATH,
+                                  GNOME_SESSION_PRESENCE_IFACE,
+                                  NULL,
+                                  presence_ready_cb,
+                                  NULL);
+
+        return scheduler;
+}
+
+/**
+ * gnome_settings_scheduler_add_job:
+ * @name: a name for debugging and statistics
+ * @period: how often to run @func, in seconds
+ * @slack: how much later than due @func may run, in seconds
+ * @policy: when to hold @func back
+ * @func: the function to run, returning %FALSE to stop
+ * @data: data for @func
+ * @notify: called on @data when the job is removed
+ *
+ * Runs @func every @period seconds, give or take the @slack needed to
+ * batch it with other jobs, on the default main context.
+ *
+ * Returns: an id for gnome_settings_scheduler_remove_job()
+ **/
+guint
+gnome_settings_scheduler_add_job (const char             *name,
+                                  guint                   period,
+                                  guint                   slack,
+                                  GnomeSettingsJobPolicy  policy,
+                                  GSourceFunc             func,
+                                  gpointer                data,
+                                  GDestroyNotify          notify)
+{
+        Job *job;
+
+        g_return_val_if_fail (name != NULL, 0);
+        g_return_val_if_fail (period > 0, 0);
+        g_return_val_if_fail (func != NULL, 0);
+
+        scheduler_get ();
+
+        job = g_new0 (Job, 1);
+        job->ref_count = 1;
+        job->id = scheduler->next_id++;
+        job->name = g_strdup (name);
+        job->period = (gint64) period * G_USEC_PER_SEC;
+        job->slack = (gint64) MIN (slack, period) * G_USEC_PER_SEC;
+        job->policy = policy;
+        job->func = func;
+        job->data = data;
+        job->notify = notify;
+        job->next_run = g_get_monotonic_time () + job->period;
+
+        g_hash_table_insert (scheduler->jobs, GUINT_TO_POINTER (job->id), job);
+        scheduler_reschedule ();
+
+        return job->id;
+}
+
+void
+gnome_settings_scheduler_remove_job (guint id)
+{
+        Job *job;
+
+        if (scheduler == NULL || id == 0)
+                return;
+
+        job = g_hash_table_lookup (scheduler->jobs, GUINT_TO_POINTER (id));
+        if (job == NULL)
+                return;
+
+        job_remove (job);
+        scheduler_reschedule ();
+}
+
+/**
+ * gnome_settings_scheduler_get_statistics:
+ *
+ * Returns: a floating #GVariant of type a(suuuuxx) holding, for each
+ * job, its name, period and slack in seconds, the number of times it
+ * ran and was deferred, and its total and longest run times in µs.
+ **/
+GVariant *
+gnome_settings_scheduler_get_statistics (void)
+{
+        GVariantBuilder builder;
+        GHashTableIter iter;
+        Job *job;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(suuuuxx)"));
+
+        if (scheduler != NULL) {
+                g_hash_table_iter_init (&iter, scheduler->jobs);
+                while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &job)) {
+                        g_variant_builder_add (&builder, "(suuuuxx)",
+                                               job->name,
+                                               (guint) (job->period / G_USEC_PER_SEC),
+                                               (guint) (job->slack / G_USEC_PER_SEC),
+                                               job->n_runs,
+                                               job->n_deferrals,
+                                               job->total_time,
+                                               job->max_time);
+                }
+        }
+
+        return g_variant_builder_end (&builder);
+}
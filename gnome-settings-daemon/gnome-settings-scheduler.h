@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GNOME_SETTINGS_SCHEDULER_H
+#define __GNOME_SETTINGS_SCHEDULER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+        GNOME_SETTINGS_JOB_ALWAYS               = 0,
+        GNOME_SETTINGS_JOB_DEFER_ON_BATTERY     = 1 << 0,
+        GNOME_SETTINGS_JOB_DEFER_WHEN_IDLE      = 1 << 1
+} GnomeSettingsJobPolicy;
+
+guint            gnome_settings_scheduler_add_job        (const char             *name,
+                                                          guint                   period,
+                                                          guint                   slack,
+                                                          GnomeSettingsJobPolicy  policy,
+                                                          GSourceFunc             func,
+                                                          gpointer                data,
+                                                          GDestroyNotify          notify);
+void             gnome_settings_scheduler_remove_job     (guint                   id);
+GVariant        *gnome_settings_scheduler_get_statistics (void);
+
+G_END_DECLS
+
+#endif /* __GNOME_SETTINGS_SCHEDULER_H */
@@ -0,0 +1,231 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "gnome-settings-snapshot.h"
+
+/*
+ * Plugins can save some of what they discovered at runtime when they
+ * are stopped, and pick it up again when the daemon is restarted, so
+ * that they don't need to find it all out again.
+ *
+ * Snapshots live in the user runtime directory, so they don't survive
+ * the end of the session, and are tagged with the boot they were made
+ * in. Loading a snapshot always removes it, so it is used at most once
+ * and a crash later on can't make the next start use stale data.
+ *
+ * The snapshot is only a hint: plugins still need to check that what
+ * it contains matches the state of the system, eg. using the mtime of
+ * the files it talks about.
+ */
+
+#define SNAPSHOT_FORMAT                 "(usv)"
+#define SNAPSHOT_BOOT_ID_FILE           "/proc/sys/kernel/random/boot_id"
+
+static char *
+get_boot_id (void)
+{
+        char *boot_id = NULL;
+
+        if (!g_file_get_contents (SNAPSHOT_BOOT_ID_FILE, &boot_id, NULL, NULL))
+                return g_strdup ("");
+        return g_strstrip (boot_id);
+}
+
+static char *
+get_snapshot_dir (void)
+{
+        return g_build_filename (g_get_user_runtime_dir (),
+                                 "gnome-settings-daemon",
+                                 NULL);
+}
+
+static char *
+get_snapshot_path (const char *name)
+{
+        char *dir;
+        char *basename;
+        char *path;
+
+        dir = get_snapshot_dir ();
+        basename = g_strdup_printf ("%s.snapshot", name);
+        path = g_build_filename (dir, basename, NULL);
+        g_free (basename);
+        g_free (dir);
+        return path;
+}
+
+/**
+ * gnome_settings_snapshot_save:
+ * @name: the plugin name
+ * @version: the version of the format of @state
+ * @state: the state to save; floating references are sunk
+ *
+ * Saves @state so that the next start of the plugin in this session
+ * can load it with gnome_settings_snapshot_load().
+ *
+ * Returns: %TRUE if the snapshot was written
+ **/
+gboolean
+gnome_settings_snapshot_save (const char *name,
+                              guint       version,
+                              GVariant   *state)
+{
+        GVariant *snapshot;
+        GError *error = NULL;
+        char *boot_id;
+        char *dir;
+        char *path = NULL;
+        gboolean ret = FALSE;
+
+        g_return_val_if_fail (name != NULL, FALSE);
+        g_return_val_if_fail (state != NULL, FALSE);
+
+        boot_id = get_boot_id ();
+        snapshot = g_variant_ref_sink (g_variant_new (SNAPSHOT_FORMAT,
+                                                      version,
+                                                      boot_id,
+                                                      state));
+
+        dir = get_snapshot_dir ();
+        if (g_mkdir_with_parents (dir, 0700) < 0) {
+                g_warning ("Failed to create %s for the %s snapshot", dir, name);
+                goto out;
+        }
+
+        path = get_snapshot_path (name);
+        if (!g_file_set_contents (path,
+                                  g_variant_get_data (snapshot),
+                                  g_variant_get_size (snapshot),
+                                  &error)) {
+                g_warning ("Failed to save the %s snapshot: %s", name, error->message);
+                g_error_free (error);
+                goto out;
+        }
+
+        g_debug ("Saved %" G_GSIZE_FORMAT " bytes of %s state",
+                 g_variant_get_size (snapshot), name);
+        ret = TRUE;
+out:
+        g_free (path);
+        g_free (dir);
+        g_free (boot_id);
+        g_variant_unref (snapshot);
+        return ret;
+}
+
+/**
+ * gnome_settings_snapshot_load:
+ * @name: the plugin name
+ * @version: the version of the format the plugin understands
+ * @type: the type of state the plugin expects
+ *
+ * Loads, and removes, the state saved by gnome_settings_snapshot_save().
+ * Nothing is returned if the snapshot was saved by another boot, with
+ * another @version, or doesn't have the right @type.
+ *
+ * Returns: the saved state, or %NULL
+ **/
+GVariant *
+gnome_settings_snapshot_load (const char         *name,
+                              guint               version,
+                              const GVariantType *type)
+{
+        GVariant *snapshot = NULL;
+        GVariant *state = NULL;
+        GError *error = NULL;
+        char *path;
+        char *contents = NULL;
+        gsize length;
+        char *boot_id = NULL;
+        const char *saved_boot_id;
+        guint saved_version;
+
+        g_return_val_if_fail (name != NULL, NULL);
+        g_return_val_if_fail (type != NULL, NULL);
+
+        path = get_snapshot_path (name);
+        if (!g_file_get_contents (path, &contents, &length, &error)) {
+                if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        g_warning ("Failed to load the %s snapshot: %s", name, error->message);
+                g_error_free (error);
+                goto out;
+        }
+        g_unlink (path);
+
+        snapshot = g_variant_ref_sink (g_variant_new_from_data (G_VARIANT_TYPE (SNAPSHOT_FORMAT),
+                                                                contents,
+                                                                length,
+                                                                FALSE,
+                                                                g_free,
+                                                                contents));
+        contents = NULL;
+
+        g_variant_get (snapshot, "(u&sv)", &saved_version, &saved_boot_id, &state);
+
+        if (saved_version != version) {
+                g_debug ("Ignoring %s snapshot with version %u, expected %u",
+                         name, saved_version, version);
+                g_clear_pointer (&state, g_variant_unref);
+                goto out;
+        }
+
+        boot_id = get_boot_id ();
+        if (g_strcmp0 (saved_boot_id, boot_id) != 0) {
+                g_debug ("Ignoring %s snapshot from another boot", name);
+                g_clear_pointer (&state, g_variant_unref);
+                goto out;
+        }
+
+        if (!g_variant_is_of_type (state, type)) {
+                g_warning ("Ignoring %s snapshot of type %s",
+                           name, g_variant_get_type_string (state));
+                g_clear_pointer (&state, g_variant_unref);
+                goto out;
+        }
+
+        g_debug ("Loaded %" G_GSIZE_FORMAT " bytes of %s state", length, name);
+out:
+        if (snapshot != NULL)
+                g_variant_unref (snapshot);
+        g_free (boot_id);
+        g_free (contents);
+        g_free (path);
+        return state;
+}
+
+/**
+ * gnome_settings_snapshot_discard:
+ * @name: the plugin name
+ *
+ * Removes the state saved by gnome_settings_snapshot_save(), if any.
+ **/
+void
+gnome_settings_snapshot_discard (const char *name)
+{
+        char *path;
+
+        g_return_if_fail (name != NULL);
+
+        path = get_snapshot_path (name);
+        g_unlink (path);
+        g_free (path);
+}
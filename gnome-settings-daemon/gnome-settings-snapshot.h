@@ -0,0 +1,35 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GNOME_SETTINGS_SNAPSHOT_H
+#define __GNOME_SETTINGS_SNAPSHOT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gboolean         gnome_settings_snapshot_save            (const char             *name,
+                                                          guint                   version,
+                                                          GVariant               *state);
+GVariant        *gnome_settings_snapshot_load            (const char             *name,
+                                                          guint                   version,
+                                                          const GVariantType     *type);
+void             gnome_settings_snapshot_discard         (const char             *name);
+
+G_END_DECLS
+
+#endif /* __GNOME_SETTINGS_SNAPSHOT_H */
@@ -0,0 +1,498 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "gnome-settings-plugin.h"
+#include "gnome-settings-scheduler.h"
+#include "gnome-settings-watchdog.h"
+
+/*
+ * Measures how long the main loop is kept busy, and by what.
+ *
+ * GLib has no dispatch hooks, so the dispatch functions of the stock
+ * timeout, idle, I/O and child watch sources are wrapped; that covers
+ * what the plugins add themselves as well as GDBus and GSettings
+ * callbacks, which are delivered through idle sources. Time spent in an
+ * iteration outside of those (GDK events, for instance) is accounted to
+ * "(other sources)". Latencies are kept per source name, as set with
+ * g_source_set_name_by_id().
+ *
+ * A helper thread notices when an iteration runs past the threshold,
+ * and then asks the main thread for a backtrace with a signal, which
+ * shows the plugin at fault even for unnamed sources.
+ *
+ * The statistics of the jobs run by the scheduler are exported here
+ * too, as they are what the latencies of its source are made of.
+ */
+
+#define WATCHDOG_DBUS_PATH      GSD_DBUS_PATH "/Watchdog"
+#define OTHER_SOURCES           "(other sources)"
+#define N_BUCKETS               7       /* < 1, 4, 16, 64, 256, 1024 ms and above */
+#define MAX_STALLS              16
+#define MAX_FRAMES              64
+
+static const gchar introspection_xml[] =
+"<node>"
+"  <interface name='org.gnome.SettingsDaemon.Watchdog'>"
+"    <method name='GetLatencies'>"
+"      <arg name='latencies' direction='out' type='a(stttat)'/>"
+"    </method>"
+"    <method name='GetStalls'>"
+"      <arg name='stalls' direction='out' type='a(xsus)'/>"
+"    </method>"
+"    <method name='GetSchedulerStatistics'>"
+"      <arg name='jobs' direction='out' type='a(suuuuxx)'/>"
+"    </method>"
+"    <property name='Threshold' type='u' access='read'/>"
+"  </interface>"
+"</node>";
+
+typedef struct {
+        guint64          count;
+        guint64          total;         /* µs */
+        guint64          max;           /* µs */
+        guint64          buckets[N_BUCKETS];
+} Histogram;
+
+typedef struct {
+        gint64           time;          /* seconds since the epoch */
+        gchar           *name;
+        guint            duration;      /* ms, until the iteration ended */
+        guint            seq;
+        gchar           *backtrace;
+} Stall;
+
+typedef struct {
+        GSourceFuncs    *funcs;
+        const char      *unnamed;
+        gboolean       (*dispatch) (GSource     *source,
+                                    GSourceFunc  callback,
+                                    gpointer     user_data);
+} WrappedFuncs;
+
+static WrappedFuncs wrapped[] = {
+        { &g_timeout_funcs, "(unnamed timeout)", NULL },
+        { &g_idle_funcs, "(unnamed idle)", NULL },
+        { &g_io_watch_funcs, "(unnamed I/O watch)", NULL },
+        { &g_child_watch_funcs, "(unnamed child watch)", NULL },
+};
+
+/* Main thread only */
+static guint             threshold = 0; /* ms */
+static GHashTable       *histograms = NULL;
+static GPollFunc         default_poll_func = NULL;
+static gint64            iteration_start = 0;
+static gint64            attributed = 0;
+
+/* Shared with the helper thread */
+static GMutex            lock;
+static gint64            busy_since = 0;
+static guint             seq = 0;
+static const char       *current_name = NULL;
+static GQueue            stalls = G_QUEUE_INIT;
+
+#ifdef HAVE_EXECINFO_H
+static pthread_t         main_thread;
+static sem_t             backtrace_sem;
+static void             *backtrace_frames[MAX_FRAMES];
+static volatile int      n_backtrace_frames;
+#endif
+
+static void
+stall_free (Stall *stall)
+{
+        g_free (stall->name);
+        g_free (stall->backtrace);
+        g_free (stall);
+}
+
+static void
+record_latency (const char *name,
+                gint64      duration)
+{
+        Histogram *histogram;
+        gint64 ms, limit;
+        guint bucket;
+
+        histogram = g_hash_table_lookup (histograms, name);
+        if (histogram == NULL) {
+                histogram = g_new0 (Histogram, 1);
+                g_hash_table_insert (histograms, g_strdup (name), histogram);
+        }
+
+        ms = duration / 1000;
+        for (bucket = 0, limit = 1; bucket < N_BUCKETS - 1 && ms >= limit; bucket++)
+                limit *= 4;
+
+        histogram->count++;
+        histogram->total += duration;
+        histogram->max = MAX (histogram->max, (guint64) duration);
+        histogram->buckets[bucket]++;
+}
+
+static gboolean
+watchdog_dispatch (GSource     *source,
+                   GSourceFunc  callback,
+                   gpointer     user_data)
+{
+        WrappedFuncs *funcs = NULL;
+        GMainContext *context;
+        const char *name, *prev_name;
+        gint64 start, duration;
+        gboolean ret;
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS (wrapped); i++) {
+                if (source->source_funcs == wrapped[i].funcs) {
+                        funcs = &wrapped[i];
+                        break;
+                }
+        }
+        g_assert (funcs != NULL);
+
+        /* The source funcs are shared by every thread, but only the
+         * main loop is measured, and nothing here is thread-safe */
+        context = g_source_get_context (source);
+        if (context != g_main_context_default () ||
+            !g_main_context_is_owner (context))
+                return funcs->dispatch (source, callback, user_data);
+
+        name = g_source_get_name (source);
+        if (name == NULL)
+                name = funcs->unnamed;
+
+        /* Callbacks may run nested main loops */
+        g_mutex_lock (&lock);
+        prev_name = current_name;
+        current_name = name;
+        g_mutex_unlock (&lock);
+
+        start = g_get_monotonic_time ();
+        ret = funcs->dispatch (source, callback, user_data);
+        duration = g_get_monotonic_time () - start;
+
+        g_mutex_lock (&lock);
+        current_name = prev_name;
+        g_mutex_unlock (&lock);
+
+        attributed += duration;
+        record_latency (name, duration);
+
+        return ret;
+}
+
+static gint
+watchdog_poll (GPollFD *fds,
+               guint    nfds,
+               gint     timeout)
+{
+        Stall *stall;
+        gint64 now;
+        gint ret;
+
+        now = g_get_monotonic_time ();
+        if (iteration_start != 0)
+                record_latency (OTHER_SOURCES, MAX (0, now - iteration_start - attributed));
+
+        g_mutex_lock (&lock);
+        stall = g_queue_peek_tail (&stalls);
+        if (stall != NULL && stall->seq == seq && busy_since != 0)
+                stall->duration = (now - busy_since) / 1000;
+        busy_since = 0;
+        g_mutex_unlock (&lock);
+
+        ret = default_poll_func (fds, nfds, timeout);
+
+        now = g_get_monotonic_time ();
+        g_mutex_lock (&lock);
+        busy_since = now;
+        seq++;
+        g_mutex_unlock (&lock);
+
+        iteration_start = now;
+        attributed = 0;
+
+        return ret;
+}
+
+#ifdef HAVE_EXECINFO_H
+static void
+backtrace_signal_handler (int signo)
+{
+        n_backtrace_frames = backtrace (backtrace_frames, MAX_FRAMES);
+        sem_post (&backtrace_sem);
+}
+
+static gchar *
+capture_backtrace (void)
+{
+        struct timespec deadline;
+        GString *str;
+        char **symbols;
+        int i;
+
+        /* Forget about any late answer to an earlier request */
+        while (sem_trywait (&backtrace_sem) == 0)
+                ;
+
+        if (pthread_kill (main_thread, SIGRTMIN) != 0)
+                return NULL;
+
+        clock_gettime (CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 200 * 1000 * 1000;
+        if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000 * 1000 * 1000;
+        }
+        if (sem_timedwait (&backtrace_sem, &deadline) != 0)
+                return NULL;
+
+        symbols = backtrace_symbols (backtrace_frames, n_backtrace_frames);
+        if (symbols == NULL)
+                return NULL;
+
+        /* Skip the signal handler itself */
+        str = g_string_new (NULL);
+        for (i = 1; i < n_backtrace_frames; i++)
+                g_string_append_printf (str, "  %s\n", symbols[i]);
+        free (symbols);
+
+        return g_string_free (str, FALSE);
+}
+#else
+static gchar *
+capture_backtrace (void)
+{
+        return NULL;
+}
+#endif
+
+static gpointer
+watchdog_thread (gpointer data)
+{
+        guint reported = 0;
+
+        while (TRUE) {
+                Stall *stall;
+                gchar *name;
+                gint64 now;
+                guint this_seq, duration;
+
+                g_usleep (MAX (threshold * 1000 / 4, 10 * 1000));
+
+                now = g_get_monotonic_time ();
+                g_mutex_lock (&lock);
+                if (busy_since == 0 ||
+                    seq == reported ||
+                    now - busy_since < (gint64) threshold * 1000) {
+                        g_mutex_unlock (&lock);
+                        continue;
+                }
+                reported = this_seq = seq;
+                duration = (now - busy_since) / 1000;
+                name = g_strdup (current_name ? current_name : OTHER_SOURCES);
+                g_mutex_unlock (&lock);
+
+                stall = g_new0 (Stall, 1);
+                stall->time = g_get_real_time () / G_USEC_PER_SEC;
+                stall->name = name;
+                stall->duration = duration;
+                stall->seq = this_seq;
+                stall->backtrace = capture_backtrace ();
+
+                g_warning ("Main loop blocked for more than %u ms in '%s'%s%s",
+                           duration, name,
+                           stall->backtrace ? ":\n" : "",
+                           stall->backtrace ? stall->backtrace : "");
+
+                g_mutex_lock (&lock);
+                g_queue_push_tail (&stalls, stall);
+                if (g_queue_get_length (&stalls) > MAX_STALLS)
+                        stall_free (g_queue_pop_head (&stalls));
+                g_mutex_unlock (&lock);
+        }
+
+        return NULL;
+}
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+        GVariantBuilder builder;
+
+        if (g_strcmp0 (method_name, "GetLatencies") == 0) {
+                GHashTableIter iter;
+                const char *name;
+                Histogram *histogram;
+
+                g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(stttat)"));
+                g_hash_table_iter_init (&iter, histograms);
+                while (g_hash_table_iter_next (&iter, (gpointer *) &name, (gpointer *) &histogram)) {
+                        GVariant *buckets;
+
+                        buckets = g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                                             histogram->buckets,
+                                                             N_BUCKETS,
+                                                             sizeof (guint64));
+                        g_variant_builder_add (&builder, "(sttt@at)",
+                                               name,
+                                               histogram->count,
+                                               histogram->total,
+                                               histogram->max,
+                                               buckets);
+                }
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(a(stttat))", &builder));
+        } else if (g_strcmp0 (method_name, "GetStalls") == 0) {
+                GList *l;
+
+                g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(xsus)"));
+                g_mutex_lock (&lock);
+                for (l = stalls.head; l != NULL; l = l->next) {
+                        Stall *stall = l->data;
+
+                        g_variant_builder_add (&builder, "(xsus)",
+                                               stall->time,
+                                               stall->name,
+                                               stall->duration,
+                                               stall->backtrace ? stall->backtrace : "");
+                }
+                g_mutex_unlock (&lock);
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(a(xsus))", &builder));
+        } else if (g_strcmp0 (method_name, "GetSchedulerStatistics") == 0) {
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(@a(suuuuxx))",
+                                                                      gnome_settings_scheduler_get_statistics ()));
+        }
+}
+
+static GVariant *
+handle_get_property (GDBusConnection *connection,
+                     const gchar     *sender,
+                     const gchar     *object_path,
+                     const gchar     *interface_name,
+                     const gchar     *property_name,
+                     GError         **error,
+                     gpointer         user_data)
+{
+        if (g_strcmp0 (property_name, "Threshold") == 0)
+                return g_variant_new_uint32 (threshold);
+
+        return NULL;
+}
+
+static const GDBusInterfaceVTable interface_vtable =
+{
+        handle_method_call,
+        handle_get_property,
+        NULL
+};
+
+/**
+ * gnome_settings_watchdog_start:
+ * @threshold_ms: the time in ms after which a busy main loop is reported
+ *
+ * Starts measuring the default main context; call before running it.
+ **/
+void
+gnome_settings_watchdog_start (guint threshold_ms)
+{
+        GMainContext *context;
+        guint i;
+
+        g_return_if_fail (histograms == NULL);
+        g_return_if_fail (threshold_ms > 0);
+
+        threshold = threshold_ms;
+        histograms = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+        for (i = 0; i < G_N_ELEMENTS (wrapped); i++) {
+                wrapped[i].dispatch = wrapped[i].funcs->dispatch;
+                wrapped[i].funcs->dispatch = watchdog_dispatch;
+        }
+
+        context = g_main_context_default ();
+        default_poll_func = g_main_context_get_poll_func (context);
+        g_main_context_set_poll_func (context, watchdog_poll);
+
+#ifdef HAVE_EXECINFO_H
+        {
+                struct sigaction sa;
+
+                main_thread = pthread_self ();
+                sem_init (&backtrace_sem, 0, 0);
+
+                /* backtrace() loads libgcc the first time, which is
+                 * not something to do from a signal handler */
+                backtrace (backtrace_frames, 1);
+
+                memset (&sa, 0, sizeof (sa));
+                sa.sa_handler = backtrace_signal_handler;
+                sa.sa_flags = SA_RESTART;
+                sigemptyset (&sa.sa_mask);
+                sigaction (SIGRTMIN, &sa, NULL);
+        }
+#endif
+
+        g_thread_unref (g_thread_new ("gsd-watchdog", watchdog_thread, NULL));
+
+        g_debug ("Watching for main loop stalls over %u ms", threshold);
+}
+
+void
+gnome_settings_watchdog_register (GDBusConnection *connection)
+{
+        GDBusNodeInfo *introspection_data;
+
+        /* Not enabled */
+        if (histograms == NULL)
+                return;
+
+        introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+        g_assert (introspection_data != NULL);
+
+        g_dbus_connection_register_object (connection,
+                                           WATCHDOG_DBUS_PATH,
+                                           introspection_data->interfaces[0],
+                                           &interface_vtable,
+                                           NULL,
+                                           NULL,
+                                           NULL);
+        g_dbus_node_info_unref (introspection_data);
+}
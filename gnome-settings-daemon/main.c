@@ -37,6 +37,7 @@
 #include "gnome-settings-plugin.h"
 #include "gnome-settings-profile.h"
 #include "gnome-settings-session.h"
+#include "gnome-settings-watchdog.h"
 
 #define GNOME_SESSION_DBUS_NAME      "org.gnome.SessionManager"
 #define GNOME_SESSION_CLIENT_PRIVATE_DBUS_INTERFACE "org.gnome.SessionManager.ClientPrivate"
@@ -44,6 +45,7 @@
 static gboolean   replace      = FALSE;
 static gboolean   debug        = FALSE;
 static gboolean   do_timed_exit = FALSE;
+static gint       watchdog_threshold = 0;
 static int        term_signal_pipe_fds[2];
 static guint      name_id      = 0;
 static GnomeSettingsManager *manager = NULL;
@@ -52,6 +54,7 @@ static GOptionEntry entries[] = {
         {"debug", 0, 0, G_OPTION_ARG_NONE, &debug, N_("Enable debugging code"), NULL },
         { "replace", 'r', 0, G_OPTION_ARG_NONE, &replace, N_("Replace existing daemon"), NULL },
         { "timed-exit", 0, 0, G_OPTION_ARG_NONE, &do_timed_exit, N_("Exit after a time (for debugging)"), NULL },
+        { "watchdog", 0, 0, G_OPTION_ARG_INT, &watchdog_threshold, N_("Report main loop stalls longer than this many milliseconds (for debugging)"), N_("MS") },
         {NULL}
 };
 
@@ -348,6 +351,8 @@ name_acquired_handler (GDBusConnection *connection,
 {
         GDBusProxy *proxy;
 
+        gnome_settings_watchdog_register (connection);
+
         proxy = gnome_settings_session_get_session_proxy ();
         /* Always call this first, as Setenv can only be called before
            any client registers */
@@ -470,6 +475,9 @@ main (int argc, char *argv[])
 
         notify_init ("gnome-settings-daemon");
 
+        if (watchdog_threshold > 0)
+                gnome_settings_watchdog_start (watchdog_threshold);
+
         bus_register ();
 
         if (do_timed_exit) {
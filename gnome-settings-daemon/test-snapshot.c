@@ -0,0 +1,137 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "gnome-settings-snapshot.h"
+
+#define TEST_NAME       "test"
+#define TEST_TYPE       "(us)"
+
+static char *snapshot_path = NULL;
+
+static void
+save_test_snapshot (guint version)
+{
+        g_assert (gnome_settings_snapshot_save (TEST_NAME, version,
+                                                g_variant_new (TEST_TYPE, 42, "hello")));
+        g_assert (g_file_test (snapshot_path, G_FILE_TEST_EXISTS));
+}
+
+static void
+test_snapshot_round_trip (void)
+{
+        GVariant *state;
+        const char *str;
+        guint value;
+
+        save_test_snapshot (1);
+
+        state = gnome_settings_snapshot_load (TEST_NAME, 1, G_VARIANT_TYPE (TEST_TYPE));
+        g_assert (state != NULL);
+        g_variant_get (state, "(u&s)", &value, &str);
+        g_assert_cmpuint (value, ==, 42);
+        g_assert_cmpstr (str, ==, "hello");
+        g_variant_unref (state);
+
+        /* loading consumes it */
+        g_assert (!g_file_test (snapshot_path, G_FILE_TEST_EXISTS));
+        state = gnome_settings_snapshot_load (TEST_NAME, 1, G_VARIANT_TYPE (TEST_TYPE));
+        g_assert (state == NULL);
+}
+
+static void
+test_snapshot_version_mismatch (void)
+{
+        GVariant *state;
+
+        save_test_snapshot (1);
+
+        state = gnome_settings_snapshot_load (TEST_NAME, 2, G_VARIANT_TYPE (TEST_TYPE));
+        g_assert (state == NULL);
+        g_assert (!g_file_test (snapshot_path, G_FILE_TEST_EXISTS));
+
+        state = gnome_settings_snapshot_load (TEST_NAME, 1, G_VARIANT_TYPE (TEST_TYPE));
+        g_assert (state == NULL);
+}
+
+static void
+test_snapshot_type_mismatch (void)
+{
+        GVariant *state;
+
+        save_test_snapshot (1);
+
+        g_test_expect_message (NULL, G_LOG_LEVEL_WARNING, "Ignoring test snapshot of type*");
+        state = gnome_settings_snapshot_load (TEST_NAME, 1, G_VARIANT_TYPE ("(s)"));
+        g_test_assert_expected_messages ();
+        g_assert (state == NULL);
+        g_assert (!g_file_test (snapshot_path, G_FILE_TEST_EXISTS));
+
+        state = gnome_settings_snapshot_load (TEST_NAME, 1, G_VARIANT_TYPE (TEST_TYPE));
+        g_assert (state == NULL);
+}
+
+static void
+test_snapshot_discard (void)
+{
+        GVariant *state;
+
+        save_test_snapshot (1);
+
+        gnome_settings_snapshot_discard (TEST_NAME);
+        g_assert (!g_file_test (snapshot_path, G_FILE_TEST_EXISTS));
+
+        state = gnome_settings_snapshot_load (TEST_NAME, 1, G_VARIANT_TYPE (TEST_TYPE));
+        g_assert (state == NULL);
+}
+
+int
+main (int argc, char **argv)
+{
+        char *runtime_dir;
+        char *dir;
+        int ret;
+
+        g_test_init (&argc, &argv, NULL);
+
+        /* before anything asks GLib for it, as it's cached */
+        runtime_dir = g_dir_make_tmp ("gsd-test-snapshot-XXXXXX", NULL);
+        g_assert (runtime_dir != NULL);
+        g_setenv ("XDG_RUNTIME_DIR", runtime_dir, TRUE);
+
+        dir = g_build_filename (runtime_dir, "gnome-settings-daemon", NULL);
+        snapshot_path = g_build_filename (dir, TEST_NAME ".snapshot", NULL);
+
+        g_test_add_func ("/snapshot/round-trip", test_snapshot_round_trip);
+        g_test_add_func ("/snapshot/version-mismatch", test_snapshot_version_mismatch);
+        g_test_add_func ("/snapshot/type-mismatch", test_snapshot_type_mismatch);
+        g_test_add_func ("/snapshot/discard", test_snapshot_discard);
+
+        ret = g_test_run ();
+
+        g_rmdir (dir);
+        g_rmdir (runtime_dir);
+        g_free (snapshot_path);
+        g_free (dir);
+        g_free (runtime_dir);
+
+        return ret;
+}
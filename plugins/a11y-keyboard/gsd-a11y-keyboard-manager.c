@@ -59,6 +59,12 @@ struct GsdA11yKeyboardManagerPrivate
 
         XkbDescRec       *desc;
 
+        /* last known server controls, refetched lazily after
+         * a ControlsNotify marks them stale */
+        XkbDescRec       *server_desc;
+        gboolean          server_desc_valid;
+        guint             update_server_id;
+
         GSettings        *settings;
 
         NotifyNotification *notification;
@@ -79,6 +85,7 @@ static void     gsd_a11y_keyboard_manager_class_init  (GsdA11yKeyboardManagerCla
 static void     gsd_a11y_keyboard_manager_init        (GsdA11yKeyboardManager      *a11y_keyboard_manager);
 static void     gsd_a11y_keyboard_manager_finalize    (GObject             *object);
 static void     set_server_from_gsettings (GsdA11yKeyboardManager *manager);
+static void     queue_set_server_from_gsettings (GsdA11yKeyboardManager *manager);
 
 G_DEFINE_TYPE (GsdA11yKeyboardManager, gsd_a11y_keyboard_manager, G_TYPE_OBJECT)
 
@@ -89,8 +96,10 @@ device_added_cb (GdkDeviceManager       *device_manager,
                  GdkDevice              *device,
                  GsdA11yKeyboardManager *manager)
 {
-        if (gdk_device_get_source (device) == GDK_SOURCE_KEYBOARD)
-                set_server_from_gsettings (manager);
+        if (gdk_device_get_source (device) == GDK_SOURCE_KEYBOARD) {
+                manager->priv->server_desc_valid = FALSE;
+                queue_set_server_from_gsettings (manager);
+        }
 }
 
 static void
@@ -132,21 +141,71 @@ get_xkb_desc_rec (GsdA11yKeyboardManager *manager)
         XkbDescRec *desc;
         Status      status = Success;
 
+        /* Only the controls are ever looked at, so don't transfer
+         * the whole keymap just to get at them */
+        desc = XkbAllocKeyboard ();
+        g_return_val_if_fail (desc != NULL, NULL);
+        desc->device_spec = XkbUseCoreKbd;
+
         gdk_error_trap_push ();
-        desc = XkbGetMap (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), XkbAllMapComponentsMask, XkbUseCoreKbd);
-        if (desc != NULL) {
-                desc->ctrls = NULL;
-                status = XkbGetControls (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), XkbAllControlsMask, desc);
-        }
+        status = XkbGetControls (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), XkbAllControlsMask, desc);
         gdk_error_trap_pop_ignored ();
 
-        g_return_val_if_fail (desc != NULL, NULL);
-        g_return_val_if_fail (desc->ctrls != NULL, NULL);
-        g_return_val_if_fail (status == Success, NULL);
+        if (status != Success || desc->ctrls == NULL) {
+                g_warning ("Failed to get the XKB controls");
+                XkbFreeKeyboard (desc, XkbAllComponentsMask, True);
+                return NULL;
+        }
 
         return desc;
 }
 
+static XkbDescRec *
+get_server_desc (GsdA11yKeyboardManager *manager)
+{
+        GsdA11yKeyboardManagerPrivate *p = manager->priv;
+        Status status;
+
+        if (p->server_desc == NULL) {
+                p->server_desc = get_xkb_desc_rec (manager);
+                p->server_desc_valid = (p->server_desc != NULL);
+                return p->server_desc;
+        }
+
+        if (!p->server_desc_valid) {
+                gdk_error_trap_push ();
+                status = XkbGetControls (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
+                                         XkbAllControlsMask,
+                                         p->server_desc);
+                gdk_error_trap_pop_ignored ();
+                if (status != Success)
+                        return NULL;
+                p->server_desc_valid = TRUE;
+        }
+
+        return p->server_desc;
+}
+
+/* Only compares the fields that are written from, or read into, GSettings */
+static gboolean
+ctrls_equal (const XkbControlsRec *a,
+             const XkbControlsRec *b)
+{
+        return a->enabled_ctrls == b->enabled_ctrls &&
+               a->ax_options == b->ax_options &&
+               a->ax_timeout == b->ax_timeout &&
+               a->axt_ctrls_mask == b->axt_ctrls_mask &&
+               a->axt_ctrls_values == b->axt_ctrls_values &&
+               a->axt_opts_mask == b->axt_opts_mask &&
+               a->debounce_delay == b->debounce_delay &&
+               a->mk_interval == b->mk_interval &&
+               a->mk_curve == b->mk_curve &&
+               a->mk_max_speed == b->mk_max_speed &&
+               a->mk_time_to_max == b->mk_time_to_max &&
+               a->mk_delay == b->mk_delay &&
+               a->slow_keys_delay == b->slow_keys_delay;
+}
+
 static int
 get_int (GSettings  *settings,
          char const *key)
@@ -166,8 +225,8 @@ set_int (GSettings      *settings,
         int prev_val;
 
         prev_val = g_settings_get_int (settings, key);
-        g_settings_set_int (settings, key, val);
         if (val != prev_val) {
+                g_settings_set_int (settings, key, val);
                 g_debug ("%s changed", key);
         }
 
@@ -183,12 +242,12 @@ set_bool (GSettings      *settings,
         gboolean prev_val;
 
         prev_val = g_settings_get_boolean (settings, key);
-        g_settings_set_boolean (settings, key, bval ? TRUE : FALSE);
         if (bval != prev_val) {
+                g_settings_set_boolean (settings, key, bval);
                 g_debug ("%s changed", key);
                 return TRUE;
         }
-        return (bval != prev_val);
+        return FALSE;
 }
 
 static unsigned long
@@ -203,13 +262,13 @@ set_clear (gboolean      flag,
 }
 
 static gboolean
-set_ctrl_from_gsettings (XkbDescRec   *desc,
-                         GSettings    *settings,
-                         char const   *key,
-                         unsigned long mask)
+set_ctrl_from_gsettings (XkbControlsRec *ctrls,
+                         GSettings      *settings,
+                         char const     *key,
+                         unsigned long   mask)
 {
         gboolean result = g_settings_get_boolean (settings, key);
-        desc->ctrls->enabled_ctrls = set_clear (result, desc->ctrls->enabled_ctrls, mask);
+        ctrls->enabled_ctrls = set_clear (result, ctrls->enabled_ctrls, mask);
         return result;
 }
 
@@ -217,119 +276,154 @@ static void
 set_server_from_gsettings (GsdA11yKeyboardManager *manager)
 {
         XkbDescRec      *desc;
+        XkbControlsRec   ctrls_rec;
+        XkbControlsRec  *ctrls;
         gboolean         enable_accessX;
         GSettings       *settings;
 
         gnome_settings_profile_start (NULL);
 
-        desc = get_xkb_desc_rec (manager);
+        desc = get_server_desc (manager);
         if (!desc) {
-                return;
+                goto out;
         }
 
+        /* work on a copy so the result can be diffed against the server */
+        ctrls_rec = *desc->ctrls;
+        ctrls = &ctrls_rec;
+
         settings = manager->priv->settings;
 
         /* general */
         enable_accessX = g_settings_get_boolean (settings, "enable");
 
-        desc->ctrls->enabled_ctrls = set_clear (enable_accessX,
-                                                desc->ctrls->enabled_ctrls,
+        ctrls->enabled_ctrls = set_clear (enable_accessX,
+                                                ctrls->enabled_ctrls,
                                                 XkbAccessXKeysMask);
 
-        if (set_ctrl_from_gsettings (desc, settings, "timeout-enable",
+        if (set_ctrl_from_gsettings (ctrls, settings, "timeout-enable",
                                      XkbAccessXTimeoutMask)) {
-                desc->ctrls->ax_timeout = get_int (settings, "disable-timeout");
+                ctrls->ax_timeout = get_int (settings, "disable-timeout");
                 /* disable only the master flag via the server we will disable
                  * the rest on the rebound without affecting GSettings state
                  * don't change the option flags at all.
                  */
-                desc->ctrls->axt_ctrls_mask = XkbAccessXKeysMask | XkbAccessXFeedbackMask;
-                desc->ctrls->axt_ctrls_values = 0;
-                desc->ctrls->axt_opts_mask = 0;
+                ctrls->axt_ctrls_mask = XkbAccessXKeysMask | XkbAccessXFeedbackMask;
+                ctrls->axt_ctrls_values = 0;
+                ctrls->axt_opts_mask = 0;
         }
 
-        desc->ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "feature-state-change-beep"),
-                                             desc->ctrls->ax_options,
+        ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "feature-state-change-beep"),
+                                             ctrls->ax_options,
                                              XkbAccessXFeedbackMask | XkbAX_FeatureFBMask | XkbAX_SlowWarnFBMask);
 
         /* bounce keys */
-        if (set_ctrl_from_gsettings (desc, settings, "bouncekeys-enable", XkbBounceKeysMask)) {
-                desc->ctrls->debounce_delay = get_int (settings, "bouncekeys-delay");
-                desc->ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "bouncekeys-beep-reject"),
-                                                     desc->ctrls->ax_options,
+        if (set_ctrl_from_gsettings (ctrls, settings, "bouncekeys-enable", XkbBounceKeysMask)) {
+                ctrls->debounce_delay = get_int (settings, "bouncekeys-delay");
+                ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "bouncekeys-beep-reject"),
+                                                     ctrls->ax_options,
                                                      XkbAccessXFeedbackMask | XkbAX_BKRejectFBMask);
         }
 
         /* mouse keys */
-        if (set_ctrl_from_gsettings (desc, settings, "mousekeys-enable", XkbMouseKeysMask | XkbMouseKeysAccelMask)) {
-                desc->ctrls->mk_interval     = 100;     /* msec between mousekey events */
-                desc->ctrls->mk_curve        = 50;
+        if (set_ctrl_from_gsettings (ctrls, settings, "mousekeys-enable", XkbMouseKeysMask | XkbMouseKeysAccelMask)) {
+                ctrls->mk_interval     = 100;     /* msec between mousekey events */
+                ctrls->mk_curve        = 50;
 
                 /* We store pixels / sec, XKB wants pixels / event */
-                desc->ctrls->mk_max_speed    = get_int (settings, "mousekeys-max-speed") / (1000 / desc->ctrls->mk_interval);
-                if (desc->ctrls->mk_max_speed <= 0)
-                        desc->ctrls->mk_max_speed = 1;
+                ctrls->mk_max_speed    = get_int (settings, "mousekeys-max-speed") / (1000 / ctrls->mk_interval);
+                if (ctrls->mk_max_speed <= 0)
+                        ctrls->mk_max_speed = 1;
 
-                desc->ctrls->mk_time_to_max = get_int (settings, /* events before max */
-                                                       "mousekeys-accel-time") / desc->ctrls->mk_interval;
-                if (desc->ctrls->mk_time_to_max <= 0)
-                        desc->ctrls->mk_time_to_max = 1;
+                ctrls->mk_time_to_max = get_int (settings, /* events before max */
+                                                       "mousekeys-accel-time") / ctrls->mk_interval;
+                if (ctrls->mk_time_to_max <= 0)
+                        ctrls->mk_time_to_max = 1;
 
-                desc->ctrls->mk_delay = get_int (settings, /* ms before 1st event */
+                ctrls->mk_delay = get_int (settings, /* ms before 1st event */
                                                  "mousekeys-init-delay");
         }
 
         /* slow keys */
-        if (set_ctrl_from_gsettings (desc, settings, "slowkeys-enable", XkbSlowKeysMask)) {
-                desc->ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "slowkeys-beep-press"),
-                                                     desc->ctrls->ax_options,
+        if (set_ctrl_from_gsettings (ctrls, settings, "slowkeys-enable", XkbSlowKeysMask)) {
+                ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "slowkeys-beep-press"),
+                                                     ctrls->ax_options,
                                                      XkbAccessXFeedbackMask | XkbAX_SKPressFBMask);
-                desc->ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "slowkeys-beep-accept"),
-                                                     desc->ctrls->ax_options,
+                ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "slowkeys-beep-accept"),
+                                                     ctrls->ax_options,
                                                      XkbAccessXFeedbackMask | XkbAX_SKAcceptFBMask);
-                desc->ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "slowkeys-beep-reject"),
-                                                     desc->ctrls->ax_options,
+                ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "slowkeys-beep-reject"),
+                                                     ctrls->ax_options,
                                                      XkbAccessXFeedbackMask | XkbAX_SKRejectFBMask);
-                desc->ctrls->slow_keys_delay = get_int (settings, "slowkeys-delay");
+                ctrls->slow_keys_delay = get_int (settings, "slowkeys-delay");
                 /* anything larger than 500 seems to loose all keyboard input */
-                if (desc->ctrls->slow_keys_delay > 500)
-                        desc->ctrls->slow_keys_delay = 500;
+                if (ctrls->slow_keys_delay > 500)
+                        ctrls->slow_keys_delay = 500;
         }
 
         /* sticky keys */
-        if (set_ctrl_from_gsettings (desc, settings, "stickykeys-enable", XkbStickyKeysMask)) {
-                desc->ctrls->ax_options |= XkbAX_LatchToLockMask;
-                desc->ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "stickykeys-two-key-off"),
-                                                     desc->ctrls->ax_options,
+        if (set_ctrl_from_gsettings (ctrls, settings, "stickykeys-enable", XkbStickyKeysMask)) {
+                ctrls->ax_options |= XkbAX_LatchToLockMask;
+                ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "stickykeys-two-key-off"),
+                                                     ctrls->ax_options,
                                                      XkbAccessXFeedbackMask | XkbAX_TwoKeysMask);
-                desc->ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "stickykeys-modifier-beep"),
-                                                     desc->ctrls->ax_options,
+                ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "stickykeys-modifier-beep"),
+                                                     ctrls->ax_options,
                                                      XkbAccessXFeedbackMask | XkbAX_StickyKeysFBMask);
         }
 
         /* toggle keys */
-        desc->ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "togglekeys-enable"),
-                                             desc->ctrls->ax_options,
+        ctrls->ax_options = set_clear (g_settings_get_boolean (settings, "togglekeys-enable"),
+                                             ctrls->ax_options,
                                              XkbAccessXFeedbackMask | XkbAX_IndicatorFBMask);
 
+        if (ctrls_equal (ctrls, desc->ctrls)) {
+                g_debug ("XKB controls already match GSettings");
+                goto out;
+        }
+
         /*
-        g_debug ("CHANGE to : 0x%x", desc->ctrls->enabled_ctrls);
-        g_debug ("CHANGE to : 0x%x (2)", desc->ctrls->ax_options);
+        g_debug ("CHANGE to : 0x%x", ctrls->enabled_ctrls);
+        g_debug ("CHANGE to : 0x%x (2)", ctrls->ax_options);
         */
 
+        *desc->ctrls = ctrls_rec;
+
+        /* The error trap is popped asynchronously, so there is no need
+         * to block on a round-trip; the resulting ControlsNotify will
+         * mark the cached copy stale if the server adjusts anything */
         gdk_error_trap_push ();
         XkbSetControls (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
                         DEFAULT_XKB_SET_CONTROLS_MASK,
                         desc);
-
-        XkbFreeKeyboard (desc, XkbAllComponentsMask, True);
-
-        XSync (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), FALSE);
+        XFlush (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()));
         gdk_error_trap_pop_ignored ();
 
+ out:
         gnome_settings_profile_end (NULL);
 }
 
+static gboolean
+set_server_from_gsettings_idle_cb (GsdA11yKeyboardManager *manager)
+{
+        manager->priv->update_server_id = 0;
+        set_server_from_gsettings (manager);
+        return FALSE;
+}
+
+/* Coalesce bursts of key changes, such as a whole profile being
+ * applied, into a single update of the server */
+static void
+queue_set_server_from_gsettings (GsdA11yKeyboardManager *manager)
+{
+        if (manager->priv->update_server_id != 0)
+                return;
+
+        manager->priv->update_server_id = g_idle_add ((GSourceFunc) set_server_from_gsettings_idle_cb, manager);
+        g_source_set_name_by_id (manager->priv->update_server_id,
+                                 "[gnome-settings-daemon] set_server_from_gsettings_idle_cb");
+}
+
 static void
 ax_response_callback (GsdA11yKeyboardManager *manager,
                       const char             *action,
@@ -349,7 +443,7 @@ ax_response_callback (GsdA11yKeyboardManager *manager,
                                                 !enabled);
                 }
 
-                set_server_from_gsettings (manager);
+                queue_set_server_from_gsettings (manager);
         }
 }
 
@@ -523,16 +617,28 @@ static void
 set_gsettings_from_server (GsdA11yKeyboardManager *manager)
 {
         XkbDescRec     *desc;
+        XkbControlsRec  old_ctrls;
+        gboolean        had_ctrls;
         gboolean        changed = FALSE;
         gboolean        slowkeys_changed;
         gboolean        stickykeys_changed;
         GSettings      *settings;
 
-        desc = get_xkb_desc_rec (manager);
+        had_ctrls = (manager->priv->server_desc != NULL);
+        if (had_ctrls)
+                old_ctrls = *manager->priv->server_desc->ctrls;
+
+        manager->priv->server_desc_valid = FALSE;
+        desc = get_server_desc (manager);
         if (! desc) {
                 return;
         }
 
+        if (had_ctrls && ctrls_equal (&old_ctrls, desc->ctrls)) {
+                g_debug ("XKB controls unchanged, not updating GSettings");
+                return;
+        }
+
 	/* Create a new one, so that only those settings
 	 * are delayed */
         settings = g_settings_new (KEYBOARD_A11Y_SCHEMA);
@@ -633,8 +739,6 @@ set_gsettings_from_server (GsdA11yKeyboardManager *manager)
                 }
         }
 
-        XkbFreeKeyboard (desc, XkbAllComponentsMask, True);
-
         g_settings_apply (settings);
         g_object_unref (settings);
 }
@@ -660,6 +764,9 @@ cb_xkb_event_filter (GdkXEvent              *xevent,
             xkbEv->ctrls.event_type != 0) {
                 g_debug ("XKB state changed");
                 set_gsettings_from_server (manager);
+        } else if (xev->xany.type == (manager->priv->xkbEventBase + XkbEventCode) &&
+                   xkbEv->any.xkb_type == XkbControlsNotify) {
+                manager->priv->server_desc_valid = FALSE;
         } else if (xev->xany.type == (manager->priv->xkbEventBase + XkbEventCode) &&
                    xkbEv->any.xkb_type == XkbAccessXNotify) {
                 if (xkbEv->accessx.detail == XkbAXN_AXKWarning) {
@@ -680,7 +787,7 @@ keyboard_callback (GSettings              *settings,
                    const char             *key,
                    GsdA11yKeyboardManager *manager)
 {
-        set_server_from_gsettings (manager);
+        queue_set_server_from_gsettings (manager);
 }
 
 static gboolean
@@ -766,11 +873,22 @@ gsd_a11y_keyboard_manager_stop (GsdA11yKeyboardManager *manager)
                 p->desc = NULL;
         }
 
+        if (p->server_desc != NULL) {
+                XkbFreeKeyboard (p->server_desc, XkbAllComponentsMask, True);
+                p->server_desc = NULL;
+                p->server_desc_valid = FALSE;
+        }
+
         if (p->start_idle_id != 0) {
                 g_source_remove (p->start_idle_id);
                 p->start_idle_id = 0;
         }
 
+        if (p->update_server_id != 0) {
+                g_source_remove (p->update_server_id);
+                p->update_server_id = 0;
+        }
+
         if (p->device_manager != NULL) {
                 g_signal_handler_disconnect (p->device_manager, p->device_added_id);
                 p->device_manager = NULL;
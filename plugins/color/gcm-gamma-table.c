@@ -0,0 +1,243 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2013 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <lcms2.h>
+
+#include "gcm-gamma-table.h"
+
+/*
+ * The three channels live in the same allocation as the header so
+ * that a table can be handed straight to gnome_rr_crtc_set_gamma()
+ * and shared between outputs without any further copying.
+ */
+struct _GcmGammaTable
+{
+        gint             refcount;
+        guint            size;
+        guint16         *red;
+        guint16         *green;
+        guint16         *blue;
+};
+
+GQuark
+gcm_gamma_table_error_quark (void)
+{
+        static GQuark quark = 0;
+        if (!quark)
+                quark = g_quark_from_static_string ("gcm_gamma_table_error");
+        return quark;
+}
+
+static GcmGammaTable *
+gcm_gamma_table_alloc (guint size)
+{
+        GcmGammaTable *table;
+        guint16 *data;
+
+        table = g_malloc (sizeof (GcmGammaTable) + 3 * size * sizeof (guint16));
+        data = (guint16 *) (table + 1);
+        table->refcount = 1;
+        table->size = size;
+        table->red = data;
+        table->green = data + size;
+        table->blue = data + 2 * size;
+        return table;
+}
+
+static guint16
+gcm_gamma_table_eval (const cmsToneCurve *curve, cmsFloat32Number in)
+{
+        cmsFloat32Number out;
+
+        out = cmsEvalToneCurveFloat (curve, in);
+        if (out <= 0.0f)
+                return 0;
+        if (out >= 1.0f)
+                return 0xffff;
+        return (guint16) (out * (gdouble) 0xffff);
+}
+
+/**
+ * gcm_gamma_table_new_linear:
+ * @size: the number of entries per channel, which must be at least 2
+ *
+ * Returns: a new identity ramp, free with gcm_gamma_table_unref()
+ **/
+GcmGammaTable *
+gcm_gamma_table_new_linear (guint size)
+{
+        GcmGammaTable *table;
+        guint16 value;
+        guint i;
+
+        g_return_val_if_fail (size > 1, NULL);
+
+        table = gcm_gamma_table_alloc (size);
+        for (i = 0; i < size; i++) {
+                value = (i * 0xffff) / (size - 1);
+                table->red[i] = value;
+                table->green[i] = value;
+                table->blue[i] = value;
+        }
+        return table;
+}
+
+/**
+ * gcm_gamma_table_new_from_vcgt:
+ * @vcgt: the three tone curves from the profile VCGT tag
+ * @size: the number of entries per channel, which must be at least 2
+ *
+ * Returns: a new table, free with gcm_gamma_table_unref()
+ **/
+GcmGammaTable *
+gcm_gamma_table_new_from_vcgt (const cmsToneCurve **vcgt, guint size)
+{
+        GcmGammaTable *table;
+        cmsFloat32Number in;
+        guint i;
+
+        g_return_val_if_fail (vcgt != NULL, NULL);
+        g_return_val_if_fail (size > 1, NULL);
+
+        table = gcm_gamma_table_alloc (size);
+        for (i = 0; i < size; i++) {
+                in = (gdouble) i / (gdouble) (size - 1);
+                table->red[i] = gcm_gamma_table_eval (vcgt[0], in);
+                table->green[i] = gcm_gamma_table_eval (vcgt[1], in);
+                table->blue[i] = gcm_gamma_table_eval (vcgt[2], in);
+        }
+        return table;
+}
+
+/**
+ * gcm_gamma_table_new_from_filename:
+ * @filename: an ICC profile filename
+ * @size: the number of entries per channel
+ * @error: a #GError, or %NULL
+ *
+ * Returns: a new table, or %NULL if the profile has no VCGT data
+ **/
+GcmGammaTable *
+gcm_gamma_table_new_from_filename (const gchar *filename,
+                                   guint size,
+                                   GError **error)
+{
+        GcmGammaTable *table = NULL;
+        const cmsToneCurve **vcgt;
+        cmsHPROFILE lcms_profile;
+
+        g_return_val_if_fail (filename != NULL, NULL);
+
+        /* invalid size */
+        if (size < 2) {
+                g_set_error (error,
+                             GCM_GAMMA_TABLE_ERROR,
+                             GCM_GAMMA_TABLE_ERROR_FAILED,
+                             "invalid gamma size %u", size);
+                return NULL;
+        }
+
+        /* open file */
+        lcms_profile = cmsOpenProfileFromFile (filename, "r");
+        if (lcms_profile == NULL) {
+                g_set_error (error,
+                             GCM_GAMMA_TABLE_ERROR,
+                             GCM_GAMMA_TABLE_ERROR_FAILED,
+                             "failed to open %s", filename);
+                return NULL;
+        }
+
+        /* get tone curves from profile */
+        vcgt = cmsReadTag (lcms_profile, cmsSigVcgtTag);
+        if (vcgt == NULL || vcgt[0] == NULL) {
+                g_set_error (error,
+                             GCM_GAMMA_TABLE_ERROR,
+                             GCM_GAMMA_TABLE_ERROR_FAILED,
+                             "%s does not have any VCGT data", filename);
+                goto out;
+        }
+        table = gcm_gamma_table_new_from_vcgt (vcgt, size);
+out:
+        cmsCloseProfile (lcms_profile);
+        return table;
+}
+
+GcmGammaTable *
+gcm_gamma_table_ref (GcmGammaTable *table)
+{
+        g_return_val_if_fail (table != NULL, NULL);
+        g_atomic_int_inc (&table->refcount);
+        return table;
+}
+
+void
+gcm_gamma_table_unref (GcmGammaTable *table)
+{
+        g_return_if_fail (table != NULL);
+        if (g_atomic_int_dec_and_test (&table->refcount))
+                g_free (table);
+}
+
+guint
+gcm_gamma_table_get_size (GcmGammaTable *table)
+{
+        g_return_val_if_fail (table != NULL, 0);
+        return table->size;
+}
+
+guint16 *
+gcm_gamma_table_get_red (GcmGammaTable *table)
+{
+        g_return_val_if_fail (table != NULL, NULL);
+        return table->red;
+}
+
+guint16 *
+gcm_gamma_table_get_green (GcmGammaTable *table)
+{
+        g_return_val_if_fail (table != NULL, NULL);
+        return table->green;
+}
+
+guint16 *
+gcm_gamma_table_get_blue (GcmGammaTable *table)
+{
+        g_return_val_if_fail (table != NULL, NULL);
+        return table->blue;
+}
+
+/**
+ * gcm_gamma_table_get_cache_key:
+ * @checksum: the profile checksum, or %NULL for a linear ramp
+ * @size: the number of entries per channel
+ *
+ * Returns: a key suitable for a string-keyed table cache
+ **/
+gchar *
+gcm_gamma_table_get_cache_key (const gchar *checksum, guint size)
+{
+        return g_strdup_printf ("%s:%u",
+                                checksum != NULL ? checksum : "linear",
+                                size);
+}
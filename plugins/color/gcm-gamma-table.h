@@ -0,0 +1,57 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2013 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GCM_GAMMA_TABLE_H
+#define __GCM_GAMMA_TABLE_H
+
+#include <glib.h>
+#include <lcms2.h>
+
+G_BEGIN_DECLS
+
+#define GCM_GAMMA_TABLE_ERROR           (gcm_gamma_table_error_quark ())
+
+typedef struct _GcmGammaTable           GcmGammaTable;
+
+enum
+{
+        GCM_GAMMA_TABLE_ERROR_FAILED
+};
+
+GQuark           gcm_gamma_table_error_quark            (void);
+GcmGammaTable   *gcm_gamma_table_new_linear             (guint                   size);
+GcmGammaTable   *gcm_gamma_table_new_from_vcgt          (const cmsToneCurve    **vcgt,
+                                                         guint                   size);
+GcmGammaTable   *gcm_gamma_table_new_from_filename      (const gchar            *filename,
+                                                         guint                   size,
+                                                         GError                 **error);
+GcmGammaTable   *gcm_gamma_table_ref                    (GcmGammaTable          *table);
+void             gcm_gamma_table_unref                  (GcmGammaTable          *table);
+guint            gcm_gamma_table_get_size               (GcmGammaTable          *table);
+guint16         *gcm_gamma_table_get_red                (GcmGammaTable          *table);
+guint16         *gcm_gamma_table_get_green              (GcmGammaTable          *table);
+guint16         *gcm_gamma_table_get_blue               (GcmGammaTable          *table);
+gchar           *gcm_gamma_table_get_cache_key          (const gchar            *checksum,
+                                                         guint                   size);
+
+G_END_DECLS
+
+#endif /* __GCM_GAMMA_TABLE_H */
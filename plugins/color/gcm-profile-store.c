@@ -32,8 +32,8 @@ static void     gcm_profile_store_finalize      (GObject     *object);
 
 struct _GcmProfileStorePrivate
 {
-        GPtrArray                       *filename_array;
-        GPtrArray                       *directory_array;
+        GHashTable                      *filename_hash;
+        GHashTable                      *directory_hash;
         GCancellable                    *cancellable;
 };
 
@@ -57,6 +57,7 @@ typedef struct {
         gchar           *path;
         GFileMonitor    *monitor;
         guint            depth;
+        GHashTable      *profiles;
 } GcmProfileStoreDirHelper;
 
 static void
@@ -65,77 +66,65 @@ gcm_profile_store_helper_free (GcmProfileStoreDirHelper *helper)
         g_free (helper->path);
         if (helper->monitor != NULL)
                 g_object_unref (helper->monitor);
+        g_hash_table_unref (helper->profiles);
         g_free (helper);
 }
 
-static const gchar *
+static GcmProfileStoreDirHelper *
 gcm_profile_store_find_filename (GcmProfileStore *profile_store, const gchar *filename)
 {
-        const gchar *tmp;
-        guint i;
-        GPtrArray *array = profile_store->priv->filename_array;
-
-        for (i=0; i<array->len; i++) {
-                tmp = g_ptr_array_index (array, i);
-                if (g_strcmp0 (filename, tmp) == 0)
-                        return tmp;
-        }
-        return NULL;
+        return g_hash_table_lookup (profile_store->priv->filename_hash, filename);
 }
 
 static GcmProfileStoreDirHelper *
 gcm_profile_store_find_directory (GcmProfileStore *profile_store, const gchar *path)
 {
-        GcmProfileStoreDirHelper *tmp;
-        guint i;
-        GPtrArray *array = profile_store->priv->directory_array;
-
-        for (i=0; i<array->len; i++) {
-                tmp = g_ptr_array_index (array, i);
-                if (g_strcmp0 (path, tmp->path) == 0)
-                        return tmp;
-        }
-        return NULL;
+        return g_hash_table_lookup (profile_store->priv->directory_hash, path);
 }
 
 static gboolean
 gcm_profile_store_remove_profile (GcmProfileStore *profile_store,
                                   const gchar *filename)
 {
-        gboolean ret = FALSE;
-        const gchar *tmp;
-        gchar *filename_dup = NULL;
-
+        gchar *filename_dup;
+        GcmProfileStoreDirHelper *helper;
         GcmProfileStorePrivate *priv = profile_store->priv;
 
-        /* find exact pointer */
-        tmp = gcm_profile_store_find_filename (profile_store, filename);
-        if (tmp == NULL)
-                goto out;
+        /* find the directory that owns it */
+        helper = gcm_profile_store_find_filename (profile_store, filename);
+        if (helper == NULL)
+                return FALSE;
 
         /* dup so we can emit the signal */
-        filename_dup = g_strdup (tmp);
-        ret = g_ptr_array_remove (priv->filename_array, (gpointer)tmp);
-        if (!ret) {
-                g_warning ("failed to remove %s", filename);
-                goto out;
-        }
+        filename_dup = g_strdup (filename);
+        g_hash_table_remove (helper->profiles, filename_dup);
+        g_hash_table_remove (priv->filename_hash, filename_dup);
 
         /* emit a signal */
         g_debug ("emit removed: %s", filename_dup);
         g_signal_emit (profile_store, signals[SIGNAL_REMOVED], 0, filename_dup);
-out:
         g_free (filename_dup);
-        return ret;
+        return TRUE;
 }
 
 static void
-gcm_profile_store_add_profile (GcmProfileStore *profile_store, const gchar *filename)
+gcm_profile_store_add_profile (GcmProfileStore *profile_store,
+                               GcmProfileStoreDirHelper *helper,
+                               const gchar *filename)
 {
+        gchar *key;
         GcmProfileStorePrivate *priv = profile_store->priv;
 
-        /* add to list */
-        g_ptr_array_add (priv->filename_array, g_strdup (filename));
+        /* already known, e.g. the file was replaced in place */
+        if (gcm_profile_store_find_filename (profile_store, filename) != NULL) {
+                g_debug ("already added: %s", filename);
+                return;
+        }
+
+        /* add to the store and to the owning directory */
+        key = g_strdup (filename);
+        g_hash_table_insert (priv->filename_hash, key, helper);
+        g_hash_table_add (helper->profiles, key);
 
         /* emit a signal */
         g_debug ("emit add: %s", filename);
@@ -172,20 +161,45 @@ gcm_profile_store_created_query_info_cb (GObject *source_object,
 }
 
 static void
-gcm_profile_store_remove_from_prefix (GcmProfileStore *profile_store,
-                                      const gchar *prefix)
+gcm_profile_store_remove_directory (GcmProfileStore *profile_store,
+                                    const gchar *path)
 {
-        guint i;
-        const gchar *path;
+        GHashTableIter iter;
+        GList *l;
+        GList *list;
+        gchar *prefix;
+        const gchar *tmp;
+        GcmProfileStoreDirHelper *helper;
         GcmProfileStorePrivate *priv = profile_store->priv;
 
-        for (i = 0; i < priv->filename_array->len; i++) {
-                path = g_ptr_array_index (priv->filename_array, i);
-                if (g_str_has_prefix (path, prefix)) {
-                        g_debug ("auto-removed %s as path removed", path);
-                        gcm_profile_store_remove_profile (profile_store, path);
-                }
+        helper = gcm_profile_store_find_directory (profile_store, path);
+        if (helper == NULL)
+                return;
+
+        /* remove the profiles directly in this directory; copy the
+         * list as removing modifies helper->profiles */
+        list = g_hash_table_get_keys (helper->profiles);
+        for (l = list; l != NULL; l = l->next) {
+                tmp = l->data;
+                g_debug ("auto-removed %s as path removed", tmp);
+                gcm_profile_store_remove_profile (profile_store, tmp);
         }
+        g_list_free (list);
+
+        /* then any monitored subdirectories */
+        list = NULL;
+        prefix = g_strconcat (path, G_DIR_SEPARATOR_S, NULL);
+        g_hash_table_iter_init (&iter, priv->directory_hash);
+        while (g_hash_table_iter_next (&iter, (gpointer *) &tmp, NULL)) {
+                if (g_str_has_prefix (tmp, prefix))
+                        list = g_list_prepend (list, g_strdup (tmp));
+        }
+        for (l = list; l != NULL; l = l->next)
+                gcm_profile_store_remove_directory (profile_store, l->data);
+        g_list_free_full (list, g_free);
+        g_free (prefix);
+
+        g_hash_table_remove (priv->directory_hash, path);
 }
 
 static void
@@ -197,8 +211,6 @@ gcm_profile_store_file_monitor_changed_cb (GFileMonitor *monitor,
 {
         gchar *path = NULL;
         gchar *parent_path = NULL;
-        const gchar *tmp;
-        GcmProfileStoreDirHelper *helper;
 
         /* profile was deleted */
         if (event_type == G_FILE_MONITOR_EVENT_DELETED) {
@@ -207,20 +219,11 @@ gcm_profile_store_file_monitor_changed_cb (GFileMonitor *monitor,
                  * file. We can't call g_file_query_info_async() as the
                  * inode doesn't exist anymore */
                 path = g_file_get_path (file);
-                tmp = gcm_profile_store_find_filename (profile_store, path);
-                if (tmp != NULL) {
-                        /* is a file */
-                        gcm_profile_store_remove_profile (profile_store, path);
+                if (gcm_profile_store_remove_profile (profile_store, path))
                         goto out;
-                }
 
                 /* is a directory, urgh. Remove all profiles there. */
-                gcm_profile_store_remove_from_prefix (profile_store, path);
-                helper = gcm_profile_store_find_directory (profile_store, path);
-                if (helper != NULL) {
-                        g_ptr_array_remove (profile_store->priv->directory_array,
-                                            helper);
-                }
+                gcm_profile_store_remove_directory (profile_store, path);
                 goto out;
         }
 
@@ -231,8 +234,14 @@ gcm_profile_store_file_monitor_changed_cb (GFileMonitor *monitor,
                 goto out;
         }
 
-        /* only care about created objects */
+        /* only care about created objects, and only query the one
+         * object that appeared rather than the whole directory */
         if (event_type == G_FILE_MONITOR_EVENT_CREATED) {
+                if (gcm_profile_store_find_filename (profile_store, path) != NULL ||
+                    gcm_profile_store_find_directory (profile_store, path) != NULL) {
+                        g_debug ("already tracking %s", path);
+                        goto out;
+                }
                 g_file_query_info_async (file,
                                          G_FILE_ATTRIBUTE_STANDARD_NAME ","
                                          G_FILE_ATTRIBUTE_STANDARD_TYPE,
@@ -286,7 +295,7 @@ gcm_profile_store_process_child (GcmProfileStore *profile_store,
         }
 
         /* is a file */
-        gcm_profile_store_add_profile (profile_store, full_path);
+        gcm_profile_store_add_profile (profile_store, helper, full_path);
 out:
         g_free (full_path);
 }
@@ -353,7 +362,6 @@ gcm_profile_store_enumerate_children_cb (GObject *source_object,
                                                        res,
                                                        &error);
         if (enumerator == NULL) {
-                GcmProfileStoreDirHelper *helper;
                 gchar *path = NULL;
 
                 path = g_file_get_path (G_FILE (source_object));
@@ -363,9 +371,7 @@ gcm_profile_store_enumerate_children_cb (GObject *source_object,
                 else
                         g_warning ("failed to enumerate directory %s: %s",
                                    path, error->message);
-                helper = gcm_profile_store_find_directory (profile_store, path);
-                if (helper)
-                        g_ptr_array_remove (profile_store->priv->directory_array, helper);
+                gcm_profile_store_remove_directory (profile_store, path);
                 g_error_free (error);
                 g_free (path);
                 return;
@@ -390,24 +396,28 @@ gcm_profile_store_search_path (GcmProfileStore *profile_store, const gchar *path
 
         file = g_file_new_for_path (path);
 
-        /* add an inotify watch if not already added */
+        /* already watched, so the monitor keeps the contents up to date */
         helper = gcm_profile_store_find_directory (profile_store, path);
-        if (helper == NULL) {
-                helper = g_new0 (GcmProfileStoreDirHelper, 1);
-                helper->depth = depth;
-                helper->path = g_strdup (path);
-                helper->monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, &error);
-                if (helper->monitor == NULL) {
-                        g_debug ("failed to monitor path: %s", error->message);
-                        g_error_free (error);
-                        gcm_profile_store_helper_free (helper);
-                        goto out;
-                }
-                g_signal_connect (helper->monitor, "changed",
-                                  G_CALLBACK(gcm_profile_store_file_monitor_changed_cb),
-                                  profile_store);
-                g_ptr_array_add (profile_store->priv->directory_array, helper);
+        if (helper != NULL)
+                goto out;
+
+        /* add an inotify watch */
+        helper = g_new0 (GcmProfileStoreDirHelper, 1);
+        helper->depth = depth;
+        helper->path = g_strdup (path);
+        helper->profiles = g_hash_table_new (g_str_hash, g_str_equal);
+        helper->monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, &error);
+        if (helper->monitor == NULL) {
+                g_debug ("failed to monitor path: %s", error->message);
+                g_error_free (error);
+                gcm_profile_store_helper_free (helper);
+                goto out;
         }
+        g_signal_connect (helper->monitor, "changed",
+                          G_CALLBACK(gcm_profile_store_file_monitor_changed_cb),
+                          profile_store);
+        g_hash_table_insert (profile_store->priv->directory_hash,
+                             helper->path, helper);
 
         /* get contents of directory */
         g_file_enumerate_children_async (file,
@@ -493,8 +503,8 @@ gcm_profile_store_init (GcmProfileStore *profile_store)
 {
         profile_store->priv = GCM_PROFILE_STORE_GET_PRIVATE (profile_store);
         profile_store->priv->cancellable = g_cancellable_new ();
-        profile_store->priv->filename_array = g_ptr_array_new_with_free_func (g_free);
-        profile_store->priv->directory_array = g_ptr_array_new_with_free_func ((GDestroyNotify) gcm_profile_store_helper_free);
+        profile_store->priv->filename_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        profile_store->priv->directory_hash = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) gcm_profile_store_helper_free);
 }
 
 static void
@@ -505,8 +515,8 @@ gcm_profile_store_finalize (GObject *object)
 
         g_cancellable_cancel (profile_store->priv->cancellable);
         g_object_unref (profile_store->priv->cancellable);
-        g_ptr_array_unref (priv->filename_array);
-        g_ptr_array_unref (priv->directory_array);
+        g_hash_table_unref (priv->filename_hash);
+        g_hash_table_unref (priv->directory_hash);
 
         G_OBJECT_CLASS (gcm_profile_store_parent_class)->finalize (object);
 }
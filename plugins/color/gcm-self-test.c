@@ -27,6 +27,7 @@
 
 #include "gcm-edid.h"
 #include "gcm-dmi.h"
+#include "gcm-gamma-table.h"
 
 static void
 gcm_test_dmi_func (void)
@@ -97,6 +98,41 @@ gcm_test_edid_func (void)
         g_object_unref (edid);
 }
 
+static void
+gcm_test_gamma_table_func (void)
+{
+        GcmGammaTable *table;
+        cmsToneCurve *curve;
+        const cmsToneCurve *vcgt[3];
+
+        /* identity ramp */
+        table = gcm_gamma_table_new_linear (256);
+        g_assert (table != NULL);
+        g_assert_cmpint (gcm_gamma_table_get_size (table), ==, 256);
+        g_assert_cmpint (gcm_gamma_table_get_red (table)[0], ==, 0);
+        g_assert_cmpint (gcm_gamma_table_get_green (table)[128], ==, (128 * 0xffff) / 255);
+        g_assert_cmpint (gcm_gamma_table_get_blue (table)[255], ==, 0xffff);
+
+        /* channels are contiguous */
+        g_assert (gcm_gamma_table_get_green (table) == gcm_gamma_table_get_red (table) + 256);
+        g_assert (gcm_gamma_table_get_blue (table) == gcm_gamma_table_get_green (table) + 256);
+        gcm_gamma_table_unref (table);
+
+        /* from tone curves */
+        curve = cmsBuildGamma (NULL, 2.2);
+        vcgt[0] = vcgt[1] = vcgt[2] = curve;
+        table = gcm_gamma_table_new_from_vcgt (vcgt, 1024);
+        g_assert (table != NULL);
+        g_assert_cmpint (gcm_gamma_table_get_size (table), ==, 1024);
+        g_assert_cmpint (gcm_gamma_table_get_red (table)[0], ==, 0);
+        g_assert_cmpint (gcm_gamma_table_get_red (table)[1023], ==, 0xffff);
+        g_assert_cmpint (gcm_gamma_table_get_green (table)[512], <, 0x4000);
+        g_assert_cmpint (gcm_gamma_table_get_blue (table)[512], ==,
+                         gcm_gamma_table_get_red (table)[512]);
+        gcm_gamma_table_unref (table);
+        cmsFreeToneCurve (curve);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -105,6 +141,7 @@ main (int argc, char **argv)
 
         g_test_add_func ("/color/dmi", gcm_test_dmi_func);
         g_test_add_func ("/color/edid", gcm_test_edid_func);
+        g_test_add_func ("/color/gamma-table", gcm_test_gamma_table_func);
 
         return g_test_run ();
 }
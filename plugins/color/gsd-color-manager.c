@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <colord.h>
 #include <libnotify/notify.h>
 #include <gdk/gdk.h>
@@ -35,10 +36,12 @@
 #include "gnome-settings-plugin.h"
 #include "gnome-settings-profile.h"
 #include "gnome-settings-session.h"
+#include "gnome-settings-snapshot.h"
 #include "gsd-color-manager.h"
 #include "gcm-profile-store.h"
 #include "gcm-dmi.h"
 #include "gcm-edid.h"
+#include "gcm-gamma-table.h"
 
 #define GSD_COLOR_MANAGER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), GSD_TYPE_COLOR_MANAGER, GsdColorManagerPrivate))
 
@@ -46,6 +49,10 @@
 #define GCM_SETTINGS_RECALIBRATE_PRINTER_THRESHOLD      "recalibrate-printer-threshold"
 #define GCM_SETTINGS_RECALIBRATE_DISPLAY_THRESHOLD      "recalibrate-display-threshold"
 
+/* bump when the format of the snapshot changes */
+#define GCM_SNAPSHOT_VERSION                            1
+#define GCM_SNAPSHOT_TYPE                               "(sa{s(xxb)}a{s(xxs)})"
+
 struct GsdColorManagerPrivate
 {
         GDBusProxy      *session;
@@ -55,11 +62,47 @@ struct GsdColorManagerPrivate
         GcmDmi          *dmi;
         GnomeRRScreen   *x11_screen;
         GHashTable      *edid_cache;
+        GHashTable      *gamma_cache;
+        GHashTable      *profile_md_cache;
+        GThreadPool     *profile_pool;
+        GHashTable      *icc_blob_cache;
+        gchar           *icc_blob_published;
         GdkWindow       *gdk_window;
         gboolean         session_is_active;
         GHashTable      *device_assign_hash;
 };
 
+/* What we know about an auto-generated profile, valid as long as the
+ * file keeps the same mtime and size */
+typedef struct {
+        gint64           mtime;
+        goffset          size;
+        gboolean         has_device_md;
+} GcmProfileMd;
+
+/* Identifies the contents of a profile file without reading it again,
+ * as long as the file keeps the same mtime and size */
+typedef struct {
+        gint64           mtime;
+        goffset          size;
+        gchar           *checksum;
+} GcmIccBlob;
+
+/* Checks the auto-generated profile for a display, and creates it if
+ * needed, in profile_pool */
+typedef struct {
+        GsdColorManager *manager;
+        CdDevice        *device;
+        GcmEdid         *edid;
+        gchar           *device_id;
+        gchar           *dmi_name;
+        gchar           *dmi_vendor;
+        gchar           *filename;
+        GcmProfileMd     md;
+        gboolean         md_valid;
+        GError          *error;
+} GcmProfileJob;
+
 enum {
         PROP_0,
 };
@@ -76,12 +119,6 @@ static gpointer manager_object = NULL;
 #define GCM_ICC_PROFILE_IN_X_VERSION_MAJOR      0
 #define GCM_ICC_PROFILE_IN_X_VERSION_MINOR      3
 
-typedef struct {
-        guint32          red;
-        guint32          green;
-        guint32          blue;
-} GnomeRROutputClutItem;
-
 GQuark
 gsd_color_manager_error_quark (void)
 {
@@ -132,25 +169,85 @@ out:
         return edid;
 }
 
+static void
+gcm_icc_blob_free (GcmIccBlob *blob)
+{
+        g_free (blob->checksum);
+        g_free (blob);
+}
+
+static void
+gcm_session_screen_clear_icc_profile (GsdColorManager *manager)
+{
+        GsdColorManagerPrivate *priv = manager->priv;
+
+        gdk_property_delete (priv->gdk_window,
+                             gdk_atom_intern_static_string ("_ICC_PROFILE"));
+        gdk_property_delete (priv->gdk_window,
+                             gdk_atom_intern_static_string ("_ICC_PROFILE_IN_X_VERSION"));
+        g_clear_pointer (&priv->icc_blob_published, g_free);
+}
+
 static gboolean
 gcm_session_screen_set_icc_profile (GsdColorManager *manager,
                                     const gchar *filename,
                                     GError **error)
 {
-        gboolean ret;
-        gchar *data = NULL;
-        gsize length;
+        gboolean ret = TRUE;
+        GMappedFile *mapped = NULL;
+        GcmIccBlob *blob;
+        GStatBuf buf;
         guint version_data;
         GsdColorManagerPrivate *priv = manager->priv;
 
         g_return_val_if_fail (filename != NULL, FALSE);
 
-        g_debug ("setting root window ICC profile atom from %s", filename);
+        /* do we already know what's in the file */
+        blob = g_hash_table_lookup (priv->icc_blob_cache, filename);
+        if (blob != NULL &&
+            (g_stat (filename, &buf) != 0 ||
+             buf.st_mtime != blob->mtime ||
+             buf.st_size != blob->size)) {
+                g_hash_table_remove (priv->icc_blob_cache, filename);
+                blob = NULL;
+        }
 
-        /* get contents of file */
-        ret = g_file_get_contents (filename, &data, &length, error);
-        if (!ret)
+        if (blob == NULL) {
+                mapped = g_mapped_file_new (filename, FALSE, error);
+                if (mapped == NULL) {
+                        ret = FALSE;
+                        goto out;
+                }
+                blob = g_new0 (GcmIccBlob, 1);
+                blob->checksum = g_compute_checksum_for_data (G_CHECKSUM_MD5,
+                                                              (const guchar *) g_mapped_file_get_contents (mapped),
+                                                              g_mapped_file_get_length (mapped));
+                if (g_stat (filename, &buf) == 0) {
+                        blob->mtime = buf.st_mtime;
+                        blob->size = buf.st_size;
+                        g_hash_table_insert (priv->icc_blob_cache,
+                                             g_strdup (filename),
+                                             blob);
+                }
+        }
+
+        /* every color-managed client reloads the profile when the
+         * property changes, so don't touch it if it's the same */
+        if (g_strcmp0 (priv->icc_blob_published, blob->checksum) == 0) {
+                g_debug ("root window ICC profile atom already set from %s",
+                         filename);
                 goto out;
+        }
+
+        g_debug ("setting root window ICC profile atom from %s", filename);
+
+        if (mapped == NULL) {
+                mapped = g_mapped_file_new (filename, FALSE, error);
+                if (mapped == NULL) {
+                        ret = FALSE;
+                        goto out;
+                }
+        }
 
         /* set profile property */
         gdk_property_change (priv->gdk_window,
@@ -158,7 +255,8 @@ gcm_session_screen_set_icc_profile (GsdColorManager *manager,
                              gdk_atom_intern_static_string ("CARDINAL"),
                              8,
                              GDK_PROP_MODE_REPLACE,
-                             (const guchar *) data, length);
+                             (const guchar *) g_mapped_file_get_contents (mapped),
+                             g_mapped_file_get_length (mapped));
 
         /* set version property */
         version_data = GCM_ICC_PROFILE_IN_X_VERSION_MAJOR * 100 +
@@ -169,8 +267,16 @@ gcm_session_screen_set_icc_profile (GsdColorManager *manager,
                              8,
                              GDK_PROP_MODE_REPLACE,
                              (const guchar *) &version_data, 1);
+
+        g_free (priv->icc_blob_published);
+        priv->icc_blob_published = g_strdup (blob->checksum);
 out:
-        g_free (data);
+        /* not in the cache if the file vanished while we read it */
+        if (blob != NULL &&
+            g_hash_table_lookup (priv->icc_blob_cache, filename) != blob)
+                gcm_icc_blob_free (blob);
+        if (mapped != NULL)
+                g_mapped_file_unref (mapped);
         return ret;
 }
 
@@ -337,13 +443,13 @@ out:
 }
 #endif /* HAVE_NEW_LCMS */
 
+/* Called from profile_pool, so only uses what the job copied */
 static gboolean
-gcm_apply_create_icc_profile_for_edid (GsdColorManager *manager,
-                                       CdDevice *device,
-                                       GcmEdid *edid,
-                                       const gchar *filename,
+gcm_apply_create_icc_profile_for_edid (GcmProfileJob *job,
                                        GError **error)
 {
+        GcmEdid *edid = job->edid;
+        const gchar *filename = job->filename;
         const CdColorYxy *tmp;
         cmsCIExyYTRIPLE chroma;
         cmsCIExyY white_point;
@@ -357,7 +463,6 @@ gcm_apply_create_icc_profile_for_edid (GsdColorManager *manager,
 #ifdef HAVE_NEW_LCMS
         cmsHANDLE dict = NULL;
 #endif
-        GsdColorManagerPrivate *priv = manager->priv;
 
         /* ensure the per-user directory exists */
         ret = gcm_utils_mkdir_for_filename (filename, error);
@@ -414,7 +519,7 @@ gcm_apply_create_icc_profile_for_edid (GsdColorManager *manager,
         /* set model */
         data = gcm_edid_get_monitor_name (edid);
         if (data == NULL)
-                data = gcm_dmi_get_name (priv->dmi);
+                data = job->dmi_name;
         if (data == NULL)
                 data = "Unknown monitor";
         ret = _cmsWriteTagTextAscii (lcms_profile,
@@ -440,7 +545,7 @@ gcm_apply_create_icc_profile_for_edid (GsdColorManager *manager,
         /* get manufacturer */
         data = gcm_edid_get_vendor_name (edid);
         if (data == NULL)
-                data = gcm_dmi_get_vendor (priv->dmi);
+                data = job->dmi_vendor;
         if (data == NULL)
                 data = "Unknown vendor";
         ret = _cmsWriteTagTextAscii (lcms_profile,
@@ -470,7 +575,7 @@ gcm_apply_create_icc_profile_for_edid (GsdColorManager *manager,
                                PACKAGE_VERSION);
         _cmsDictAddEntryAscii (dict,
                                CD_PROFILE_METADATA_MAPPING_DEVICE_ID,
-                               cd_device_get_id (device));
+                               job->device_id);
 
         /* set the data source so we don't ever prompt the user to
          * recalibrate (as the EDID data won't have changed) */
@@ -550,55 +655,59 @@ out:
 #endif
         if (*transfer_curve != NULL)
                 cmsFreeToneCurve (*transfer_curve);
+        if (lcms_profile != NULL)
+                cmsCloseProfile (lcms_profile);
         return ret;
 }
 
-static GPtrArray *
-gcm_session_generate_vcgt (CdProfile *profile, guint size)
+static GcmGammaTable *
+gcm_session_get_gamma_table (GsdColorManager *manager,
+                             CdProfile *profile,
+                             guint size,
+                             GError **error)
 {
-        GnomeRROutputClutItem *tmp;
-        GPtrArray *array = NULL;
-        const cmsToneCurve **vcgt;
-        cmsFloat32Number in;
-        guint i;
+        const gchar *checksum;
         const gchar *filename;
-        cmsHPROFILE lcms_profile = NULL;
-
-        /* invalid size */
-        if (size == 0)
-                goto out;
+        gchar *key = NULL;
+        GcmGammaTable *table;
 
         /* not an actual profile */
         filename = cd_profile_get_filename (profile);
-        if (filename == NULL)
-                goto out;
-
-        /* open file */
-        lcms_profile = cmsOpenProfileFromFile (filename, "r");
-        if (lcms_profile == NULL)
-                goto out;
+        if (filename == NULL) {
+                g_set_error_literal (error,
+                                     GSD_COLOR_MANAGER_ERROR,
+                                     GSD_COLOR_MANAGER_ERROR_FAILED,
+                                     "profile has no filename");
+                return NULL;
+        }
+
+        /* the same profile is usually applied to every output with
+         * the same gamma size, and re-applied on every hotplug */
+        checksum = cd_profile_get_metadata_item (profile,
+                                                 CD_PROFILE_METADATA_FILE_CHECKSUM);
+        if (checksum != NULL) {
+                key = gcm_gamma_table_get_cache_key (checksum, size);
+                table = g_hash_table_lookup (manager->priv->gamma_cache, key);
+                if (table != NULL) {
+                        g_free (key);
+                        return gcm_gamma_table_ref (table);
+                }
+        }
 
-        /* get tone curves from profile */
-        vcgt = cmsReadTag (lcms_profile, cmsSigVcgtTag);
-        if (vcgt == NULL || vcgt[0] == NULL) {
-                g_debug ("profile does not have any VCGT data");
-                goto out;
+        /* generate from the VCGT */
+        table = gcm_gamma_table_new_from_filename (filename, size, error);
+        if (table == NULL) {
+                g_free (key);
+                return NULL;
         }
 
-        /* create array */
-        array = g_ptr_array_new_with_free_func (g_free);
-        for (i = 0; i < size; i++) {
-                in = (gdouble) i / (gdouble) (size - 1);
-                tmp = g_new0 (GnomeRROutputClutItem, 1);
-                tmp->red = cmsEvalToneCurveFloat(vcgt[0], in) * (gdouble) 0xffff;
-                tmp->green = cmsEvalToneCurveFloat(vcgt[1], in) * (gdouble) 0xffff;
-                tmp->blue = cmsEvalToneCurveFloat(vcgt[2], in) * (gdouble) 0xffff;
-                g_ptr_array_add (array, tmp);
+        /* add to cache */
+        if (key != NULL) {
+                g_hash_table_insert (manager->priv->gamma_cache,
+                                     key,
+                                     gcm_gamma_table_ref (table));
         }
-out:
-        if (lcms_profile != NULL)
-                cmsCloseProfile (lcms_profile);
-        return array;
+        return table;
 }
 
 static guint
@@ -618,66 +727,38 @@ gnome_rr_output_get_gamma_size (GnomeRROutput *output)
 
 static gboolean
 gcm_session_output_set_gamma (GnomeRROutput *output,
-                              GPtrArray *array,
+                              GcmGammaTable *table,
                               GError **error)
 {
-        gboolean ret = TRUE;
-        guint16 *red = NULL;
-        guint16 *green = NULL;
-        guint16 *blue = NULL;
-        guint i;
-        GnomeRROutputClutItem *data;
         GnomeRRCrtc *crtc;
 
-        /* no length? */
-        if (array->len == 0) {
-                ret = FALSE;
-                g_set_error_literal (error,
-                                     GSD_COLOR_MANAGER_ERROR,
-                                     GSD_COLOR_MANAGER_ERROR_FAILED,
-                                     "no data in the CLUT array");
-                goto out;
-        }
-
-        /* convert to a type X understands */
-        red = g_new (guint16, array->len);
-        green = g_new (guint16, array->len);
-        blue = g_new (guint16, array->len);
-        for (i = 0; i < array->len; i++) {
-                data = g_ptr_array_index (array, i);
-                red[i] = data->red;
-                green[i] = data->green;
-                blue[i] = data->blue;
-        }
-
         /* send to LUT */
         crtc = gnome_rr_output_get_crtc (output);
         if (crtc == NULL) {
-                ret = FALSE;
                 g_set_error (error,
                              GSD_COLOR_MANAGER_ERROR,
                              GSD_COLOR_MANAGER_ERROR_FAILED,
                              "failed to get ctrc for %s",
                              gnome_rr_output_get_name (output));
-                goto out;
+                return FALSE;
         }
-        gnome_rr_crtc_set_gamma (crtc, array->len,
-                                 red, green, blue);
-out:
-        g_free (red);
-        g_free (green);
-        g_free (blue);
-        return ret;
+        gnome_rr_crtc_set_gamma (crtc,
+                                 gcm_gamma_table_get_size (table),
+                                 gcm_gamma_table_get_red (table),
+                                 gcm_gamma_table_get_green (table),
+                                 gcm_gamma_table_get_blue (table));
+        return TRUE;
 }
 
 static gboolean
-gcm_session_device_set_gamma (GnomeRROutput *output,
+gcm_session_device_set_gamma (GsdColorManager *manager,
+                              GnomeRROutput *output,
                               CdProfile *profile,
                               GError **error)
 {
         gboolean ret = FALSE;
         guint size;
-        GPtrArray *clut = NULL;
+        GcmGammaTable *table = NULL;
 
         /* create a lookup table */
         size = gnome_rr_output_get_gamma_size (output);
@@ -685,59 +766,47 @@ gcm_session_device_set_gamma (GnomeRROutput *output,
                 ret = TRUE;
                 goto out;
         }
-        clut = gcm_session_generate_vcgt (profile, size);
-        if (clut == NULL) {
-                g_set_error_literal (error,
-                                     GSD_COLOR_MANAGER_ERROR,
-                                     GSD_COLOR_MANAGER_ERROR_FAILED,
-                                     "failed to generate vcgt");
+        table = gcm_session_get_gamma_table (manager, profile, size, error);
+        if (table == NULL)
                 goto out;
-        }
 
         /* apply the vcgt to this output */
-        ret = gcm_session_output_set_gamma (output, clut, error);
+        ret = gcm_session_output_set_gamma (output, table, error);
         if (!ret)
                 goto out;
 out:
-        if (clut != NULL)
-                g_ptr_array_unref (clut);
+        if (table != NULL)
+                gcm_gamma_table_unref (table);
         return ret;
 }
 
 static gboolean
-gcm_session_device_reset_gamma (GnomeRROutput *output,
+gcm_session_device_reset_gamma (GsdColorManager *manager,
+                                GnomeRROutput *output,
                                 GError **error)
 {
         gboolean ret;
-        guint i;
         guint size;
-        guint32 value;
-        GPtrArray *clut;
-        GnomeRROutputClutItem *data;
+        gchar *key;
+        GcmGammaTable *table;
 
         /* create a linear ramp */
         g_debug ("falling back to dummy ramp");
-        clut = g_ptr_array_new_with_free_func (g_free);
         size = gnome_rr_output_get_gamma_size (output);
-        if (size == 0) {
-                ret = TRUE;
-                goto out;
-        }
-        for (i = 0; i < size; i++) {
-                value = (i * 0xffff) / (size - 1);
-                data = g_new0 (GnomeRROutputClutItem, 1);
-                data->red = value;
-                data->green = value;
-                data->blue = value;
-                g_ptr_array_add (clut, data);
+        if (size < 2)
+                return TRUE;
+        key = gcm_gamma_table_get_cache_key (NULL, size);
+        table = g_hash_table_lookup (manager->priv->gamma_cache, key);
+        if (table == NULL) {
+                table = gcm_gamma_table_new_linear (size);
+                g_hash_table_insert (manager->priv->gamma_cache,
+                                     key, table);
+        } else {
+                g_free (key);
         }
 
         /* apply the vcgt to this output */
-        ret = gcm_session_output_set_gamma (output, clut, error);
-        if (!ret)
-                goto out;
-out:
-        g_ptr_array_unref (clut);
+        ret = gcm_session_output_set_gamma (output, table, error);
         return ret;
 }
 
@@ -939,7 +1008,8 @@ gcm_session_device_assign_profile_connect_cb (GObject *object,
         /* create a vcgt for this icc file */
         ret = cd_profile_get_has_vcgt (profile);
         if (ret) {
-                ret = gcm_session_device_set_gamma (output,
+                ret = gcm_session_device_set_gamma (manager,
+                                                    output,
                                                     profile,
                                                     &error);
                 if (!ret) {
@@ -950,7 +1020,8 @@ gcm_session_device_assign_profile_connect_cb (GObject *object,
                         goto out;
                 }
         } else {
-                ret = gcm_session_device_reset_gamma (output,
+                ret = gcm_session_device_reset_gamma (manager,
+                                                      output,
                                                       &error);
                 if (!ret) {
                         g_warning ("failed to reset %s gamma tables: %s",
@@ -1012,21 +1083,179 @@ out:
         return ret;
 }
 
+static void
+gcm_session_device_assign_default_profile (GsdColorManager *manager,
+                                           CdDevice *device,
+                                           GnomeRROutput *output)
+{
+        CdProfile *profile;
+        gboolean ret;
+        GError *error = NULL;
+        GcmSessionAsyncHelper *helper;
+
+        /* get the default profile for the device */
+        profile = cd_device_get_default_profile (device);
+        if (profile == NULL) {
+                g_debug ("%s has no default profile to set",
+                         cd_device_get_id (device));
+
+                /* the default output? */
+                if (gnome_rr_output_get_is_primary (output))
+                        gcm_session_screen_clear_icc_profile (manager);
+
+                /* reset, as we want linear profiles for profiling */
+                ret = gcm_session_device_reset_gamma (manager,
+                                                      output,
+                                                      &error);
+                if (!ret) {
+                        g_warning ("failed to reset %s gamma tables: %s",
+                                   cd_device_get_id (device),
+                                   error->message);
+                        g_error_free (error);
+                }
+                return;
+        }
+
+        /* get properties */
+        helper = g_new0 (GcmSessionAsyncHelper, 1);
+        helper->output_id = gnome_rr_output_get_id (output);
+        helper->manager = g_object_ref (manager);
+        helper->device = g_object_ref (device);
+        cd_profile_connect (profile,
+                            NULL,
+                            gcm_session_device_assign_profile_connect_cb,
+                            helper);
+        g_object_unref (profile);
+}
+
+static gboolean
+gcm_session_profile_md_stat (const gchar *filename, GcmProfileMd *md)
+{
+        GStatBuf buf;
+
+        if (g_stat (filename, &buf) != 0)
+                return FALSE;
+        md->mtime = buf.st_mtime;
+        md->size = buf.st_size;
+        return TRUE;
+}
+
+/* Returns TRUE if the index knows whether the profile has the device
+ * metadata, which only costs a stat() */
+static gboolean
+gcm_session_profile_md_lookup (GsdColorManager *manager,
+                               const gchar *filename,
+                               gboolean *has_device_md)
+{
+        GcmProfileMd current;
+        GcmProfileMd *md;
+
+        md = g_hash_table_lookup (manager->priv->profile_md_cache, filename);
+        if (md == NULL)
+                return FALSE;
+
+        if (!gcm_session_profile_md_stat (filename, &current) ||
+            current.mtime != md->mtime ||
+            current.size != md->size) {
+                g_hash_table_remove (manager->priv->profile_md_cache, filename);
+                return FALSE;
+        }
+
+        *has_device_md = md->has_device_md;
+        return TRUE;
+}
+
+static void
+gcm_profile_job_free (GcmProfileJob *job)
+{
+        g_object_unref (job->manager);
+        g_object_unref (job->device);
+        g_object_unref (job->edid);
+        g_free (job->device_id);
+        g_free (job->dmi_name);
+        g_free (job->dmi_vendor);
+        g_free (job->filename);
+        g_clear_error (&job->error);
+        g_free (job);
+}
+
+
+static gboolean
+gcm_session_profile_job_done (gpointer data)
+{
+        GcmProfileJob *job = data;
+        GsdColorManager *manager = job->manager;
+        GnomeRROutput *output;
+        GError *error = NULL;
+
+        /* stopped in the meantime */
+        if (manager->priv->x11_screen == NULL)
+                return FALSE;
+
+        if (job->error != NULL) {
+                g_warning ("failed to create profile from EDID data: %s",
+                           job->error->message);
+        } else if (job->md_valid) {
+                g_hash_table_insert (manager->priv->profile_md_cache,
+                                     g_strdup (job->filename),
+                                     g_memdup (&job->md, sizeof (GcmProfileMd)));
+        }
+
+        /* the outputs might have changed while we were busy */
+        output = gcm_session_get_x11_output_by_id (manager,
+                                                   job->device_id,
+                                                   &error);
+        if (output == NULL) {
+                g_debug ("no %s device found anymore: %s",
+                         job->device_id, error->message);
+                g_error_free (error);
+                return FALSE;
+        }
+
+        gcm_session_device_assign_default_profile (manager, job->device, output);
+        return FALSE;
+}
+
+static void
+gcm_session_profile_job_run (gpointer data, gpointer user_data)
+{
+        GcmProfileJob *job = data;
+
+        /* check if auto-profile has up-to-date metadata */
+        if (gcm_session_check_profile_device_md (job->filename)) {
+                g_debug ("auto-profile edid %s exists with md", job->filename);
+        } else {
+                g_debug ("auto-profile edid does not exist, creating as %s",
+                         job->filename);
+                gcm_apply_create_icc_profile_for_edid (job, &job->error);
+        }
+
+        if (job->error == NULL) {
+                job->md.has_device_md = TRUE;
+                job->md_valid = gcm_session_profile_md_stat (job->filename, &job->md);
+        }
+
+        g_idle_add_full (G_PRIORITY_DEFAULT,
+                         gcm_session_profile_job_done,
+                         job,
+                         (GDestroyNotify) gcm_profile_job_free);
+}
+
 static void
 gcm_session_device_assign_connect_cb (GObject *object,
                                       GAsyncResult *res,
                                       gpointer user_data)
 {
         CdDeviceKind kind;
-        CdProfile *profile = NULL;
         gboolean ret;
+        gboolean has_device_md;
         gchar *autogen_filename = NULL;
         gchar *autogen_path = NULL;
         GcmEdid *edid = NULL;
         GnomeRROutput *output = NULL;
         GError *error = NULL;
         const gchar *xrandr_id;
-        GcmSessionAsyncHelper *helper;
+        GcmProfileJob *job;
         CdDevice *device = CD_DEVICE (object);
         GsdColorManager *manager = GSD_COLOR_MANAGER (user_data);
         GsdColorManagerPrivate *priv = manager->priv;
@@ -1072,75 +1301,39 @@ gcm_session_device_assign_connect_cb (GObject *object,
                            cd_device_get_id (device),
                            error->message);
                 g_clear_error (&error);
-
-        } else {
-                autogen_filename = g_strdup_printf ("edid-%s.icc",
-                                                    gcm_edid_get_checksum (edid));
-                autogen_path = g_build_filename (g_get_user_data_dir (),
-                                                 "icc", autogen_filename, NULL);
-
-                /* check if auto-profile has up-to-date metadata */
-                if (gcm_session_check_profile_device_md (autogen_path)) {
-                        g_debug ("auto-profile edid %s exists with md", autogen_path);
-                } else {
-                        g_debug ("auto-profile edid does not exist, creating as %s",
-                                 autogen_path);
-                        ret = gcm_apply_create_icc_profile_for_edid (manager,
-                                                                     device,
-                                                                     edid,
-                                                                     autogen_path,
-                                                                     &error);
-                        if (!ret) {
-                                g_warning ("failed to create profile from EDID data: %s",
-                                             error->message);
-                                g_clear_error (&error);
-                        }
-                }
+                gcm_session_device_assign_default_profile (manager, device, output);
+                goto out;
         }
 
-        /* get the default profile for the device */
-        profile = cd_device_get_default_profile (device);
-        if (profile == NULL) {
-                g_debug ("%s has no default profile to set",
-                         cd_device_get_id (device));
-
-                /* the default output? */
-                if (gnome_rr_output_get_is_primary (output)) {
-                        gdk_property_delete (priv->gdk_window,
-                                             gdk_atom_intern_static_string ("_ICC_PROFILE"));
-                        gdk_property_delete (priv->gdk_window,
-                                             gdk_atom_intern_static_string ("_ICC_PROFILE_IN_X_VERSION"));
-                }
+        autogen_filename = g_strdup_printf ("edid-%s.icc",
+                                            gcm_edid_get_checksum (edid));
+        autogen_path = g_build_filename (g_get_user_data_dir (),
+                                         "icc", autogen_filename, NULL);
 
-                /* reset, as we want linear profiles for profiling */
-                ret = gcm_session_device_reset_gamma (output,
-                                                      &error);
-                if (!ret) {
-                        g_warning ("failed to reset %s gamma tables: %s",
-                                   cd_device_get_id (device),
-                                   error->message);
-                        g_error_free (error);
-                        goto out;
-                }
+        /* the usual case on resume, hotplug or user switch */
+        if (gcm_session_profile_md_lookup (manager, autogen_path, &has_device_md) &&
+            has_device_md) {
+                g_debug ("auto-profile edid %s exists with md (cached)", autogen_path);
+                gcm_session_device_assign_default_profile (manager, device, output);
                 goto out;
         }
 
-        /* get properties */
-        helper = g_new0 (GcmSessionAsyncHelper, 1);
-        helper->output_id = gnome_rr_output_get_id (output);
-        helper->manager = g_object_ref (manager);
-        helper->device = g_object_ref (device);
-        cd_profile_connect (profile,
-                            NULL,
-                            gcm_session_device_assign_profile_connect_cb,
-                            helper);
+        /* parsing or writing the ICC file is done in a thread, and the
+         * assignment continues once it's done */
+        job = g_new0 (GcmProfileJob, 1);
+        job->manager = g_object_ref (manager);
+        job->device = g_object_ref (device);
+        job->edid = g_object_ref (edid);
+        job->device_id = g_strdup (xrandr_id);
+        job->dmi_name = g_strdup (gcm_dmi_get_name (priv->dmi));
+        job->dmi_vendor = g_strdup (gcm_dmi_get_vendor (priv->dmi));
+        job->filename = g_strdup (autogen_path);
+        g_thread_pool_push (priv->profile_pool, job, NULL);
 out:
         g_free (autogen_filename);
         g_free (autogen_path);
         if (edid != NULL)
                 g_object_unref (edid);
-        if (profile != NULL)
-                g_object_unref (profile);
 }
 
 static void
@@ -1549,6 +1742,162 @@ out:
         return;
 }
 
+static void
+gcm_session_snapshot_save (GsdColorManager *manager)
+{
+        GsdColorManagerPrivate *priv = manager->priv;
+        GVariantBuilder md_builder;
+        GVariantBuilder blob_builder;
+        GHashTableIter iter;
+        const gchar *filename;
+        GcmProfileMd *md;
+        GcmIccBlob *blob;
+
+        g_variant_builder_init (&md_builder, G_VARIANT_TYPE ("a{s(xxb)}"));
+        g_hash_table_iter_init (&iter, priv->profile_md_cache);
+        while (g_hash_table_iter_next (&iter, (gpointer *) &filename, (gpointer *) &md)) {
+                g_variant_builder_add (&md_builder, "{s(xxb)}",
+                                       filename,
+                                       md->mtime,
+                                       (gint64) md->size,
+                                       md->has_device_md);
+        }
+
+        g_variant_builder_init (&blob_builder, G_VARIANT_TYPE ("a{s(xxs)}"));
+        g_hash_table_iter_init (&iter, priv->icc_blob_cache);
+        while (g_hash_table_iter_next (&iter, (gpointer *) &filename, (gpointer *) &blob)) {
+                g_variant_builder_add (&blob_builder, "{s(xxs)}",
+                                       filename,
+                                       blob->mtime,
+                                       (gint64) blob->size,
+                                       blob->checksum);
+        }
+
+        gnome_settings_snapshot_save ("color",
+                                      GCM_SNAPSHOT_VERSION,
+                                      g_variant_new (GCM_SNAPSHOT_TYPE,
+                                                     priv->icc_blob_published != NULL ?
+                                                     priv->icc_blob_published : "",
+                                                     &md_builder,
+                                                     &blob_builder));
+}
+
+/* Returns the checksum of what is in the _ICC_PROFILE property now */
+static gchar *
+gcm_session_screen_get_icc_profile_checksum (GsdColorManager *manager)
+{
+        GdkAtom type;
+        gint format;
+        gint length;
+        guchar *data = NULL;
+        gchar *checksum = NULL;
+
+        if (!gdk_property_get (manager->priv->gdk_window,
+                               gdk_atom_intern_static_string ("_ICC_PROFILE"),
+                               gdk_atom_intern_static_string ("CARDINAL"),
+                               0, G_MAXLONG, FALSE,
+                               &type, &format, &length, &data))
+                goto out;
+        if (format != 8 || length <= 0)
+                goto out;
+        checksum = g_compute_checksum_for_data (G_CHECKSUM_MD5, data, length);
+out:
+        g_free (data);
+        return checksum;
+}
+
+/* Whether _ICC_PROFILE_IN_X_VERSION is what we would set it to */
+static gboolean
+gcm_session_screen_icc_version_is_current (GsdColorManager *manager)
+{
+        GdkAtom type;
+        gint format;
+        gint length;
+        guchar *data = NULL;
+        guint version_data;
+        gboolean ret = FALSE;
+
+        if (!gdk_property_get (manager->priv->gdk_window,
+                               gdk_atom_intern_static_string ("_ICC_PROFILE_IN_X_VERSION"),
+                               gdk_atom_intern_static_string ("CARDINAL"),
+                               0, 1, FALSE,
+                               &type, &format, &length, &data))
+                goto out;
+
+        /* only the first byte is set, see gcm_session_screen_set_icc_profile() */
+        version_data = GCM_ICC_PROFILE_IN_X_VERSION_MAJOR * 100 +
+                        GCM_ICC_PROFILE_IN_X_VERSION_MINOR * 1;
+        ret = format == 8 && length == 1 &&
+              data[0] == ((const guchar *) &version_data)[0];
+out:
+        g_free (data);
+        return ret;
+}
+
+/* Every entry is still checked against the file before it's used, the
+ * snapshot only spares us from parsing the profiles again */
+static void
+gcm_session_snapshot_restore (GsdColorManager *manager)
+{
+        GsdColorManagerPrivate *priv = manager->priv;
+        GVariant *state;
+        GVariantIter *md_iter = NULL;
+        GVariantIter *blob_iter = NULL;
+        const gchar *published;
+        const gchar *filename;
+        const gchar *checksum;
+        gchar *current = NULL;
+        gint64 mtime;
+        gint64 size;
+        gboolean has_device_md;
+        GcmProfileMd *md;
+        GcmIccBlob *blob;
+
+        state = gnome_settings_snapshot_load ("color",
+                                              GCM_SNAPSHOT_VERSION,
+                                              G_VARIANT_TYPE (GCM_SNAPSHOT_TYPE));
+        if (state == NULL)
+                return;
+
+        g_variant_get (state, "(&sa{s(xxb)}a{s(xxs)})", &published, &md_iter, &blob_iter);
+
+        while (g_variant_iter_next (md_iter, "{&s(xxb)}",
+                                    &filename, &mtime, &size, &has_device_md)) {
+                md = g_new0 (GcmProfileMd, 1);
+                md->mtime = mtime;
+                md->size = size;
+                md->has_device_md = has_device_md;
+                g_hash_table_insert (priv->profile_md_cache, g_strdup (filename), md);
+        }
+
+        while (g_variant_iter_next (blob_iter, "{&s(xxs)}",
+                                    &filename, &mtime, &size, &checksum)) {
+                blob = g_new0 (GcmIccBlob, 1);
+                blob->mtime = mtime;
+                blob->size = size;
+                blob->checksum = g_strdup (checksum);
+                g_hash_table_insert (priv->icc_blob_cache, g_strdup (filename), blob);
+        }
+
+        /* the root window outlives us, but someone else might have
+         * changed the profile while we weren't running */
+        if (published[0] != '\0') {
+                current = gcm_session_screen_get_icc_profile_checksum (manager);
+                if (g_strcmp0 (current, published) == 0 &&
+                    gcm_session_screen_icc_version_is_current (manager))
+                        priv->icc_blob_published = g_strdup (published);
+        }
+
+        g_debug ("restored %u profiles and %u ICC blobs from the snapshot",
+                 g_hash_table_size (priv->profile_md_cache),
+                 g_hash_table_size (priv->icc_blob_cache));
+
+        g_free (current);
+        g_variant_iter_free (md_iter);
+        g_variant_iter_free (blob_iter);
+        g_variant_unref (state);
+}
+
 gboolean
 gsd_color_manager_start (GsdColorManager *manager,
                          GError          **error)
@@ -1564,6 +1913,8 @@ gsd_color_manager_start (GsdColorManager *manager,
         if (priv->x11_screen == NULL)
                 goto out;
 
+        gcm_session_snapshot_restore (manager);
+
         cd_client_connect (priv->client,
                            NULL,
                            gcm_session_client_connect_cb,
@@ -1581,6 +1932,10 @@ gsd_color_manager_stop (GsdColorManager *manager)
 {
         g_debug ("Stopping color manager");
 
+        /* only worth keeping if we got as far as looking at screens */
+        if (manager->priv->x11_screen != NULL)
+                gcm_session_snapshot_save (manager);
+
         g_clear_object (&manager->priv->settings);
         g_clear_object (&manager->priv->client);
         g_clear_object (&manager->priv->profile_store);
@@ -1588,6 +1943,10 @@ gsd_color_manager_stop (GsdColorManager *manager)
         g_clear_object (&manager->priv->session);
         g_clear_pointer (&manager->priv->edid_cache, g_hash_table_destroy);
         g_clear_pointer (&manager->priv->device_assign_hash, g_hash_table_destroy);
+        g_hash_table_remove_all (manager->priv->gamma_cache);
+        g_hash_table_remove_all (manager->priv->profile_md_cache);
+        g_hash_table_remove_all (manager->priv->icc_blob_cache);
+        g_clear_pointer (&manager->priv->icc_blob_published, g_free);
         g_clear_object (&manager->priv->x11_screen);
 }
 
@@ -2157,6 +2516,27 @@ gsd_color_manager_init (GsdColorManager *manager)
                                                   g_free,
                                                   g_object_unref);
 
+        /* evaluating the VCGT is expensive, and the result only
+         * depends on the profile contents and the gamma size */
+        priv->gamma_cache = g_hash_table_new_full (g_str_hash,
+                                                   g_str_equal,
+                                                   g_free,
+                                                   (GDestroyNotify) gcm_gamma_table_unref);
+
+        /* parsing the auto-generated profiles is expensive */
+        priv->profile_md_cache = g_hash_table_new_full (g_str_hash,
+                                                        g_str_equal,
+                                                        g_free,
+                                                        g_free);
+        priv->profile_pool = g_thread_pool_new (gcm_session_profile_job_run,
+                                                NULL, 1, FALSE, NULL);
+
+        /* publishing the same profile again makes clients reload it */
+        priv->icc_blob_cache = g_hash_table_new_full (g_str_hash,
+                                                      g_str_equal,
+                                                      g_free,
+                                                      (GDestroyNotify) gcm_icc_blob_free);
+
         /* we don't want to assign devices multiple times at startup */
         priv->device_assign_hash = g_hash_table_new_full (g_str_hash,
                                                           g_str_equal,
@@ -2205,6 +2585,14 @@ gsd_color_manager_finalize (GObject *object)
         g_clear_object (&manager->priv->session);
         g_clear_pointer (&manager->priv->edid_cache, g_hash_table_destroy);
         g_clear_pointer (&manager->priv->device_assign_hash, g_hash_table_destroy);
+        g_clear_pointer (&manager->priv->gamma_cache, g_hash_table_destroy);
+        if (manager->priv->profile_pool != NULL) {
+                g_thread_pool_free (manager->priv->profile_pool, FALSE, TRUE);
+                manager->priv->profile_pool = NULL;
+        }
+        g_clear_pointer (&manager->priv->profile_md_cache, g_hash_table_destroy);
+        g_clear_pointer (&manager->priv->icc_blob_cache, g_hash_table_destroy);
+        g_free (manager->priv->icc_blob_published);
         g_clear_object (&manager->priv->x11_screen);
 
         G_OBJECT_CLASS (gsd_color_manager_parent_class)->finalize (object);
@@ -24,6 +24,9 @@
 #include <glib.h>
 #include <gio/gio.h>
 
+#define G_SETTINGS_ENABLE_BACKEND
+#include <gio/gsettingsbackend.h>
+
 #include "gnome-settings-plugin.h"
 #include "gsd-connman-manager.h"
 
@@ -46,11 +49,38 @@
 
 #define GSD_CONNMAN_MANAGER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), GSD_TYPE_CONNMAN_MANAGER, GsdConnmanManagerPrivate))
 
+/* org.gnome.system.proxy and its per-protocol children */
+enum {
+        PROXY_ROOT,
+        PROXY_HTTP,
+        PROXY_HTTPS,
+        PROXY_FTP,
+        PROXY_SOCKS,
+        N_PROXY_SETTINGS
+};
+
+static const gchar *proxy_children[N_PROXY_SETTINGS] = {
+        NULL, KEY_HTTP, KEY_HTTPS, KEY_FTP, KEY_SOCKS
+};
+
+typedef struct {
+        GSettings       *writer;        /* delay-apply */
+        GSettings       *defaults;      /* memory backend, only holds defaults */
+} ProxySettings;
+
+/* The complete configuration we want, NULL meaning the default */
+typedef struct {
+        const gchar     *mode;
+        gchar           *auto_url;
+        GVariant        *ignore_hosts;
+        gchar           *hosts[N_PROXY_SETTINGS];
+        gint             ports[N_PROXY_SETTINGS];
+} ProxyState;
+
 struct GsdConnmanManagerPrivate {
         Manager         *manager_proxy;
         Service         *active_service;
-        GSettings       *proxy_settings;
-        gchar           **current_servers;
+        ProxySettings    proxy_settings[N_PROXY_SETTINGS];
 };
 
 static void     gsd_connman_manager_class_init  (GsdConnmanManagerClass *klass);
@@ -60,56 +90,107 @@ G_DEFINE_TYPE (GsdConnmanManager, gsd_connman_manager, G_TYPE_OBJECT)
 
 static gpointer manager_object = NULL;
 
+static void
+proxy_state_clear (ProxyState *state)
+{
+        guint i;
+
+        g_clear_pointer (&state->auto_url, g_free);
+        g_clear_pointer (&state->ignore_hosts, g_variant_unref);
+        for (i = 0; i < N_PROXY_SETTINGS; i++)
+                g_clear_pointer (&state->hosts[i], g_free);
+}
+
+/* Only touches @key if its value would actually change */
+static gboolean
+proxy_settings_write (ProxySettings *settings,
+                      const gchar   *key,
+                      GVariant      *value)
+{
+        GVariant        *current, *wanted;
+        gboolean         changed;
+
+        current = g_settings_get_value (settings->writer, key);
+        if (value != NULL)
+                wanted = g_variant_ref_sink (value);
+        else
+                wanted = g_settings_get_value (settings->defaults, key);
+
+        changed = !g_variant_equal (current, wanted);
+        if (changed) {
+                if (value != NULL)
+                        g_settings_set_value (settings->writer, key, wanted);
+                else
+                        g_settings_reset (settings->writer, key);
+        }
+
+        g_variant_unref (current);
+        g_variant_unref (wanted);
+
+        return changed;
+}
+
+static void
+connman_manager_write_proxy_state (GsdConnmanManager *manager,
+                                   ProxyState        *state)
+{
+        ProxySettings   *settings = manager->priv->proxy_settings;
+        guint            i, n_changed = 0;
+
+        for (i = PROXY_ROOT + 1; i < N_PROXY_SETTINGS; i++) {
+                n_changed += proxy_settings_write (&settings[i], KEY_HOST,
+                                                   state->hosts[i] ? g_variant_new_string (state->hosts[i]) : NULL);
+                n_changed += proxy_settings_write (&settings[i], KEY_PORT,
+                                                   state->hosts[i] ? g_variant_new_int32 (state->ports[i]) : NULL);
+        }
+
+        n_changed += proxy_settings_write (&settings[PROXY_ROOT], KEY_IGNORE,
+                                           state->ignore_hosts ? g_variant_ref (state->ignore_hosts) : NULL);
+        n_changed += proxy_settings_write (&settings[PROXY_ROOT], KEY_AUTO_URL,
+                                           state->auto_url ? g_variant_new_string (state->auto_url) : NULL);
+        n_changed += proxy_settings_write (&settings[PROXY_ROOT], KEY_MODE,
+                                           state->mode ? g_variant_new_string (state->mode) : NULL);
+
+        if (n_changed == 0) {
+                g_debug ("Proxy configuration unchanged");
+                return;
+        }
+
+        g_debug ("Applying %u changed proxy settings", n_changed);
+
+        /* Children first, so that the mode only changes once the
+         * servers it refers to are in place */
+        for (i = N_PROXY_SETTINGS; i-- > 0; ) {
+                if (g_settings_get_has_unapplied (settings[i].writer))
+                        g_settings_apply (settings[i].writer);
+        }
+}
+
 static void
 connman_manager_clear_proxy_settings (GsdConnmanManager *manager)
 {
-        GSettings       *child;
+        ProxyState       state = { NULL, };
 
         g_debug ("Resetting org.gnome.system.proxy and its children");
 
-        g_settings_reset (manager->priv->proxy_settings, KEY_AUTO_URL);
-        g_settings_reset (manager->priv->proxy_settings, KEY_MODE);
-        g_settings_reset (manager->priv->proxy_settings, KEY_IGNORE);
-
-        child = g_settings_get_child (manager->priv->proxy_settings, KEY_HTTP);
-        g_settings_reset (child, KEY_HOST);
-        g_settings_reset (child, KEY_PORT);
-        g_object_unref (child);
-
-        child = g_settings_get_child (manager->priv->proxy_settings, KEY_HTTPS);
-        g_settings_reset (child, KEY_HOST);
-        g_settings_reset (child, KEY_PORT);
-        g_object_unref (child);
-
-        child = g_settings_get_child (manager->priv->proxy_settings, KEY_FTP);
-        g_settings_reset (child, KEY_HOST);
-        g_settings_reset (child, KEY_PORT);
-        g_object_unref (child);
-
-        child = g_settings_get_child (manager->priv->proxy_settings, KEY_SOCKS);
-        g_settings_reset (child, KEY_HOST);
-        g_settings_reset (child, KEY_PORT);
-        g_object_unref (child);
+        connman_manager_write_proxy_state (manager, &state);
 }
 
 static void
-gsd_connman_manager_set_auto_proxy (GsdConnmanManager   *manager,
-                                    GVariant            *proxy_values)
+gsd_connman_manager_set_auto_proxy (ProxyState  *state,
+                                    GVariant    *proxy_values)
 {
         GVariant                *val;
-        const gchar             *auto_url;
 
         val = g_variant_lookup_value (proxy_values, "URL",
                                       G_VARIANT_TYPE_STRING);
-        auto_url = g_variant_get_string (val, 0);
-
-        g_debug ("Setting proxy to auto: %s", auto_url);
-        g_settings_set_string (manager->priv->proxy_settings,
-                               KEY_MODE, "auto");
-        g_settings_set_string (manager->priv->proxy_settings,
-                               KEY_AUTO_URL, auto_url);
+        state->mode = "auto";
+        if (val) {
+                state->auto_url = g_variant_dup_string (val, NULL);
+                g_variant_unref (val);
+        }
 
-        g_variant_unref (val);
+        g_debug ("Setting proxy to auto: %s", state->auto_url);
 }
 
 static void
@@ -158,11 +239,10 @@ host:
 }
 
 static void
-gsd_connman_manager_set_manual_proxy (GsdConnmanManager *manager,
+gsd_connman_manager_set_manual_proxy (ProxyState        *state,
                                       GVariant          *proxy_values)
 {
         GVariant        *val;
-        GSettings       *child_settings = NULL;
         const gchar     **servers;
         guint           i;
         gsize           num_servers;
@@ -178,189 +258,47 @@ gsd_connman_manager_set_manual_proxy (GsdConnmanManager *manager,
                         gchar   *protocol = NULL;
                         gchar   *server = NULL;
                         gint    port;
+                        guint   child = PROXY_ROOT;
 
                         parse_server_entry (servers[i], &protocol, &server, &port);
                         if (!server)
                                 continue;
 
                         if (g_strcmp0 (protocol, "http") == 0) {
-                                child_settings = g_settings_get_child
-                                        (manager->priv->proxy_settings,
-                                         KEY_HTTP);
+                                child = PROXY_HTTP;
                         } else if (g_strcmp0 (protocol, "https") == 0) {
-                                child_settings = g_settings_get_child
-                                        (manager->priv->proxy_settings,
-                                         KEY_HTTPS);
+                                child = PROXY_HTTPS;
                         } else if (g_strcmp0 (protocol, "ftp") == 0) {
-                                child_settings = g_settings_get_child
-                                        (manager->priv->proxy_settings,
-                                         KEY_FTP);
+                                child = PROXY_FTP;
                         } else if (g_strcmp0 (protocol, "socks") == 0 ||
                                    g_strcmp0 (protocol, "socks4") == 0 ||
                                    g_strcmp0 (protocol, "socks5") == 0) {
-                                child_settings = g_settings_get_child
-                                        (manager->priv->proxy_settings,
-                                         KEY_SOCKS);
+                                child = PROXY_SOCKS;
                         }
 
-                        if (port > 0 && child_settings) {
-                                g_settings_set_string (child_settings, KEY_HOST,
-                                                       server);
-                                g_settings_set_int (child_settings, KEY_PORT,
-                                                    port);
+                        if (port > 0 && child != PROXY_ROOT) {
+                                g_free (state->hosts[child]);
+                                state->hosts[child] = server;
+                                state->ports[child] = port;
+                                server = NULL;
                         }
 
-                        g_object_unref (child_settings);
                         g_free (protocol);
                         g_free (server);
                 }
 
-                g_clear_pointer (&manager->priv->current_servers, g_strfreev);
-                manager->priv->current_servers = g_strdupv ((gchar **) servers);
-
                 g_free (servers);
                 g_variant_unref (val);
         }
 
-        val = g_variant_lookup_value (proxy_values, "Excludes",
-                                      G_VARIANT_TYPE_STRING_ARRAY);
-        if (val) {
-                /* The Excludes property of a ConnMan Service is of type as
-                 * and the ignore-hosts GSetting expects an as .:. we can just
-                 * set the exact values we retrieved.
-                 */
-                g_settings_set_value (manager->priv->proxy_settings,
-                                      KEY_IGNORE, val);
-
-                g_variant_unref (val);
-        }
-
-        g_settings_set_string (manager->priv->proxy_settings,
-                               KEY_MODE, "manual");
-}
-
-static gboolean
-gsd_connman_manager_settings_changed (GsdConnmanManager *manager,
-                                      const gchar       *method,
-                                      GVariant          *proxy_values)
-{
-        gboolean        has_changed = FALSE;
-        gchar           *current_method;
-        gchar           **current_excludes;
-        const gchar     *new_method;
-
-        current_method = g_settings_get_string (manager->priv->proxy_settings,
-                                                KEY_MODE);
-
-        /* GNOME uses 'none' where ConnMan uses 'direct' */
-        if (g_strcmp0 (method, "direct") == 0)
-                new_method = "none";
-        else
-                new_method = method;
-
-        /* If the methods are different, settings have changed */
-        if (g_strcmp0 (new_method, current_method) != 0) {
-                g_debug ("Proxy method changed from %s to %s",
-                         current_method, method);
-                has_changed = TRUE;
-        } else {
-                GVariant        *val;
-
-                /* Method was direct and is still direct = not changed */
-                if (g_strcmp0 (method, "direct") == 0) {
-                        /*g_debug ("Proxy method unchanged - direct");*/
-                        has_changed = FALSE;
-                /* Method is auto and URL different = changed */
-                } else if (g_strcmp0 (method, "auto") == 0) {
-                        const gchar     *auto_url;
-                        gchar           *current_auto_url;
-
-                        val = g_variant_lookup_value (proxy_values, "URL",
-                                                      G_VARIANT_TYPE_STRING);
-                        auto_url = g_variant_get_string (val, 0);
-                        current_auto_url = g_settings_get_string (manager->priv->proxy_settings,
-                                                                  KEY_AUTO_URL);
-
-                        if (g_strcmp0 (auto_url, current_auto_url) != 0) {
-                                g_debug ("Proxy auto url changed from %s to %s",
-                                         current_auto_url, auto_url);
-                                has_changed = TRUE;
-                        }
-
-                        g_variant_unref (val);
-
-                /* Method is manual and any of the servers or excludes are different
-                 * = changed
-                 */
-                } else if (g_strcmp0 (method, "manual") == 0) {
-                        /* Compare Servers, as soon as mismatch return TRUE
-                         */
-                        val = g_variant_lookup_value (proxy_values, "Servers",
-                                      G_VARIANT_TYPE_STRING_ARRAY);
-                        if (val) {
-                                const gchar **servers;
-                                gsize num_servers;
-                                gint i;
-
-                                servers = g_variant_get_strv (val, &num_servers);
-
-                                if (g_strv_length ((gchar **) servers) != g_strv_length (manager->priv->current_servers)) {
-                                        g_debug ("Number of configured proxy servers has changed");
-                                        has_changed = TRUE;
-                                        goto servers_done;
-                                }
-
-                                for (i = 0; i < num_servers; i++) {
-                                        if (g_strcmp0 (servers[i], manager->priv->current_servers[i]) != 0) {
-                                                g_debug ("Configured servers have changed");
-                                                has_changed = TRUE;
-                                                break;
-                                        }
-                                }
-
-                        servers_done:
-                                g_free (servers);
-                                g_variant_unref (val);
-                        }
-
-                        /* Compare Excludes, as soon as mismatch return TRUE
-                         */
-                        val = g_variant_lookup_value (proxy_values, "Excludes",
+        /* The Excludes property of a ConnMan Service is of type as
+         * and the ignore-hosts GSetting expects an as .:. we can just
+         * set the exact values we retrieved.
+         */
+        state->ignore_hosts = g_variant_lookup_value (proxy_values, "Excludes",
                                                       G_VARIANT_TYPE_STRING_ARRAY);
-                        current_excludes = g_settings_get_strv (manager->priv->proxy_settings, KEY_IGNORE);
-                        if (val) {
-                                const gchar     **excludes;
-                                gsize           num_excludes;
-                                gint            i;
-
-                                excludes = g_variant_get_strv (val, &num_excludes);
-
-                                if (g_strv_length (current_excludes) != g_strv_length ((gchar **) excludes)) {
-                                        g_debug ("Number of excludes has changed");
-                                        has_changed = TRUE;
-                                        goto excludes_done;
-                                }
-
-                                for (i = 0; i < num_excludes; i++) {
-                                        if (g_strcmp0 (excludes[i], current_excludes[i]) != 0) {
-                                                g_debug ("Configured excludes have changed");
-                                                has_changed = TRUE;
-                                                break;
-                                        }
-                                }
-                        excludes_done:
-                                g_strfreev (current_excludes);
-                                g_free (excludes);
-                                g_variant_unref (val);
-                        }
-                }
-        }
-
-        /*g_debug ("Proxy configuration has%s changed", has_changed ? "" : " not");*/
 
-        g_free (current_method);
-
-        return has_changed;
+        state->mode = "manual";
 }
 
 static void
@@ -369,6 +307,7 @@ gsd_connman_manager_set_proxy_values (GsdConnmanManager *manager,
 {
         GVariant                *val;
         const gchar             *method;
+        ProxyState               state = { NULL, };
 
         val = g_variant_lookup_value (proxy_values, "Method",
                                       G_VARIANT_TYPE_STRING);
@@ -376,21 +315,19 @@ gsd_connman_manager_set_proxy_values (GsdConnmanManager *manager,
         if (val) {
                 method = g_variant_get_string (val, 0);
 
-                if (!gsd_connman_manager_settings_changed (manager, method, proxy_values))
-                        goto done;
-
-                connman_manager_clear_proxy_settings (manager);
-
                 if (method == NULL || g_strcmp0 (method, "direct") == 0) {
                         g_debug ("Setting proxy to direct");
                 } else if (g_strcmp0 (method, "auto") == 0) {
-                        gsd_connman_manager_set_auto_proxy (manager,
+                        gsd_connman_manager_set_auto_proxy (&state,
                                                             proxy_values);
                 } else if (g_strcmp0 (method, "manual") == 0) {
-                        gsd_connman_manager_set_manual_proxy (manager,
+                        gsd_connman_manager_set_manual_proxy (&state,
                                                               proxy_values);
                 }
-        done:
+
+                connman_manager_write_proxy_state (manager, &state);
+
+                proxy_state_clear (&state);
                 g_variant_unref (val);
         }
 }
@@ -602,13 +539,13 @@ gsd_connman_manager_stop (GsdConnmanManager *manager)
 
         g_clear_object (&manager->priv->manager_proxy);
         g_clear_object (&manager->priv->active_service);
-        g_clear_pointer (&manager->priv->current_servers, g_strfreev);
 }
 
 static void
 gsd_connman_manager_finalize (GObject *object)
 {
         GsdConnmanManager *manager;
+        guint i;
 
         g_return_if_fail (object != NULL);
         g_return_if_fail (GSD_IS_CONNMAN_MANAGER (object));
@@ -617,7 +554,10 @@ gsd_connman_manager_finalize (GObject *object)
 
         g_return_if_fail (manager->priv != NULL);
 
-        g_clear_object (&manager->priv->proxy_settings);
+        for (i = 0; i < N_PROXY_SETTINGS; i++) {
+                g_clear_object (&manager->priv->proxy_settings[i].writer);
+                g_clear_object (&manager->priv->proxy_settings[i].defaults);
+        }
 
         G_OBJECT_CLASS (gsd_connman_manager_parent_class)->finalize (object);
 }
@@ -635,11 +575,29 @@ gsd_connman_manager_class_init (GsdConnmanManagerClass *klass)
 static void
 gsd_connman_manager_init (GsdConnmanManager *manager)
 {
+        ProxySettings *settings;
+        GSettingsBackend *backend;
+        guint i;
+
         manager->priv = GSD_CONNMAN_MANAGER_GET_PRIVATE (manager);
 
         manager->priv->active_service = NULL;
-        manager->priv->proxy_settings = g_settings_new (SCHEMA_PROXY);
-        manager->priv->current_servers = NULL;
+
+        /* Changes are batched per schema and only applied if
+         * something actually differs */
+        settings = manager->priv->proxy_settings;
+        backend = g_memory_settings_backend_new ();
+        settings[PROXY_ROOT].writer = g_settings_new (SCHEMA_PROXY);
+        settings[PROXY_ROOT].defaults = g_settings_new_with_backend (SCHEMA_PROXY, backend);
+        for (i = PROXY_ROOT + 1; i < N_PROXY_SETTINGS; i++) {
+                settings[i].writer = g_settings_get_child (settings[PROXY_ROOT].writer,
+                                                           proxy_children[i]);
+                settings[i].defaults = g_settings_get_child (settings[PROXY_ROOT].defaults,
+                                                             proxy_children[i]);
+        }
+        for (i = 0; i < N_PROXY_SETTINGS; i++)
+                g_settings_delay (settings[i].writer);
+        g_object_unref (backend);
 }
 
 GsdConnmanManager *
@@ -0,0 +1,750 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * vim: set et sw=8 ts=8:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gio/gunixmounts.h>
+
+#include "gsd-disk-space-purge.h"
+#include "gsd-disk-space-helper.h"
+
+/* Filesystem operations a single run may do before leaving the rest
+ * to the next one, which resumes where it stopped. The run pauses
+ * after each batch to let other I/O through */
+#define PURGE_BUDGET               200000
+#define PURGE_BATCH                512
+#define PURGE_PAUSE_USEC           (2 * 1000)
+
+#define PURGE_PROGRESS_INTERVAL    (G_USEC_PER_SEC / 2)
+#define PURGE_MAX_DEPTH            128
+#define PURGE_TRASHINFO_MAX_SIZE   4096
+
+typedef enum {
+        PURGE_ROOT_DIR,
+        /* <mount>/.Trash/$uid */
+        PURGE_ROOT_SHARED_TRASH,
+        /* <mount>/.Trash-$uid */
+        PURGE_ROOT_USER_TRASH
+} PurgeRootKind;
+
+typedef struct {
+        PurgeRootKind     kind;
+        gchar            *path;
+} PurgeRoot;
+
+/* Where the next run of a kind starts: the roots before this one, and
+ * the top-level entries of this one up to @name, were done by the
+ * current pass */
+typedef struct {
+        PurgeRootKind     kind;
+        gchar            *path;
+        gchar            *name;
+} PurgeCursor;
+
+typedef struct {
+        GsdPurgeProgress  progress;
+        GPtrArray        *roots;
+        PurgeCursor      *cursor;
+        /* dry runs don't move the cursor of real ones */
+        PurgeCursor       dry_run_cursor;
+        gint64            old;
+        gboolean          dry_run;
+        uid_t             uid;
+        dev_t             dev;
+        guint             ops;
+        gint64            last_report;
+        GCancellable     *cancellable;
+} PurgeJob;
+
+typedef struct {
+        GsdPurgeProgress  progress;
+        GCancellable     *cancellable;
+} PurgeReport;
+
+static GThreadPool          *purge_pool = NULL;
+static GCancellable         *purge_cancellable = NULL;
+static GsdPurgeProgressFunc  purge_progress_func = NULL;
+static gpointer              purge_progress_data = NULL;
+/* only used by the worker */
+static PurgeCursor           purge_cursors[2];
+
+const gchar *
+gsd_purge_kind_to_string (GsdPurgeKind kind)
+{
+        if (kind == GSD_PURGE_TRASH)
+                return "trash";
+        return "temp-files";
+}
+
+static void
+purge_root_free (PurgeRoot *root)
+{
+        g_free (root->path);
+        g_free (root);
+}
+
+static void
+purge_add_root (GPtrArray *roots, PurgeRootKind kind, gchar *path)
+{
+        PurgeRoot *root;
+
+        root = g_new0 (PurgeRoot, 1);
+        root->kind = kind;
+        root->path = path;
+        g_ptr_array_add (roots, root);
+}
+
+static void
+purge_cursor_set (PurgeCursor *cursor, PurgeRoot *root, const char *name)
+{
+        if (root != NULL) {
+                cursor->kind = root->kind;
+                if (cursor->path != root->path) {
+                        g_free (cursor->path);
+                        cursor->path = g_strdup (root->path);
+                }
+        } else {
+                g_clear_pointer (&cursor->path, g_free);
+        }
+
+        if (cursor->name != name) {
+                g_free (cursor->name);
+                cursor->name = g_strdup (name);
+        }
+}
+
+static gboolean
+purge_cursor_is_at (PurgeCursor *cursor, PurgeRoot *root)
+{
+        return cursor->path != NULL &&
+               cursor->kind == root->kind &&
+               strcmp (cursor->path, root->path) == 0;
+}
+
+static void
+purge_job_free (PurgeJob *job)
+{
+        purge_cursor_set (&job->dry_run_cursor, NULL, NULL);
+        g_ptr_array_unref (job->roots);
+        g_object_unref (job->cancellable);
+        g_free (job);
+}
+
+static void
+purge_report_free (PurgeReport *report)
+{
+        g_object_unref (report->cancellable);
+        g_free (report);
+}
+
+static gboolean
+purge_report_idle (gpointer user_data)
+{
+        PurgeReport *report = user_data;
+
+        if (g_cancellable_is_cancelled (report->cancellable))
+                return FALSE;
+
+        if (purge_progress_func != NULL)
+                purge_progress_func (&report->progress, purge_progress_data);
+
+        return FALSE;
+}
+
+/* Called from the worker, progress is handed over to the main loop */
+static void
+purge_job_report (PurgeJob *job, gboolean finished)
+{
+        PurgeReport *report;
+        gint64 now;
+
+        now = g_get_monotonic_time ();
+        if (!finished && now - job->last_report < PURGE_PROGRESS_INTERVAL)
+                return;
+        job->last_report = now;
+
+        report = g_new0 (PurgeReport, 1);
+        report->progress = job->progress;
+        report->progress.finished = finished;
+        report->cancellable = g_object_ref (job->cancellable);
+        g_idle_add_full (G_PRIORITY_DEFAULT,
+                         purge_report_idle,
+                         report,
+                         (GDestroyNotify) purge_report_free);
+}
+
+static gboolean
+purge_job_should_stop (PurgeJob *job)
+{
+        return g_cancellable_is_cancelled (job->cancellable) ||
+               job->ops >= PURGE_BUDGET;
+}
+
+/* Accounts for one filesystem operation, returns FALSE if the run
+ * has to stop there */
+static gboolean
+purge_job_spend (PurgeJob *job)
+{
+        if (purge_job_should_stop (job))
+                return FALSE;
+
+        job->ops++;
+        if (job->ops % PURGE_BATCH == 0) {
+                purge_job_report (job, FALSE);
+                g_usleep (PURGE_PAUSE_USEC);
+        }
+
+        return TRUE;
+}
+
+static gboolean
+purge_is_old (PurgeJob *job, const struct stat *st)
+{
+        return st->st_uid == job->uid && st->st_ctime <= job->old;
+}
+
+/* Returns TRUE if @name is gone, or would be on a dry run */
+static gboolean
+purge_unlink (PurgeJob *job, int dfd, const char *name, const struct stat *st)
+{
+        if (!purge_job_spend (job))
+                return FALSE;
+
+        if (job->dry_run) {
+                g_debug ("GsdHousekeeping: would purge %s", name);
+                return TRUE;
+        }
+
+        if (unlinkat (dfd, name, S_ISDIR (st->st_mode) ? AT_REMOVEDIR : 0) != 0)
+                return FALSE;
+
+        job->progress.removed++;
+        job->progress.freed += (guint64) st->st_blocks * 512;
+        return TRUE;
+}
+
+static gboolean purge_entry (PurgeJob *job, int dfd, const char *name, gint depth, gboolean force);
+
+/* Takes ownership of @dfd. Returns FALSE if the run has to stop */
+static gboolean
+purge_dir (PurgeJob *job, int dfd, gint depth, gboolean force)
+{
+        DIR *dir;
+        struct dirent *de;
+        gboolean ret = TRUE;
+
+        dir = fdopendir (dfd);
+        if (dir == NULL) {
+                close (dfd);
+                return TRUE;
+        }
+
+        while ((de = readdir (dir)) != NULL) {
+                if (strcmp (de->d_name, ".") == 0 ||
+                    strcmp (de->d_name, "..") == 0)
+                        continue;
+
+                if (!purge_entry (job, dirfd (dir), de->d_name, depth + 1, force)) {
+                        ret = FALSE;
+                        break;
+                }
+        }
+
+        closedir (dir);
+        return ret;
+}
+
+static gboolean
+purge_entry (PurgeJob *job, int dfd, const char *name, gint depth, gboolean force)
+{
+        struct stat st;
+        int fd;
+
+        if (!purge_job_spend (job))
+                return FALSE;
+
+        if (fstatat (dfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                return TRUE;
+        job->progress.examined++;
+
+        /* don't wander into other filesystems mounted below */
+        if (st.st_dev != job->dev)
+                return TRUE;
+
+        if (S_ISDIR (st.st_mode) && depth < PURGE_MAX_DEPTH) {
+                if (!purge_job_spend (job))
+                        return FALSE;
+                fd = openat (dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (fd >= 0 && !purge_dir (job, fd, depth, force))
+                        return FALSE;
+        }
+
+        if (force || purge_is_old (job, &st))
+                purge_unlink (job, dfd, name, &st);
+
+        return !purge_job_should_stop (job);
+}
+
+static gint
+purge_compare_names (gconstpointer a, gconstpointer b)
+{
+        return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* The top-level entries of a root are handled in name order, so that
+ * a run that stops can leave a cursor for the next one. Returns the
+ * entries after the cursor */
+static GPtrArray *
+purge_read_names (PurgeJob *job, DIR *dir)
+{
+        GPtrArray *names;
+        struct dirent *de;
+
+        names = g_ptr_array_new_with_free_func (g_free);
+        while ((de = readdir (dir)) != NULL) {
+                if (strcmp (de->d_name, ".") == 0 ||
+                    strcmp (de->d_name, "..") == 0)
+                        continue;
+                if (job->cursor->name != NULL &&
+                    strcmp (de->d_name, job->cursor->name) <= 0)
+                        continue;
+                g_ptr_array_add (names, g_strdup (de->d_name));
+        }
+        g_ptr_array_sort (names, purge_compare_names);
+
+        return names;
+}
+
+/* Moves the cursor past a top-level entry. An entry the run stopped
+ * in is skipped too if it was the first one, as one that takes more
+ * than the budget would otherwise stall every run */
+static void
+purge_job_advance (PurgeJob *job, GPtrArray *names, guint i, gboolean done)
+{
+        if (!done && (i > 0 || g_cancellable_is_cancelled (job->cancellable)))
+                return;
+        g_free (job->cursor->name);
+        job->cursor->name = g_strdup (g_ptr_array_index (names, i));
+}
+
+/* Takes ownership of @dfd. Returns FALSE if the run has to stop */
+static gboolean
+purge_root_dir (PurgeJob *job, int dfd)
+{
+        DIR *dir;
+        GPtrArray *names;
+        gboolean ret = TRUE;
+        guint i;
+
+        dir = fdopendir (dfd);
+        if (dir == NULL) {
+                close (dfd);
+                return TRUE;
+        }
+
+        names = purge_read_names (job, dir);
+        for (i = 0; i < names->len; i++) {
+                ret = purge_entry (job, dirfd (dir), g_ptr_array_index (names, i), 1, FALSE);
+                purge_job_advance (job, names, i, ret);
+                if (!ret)
+                        break;
+        }
+
+        g_ptr_array_unref (names);
+        closedir (dir);
+        return ret;
+}
+
+/* Returns the DeletionDate of a trashed file, or -1 if unknown */
+static gint64
+purge_read_deletion_date (PurgeJob *job, int info_fd, const char *name)
+{
+        gchar *info_name;
+        gchar buf[PURGE_TRASHINFO_MAX_SIZE];
+        gchar *date = NULL;
+        GKeyFile *keyfile = NULL;
+        GDateTime *dt = NULL;
+        gint year, month, day, hour, minute, second;
+        gint64 ret = -1;
+        ssize_t len;
+        int fd;
+
+        if (info_fd < 0 || !purge_job_spend (job))
+                return -1;
+
+        info_name = g_strconcat (name, ".trashinfo", NULL);
+        fd = openat (info_fd, info_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        g_free (info_name);
+        if (fd < 0)
+                return -1;
+        len = read (fd, buf, sizeof (buf) - 1);
+        close (fd);
+        if (len <= 0)
+                return -1;
+        buf[len] = '\0';
+
+        keyfile = g_key_file_new ();
+        if (!g_key_file_load_from_data (keyfile, buf, len, G_KEY_FILE_NONE, NULL))
+                goto out;
+        date = g_key_file_get_string (keyfile, "Trash Info", "DeletionDate", NULL);
+        if (date == NULL)
+                goto out;
+
+        /* local time, see the trash specification */
+        if (sscanf (date, "%d-%d-%dT%d:%d:%d",
+                    &year, &month, &day, &hour, &minute, &second) != 6)
+                goto out;
+        dt = g_date_time_new_local (year, month, day, hour, minute, second);
+        if (dt == NULL)
+                goto out;
+        ret = g_date_time_to_unix (dt);
+out:
+        if (dt != NULL)
+                g_date_time_unref (dt);
+        g_free (date);
+        g_key_file_free (keyfile);
+        return ret;
+}
+
+static void
+purge_unlink_trashinfo (PurgeJob *job, int info_fd, const char *name)
+{
+        gchar *info_name;
+
+        if (info_fd < 0 || job->dry_run || !purge_job_spend (job))
+                return;
+
+        info_name = g_strconcat (name, ".trashinfo", NULL);
+        unlinkat (info_fd, info_name, 0);
+        g_free (info_name);
+}
+
+/* Trashed items are purged as a whole, once their deletion date is
+ * old enough, along with their .trashinfo. Returns FALSE if the run
+ * has to stop */
+static gboolean
+purge_trash_item (PurgeJob *job, int files_fd, int info_fd, const char *name)
+{
+        struct stat st;
+        gint64 deleted;
+        int fd;
+
+        if (!purge_job_spend (job))
+                return FALSE;
+        if (fstatat (files_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                return TRUE;
+        job->progress.examined++;
+
+        deleted = purge_read_deletion_date (job, info_fd, name);
+        if (deleted < 0) {
+                if (!purge_is_old (job, &st))
+                        return !purge_job_should_stop (job);
+        } else if (deleted > job->old) {
+                return !purge_job_should_stop (job);
+        }
+
+        g_debug ("GsdHousekeeping: purging %s from the trash", name);
+
+        if (S_ISDIR (st.st_mode)) {
+                fd = openat (files_fd, name,
+                             O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (fd >= 0 && !purge_dir (job, fd, 1, TRUE))
+                        return FALSE;
+        }
+        /* keep the .trashinfo of what couldn't be removed, so
+         * that it can still be restored */
+        if (purge_unlink (job, files_fd, name, &st))
+                purge_unlink_trashinfo (job, info_fd, name);
+
+        return !purge_job_should_stop (job);
+}
+
+static gboolean
+purge_trash_dir (PurgeJob *job, int trash_fd)
+{
+        DIR *dir;
+        GPtrArray *names;
+        gboolean ret = TRUE;
+        int files_fd, info_fd;
+        guint i;
+
+        files_fd = openat (trash_fd, "files", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (files_fd < 0)
+                return TRUE;
+        info_fd = openat (trash_fd, "info", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+        dir = fdopendir (files_fd);
+        if (dir == NULL) {
+                close (files_fd);
+                goto out;
+        }
+
+        names = purge_read_names (job, dir);
+        for (i = 0; i < names->len; i++) {
+                ret = purge_trash_item (job, dirfd (dir), info_fd,
+                                        g_ptr_array_index (names, i));
+                purge_job_advance (job, names, i, ret);
+                if (!ret)
+                        break;
+        }
+
+        g_ptr_array_unref (names);
+        closedir (dir);
+out:
+        if (info_fd >= 0)
+                close (info_fd);
+        return ret;
+}
+
+/* The trash dirs on other mounts can be tampered with by other users,
+ * so do the same checks as GIO before trusting them: .Trash has to be
+ * a sticky dir, and the per-user dir has to be ours, and we never
+ * follow symlinks on the way there. Returns -1 if the dir is not
+ * there or can't be trusted */
+static int
+purge_open_root (PurgeJob *job, PurgeRoot *root)
+{
+        struct stat st;
+        gchar *name = NULL;
+        int mount_fd = -1;
+        int shared_fd = -1;
+        int fd = -1;
+
+        if (root->kind == PURGE_ROOT_DIR)
+                return open (root->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        mount_fd = open (root->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (mount_fd < 0)
+                goto out;
+
+        if (root->kind == PURGE_ROOT_SHARED_TRASH) {
+                shared_fd = openat (mount_fd, ".Trash",
+                                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (shared_fd < 0)
+                        goto out;
+                if (fstat (shared_fd, &st) != 0 ||
+                    !S_ISDIR (st.st_mode) ||
+                    (st.st_mode & S_ISVTX) == 0) {
+                        g_debug ("GsdHousekeeping: ignoring %s/.Trash, not a sticky directory",
+                                 root->path);
+                        goto out;
+                }
+                name = g_strdup_printf ("%d", (int) job->uid);
+                fd = openat (shared_fd, name,
+                             O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        } else {
+                name = g_strdup_printf (".Trash-%d", (int) job->uid);
+                fd = openat (mount_fd, name,
+                             O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        }
+        if (fd < 0)
+                goto out;
+
+        if (fstat (fd, &st) != 0 ||
+            !S_ISDIR (st.st_mode) ||
+            st.st_uid != job->uid) {
+                g_debug ("GsdHousekeeping: ignoring trash %s in %s, not owned by us",
+                         name, root->path);
+                close (fd);
+                fd = -1;
+        }
+out:
+        g_free (name);
+        if (shared_fd >= 0)
+                close (shared_fd);
+        if (mount_fd >= 0)
+                close (mount_fd);
+        return fd;
+}
+
+static void
+purge_job_run (gpointer data, gpointer user_data)
+{
+        PurgeJob *job = data;
+        PurgeRoot *root;
+        struct stat st;
+        gboolean ret = TRUE;
+        guint i, start = 0;
+        int fd;
+
+        if (job->dry_run)
+                job->cursor = &job->dry_run_cursor;
+        else
+                job->cursor = &purge_cursors[job->progress.kind];
+
+        /* start again from the top if the root went away */
+        for (i = 0; job->cursor->path != NULL && i < job->roots->len; i++) {
+                if (purge_cursor_is_at (job->cursor, g_ptr_array_index (job->roots, i))) {
+                        start = i;
+                        break;
+                }
+        }
+        if (i == job->roots->len)
+                purge_cursor_set (job->cursor, NULL, NULL);
+
+        for (i = start; ret && i < job->roots->len; i++) {
+                root = g_ptr_array_index (job->roots, i);
+                if (!purge_cursor_is_at (job->cursor, root))
+                        purge_cursor_set (job->cursor, root, NULL);
+
+                fd = purge_open_root (job, root);
+                if (fd < 0)
+                        continue;
+                if (fstat (fd, &st) != 0) {
+                        close (fd);
+                        continue;
+                }
+                job->dev = st.st_dev;
+
+                g_debug ("GsdHousekeeping: purging %s in %s",
+                         gsd_purge_kind_to_string (job->progress.kind),
+                         root->path);
+
+                if (job->progress.kind == GSD_PURGE_TRASH) {
+                        ret = purge_trash_dir (job, fd);
+                        close (fd);
+                } else {
+                        ret = purge_root_dir (job, fd);
+                }
+        }
+
+        /* the next run starts a new pass */
+        if (ret)
+                purge_cursor_set (job->cursor, NULL, NULL);
+
+        job->progress.complete = ret;
+        if (!ret && job->ops >= PURGE_BUDGET)
+                g_debug ("GsdHousekeeping: purge budget exhausted, continuing after %s in %s on the next run",
+                         job->cursor->name != NULL ? job->cursor->name : "the start",
+                         job->cursor->path);
+
+        g_debug ("GsdHousekeeping: %s purge examined %" G_GUINT64_FORMAT
+                 ", removed %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT " bytes)",
+                 gsd_purge_kind_to_string (job->progress.kind),
+                 job->progress.examined,
+                 job->progress.removed,
+                 job->progress.freed);
+
+        purge_job_report (job, TRUE);
+        purge_job_free (job);
+}
+
+static GPtrArray *
+purge_get_trash_dirs (void)
+{
+        GPtrArray *dirs;
+        GList *mounts, *l;
+        const gchar *mount_path;
+
+        dirs = g_ptr_array_new_with_free_func ((GDestroyNotify) purge_root_free);
+        purge_add_root (dirs, PURGE_ROOT_DIR,
+                        g_build_filename (g_get_user_data_dir (), "Trash", NULL));
+
+        mounts = g_unix_mounts_get (NULL);
+        for (l = mounts; l != NULL; l = l->next) {
+                GUnixMountEntry *mount = l->data;
+
+                if (gsd_should_ignore_unix_mount (mount))
+                        continue;
+
+                mount_path = g_unix_mount_get_mount_path (mount);
+                purge_add_root (dirs, PURGE_ROOT_SHARED_TRASH, g_strdup (mount_path));
+                purge_add_root (dirs, PURGE_ROOT_USER_TRASH, g_strdup (mount_path));
+        }
+        g_list_free_full (mounts, (GDestroyNotify) g_unix_mount_free);
+
+        return dirs;
+}
+
+static GPtrArray *
+purge_get_temp_dirs (void)
+{
+        GPtrArray *dirs;
+
+        dirs = g_ptr_array_new_with_free_func ((GDestroyNotify) purge_root_free);
+        purge_add_root (dirs, PURGE_ROOT_DIR, g_strdup (g_get_tmp_dir ()));
+        if (g_strcmp0 (g_get_tmp_dir (), "/var/tmp") != 0)
+                purge_add_root (dirs, PURGE_ROOT_DIR, g_strdup ("/var/tmp"));
+        if (g_strcmp0 (g_get_tmp_dir (), "/tmp") != 0)
+                purge_add_root (dirs, PURGE_ROOT_DIR, g_strdup ("/tmp"));
+
+        return dirs;
+}
+
+void
+gsd_purge_run (GsdPurgeKind  kind,
+               GDateTime    *old,
+               gboolean      dry_run)
+{
+        PurgeJob *job;
+
+        /* runs are serialised, so they don't compete for the disk */
+        if (purge_pool == NULL) {
+                purge_pool = g_thread_pool_new (purge_job_run, NULL, 1, FALSE, NULL);
+                purge_cancellable = g_cancellable_new ();
+        }
+
+        job = g_new0 (PurgeJob, 1);
+        job->progress.kind = kind;
+        job->old = g_date_time_to_unix (old);
+        job->dry_run = dry_run;
+        job->uid = getuid ();
+        job->cancellable = g_object_ref (purge_cancellable);
+        if (kind == GSD_PURGE_TRASH)
+                job->roots = purge_get_trash_dirs ();
+        else
+                job->roots = purge_get_temp_dirs ();
+
+        g_thread_pool_push (purge_pool, job, NULL);
+}
+
+void
+gsd_purge_cancel (void)
+{
+        if (purge_pool == NULL)
+                return;
+
+        /* queued runs stop as soon as they start */
+        g_cancellable_cancel (purge_cancellable);
+        g_thread_pool_free (purge_pool, FALSE, TRUE);
+        purge_pool = NULL;
+        g_clear_object (&purge_cancellable);
+
+        /* the worker is gone, so this is safe */
+        purge_cursor_set (&purge_cursors[GSD_PURGE_TRASH], NULL, NULL);
+        purge_cursor_set (&purge_cursors[GSD_PURGE_TEMP_FILES], NULL, NULL);
+}
+
+void
+gsd_purge_set_progress_func (GsdPurgeProgressFunc func,
+                             gpointer             user_data)
+{
+        purge_progress_func = func;
+        purge_progress_data = user_data;
+}
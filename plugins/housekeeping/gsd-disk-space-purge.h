@@ -0,0 +1,56 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * vim: set et sw=8 ts=8:
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __GSD_DISK_SPACE_PURGE_H
+#define __GSD_DISK_SPACE_PURGE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+        GSD_PURGE_TRASH,
+        GSD_PURGE_TEMP_FILES
+} GsdPurgeKind;
+
+typedef struct {
+        GsdPurgeKind kind;
+        guint64      examined;
+        guint64      removed;
+        guint64      freed;
+        /* set on the last report of a run */
+        gboolean     finished;
+        /* FALSE if the run was cancelled or ran out of budget */
+        gboolean     complete;
+} GsdPurgeProgress;
+
+typedef void (* GsdPurgeProgressFunc) (const GsdPurgeProgress *progress,
+                                       gpointer                user_data);
+
+void         gsd_purge_run                (GsdPurgeKind          kind,
+                                           GDateTime            *old,
+                                           gboolean              dry_run);
+void         gsd_purge_cancel             (void);
+void         gsd_purge_set_progress_func  (GsdPurgeProgressFunc  func,
+                                           gpointer              user_data);
+const gchar *gsd_purge_kind_to_string     (GsdPurgeKind          kind);
+
+G_END_DECLS
+
+#endif /* __GSD_DISK_SPACE_PURGE_H */
@@ -35,9 +35,11 @@
 #include <gtk/gtk.h>
 #include <libnotify/notify.h>
 
+#include "gnome-settings-scheduler.h"
 #include "gsd-disk-space.h"
 #include "gsd-ldsm-dialog.h"
 #include "gsd-disk-space-helper.h"
+#include "gsd-disk-space-purge.h"
 
 #define GIGABYTE                   1024 * 1024 * 1024
 
@@ -227,272 +229,26 @@ examine_callback (NotifyNotification *n,
         notify_notification_close (n, NULL);
 }
 
-static gboolean
-should_purge_file (GFile        *file,
-                   GCancellable *cancellable,
-                   GDateTime    *old)
-{
-        GFileInfo *info;
-        GDateTime *date;
-        gboolean should_purge;
-
-        should_purge = FALSE;
-
-        info = g_file_query_info (file,
-                                  G_FILE_ATTRIBUTE_TRASH_DELETION_DATE ","
-                                  G_FILE_ATTRIBUTE_UNIX_UID ","
-                                  G_FILE_ATTRIBUTE_TIME_CHANGED,
-                                  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                  cancellable,
-                                  NULL);
-
-        date = g_file_info_get_deletion_date (info);
-        if (date == NULL) {
-                guint uid;
-                guint64 ctime;
-
-                uid = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_UID);
-                if (uid != getuid ()) {
-                        should_purge = FALSE;
-                        goto out;
-                }
-
-                ctime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CHANGED);
-                date = g_date_time_new_from_unix_local ((gint64) ctime);
-        }
-
-        should_purge = g_date_time_difference (old, date) >= 0;
-        g_date_time_unref (date);
-
-out:
-        g_object_unref (info);
-
-        return should_purge;
-}
-
-typedef struct {
-        gint ref_count;
-        GFile           *file;
-        GCancellable    *cancellable;
-        GDateTime       *old;
-        gboolean         dry_run;
-        gboolean         trash;
-        gchar           *name;
-        gint             depth;
-} DeleteData;
-
-static DeleteData *
-delete_data_new (GFile        *file,
-                 GCancellable *cancellable,
-                 GDateTime    *old,
-                 gboolean      dry_run,
-                 gboolean      trash,
-                 gint          depth)
-{
-        DeleteData *data;
-
-        data = g_new (DeleteData, 1);
-        data->ref_count = 1;
-        data->file = g_object_ref (file);
-        data->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
-        data->old = g_date_time_ref (old);
-        data->dry_run = dry_run;
-        data->trash = trash;
-        data->depth = depth;
-        data->name = g_file_get_parse_name (data->file);
-
-        return data;
-}
-
-static DeleteData *
-delete_data_ref (DeleteData *data)
-{
-  data->ref_count += 1;
-  return data;
-}
-
-static void
-delete_data_unref (DeleteData *data)
-{
-        data->ref_count -= 1;
-        if (data->ref_count > 0)
-                return;
-
-        g_object_unref (data->file);
-        if (data->cancellable)
-                g_object_unref (data->cancellable);
-        g_date_time_unref (data->old);
-        g_free (data->name);
-        g_free (data);
-}
-
-static void delete_recursively_by_age (DeleteData *data);
-
-static void
-delete_batch (GObject      *source,
-              GAsyncResult *res,
-              gpointer      user_data)
-{
-        GFileEnumerator *enumerator = G_FILE_ENUMERATOR (source);
-        DeleteData *data = user_data;
-        GList *files, *f;
-        GFile *child_file;
-        DeleteData *child;
-        GFileInfo *info;
-        GError *error = NULL;
-
-        files = g_file_enumerator_next_files_finish (enumerator, res, &error);
-
-        g_debug ("GsdHousekeeping: purging %d children of %s", g_list_length (files), data->name);
-
-        if (files) {
-                for (f = files; f; f = f->next) {
-                        if (g_cancellable_is_cancelled (data->cancellable))
-                                break;
-                        info = f->data;
-
-                        child_file = g_file_get_child (data->file, g_file_info_get_name (info));
-                        child = delete_data_new (child_file,
-                                                 data->cancellable,
-                                                 data->old,
-                                                 data->dry_run,
-                                                 data->trash,
-                                                 data->depth + 1);
-                        delete_recursively_by_age (child);
-                        delete_data_unref (child);
-                        g_object_unref (child_file);
-                }
-                g_list_free_full (files, g_object_unref);
-                if (!g_cancellable_is_cancelled (data->cancellable)) {
-                        g_file_enumerator_next_files_async (enumerator, 20,
-                                                            0,
-                                                            data->cancellable,
-                                                            delete_batch,
-                                                            data);
-                        return;
-                }
-        }
-
-        g_file_enumerator_close (enumerator, data->cancellable, NULL);
-        g_object_unref (enumerator);
-
-        if (data->depth > 0 && !g_cancellable_is_cancelled (data->cancellable)) {
-                if ((data->trash && data->depth > 1) ||
-                     should_purge_file (data->file, data->cancellable, data->old)) {
-                        g_debug ("GsdHousekeeping: purging %s\n", data->name);
-                        if (!data->dry_run) {
-                                g_file_delete (data->file, data->cancellable, NULL);
-                        }
-                }
-        }
-        delete_data_unref (data);
-}
-
-static void
-delete_subdir (GObject      *source,
-               GAsyncResult *res,
-               gpointer      user_data)
-{
-        GFile *file = G_FILE (source);
-        DeleteData *data = user_data;
-        GFileEnumerator *enumerator;
-        GError *error = NULL;
-
-        g_debug ("GsdHousekeeping: purging %s in %s\n",
-                 data->trash ? "trash" : "temporary files", data->name);
-
-        enumerator = g_file_enumerate_children_finish (file, res, &error);
-        if (error) {
-                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY))
-                        g_warning ("Failed to enumerate children of %s: %s\n", data->name, error->message);
-                g_error_free (error);
-        }
-        if (enumerator) {
-                g_file_enumerator_next_files_async (enumerator, 20,
-                                                    0,
-                                                    data->cancellable,
-                                                    delete_batch,
-                                                    delete_data_ref (data));
-        }
-        delete_data_unref (data);
-}
-
-static void
-delete_recursively_by_age (DeleteData *data)
-{
-        if (data->trash && (data->depth == 1) &&
-            !should_purge_file (data->file, data->cancellable, data->old)) {
-                /* no need to recurse into trashed directories */
-                return;
-        }
-
-        g_file_enumerate_children_async (data->file,
-                                         G_FILE_ATTRIBUTE_STANDARD_NAME ","
-                                         G_FILE_ATTRIBUTE_STANDARD_TYPE,
-                                         G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                         0,
-                                         data->cancellable,
-                                         delete_subdir,
-                                         delete_data_ref (data));
-}
-
 void
 gsd_ldsm_purge_trash (GDateTime *old)
 {
-        GFile *file;
-        DeleteData *data;
-
-        file = g_file_new_for_uri ("trash:");
-        data = delete_data_new (file, NULL, old, FALSE, TRUE, 0);
-        delete_recursively_by_age (data);
-        delete_data_unref (data);
-        g_object_unref (file);
+        gsd_purge_run (GSD_PURGE_TRASH, old, FALSE);
 }
 
 void
 gsd_ldsm_purge_temp_files (GDateTime *old)
 {
-        DeleteData *data;
-        GFile *file;
-
-        file = g_file_new_for_path (g_get_tmp_dir ());
-        data = delete_data_new (file, NULL, old, FALSE, FALSE, 0);
-        delete_recursively_by_age (data);
-        delete_data_unref (data);
-        g_object_unref (file);
-
-        if (g_strcmp0 (g_get_tmp_dir (), "/var/tmp") != 0) {
-                file = g_file_new_for_path ("/var/tmp");
-                data = delete_data_new (file, NULL, old, FALSE, FALSE, 0);
-                delete_recursively_by_age (data);
-                delete_data_unref (data);
-                g_object_unref (file);
-        }
-
-        if (g_strcmp0 (g_get_tmp_dir (), "/tmp") != 0) {
-                file = g_file_new_for_path ("/tmp");
-                data = delete_data_new (file, NULL, old, FALSE, FALSE, 0);
-                delete_recursively_by_age (data);
-                delete_data_unref (data);
-                g_object_unref (file);
-        }
+        gsd_purge_run (GSD_PURGE_TEMP_FILES, old, FALSE);
 }
 
 void
 gsd_ldsm_show_empty_trash (void)
 {
-        GFile *file;
         GDateTime *old;
-        DeleteData *data;
 
         old = g_date_time_new_now_local ();
-        file = g_file_new_for_uri ("trash:");
-        data = delete_data_new (file, NULL, old, TRUE, TRUE, 0);
-        g_object_unref (file);
+        gsd_purge_run (GSD_PURGE_TRASH, old, TRUE);
         g_date_time_unref (old);
-
-        delete_recursively_by_age (data);
-        delete_data_unref (data);
 }
 
 static gboolean
@@ -917,6 +673,17 @@ ldsm_is_hash_item_not_in_mounts (gpointer key,
         return TRUE;
 }
 
+static guint
+ldsm_add_check_job (void)
+{
+        /* Nobody is around to see a notification while the session is idle */
+        return gnome_settings_scheduler_add_job ("housekeeping: check mounts",
+                                                 CHECK_EVERY_X_SECONDS,
+                                                 CHECK_EVERY_X_SECONDS / 2,
+                                                 GNOME_SETTINGS_JOB_DEFER_WHEN_IDLE,
+                                                 ldsm_check_all_mounts, NULL, NULL);
+}
+
 static void
 ldsm_mounts_changed (GObject  *monitor,
                      gpointer  data)
@@ -933,10 +700,8 @@ ldsm_mounts_changed (GObject  *monitor,
         ldsm_check_all_mounts (NULL);
 
         /* and reset the timeout */
-        if (ldsm_timeout_id)
-                g_source_remove (ldsm_timeout_id);
-        ldsm_timeout_id = g_timeout_add_seconds (CHECK_EVERY_X_SECONDS,
-                                                 ldsm_check_all_mounts, NULL);
+        gnome_settings_scheduler_remove_job (ldsm_timeout_id);
+        ldsm_timeout_id = ldsm_add_check_job ();
 }
 
 static gboolean
@@ -1016,25 +781,27 @@ gsd_ldsm_setup (gboolean check_now)
         if (check_now)
                 ldsm_check_all_mounts (NULL);
 
-        ldsm_timeout_id = g_timeout_add_seconds (CHECK_EVERY_X_SECONDS,
-                                                 ldsm_check_all_mounts, NULL);
+        ldsm_timeout_id = ldsm_add_check_job ();
 
-        purge_trash_id = g_timeout_add_seconds (3600, ldsm_purge_trash_and_temp, NULL);
+        purge_trash_id = gnome_settings_scheduler_add_job ("housekeeping: purge trash and temp",
+                                                           3600, 900,
+                                                           GNOME_SETTINGS_JOB_DEFER_ON_BATTERY,
+                                                           ldsm_purge_trash_and_temp, NULL, NULL);
 }
 
 void
 gsd_ldsm_clean (void)
 {
-        if (purge_trash_id)
-                g_source_remove (purge_trash_id);
+        gsd_purge_cancel ();
+
+        gnome_settings_scheduler_remove_job (purge_trash_id);
         purge_trash_id = 0;
 
         if (purge_temp_id)
                 g_source_remove (purge_temp_id);
         purge_temp_id = 0;
 
-        if (ldsm_timeout_id)
-                g_source_remove (ldsm_timeout_id);
+        gnome_settings_scheduler_remove_job (ldsm_timeout_id);
         ldsm_timeout_id = 0;
 
         if (ldsm_notified_hash)
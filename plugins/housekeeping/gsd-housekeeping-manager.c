@@ -26,6 +26,7 @@
 #include "gnome-settings-profile.h"
 #include "gsd-housekeeping-manager.h"
 #include "gsd-disk-space.h"
+#include "gsd-disk-space-purge.h"
 
 
 /* General */
@@ -39,12 +40,21 @@
 #define THUMB_SIZE_KEY "maximum-size"
 
 #define GSD_HOUSEKEEPING_DBUS_PATH "/org/gnome/SettingsDaemon/Housekeeping"
+#define GSD_HOUSEKEEPING_DBUS_INTERFACE "org.gnome.SettingsDaemon.Housekeeping"
 
 static const gchar introspection_xml[] =
 "<node>"
 "  <interface name='org.gnome.SettingsDaemon.Housekeeping'>"
 "    <method name='EmptyTrash'/>"
 "    <method name='RemoveTempFiles'/>"
+"    <signal name='PurgeProgress'>"
+"      <arg name='kind' type='s'/>"
+"      <arg name='examined' type='t'/>"
+"      <arg name='removed' type='t'/>"
+"      <arg name='freed' type='t'/>"
+"      <arg name='finished' type='b'/>"
+"      <arg name='complete' type='b'/>"
+"    </signal>"
 "  </interface>"
 "</node>";
 
@@ -312,6 +322,30 @@ handle_method_call (GDBusConnection       *connection,
         g_date_time_unref (now);
 }
 
+static void
+purge_progress_cb (const GsdPurgeProgress *progress,
+                   gpointer                user_data)
+{
+        GsdHousekeepingManager *manager = user_data;
+
+        if (manager->priv->connection == NULL)
+                return;
+
+        g_dbus_connection_emit_signal (manager->priv->connection,
+                                       NULL,
+                                       GSD_HOUSEKEEPING_DBUS_PATH,
+                                       GSD_HOUSEKEEPING_DBUS_INTERFACE,
+                                       "PurgeProgress",
+                                       g_variant_new ("(stttbb)",
+                                                      gsd_purge_kind_to_string (progress->kind),
+                                                      progress->examined,
+                                                      progress->removed,
+                                                      progress->freed,
+                                                      progress->finished,
+                                                      progress->complete),
+                                       NULL);
+}
+
 static const GDBusInterfaceVTable interface_vtable =
 {
         handle_method_call,
@@ -387,6 +421,7 @@ gsd_housekeeping_manager_start (GsdHousekeepingManager *manager,
         g_free (dir);
 
         gsd_ldsm_setup (FALSE);
+        gsd_purge_set_progress_func (purge_progress_cb, manager);
 
         manager->priv->settings = g_settings_new (THUMB_PREFIX);
         g_signal_connect (G_OBJECT (manager->priv->settings), "changed",
@@ -448,6 +483,7 @@ gsd_housekeeping_manager_stop (GsdHousekeepingManager *manager)
                 p->settings = NULL;
         }
 
+        gsd_purge_set_progress_func (NULL, NULL);
         gsd_ldsm_clean ();
 }
 
@@ -107,6 +107,7 @@ static const gchar introspection_xml[] =
 
 #define VOLUME_STEP 6           /* percents for one volume button press */
 #define MAX_VOLUME 65536.0
+#define VOLUME_SETTLE_TIMEOUT 250 /* ms to wait for PulseAudio to confirm a change */
 
 #define SYSTEMD_DBUS_NAME                       "org.freedesktop.login1"
 #define SYSTEMD_DBUS_PATH                       "/org/freedesktop/login1"
@@ -121,6 +122,19 @@ typedef struct {
         guint   watch_id;
 } MediaPlayer;
 
+/* The volume and mute state we expect a stream to have once PulseAudio
+ * has caught up with the key presses */
+typedef struct {
+        GvcMixerStream *stream;
+        gboolean        predicting;
+        guint           volume;
+        gboolean        muted;
+        gboolean        dirty;          /* volume not pushed yet */
+        gboolean        in_flight;      /* push not confirmed yet */
+        guint           in_flight_volume;
+        guint           settle_id;
+} VolumeState;
+
 typedef struct {
         MediaKeyType key_type;
         ShellKeyBindingMode modes;
@@ -129,11 +143,17 @@ typedef struct {
         char *custom_path;
         char *custom_command;
         guint accel_id;
+        gboolean registered;
+        guint index;            /* in the keys array, when registered */
+        gboolean grab_queued;
+        guint grab_serial;      /* of the latest grab sent for the key */
+        guint ref_count;
 } MediaKey;
 
 typedef struct {
         GsdMediaKeysManager *manager;
-        MediaKey *key;
+        GPtrArray *keys;
+        guint *serials;
 } GrabData;
 
 struct GsdMediaKeysManagerPrivate
@@ -142,6 +162,7 @@ struct GsdMediaKeysManagerPrivate
         GvcMixerControl *volume;
         GvcMixerStream  *sink;
         GvcMixerStream  *source;
+        GHashTable      *volume_states; /* key = stream id, value = VolumeState */
         ca_context      *ca;
         GtkSettings     *gtksettings;
 #ifdef HAVE_GUDEV
@@ -153,6 +174,10 @@ struct GsdMediaKeysManagerPrivate
         GHashTable      *custom_settings;
 
         GPtrArray       *keys;
+        GHashTable      *keys_by_path;          /* custom path -> MediaKey */
+        GHashTable      *keys_by_settings_key;  /* settings key -> MediaKey */
+        GPtrArray       *pending_grabs;
+        guint            grab_keys_id;
 
         /* HighContrast theme settings */
         GSettings       *interface_settings;
@@ -204,16 +229,44 @@ G_DEFINE_TYPE (GsdMediaKeysManager, gsd_media_keys_manager, G_TYPE_OBJECT)
 static gpointer manager_object = NULL;
 
 
+static MediaKey *
+media_key_new (void)
+{
+        MediaKey *key;
+
+        key = g_new0 (MediaKey, 1);
+        key->ref_count = 1;
+
+        return key;
+}
+
+static MediaKey *
+media_key_ref (MediaKey *key)
+{
+        key->ref_count++;
+        return key;
+}
+
 static void
-media_key_free (MediaKey *key)
+media_key_unref (MediaKey *key)
 {
         if (key == NULL)
                 return;
+        if (--key->ref_count > 0)
+                return;
         g_free (key->custom_path);
         g_free (key->custom_command);
         g_free (key);
 }
 
+/* Destroy notify of the keys array */
+static void
+media_key_unregister (MediaKey *key)
+{
+        key->registered = FALSE;
+        media_key_unref (key);
+}
+
 static char *
 get_term_command (GsdMediaKeysManager *manager)
 {
@@ -452,100 +505,134 @@ retry_grabs (gpointer data)
         return FALSE;
 }
 
+static void
+grab_data_free (GrabData *data)
+{
+        g_ptr_array_unref (data->keys);
+        g_free (data->serials);
+        g_slice_free (GrabData, data);
+}
+
 static void
 grab_accelerators_complete (GObject      *object,
                             GAsyncResult *result,
                             gpointer      user_data)
 {
+        GrabData *data = user_data;
+        GsdMediaKeysManager *manager = data->manager;
         GVariant *actions;
         gboolean retry = FALSE;
         GError *error = NULL;
-        GsdMediaKeysManager *manager = user_data;
+        guint i;
 
         shell_key_grabber_call_grab_accelerators_finish (SHELL_KEY_GRABBER (object),
                                                          &actions, result, &error);
 
         if (error) {
                 retry = (error->code == G_DBUS_ERROR_UNKNOWN_METHOD);
-                if (!retry)
+                if (!retry && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
                         g_warning ("%d: %s", error->code, error->message);
                 g_error_free (error);
-        } else {
-                int i;
-                for (i = 0; i < manager->priv->keys->len; i++) {
-                        MediaKey *key;
+                goto out;
+        }
 
-                        key = g_ptr_array_index (manager->priv->keys, i);
-                        g_variant_get_child (actions, i, "u", &key->accel_id);
+        for (i = 0; i < data->keys->len; i++) {
+                MediaKey *key;
+                guint accel_id;
+
+                key = g_ptr_array_index (data->keys, i);
+                g_variant_get_child (actions, i, "u", &accel_id);
+
+                /* Removed or grabbed again while we were waiting */
+                if (!key->registered || data->serials[i] != key->grab_serial) {
+                        if (accel_id != 0 && manager->priv->key_grabber != NULL)
+                                shell_key_grabber_call_ungrab_accelerator (manager->priv->key_grabber,
+                                                                           accel_id,
+                                                                           manager->priv->grab_cancellable,
+                                                                           NULL, NULL);
+                        continue;
                 }
+                key->accel_id = accel_id;
         }
+        g_variant_unref (actions);
 
+out:
         if (retry)
                 g_timeout_add_seconds (SHELL_GRABBER_RETRY_INTERVAL,
                                        retry_grabs, manager);
+        grab_data_free (data);
 }
 
-static void
-grab_media_keys (GsdMediaKeysManager *manager)
+static gboolean
+grab_pending_keys (GsdMediaKeysManager *manager)
 {
         GVariantBuilder builder;
-        int i;
+        GrabData *data;
+        guint i;
+
+        manager->priv->grab_keys_id = 0;
+
+        if (manager->priv->pending_grabs->len == 0)
+                return FALSE;
+
+        data = g_slice_new0 (GrabData);
+        data->manager = manager;
+        data->keys = manager->priv->pending_grabs;
+        manager->priv->pending_grabs = g_ptr_array_new_with_free_func ((GDestroyNotify) media_key_unref);
+        data->serials = g_new (guint, data->keys->len);
 
         g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(su)"));
 
-        for (i = 0; i < manager->priv->keys->len; i++) {
+        for (i = 0; i < data->keys->len; i++) {
                 MediaKey *key;
                 char *tmp;
 
-                key = g_ptr_array_index (manager->priv->keys, i);
+                key = g_ptr_array_index (data->keys, i);
+                key->grab_queued = FALSE;
+                data->serials[i] = ++key->grab_serial;
                 tmp = get_key_string (manager, key);
                 g_variant_builder_add (&builder, "(su)", tmp, key->modes);
                 g_free (tmp);
         }
 
+        g_debug ("Grabbing %u accelerators", data->keys->len);
+
 	shell_key_grabber_call_grab_accelerators (manager->priv->key_grabber,
 	                                          g_variant_builder_end (&builder),
 	                                          manager->priv->grab_cancellable,
 	                                          grab_accelerators_complete,
-	                                          manager);
-}
-
-static void
-grab_accelerator_complete (GObject      *object,
-                           GAsyncResult *result,
-                           gpointer      user_data)
-{
-        GrabData *data = user_data;
-        MediaKey *key = data->key;
+	                                          data);
 
-        shell_key_grabber_call_grab_accelerator_finish (SHELL_KEY_GRABBER (object),
-                                                        &key->accel_id, result, NULL);
-
-        g_slice_free (GrabData, data);
+        return FALSE;
 }
 
+/* Grabs are queued and sent to the shell in one call from an idle, so
+ * that a batch of keybinding changes costs a single round-trip */
 static void
 grab_media_key (MediaKey            *key,
 		GsdMediaKeysManager *manager)
 {
-	GrabData *data;
-	char *tmp;
-
 	ungrab_media_key (key, manager);
 
-	tmp = get_key_string (manager, key);
+        if (manager->priv->key_grabber == NULL || key->grab_queued)
+                return;
+
+        key->grab_queued = TRUE;
+        g_ptr_array_add (manager->priv->pending_grabs, media_key_ref (key));
 
-	data = g_slice_new0 (GrabData);
-	data->manager = manager;
-	data->key = key;
+        if (manager->priv->grab_keys_id == 0) {
+                manager->priv->grab_keys_id = g_idle_add ((GSourceFunc) grab_pending_keys, manager);
+                g_source_set_name_by_id (manager->priv->grab_keys_id, "[gnome-settings-daemon] grab_pending_keys");
+        }
+}
 
-	shell_key_grabber_call_grab_accelerator (manager->priv->key_grabber,
-	                                         tmp, key->modes,
-	                                         manager->priv->grab_cancellable,
-	                                         grab_accelerator_complete,
-	                                         data);
+static void
+grab_media_keys (GsdMediaKeysManager *manager)
+{
+        guint i;
 
-	g_free (tmp);
+        for (i = 0; i < manager->priv->keys->len; i++)
+                grab_media_key (g_ptr_array_index (manager->priv->keys, i), manager);
 }
 
 static void
@@ -573,12 +660,67 @@ ungrab_media_key (MediaKey            *key,
 	key->accel_id = 0;
 }
 
+static void
+register_media_key (GsdMediaKeysManager *manager,
+                    MediaKey            *key)
+{
+        key->registered = TRUE;
+        key->index = manager->priv->keys->len;
+        g_ptr_array_add (manager->priv->keys, key);
+
+        if (key->custom_path != NULL)
+                g_hash_table_insert (manager->priv->keys_by_path, key->custom_path, key);
+        else if (key->settings_key != NULL)
+                g_hash_table_insert (manager->priv->keys_by_settings_key, (gpointer) key->settings_key, key);
+}
+
+static void
+unregister_media_key (GsdMediaKeysManager *manager,
+                      guint                index)
+{
+        MediaKey *key;
+
+        key = g_ptr_array_index (manager->priv->keys, index);
+        ungrab_media_key (key, manager);
+
+        if (key->custom_path != NULL)
+                g_hash_table_remove (manager->priv->keys_by_path, key->custom_path);
+        else if (key->settings_key != NULL)
+                g_hash_table_remove (manager->priv->keys_by_settings_key, key->settings_key);
+
+        g_ptr_array_remove_index_fast (manager->priv->keys, index);
+        if (index < manager->priv->keys->len) {
+                key = g_ptr_array_index (manager->priv->keys, index);
+                key->index = index;
+        }
+}
+
+static void
+clear_media_keys (GsdMediaKeysManager *manager)
+{
+        guint i;
+
+        if (manager->priv->grab_keys_id != 0) {
+                g_source_remove (manager->priv->grab_keys_id);
+                manager->priv->grab_keys_id = 0;
+        }
+        for (i = 0; i < manager->priv->pending_grabs->len; i++) {
+                MediaKey *key = g_ptr_array_index (manager->priv->pending_grabs, i);
+                key->grab_queued = FALSE;
+        }
+        g_ptr_array_set_size (manager->priv->pending_grabs, 0);
+
+        g_hash_table_remove_all (manager->priv->keys_by_path);
+        g_hash_table_remove_all (manager->priv->keys_by_settings_key);
+        g_ptr_array_set_size (manager->priv->keys, 0);
+}
+
 static void
 gsettings_changed_cb (GSettings           *settings,
                       const gchar         *settings_key,
                       GsdMediaKeysManager *manager)
 {
-        int      i;
+        MediaKey *key;
 
         /* Give up if we don't have proxy to the shell */
         if (!manager->priv->key_grabber)
@@ -589,19 +731,9 @@ gsettings_changed_cb (GSettings           *settings,
 		return;
 
         /* Find the key that was modified */
-        for (i = 0; i < manager->priv->keys->len; i++) {
-                MediaKey *key;
-
-                key = g_ptr_array_index (manager->priv->keys, i);
-
-                /* Skip over hard-coded and GConf keys */
-                if (key->settings_key == NULL)
-                        continue;
-                if (strcmp (settings_key, key->settings_key) == 0) {
-                        grab_media_key (key, manager);
-                        break;
-                }
-        }
+        key = g_hash_table_lookup (manager->priv->keys_by_settings_key, settings_key);
+        if (key != NULL)
+                grab_media_key (key, manager);
 }
 
 static MediaKey *
@@ -635,7 +767,7 @@ media_key_new_for_path (GsdMediaKeysManager *manager,
         }
         g_free (binding);
 
-        key = g_new0 (MediaKey, 1);
+        key = media_key_new ();
         key->key_type = CUSTOM_KEY;
         key->modes = GSD_KEYBINDING_MODE_LAUNCHER;
         key->custom_path = g_strdup (path);
@@ -649,27 +781,19 @@ update_custom_binding (GsdMediaKeysManager *manager,
                        char                *path)
 {
         MediaKey *key;
-        int i;
 
         /* Remove the existing key */
-        for (i = 0; i < manager->priv->keys->len; i++) {
-                key = g_ptr_array_index (manager->priv->keys, i);
-
-                if (key->custom_path == NULL)
-                        continue;
-                if (strcmp (key->custom_path, path) == 0) {
-                        g_debug ("Removing custom key binding %s", path);
-                        ungrab_media_key (key, manager);
-                        g_ptr_array_remove_index_fast (manager->priv->keys, i);
-                        break;
-                }
+        key = g_hash_table_lookup (manager->priv->keys_by_path, path);
+        if (key != NULL) {
+                g_debug ("Removing custom key binding %s", path);
+                unregister_media_key (manager, key->index);
         }
 
         /* And create a new one! */
         key = media_key_new_for_path (manager, path);
         if (key) {
                 g_debug ("Adding new custom key binding %s", path);
-                g_ptr_array_add (manager->priv->keys, key);
+                register_media_key (manager, key);
 
                 grab_media_key (key, manager);
         }
@@ -696,38 +820,45 @@ gsettings_custom_changed_cb (GSettings           *settings,
                              GsdMediaKeysManager *manager)
 {
         char **bindings;
-        int i, j, n_bindings;
+        GHashTable *wanted;
+        GHashTableIter iter;
+        const char *path;
+        guint i;
 
         bindings = g_settings_get_strv (settings, settings_key);
-        n_bindings = g_strv_length (bindings);
-
-        /* Handle additions */
-        for (i = 0; i < n_bindings; i++) {
-                if (g_hash_table_lookup (manager->priv->custom_settings,
-                                         bindings[i]))
-                        continue;
-                update_custom_binding (manager, bindings[i]);
-        }
+        wanted = g_hash_table_new (g_str_hash, g_str_equal);
+        for (i = 0; bindings[i] != NULL; i++)
+                g_hash_table_add (wanted, bindings[i]);
 
         /* Handle removals */
         for (i = 0; i < manager->priv->keys->len; i++) {
-                gboolean found = FALSE;
                 MediaKey *key = g_ptr_array_index (manager->priv->keys, i);
                 if (key->key_type != CUSTOM_KEY)
                         continue;
-
-                for (j = 0; j < n_bindings && !found; j++)
-                        found = strcmp (bindings[j], key->custom_path) == 0;
-
-                if (found)
+                if (g_hash_table_contains (wanted, key->custom_path))
                         continue;
 
-                ungrab_media_key (key, manager);
-                g_hash_table_remove (manager->priv->custom_settings,
-                                     key->custom_path);
-                g_ptr_array_remove_index_fast (manager->priv->keys, i);
+                g_debug ("Removing custom key binding %s", key->custom_path);
+                unregister_media_key (manager, i);
                 --i; /* make up for the removed key */
         }
+
+        /* Including the settings of incomplete bindings */
+        g_hash_table_iter_init (&iter, manager->priv->custom_settings);
+        while (g_hash_table_iter_next (&iter, (gpointer *) &path, NULL)) {
+                if (!g_hash_table_contains (wanted, path))
+                        g_hash_table_iter_remove (&iter);
+        }
+
+        /* Handle additions */
+        for (i = 0; bindings[i] != NULL; i++) {
+                if (g_hash_table_lookup (manager->priv->custom_settings,
+                                         bindings[i]))
+                        continue;
+                update_custom_binding (manager, bindings[i]);
+        }
+
+        g_hash_table_destroy (wanted);
         g_strfreev (bindings);
 }
 
@@ -736,13 +867,13 @@ add_key (GsdMediaKeysManager *manager, guint i)
 {
 	MediaKey *key;
 
-	key = g_new0 (MediaKey, 1);
+	key = media_key_new ();
 	key->key_type = media_keys[i].key_type;
 	key->settings_key = media_keys[i].settings_key;
 	key->hard_coded = media_keys[i].hard_coded;
 	key->modes = media_keys[i].modes;
 
-	g_ptr_array_add (manager->priv->keys, key);
+	register_media_key (manager, key);
 }
 
 static void
@@ -768,7 +899,7 @@ init_kbd (GsdMediaKeysManager *manager)
         custom_paths = g_settings_get_strv (manager->priv->settings,
                                             "custom-keybindings");
 
-        for (i = 0; i < g_strv_length (custom_paths); i++) {
+        for (i = 0; custom_paths[i] != NULL; i++) {
                 MediaKey *key;
 
                 g_debug ("Setting up custom keybinding %s", custom_paths[i]);
@@ -777,7 +908,7 @@ init_kbd (GsdMediaKeysManager *manager)
                 if (!key) {
                         continue;
                 }
-                g_ptr_array_add (manager->priv->keys, key);
+                register_media_key (manager, key);
         }
         g_strfreev (custom_paths);
 
@@ -1179,6 +1310,120 @@ get_stream_for_device_id (GsdMediaKeysManager *manager,
 }
 #endif /* HAVE_GUDEV */
 
+static void
+volume_state_free (VolumeState *state)
+{
+        if (state->settle_id != 0)
+                g_source_remove (state->settle_id);
+        g_object_unref (state->stream);
+        g_free (state);
+}
+
+static void volume_state_push (VolumeState *state);
+
+static gboolean
+volume_state_settle_cb (VolumeState *state)
+{
+        state->settle_id = 0;
+
+        /* No confirmation; give up on it rather than stalling */
+        state->in_flight = FALSE;
+        if (state->dirty) {
+                volume_state_push (state);
+        } else {
+                /* Go back to trusting what the server reports */
+                state->predicting = FALSE;
+        }
+
+        return FALSE;
+}
+
+static void
+volume_state_push (VolumeState *state)
+{
+        gboolean ret;
+
+        /* At most one push in flight; later steps are sent together
+         * once it has been confirmed */
+        if (!state->dirty || state->in_flight)
+                return;
+
+        state->dirty = FALSE;
+
+        /* the push sends the stream's local volume */
+        ret = gvc_mixer_stream_set_volume (state->stream, state->volume);
+        if (ret)
+                gvc_mixer_stream_push_volume (state->stream);
+
+        if (!ret)
+                return;
+
+        state->in_flight = TRUE;
+        state->in_flight_volume = state->volume;
+
+        if (state->settle_id != 0)
+                g_source_remove (state->settle_id);
+        state->settle_id = g_timeout_add (VOLUME_SETTLE_TIMEOUT,
+                                          (GSourceFunc) volume_state_settle_cb,
+                                          state);
+        g_source_set_name_by_id (state->settle_id, "[gnome-settings-daemon] volume_state_settle_cb");
+}
+
+/* The local volume was already set by the push, so a notification
+ * for it would only tell us about updates that change it; this is
+ * called for every update the server sends, and the volume then is
+ * the one the server reported */
+static void
+on_control_stream_changed (GvcMixerControl     *control,
+                           guint                id,
+                           GsdMediaKeysManager *manager)
+{
+        VolumeState *state;
+
+        if (manager->priv->volume_states == NULL)
+                return;
+
+        state = g_hash_table_lookup (manager->priv->volume_states, GUINT_TO_POINTER (id));
+        if (state == NULL)
+                return;
+
+        /* Updates older than the push in flight are not interesting */
+        if (!state->in_flight ||
+            gvc_mixer_stream_get_volume (state->stream) != state->in_flight_volume)
+                return;
+
+        state->in_flight = FALSE;
+        if (state->dirty) {
+                volume_state_push (state);
+                return;
+        }
+
+        state->predicting = FALSE;
+        if (state->settle_id != 0) {
+                g_source_remove (state->settle_id);
+                state->settle_id = 0;
+        }
+}
+
+static VolumeState *
+volume_state_get (GsdMediaKeysManager *manager,
+                  GvcMixerStream      *stream)
+{
+        VolumeState *state;
+        guint id;
+
+        id = gvc_mixer_stream_get_id (stream);
+        state = g_hash_table_lookup (manager->priv->volume_states, GUINT_TO_POINTER (id));
+        if (state != NULL && state->stream == stream)
+                return state;
+
+        state = g_new0 (VolumeState, 1);
+        state->stream = g_object_ref (stream);
+        g_hash_table_replace (manager->priv->volume_states, GUINT_TO_POINTER (id), state);
+
+        return state;
+}
+
 static void
 do_sound_action (GsdMediaKeysManager *manager,
 		 guint                deviceid,
@@ -1187,6 +1432,7 @@ do_sound_action (GsdMediaKeysManager *manager,
                  gboolean             quiet)
 {
 	GvcMixerStream *stream;
+        VolumeState *state;
         gboolean old_muted, new_muted;
         guint old_vol, new_vol, norm_vol_step;
         gboolean sound_changed;
@@ -1209,9 +1455,18 @@ do_sound_action (GsdMediaKeysManager *manager,
 
         norm_vol_step = PA_VOLUME_NORM * VOLUME_STEP / 100;
 
-        /* FIXME: this is racy */
-        new_vol = old_vol = gvc_mixer_stream_get_volume (stream);
-        new_muted = old_muted = gvc_mixer_stream_get_is_muted (stream);
+        /* Steps apply to what we expect the stream to be once the
+         * previous ones are through, not to what PulseAudio last
+         * reported, which might not include them yet */
+        state = volume_state_get (manager, stream);
+        if (!state->predicting) {
+                state->volume = gvc_mixer_stream_get_volume (stream);
+                state->muted = gvc_mixer_stream_get_is_muted (stream);
+                state->predicting = TRUE;
+        }
+
+        new_vol = old_vol = state->volume;
+        new_muted = old_muted = state->muted;
         sound_changed = FALSE;
 
         switch (type) {
@@ -1236,14 +1491,24 @@ do_sound_action (GsdMediaKeysManager *manager,
 
         if (old_muted != new_muted) {
                 gvc_mixer_stream_change_is_muted (stream, new_muted);
+                state->muted = new_muted;
                 sound_changed = TRUE;
         }
 
         if (old_vol != new_vol) {
-                if (gvc_mixer_stream_set_volume (stream, new_vol) != FALSE) {
-                        gvc_mixer_stream_push_volume (stream);
-                        sound_changed = TRUE;
-                }
+                state->volume = new_vol;
+                state->dirty = TRUE;
+                volume_state_push (state);
+                sound_changed = TRUE;
+        }
+
+        /* Make sure we eventually go back to the server's state,
+         * even if only the mute state changed */
+        if (state->settle_id == 0) {
+                state->settle_id = g_timeout_add (VOLUME_SETTLE_TIMEOUT,
+                                                  (GSourceFunc) volume_state_settle_cb,
+                                                  state);
+                g_source_set_name_by_id (state->settle_id, "[gnome-settings-daemon] volume_state_settle_cb");
         }
 
         update_dialog (manager, stream, new_vol, new_muted, sound_changed, quiet);
@@ -1340,6 +1605,8 @@ on_control_stream_removed (GvcMixerControl     *control,
                            guint                id,
                            GsdMediaKeysManager *manager)
 {
+        g_hash_table_remove (manager->priv->volume_states, GUINT_TO_POINTER (id));
+
         if (manager->priv->sink != NULL) {
 		if (gvc_mixer_stream_get_id (manager->priv->sink) == id)
 			g_clear_object (&manager->priv->sink);
@@ -2161,6 +2428,8 @@ initialize_volume_handler (GsdMediaKeysManager *manager)
         gnome_settings_profile_start ("gvc_mixer_control_new");
 
         manager->priv->volume = gvc_mixer_control_new ("GNOME Volume Control Media Keys");
+        manager->priv->volume_states = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                              NULL, (GDestroyNotify) volume_state_free);
 
         g_signal_connect (manager->priv->volume,
                           "state-changed",
@@ -2174,6 +2443,10 @@ initialize_volume_handler (GsdMediaKeysManager *manager)
                           "default-source-changed",
                           G_CALLBACK (on_control_default_source_changed),
                           manager);
+        g_signal_connect (manager->priv->volume,
+                          "stream-changed",
+                          G_CALLBACK (on_control_stream_changed),
+                          manager);
         g_signal_connect (manager->priv->volume,
                           "stream-removed",
                           G_CALLBACK (on_control_stream_removed),
@@ -2245,7 +2518,7 @@ on_shell_vanished (GDBusConnection  *connection,
 {
         GsdMediaKeysManager *manager = user_data;
 
-        g_ptr_array_set_size (manager->priv->keys, 0);
+        clear_media_keys (manager);
 
         g_clear_object (&manager->priv->key_grabber);
         g_clear_object (&manager->priv->shell_proxy);
@@ -2259,7 +2532,10 @@ start_media_keys_idle_cb (GsdMediaKeysManager *manager)
         g_debug ("Starting media_keys manager");
         gnome_settings_profile_start (NULL);
 
-        manager->priv->keys = g_ptr_array_new_with_free_func ((GDestroyNotify) media_key_free);
+        manager->priv->keys = g_ptr_array_new_with_free_func ((GDestroyNotify) media_key_unregister);
+        manager->priv->keys_by_path = g_hash_table_new (g_str_hash, g_str_equal);
+        manager->priv->keys_by_settings_key = g_hash_table_new (g_str_hash, g_str_equal);
+        manager->priv->pending_grabs = g_ptr_array_new_with_free_func ((GDestroyNotify) media_key_unref);
 
         initialize_volume_handler (manager);
 
@@ -2395,8 +2671,12 @@ gsd_media_keys_manager_stop (GsdMediaKeysManager *manager)
                         key = g_ptr_array_index (manager->priv->keys, i);
                         ungrab_media_key (key, manager);
                 }
+                clear_media_keys (manager);
                 g_ptr_array_free (priv->keys, TRUE);
                 priv->keys = NULL;
+                g_clear_pointer (&priv->keys_by_path, g_hash_table_destroy);
+                g_clear_pointer (&priv->keys_by_settings_key, g_hash_table_destroy);
+                g_clear_pointer (&priv->pending_grabs, g_ptr_array_unref);
         }
 
         if (priv->grab_cancellable != NULL) {
@@ -2409,6 +2689,7 @@ gsd_media_keys_manager_stop (GsdMediaKeysManager *manager)
                 g_clear_object (&priv->shell_cancellable);
         }
 
+        g_clear_pointer (&priv->volume_states, g_hash_table_destroy);
         g_clear_object (&priv->sink);
         g_clear_object (&priv->source);
         g_clear_object (&priv->volume);
@@ -56,6 +56,15 @@ struct GsdOrientationManagerPrivate
         char *sysfs_path;
         OrientationUp prev_orientation;
 
+        /* Rotation */
+        OrientationUp applied_orientation;
+        guint settle_id;
+        guint settle_time;
+        guint hysteresis;
+        gint64 rotation_start;
+        gint64 last_rotation;
+        gint64 max_latency;
+
         /* DBus */
         GDBusNodeInfo   *introspection_data;
         GDBusConnection *connection;
@@ -70,6 +79,8 @@ struct GsdOrientationManagerPrivate
 
 #define CONF_SCHEMA "org.gnome.settings-daemon.peripherals.touchscreen"
 #define ORIENTATION_LOCK_KEY "orientation-lock"
+#define SETTLE_TIME_KEY "orientation-settle-time"
+#define HYSTERESIS_KEY "orientation-hysteresis"
 
 #define GSD_ORIENTATION_DBUS_NAME GSD_DBUS_NAME ".Orientation"
 #define GSD_ORIENTATION_DBUS_PATH GSD_DBUS_PATH "/Orientation"
@@ -126,6 +137,7 @@ gsd_orientation_manager_init (GsdOrientationManager *manager)
 {
         manager->priv = GSD_ORIENTATION_MANAGER_GET_PRIVATE (manager);
         manager->priv->prev_orientation = ORIENTATION_UNDEFINED;
+        manager->priv->applied_orientation = ORIENTATION_UNDEFINED;
 }
 
 static GnomeRRRotation
@@ -196,25 +208,49 @@ get_orientation_from_device (GUdevDevice *dev)
         return orientation_from_string (value);
 }
 
+static void schedule_rotation (GsdOrientationManager *manager);
+
 static void
 on_xrandr_action_call_finished (GObject               *source_object,
                                 GAsyncResult          *res,
                                 GsdOrientationManager *manager)
 {
+        GsdOrientationManagerPrivate *priv;
         GError *error = NULL;
         GVariant *variant;
+        gint64 latency;
 
         variant = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
 
-        g_object_unref (manager->priv->cancellable);
-        manager->priv->cancellable = NULL;
+        /* the manager was stopped, and might be gone */
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                g_error_free (error);
+                return;
+        }
+
+        priv = manager->priv;
+        g_object_unref (priv->cancellable);
+        priv->cancellable = NULL;
+
+        priv->last_rotation = g_get_monotonic_time ();
+        latency = (priv->last_rotation - priv->rotation_start) / 1000;
+        priv->max_latency = MAX (priv->max_latency, latency);
+        g_debug ("Rotation to '%s' took %" G_GINT64_FORMAT " ms (slowest %" G_GINT64_FORMAT " ms)",
+                 orientation_to_string (priv->applied_orientation),
+                 latency, priv->max_latency);
 
         if (error != NULL) {
                 g_warning ("Unable to call 'RotateTo': %s", error->message);
                 g_error_free (error);
-        } else {
-                g_variant_unref (variant);
+                /* We don't know what the screen looks like now */
+                priv->applied_orientation = ORIENTATION_UNDEFINED;
+                return;
         }
+
+        g_variant_unref (variant);
+
+        /* The device might have moved again while we were busy */
+        schedule_rotation (manager);
 }
 
 static void
@@ -227,11 +263,7 @@ do_xrandr_action (GsdOrientationManager *manager,
 
         if (priv->connection == NULL || priv->xrandr_proxy == NULL) {
                 g_warning ("No existing D-Bus connection trying to handle XRANDR keys");
-                return;
-        }
-
-        if (priv->cancellable != NULL) {
-                g_debug ("xrandr action already in flight");
+                priv->applied_orientation = ORIENTATION_UNDEFINED;
                 return;
         }
 
@@ -239,6 +271,7 @@ do_xrandr_action (GsdOrientationManager *manager,
         timestamp = tv.tv_sec * 1000 + tv.tv_usec / 1000;
 
         priv->cancellable = g_cancellable_new ();
+        priv->rotation_start = g_get_monotonic_time ();
 
         g_dbus_proxy_call (priv->xrandr_proxy,
                            "RotateTo",
@@ -253,22 +286,81 @@ do_xrandr_action (GsdOrientationManager *manager,
 static void
 do_rotation (GsdOrientationManager *manager)
 {
+        GsdOrientationManagerPrivate *priv = manager->priv;
         GnomeRRRotation rotation;
 
-        if (manager->priv->orientation_lock) {
+        if (priv->orientation_lock) {
                 g_debug ("Orientation changed, but we are locked");
                 return;
         }
-        if (manager->priv->prev_orientation == ORIENTATION_UNDEFINED) {
+        if (priv->prev_orientation == ORIENTATION_UNDEFINED) {
                 g_debug ("Not trying to rotate, orientation is undefined");
                 return;
         }
 
-        rotation = orientation_to_rotation (manager->priv->prev_orientation);
+        /* Only the latest orientation matters, and it will be picked
+         * up once the current rotation is done */
+        if (priv->cancellable != NULL) {
+                g_debug ("xrandr action already in flight, queueing '%s'",
+                         orientation_to_string (priv->prev_orientation));
+                return;
+        }
+
+        if (priv->prev_orientation == priv->applied_orientation)
+                return;
+
+        priv->applied_orientation = priv->prev_orientation;
+        rotation = orientation_to_rotation (priv->applied_orientation);
 
         do_xrandr_action (manager, rotation);
 }
 
+static gboolean
+settle_cb (GsdOrientationManager *manager)
+{
+        manager->priv->settle_id = 0;
+        do_rotation (manager);
+        return FALSE;
+}
+
+/* Rotates once the orientation has been stable for the settle time,
+ * and no sooner than the hysteresis after the previous rotation */
+static void
+schedule_rotation (GsdOrientationManager *manager)
+{
+        GsdOrientationManagerPrivate *priv = manager->priv;
+        gint64 delay, since_last;
+
+        if (priv->settle_id != 0) {
+                g_source_remove (priv->settle_id);
+                priv->settle_id = 0;
+        }
+
+        if (priv->orientation_lock ||
+            priv->prev_orientation == ORIENTATION_UNDEFINED)
+                return;
+
+        /* Back where we were before it settled, nothing to do */
+        if (priv->prev_orientation == priv->applied_orientation)
+                return;
+
+        /* on_xrandr_action_call_finished() will get back to us */
+        if (priv->cancellable != NULL)
+                return;
+
+        delay = priv->settle_time;
+        if (priv->last_rotation != 0) {
+                since_last = (g_get_monotonic_time () - priv->last_rotation) / 1000;
+                delay = MAX (delay, (gint64) priv->hysteresis - since_last);
+        }
+
+        g_debug ("Rotating to '%s' in %" G_GINT64_FORMAT " ms if it settles",
+                 orientation_to_string (priv->prev_orientation), delay);
+
+        priv->settle_id = g_timeout_add (delay, (GSourceFunc) settle_cb, manager);
+        g_source_set_name_by_id (priv->settle_id, "[gnome-settings-daemon] settle_cb");
+}
+
 static void
 client_uevent_cb (GUdevClient           *client,
                   gchar                 *action,
@@ -295,10 +387,10 @@ client_uevent_cb (GUdevClient           *client,
         orientation = get_orientation_from_device (device);
         if (orientation != manager->priv->prev_orientation) {
                 manager->priv->prev_orientation = orientation;
-                g_debug ("Orientation changed to '%s', switching screen rotation",
+                g_debug ("Orientation changed to '%s'",
                          orientation_to_string (manager->priv->prev_orientation));
 
-                do_rotation (manager);
+                schedule_rotation (manager);
         }
 }
 
@@ -317,11 +409,24 @@ orientation_lock_changed_cb (GSettings             *settings,
 
         if (new == FALSE) {
                 /* Handle the rotations that could have occurred while
-                 * we were locked */
+                 * we were locked, whatever we did last */
+                manager->priv->applied_orientation = ORIENTATION_UNDEFINED;
                 do_rotation (manager);
+        } else if (manager->priv->settle_id != 0) {
+                g_source_remove (manager->priv->settle_id);
+                manager->priv->settle_id = 0;
         }
 }
 
+static void
+timing_changed_cb (GSettings             *settings,
+                   gchar                 *key,
+                   GsdOrientationManager *manager)
+{
+        manager->priv->settle_time = MAX (0, g_settings_get_int (settings, SETTLE_TIME_KEY));
+        manager->priv->hysteresis = MAX (0, g_settings_get_int (settings, HYSTERESIS_KEY));
+}
+
 static void
 xrandr_ready_cb (GObject               *source_object,
                  GAsyncResult          *res,
@@ -430,6 +535,11 @@ gsd_orientation_manager_idle_cb (GsdOrientationManager *manager)
         manager->priv->orientation_lock = g_settings_get_boolean (manager->priv->settings, ORIENTATION_LOCK_KEY);
         g_signal_connect (G_OBJECT (manager->priv->settings), "changed::orientation-lock",
                           G_CALLBACK (orientation_lock_changed_cb), manager);
+        g_signal_connect (G_OBJECT (manager->priv->settings), "changed::" SETTLE_TIME_KEY,
+                          G_CALLBACK (timing_changed_cb), manager);
+        g_signal_connect (G_OBJECT (manager->priv->settings), "changed::" HYSTERESIS_KEY,
+                          G_CALLBACK (timing_changed_cb), manager);
+        timing_changed_cb (manager->priv->settings, NULL, manager);
 
         manager->priv->client = g_udev_client_new (subsystems);
         dev = get_accelerometer (manager->priv->client);
@@ -481,6 +591,18 @@ gsd_orientation_manager_stop (GsdOrientationManager *manager)
 
         g_debug ("Stopping orientation manager");
 
+        if (p->settle_id != 0) {
+                g_source_remove (p->settle_id);
+                p->settle_id = 0;
+        }
+
+        if (p->cancellable != NULL) {
+                g_cancellable_cancel (p->cancellable);
+                g_clear_object (&p->cancellable);
+                /* We don't know whether it was applied */
+                p->applied_orientation = ORIENTATION_UNDEFINED;
+        }
+
         if (p->settings) {
                 g_object_unref (p->settings);
                 p->settings = NULL;
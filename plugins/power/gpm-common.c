@@ -34,6 +34,7 @@
 #define GNOME_DESKTOP_USE_UNSTABLE_API
 #include <libgnome-desktop/gnome-rr.h>
 
+#include "gnome-settings-scheduler.h"
 #include "gpm-common.h"
 #include "gsd-power-constants.h"
 #include "gsd-power-manager.h"
@@ -1150,9 +1151,12 @@ disable_builtin_screensaver (gpointer unused)
 guint
 gsd_power_enable_screensaver_watchdog (void)
 {
-        return g_timeout_add_seconds (XSCREENSAVER_WATCHDOG_TIMEOUT,
-                                      disable_builtin_screensaver,
-                                      NULL);
+        return gnome_settings_scheduler_add_job ("power: screensaver watchdog",
+                                                 XSCREENSAVER_WATCHDOG_TIMEOUT,
+                                                 XSCREENSAVER_WATCHDOG_TIMEOUT / 2,
+                                                 GNOME_SETTINGS_JOB_ALWAYS,
+                                                 disable_builtin_screensaver,
+                                                 NULL, NULL);
 }
 
 static GnomeRROutput *
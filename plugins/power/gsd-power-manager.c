@@ -47,6 +47,7 @@
 #include "gpm-common.h"
 #include "gnome-settings-plugin.h"
 #include "gnome-settings-profile.h"
+#include "gnome-settings-scheduler.h"
 #include "gnome-settings-session.h"
 #include "gsd-enums.h"
 #include "gsd-power-manager.h"
@@ -218,8 +219,20 @@ struct GsdPowerManagerPrivate
         guint                    idle_blank_id;
         guint                    idle_sleep_warning_id;
         guint                    idle_sleep_id;
+        guint                    idle_dim_timeout;      /* of the installed watches, in s */
+        guint                    idle_blank_timeout;
+        guint                    idle_sleep_warning_timeout;
+        guint                    idle_sleep_timeout;
         GsdPowerIdleMode         current_idle_mode;
 
+        /* Cached idle settings, see idle_settings_refresh() */
+        GsdPowerActionType       sleep_inactive_ac_type;
+        GsdPowerActionType       sleep_inactive_battery_type;
+        guint                    sleep_inactive_ac_timeout;
+        guint                    sleep_inactive_battery_timeout;
+        gboolean                 idle_dim;
+        guint                    idle_delay;
+
         guint                    temporary_unidle_on_ac_id;
         GsdPowerIdleMode         previous_idle_mode;
 
@@ -2609,14 +2622,55 @@ clear_idle_watch (GnomeIdleMonitor *monitor,
         *id = 0;
 }
 
+/* Each watch added or removed is a round-trip to the idle monitor of
+ * the compositor, so only touch the watches whose timeout changed */
+static void
+idle_watch_update (GsdPowerManager *manager,
+                   const char      *kind,
+                   guint           *id,
+                   guint           *installed_timeout,
+                   guint            timeout)
+{
+        if (*id != 0 && *installed_timeout == timeout)
+                return;
+        if (*id == 0 && timeout == 0)
+                return;
+
+        clear_idle_watch (manager->priv->idle_monitor, id);
+        *installed_timeout = 0;
+
+        if (timeout == 0) {
+                g_debug ("removed %s callback", kind);
+                return;
+        }
+
+        g_debug ("setting up %s callback for %is", kind, timeout);
+        *id = gnome_idle_monitor_add_idle_watch (manager->priv->idle_monitor,
+                                                 timeout * 1000,
+                                                 idle_triggered_idle_cb, manager, NULL);
+        *installed_timeout = timeout;
+}
+
+static void
+idle_settings_refresh (GsdPowerManager *manager)
+{
+        manager->priv->sleep_inactive_ac_type = g_settings_get_enum (manager->priv->settings, "sleep-inactive-ac-type");
+        manager->priv->sleep_inactive_battery_type = g_settings_get_enum (manager->priv->settings, "sleep-inactive-battery-type");
+        manager->priv->sleep_inactive_ac_timeout = MAX (0, g_settings_get_int (manager->priv->settings, "sleep-inactive-ac-timeout"));
+        manager->priv->sleep_inactive_battery_timeout = MAX (0, g_settings_get_int (manager->priv->settings, "sleep-inactive-battery-timeout"));
+        manager->priv->idle_dim = g_settings_get_boolean (manager->priv->settings, "idle-dim");
+        manager->priv->idle_delay = g_settings_get_uint (manager->priv->settings_session, "idle-delay");
+}
+
 static void
 idle_configure (GsdPowerManager *manager)
 {
         gboolean is_idle_inhibited;
         GsdPowerActionType action_type;
-        guint timeout_blank;
-        guint timeout_sleep;
-        guint timeout_dim;
+        guint timeout_blank = 0;
+        guint timeout_sleep = 0;
+        guint timeout_sleep_warning = 0;
+        guint timeout_dim = 0;
         gboolean on_battery;
 
         if (!idle_is_session_inhibited (manager,
@@ -2630,23 +2684,12 @@ idle_configure (GsdPowerManager *manager)
         if (!is_session_active (manager) || is_idle_inhibited) {
                 g_debug ("inhibited or inactive, so using normal state");
                 idle_set_mode (manager, GSD_POWER_IDLE_MODE_NORMAL);
-
-                clear_idle_watch (manager->priv->idle_monitor,
-                                  &manager->priv->idle_blank_id);
-                clear_idle_watch (manager->priv->idle_monitor,
-                                  &manager->priv->idle_sleep_id);
-                clear_idle_watch (manager->priv->idle_monitor,
-                                  &manager->priv->idle_dim_id);
-                clear_idle_watch (manager->priv->idle_monitor,
-                                  &manager->priv->idle_sleep_warning_id);
-                notify_close_if_showing (&manager->priv->notification_sleep_warning);
-                return;
+                goto out;
         }
 
         /* set up blank callback only when the screensaver is on,
          * as it's what will drive the blank */
         on_battery = up_client_get_on_battery (manager->priv->up_client);
-        timeout_blank = 0;
         if (manager->priv->screensaver_active) {
                 /* The tail is wagging the dog.
                  * The screensaver coming on will blank the screen.
@@ -2655,62 +2698,26 @@ idle_configure (GsdPowerManager *manager)
                 timeout_blank = SCREENSAVER_TIMEOUT_BLANK;
         }
 
-        clear_idle_watch (manager->priv->idle_monitor,
-                          &manager->priv->idle_blank_id);
-
-        if (timeout_blank != 0) {
-                g_debug ("setting up blank callback for %is", timeout_blank);
-
-                manager->priv->idle_blank_id = gnome_idle_monitor_add_idle_watch (manager->priv->idle_monitor,
-                                                                                  timeout_blank * 1000,
-                                                                                  idle_triggered_idle_cb, manager, NULL);
-        }
-
         /* only do the sleep timeout when the session is idle
          * and we aren't inhibited from sleeping (or logging out, etc.) */
-        action_type = g_settings_get_enum (manager->priv->settings, on_battery ?
-                                           "sleep-inactive-battery-type" : "sleep-inactive-ac-type");
-        timeout_sleep = 0;
+        action_type = on_battery ? manager->priv->sleep_inactive_battery_type : manager->priv->sleep_inactive_ac_type;
         if (!is_action_inhibited (manager, action_type)) {
-                timeout_sleep = g_settings_get_int (manager->priv->settings, on_battery ?
-                                                    "sleep-inactive-battery-timeout" : "sleep-inactive-ac-timeout");
+                timeout_sleep = on_battery ? manager->priv->sleep_inactive_battery_timeout :
+                                             manager->priv->sleep_inactive_ac_timeout;
         }
 
-        clear_idle_watch (manager->priv->idle_monitor,
-                          &manager->priv->idle_sleep_id);
-        clear_idle_watch (manager->priv->idle_monitor,
-                          &manager->priv->idle_sleep_warning_id);
-
-        if (timeout_sleep != 0) {
-                g_debug ("setting up sleep callback %is", timeout_sleep);
-
-                manager->priv->idle_sleep_id = gnome_idle_monitor_add_idle_watch (manager->priv->idle_monitor,
-                                                                                  timeout_sleep * 1000,
-                                                                                  idle_triggered_idle_cb, manager, NULL);
-                if (action_type == GSD_POWER_ACTION_LOGOUT ||
-                    action_type == GSD_POWER_ACTION_SUSPEND ||
-                    action_type == GSD_POWER_ACTION_HIBERNATE) {
-                        guint timeout_sleep_warning;
-
-                        manager->priv->sleep_action_type = action_type;
-                        timeout_sleep_warning = timeout_sleep * IDLE_DELAY_TO_IDLE_DIM_MULTIPLIER;
-                        if (timeout_sleep_warning < MINIMUM_IDLE_DIM_DELAY)
-                                timeout_sleep_warning = 0;
-
-                        g_debug ("setting up sleep warning callback %is", timeout_sleep_warning);
-
-                        manager->priv->idle_sleep_warning_id = gnome_idle_monitor_add_idle_watch (manager->priv->idle_monitor,
-                                                                                                  timeout_sleep_warning * 1000,
-                                                                                                  idle_triggered_idle_cb, manager, NULL);
-                }
+        if (timeout_sleep != 0 &&
+            (action_type == GSD_POWER_ACTION_LOGOUT ||
+             action_type == GSD_POWER_ACTION_SUSPEND ||
+             action_type == GSD_POWER_ACTION_HIBERNATE)) {
+                manager->priv->sleep_action_type = action_type;
+                timeout_sleep_warning = timeout_sleep * IDLE_DELAY_TO_IDLE_DIM_MULTIPLIER;
+                if (timeout_sleep_warning < MINIMUM_IDLE_DIM_DELAY)
+                        timeout_sleep_warning = 0;
         }
 
-        if (manager->priv->idle_sleep_warning_id == 0)
-                notify_close_if_showing (&manager->priv->notification_sleep_warning);
-
         /* set up dim callback for when the screen lock is not active,
          * but only if we actually want to dim. */
-        timeout_dim = 0;
         if (manager->priv->screensaver_active) {
                 /* Don't dim when the screen lock is active */
         } else if (!on_battery) {
@@ -2718,33 +2725,36 @@ idle_configure (GsdPowerManager *manager)
         } else if (manager->priv->battery_is_low) {
                 /* Aggressively blank when battery is low */
                 timeout_dim = SCREENSAVER_TIMEOUT_BLANK;
-        } else {
-                if (g_settings_get_boolean (manager->priv->settings, "idle-dim")) {
-                        timeout_dim = g_settings_get_uint (manager->priv->settings_session,
-                                                           "idle-delay");
-                        if (timeout_dim == 0) {
-                                timeout_dim = IDLE_DIM_BLANK_DISABLED_MIN;
-                        } else {
-                                timeout_dim *= IDLE_DELAY_TO_IDLE_DIM_MULTIPLIER;
-                                /* Don't bother dimming if the idle-delay is
-                                 * too low, we'll do that when we bring down the
-                                 * screen lock */
-                                if (timeout_dim < MINIMUM_IDLE_DIM_DELAY)
-                                        timeout_dim = 0;
-                        }
+        } else if (manager->priv->idle_dim) {
+                timeout_dim = manager->priv->idle_delay;
+                if (timeout_dim == 0) {
+                        timeout_dim = IDLE_DIM_BLANK_DISABLED_MIN;
+                } else {
+                        timeout_dim *= IDLE_DELAY_TO_IDLE_DIM_MULTIPLIER;
+                        /* Don't bother dimming if the idle-delay is
+                         * too low, we'll do that when we bring down the
+                         * screen lock */
+                        if (timeout_dim < MINIMUM_IDLE_DIM_DELAY)
+                                timeout_dim = 0;
                 }
         }
 
-        clear_idle_watch (manager->priv->idle_monitor,
-                          &manager->priv->idle_dim_id);
-
-        if (timeout_dim != 0) {
-                g_debug ("setting up dim callback for %is", timeout_dim);
+out:
+        idle_watch_update (manager, "blank",
+                           &manager->priv->idle_blank_id, &manager->priv->idle_blank_timeout,
+                           timeout_blank);
+        idle_watch_update (manager, "sleep",
+                           &manager->priv->idle_sleep_id, &manager->priv->idle_sleep_timeout,
+                           timeout_sleep);
+        idle_watch_update (manager, "sleep warning",
+                           &manager->priv->idle_sleep_warning_id, &manager->priv->idle_sleep_warning_timeout,
+                           timeout_sleep_warning);
+        idle_watch_update (manager, "dim",
+                           &manager->priv->idle_dim_id, &manager->priv->idle_dim_timeout,
+                           timeout_dim);
 
-                manager->priv->idle_dim_id = gnome_idle_monitor_add_idle_watch (manager->priv->idle_monitor,
-                                                                                timeout_dim * 1000,
-                                                                                idle_triggered_idle_cb, manager, NULL);
-        }
+        if (manager->priv->idle_sleep_warning_id == 0)
+                notify_close_if_showing (&manager->priv->notification_sleep_warning);
 }
 
 static void
@@ -3127,6 +3137,7 @@ engine_settings_key_changed_cb (GSettings *settings,
         if (g_str_has_prefix (key, "sleep-inactive") ||
             g_str_equal (key, "idle-delay") ||
             g_str_equal (key, "idle-dim")) {
+                idle_settings_refresh (manager);
                 idle_configure (manager);
                 return;
         }
@@ -3515,6 +3526,7 @@ gsd_power_manager_start (GsdPowerManager *manager,
 
         /* create IDLETIME watcher */
         manager->priv->idle_monitor = gnome_idle_monitor_new ();
+        idle_settings_refresh (manager);
 
         /* set up the screens */
         g_signal_connect (manager->priv->rr_screen, "changed", G_CALLBACK (on_randr_event), manager);
@@ -3608,10 +3620,15 @@ gsd_power_manager_stop (GsdPowerManager *manager)
 
         play_loop_stop (&manager->priv->critical_alert_timeout_id);
 
+        /* the watches go away with the monitor */
         g_clear_object (&manager->priv->idle_monitor);
+        manager->priv->idle_dim_id = 0;
+        manager->priv->idle_blank_id = 0;
+        manager->priv->idle_sleep_warning_id = 0;
+        manager->priv->idle_sleep_id = 0;
 
         if (manager->priv->xscreensaver_watchdog_timer_id > 0) {
-                g_source_remove (manager->priv->xscreensaver_watchdog_timer_id);
+                gnome_settings_scheduler_remove_job (manager->priv->xscreensaver_watchdog_timer_id);
                 manager->priv->xscreensaver_watchdog_timer_id = 0;
         }
 }
@@ -0,0 +1,279 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib.h>
+#include <cups/cups.h>
+
+#include "gsd-cups-dest-cache.h"
+
+/*
+ * The whole list of destinations is only fetched the first time it is
+ * needed, and again after gsd_cups_dest_cache_invalidate(); in between,
+ * single destinations are updated as the callers learn about changes.
+ * Only the default instance of each destination is kept.
+ */
+struct _GsdCupsDestCache
+{
+        GHashTable *dests;
+        gboolean    loaded;
+};
+
+struct
+{
+        int            num_options;
+        cups_option_t *options;
+} typedef CachedDest;
+
+static CachedDest *
+cached_dest_new (cups_dest_t *dest)
+{
+        CachedDest *cached;
+        int         i;
+
+        cached = g_new0 (CachedDest, 1);
+        for (i = 0; i < dest->num_options; i++)
+                cached->num_options = cupsAddOption (dest->options[i].name,
+                                                     dest->options[i].value,
+                                                     cached->num_options,
+                                                     &cached->options);
+        return cached;
+}
+
+static void
+cached_dest_free (gpointer data)
+{
+        CachedDest *cached = (CachedDest *) data;
+
+        cupsFreeOptions (cached->num_options, cached->options);
+        g_free (cached);
+}
+
+static void
+gsd_cups_dest_cache_load (GsdCupsDestCache *cache)
+{
+        cups_dest_t *dests;
+        int          num_dests;
+        int          i;
+
+        if (cache->loaded)
+                return;
+
+        g_hash_table_remove_all (cache->dests);
+
+        num_dests = cupsGetDests (&dests);
+        for (i = 0; i < num_dests; i++) {
+                if (dests[i].instance != NULL)
+                        continue;
+                g_hash_table_replace (cache->dests,
+                                      g_strdup (dests[i].name),
+                                      cached_dest_new (&dests[i]));
+        }
+        cupsFreeDests (num_dests, dests);
+
+        g_debug ("Cached %u printer destinations", g_hash_table_size (cache->dests));
+        cache->loaded = TRUE;
+}
+
+static CachedDest *
+gsd_cups_dest_cache_lookup (GsdCupsDestCache *cache,
+                            const char       *name)
+{
+        if (name == NULL)
+                return NULL;
+
+        gsd_cups_dest_cache_load (cache);
+        return g_hash_table_lookup (cache->dests, name);
+}
+
+GsdCupsDestCache *
+gsd_cups_dest_cache_new (void)
+{
+        GsdCupsDestCache *cache;
+
+        cache = g_new0 (GsdCupsDestCache, 1);
+        cache->dests = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, cached_dest_free);
+        return cache;
+}
+
+void
+gsd_cups_dest_cache_free (GsdCupsDestCache *cache)
+{
+        if (cache == NULL)
+                return;
+
+        g_hash_table_destroy (cache->dests);
+        g_free (cache);
+}
+
+/**
+ * gsd_cups_dest_cache_invalidate:
+ *
+ * Makes the next lookup fetch the whole list of destinations again.
+ **/
+void
+gsd_cups_dest_cache_invalidate (GsdCupsDestCache *cache)
+{
+        cache->loaded = FALSE;
+}
+
+void
+gsd_cups_dest_cache_refresh (GsdCupsDestCache *cache)
+{
+        gsd_cups_dest_cache_invalidate (cache);
+        gsd_cups_dest_cache_load (cache);
+}
+
+/**
+ * gsd_cups_dest_cache_get_size:
+ *
+ * Returns: the number of destinations currently in the cache; this
+ * never fetches anything from the server.
+ **/
+guint
+gsd_cups_dest_cache_get_size (GsdCupsDestCache *cache)
+{
+        if (!cache->loaded)
+                return 0;
+        return g_hash_table_size (cache->dests);
+}
+
+gboolean
+gsd_cups_dest_cache_has_dest (GsdCupsDestCache *cache,
+                              const char       *name)
+{
+        return gsd_cups_dest_cache_lookup (cache, name) != NULL;
+}
+
+/**
+ * gsd_cups_dest_cache_get_attr:
+ *
+ * Returns: the value of @attr for the printer @name, owned by the
+ * cache and only valid until the destination is next changed.
+ **/
+const char *
+gsd_cups_dest_cache_get_attr (GsdCupsDestCache *cache,
+                              const char       *name,
+                              const char       *attr)
+{
+        CachedDest *cached;
+        const char *value;
+
+        cached = gsd_cups_dest_cache_lookup (cache, name);
+        if (cached == NULL) {
+                g_debug ("Unable to find a printer named '%s'", name);
+                return NULL;
+        }
+
+        value = cupsGetOption (attr, cached->num_options, cached->options);
+        if (value == NULL)
+                g_debug ("Unable to get %s for '%s'", attr, name);
+
+        return value;
+}
+
+gboolean
+gsd_cups_dest_cache_is_local (GsdCupsDestCache *cache,
+                              const char       *name)
+{
+        const char   *type_str;
+        cups_ptype_t  type;
+
+        type_str = gsd_cups_dest_cache_get_attr (cache, name, "printer-type");
+        if (type_str == NULL)
+                return FALSE;
+
+        type = atoi (type_str);
+        return !(type & (CUPS_PRINTER_REMOTE | CUPS_PRINTER_IMPLICIT));
+}
+
+/**
+ * gsd_cups_dest_cache_set_attr:
+ *
+ * Records a new value for @attr, as reported by a notification, if
+ * the printer @name is known.
+ **/
+void
+gsd_cups_dest_cache_set_attr (GsdCupsDestCache *cache,
+                              const char       *name,
+                              const char       *attr,
+                              const char       *value)
+{
+        CachedDest *cached;
+
+        if (!cache->loaded || name == NULL || value == NULL)
+                return;
+
+        cached = g_hash_table_lookup (cache->dests, name);
+        if (cached == NULL)
+                return;
+
+        cached->num_options = cupsAddOption (attr, value,
+                                             cached->num_options,
+                                             &cached->options);
+}
+
+/**
+ * gsd_cups_dest_cache_update_dest:
+ *
+ * Fetches the printer @name alone, after it was added or changed.
+ *
+ * Returns: %TRUE if the printer exists
+ **/
+gboolean
+gsd_cups_dest_cache_update_dest (GsdCupsDestCache *cache,
+                                 const char       *name)
+{
+        cups_dest_t *dest;
+
+        if (name == NULL)
+                return FALSE;
+
+        /* the full list will have it anyway */
+        if (!cache->loaded)
+                return gsd_cups_dest_cache_has_dest (cache, name);
+
+        dest = cupsGetNamedDest (CUPS_HTTP_DEFAULT, name, NULL);
+        if (dest == NULL) {
+                g_hash_table_remove (cache->dests, name);
+                return FALSE;
+        }
+
+        g_hash_table_replace (cache->dests,
+                              g_strdup (name),
+                              cached_dest_new (dest));
+        cupsFreeDests (1, dest);
+
+        return TRUE;
+}
+
+void
+gsd_cups_dest_cache_remove_dest (GsdCupsDestCache *cache,
+                                 const char       *name)
+{
+        if (name == NULL)
+                return;
+
+        g_hash_table_remove (cache->dests, name);
+}
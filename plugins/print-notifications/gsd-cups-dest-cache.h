@@ -0,0 +1,53 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __GSD_CUPS_DEST_CACHE_H
+#define __GSD_CUPS_DEST_CACHE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GsdCupsDestCache GsdCupsDestCache;
+
+GsdCupsDestCache *gsd_cups_dest_cache_new         (void);
+void              gsd_cups_dest_cache_free        (GsdCupsDestCache *cache);
+void              gsd_cups_dest_cache_invalidate  (GsdCupsDestCache *cache);
+void              gsd_cups_dest_cache_refresh     (GsdCupsDestCache *cache);
+guint             gsd_cups_dest_cache_get_size    (GsdCupsDestCache *cache);
+gboolean          gsd_cups_dest_cache_has_dest    (GsdCupsDestCache *cache,
+                                                   const char       *name);
+const char       *gsd_cups_dest_cache_get_attr    (GsdCupsDestCache *cache,
+                                                   const char       *name,
+                                                   const char       *attr);
+gboolean          gsd_cups_dest_cache_is_local    (GsdCupsDestCache *cache,
+                                                   const char       *name);
+void              gsd_cups_dest_cache_set_attr    (GsdCupsDestCache *cache,
+                                                   const char       *name,
+                                                   const char       *attr,
+                                                   const char       *value);
+gboolean          gsd_cups_dest_cache_update_dest (GsdCupsDestCache *cache,
+                                                   const char       *name);
+void              gsd_cups_dest_cache_remove_dest (GsdCupsDestCache *cache,
+                                                   const char       *name);
+
+G_END_DECLS
+
+#endif /* __GSD_CUPS_DEST_CACHE_H */
@@ -39,7 +39,9 @@
 #include <libnotify/notify.h>
 
 #include "gnome-settings-profile.h"
+#include "gnome-settings-scheduler.h"
 #include "gsd-print-notifications-manager.h"
+#include "gsd-cups-dest-cache.h"
 
 #define GSD_PRINT_NOTIFICATIONS_MANAGER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), GSD_TYPE_PRINT_NOTIFICATIONS_MANAGER, GsdPrintNotificationsManagerPrivate))
 
@@ -48,10 +50,14 @@
 #define CUPS_DBUS_INTERFACE "org.cups.cupsd.Notifier"
 
 #define RENEW_INTERVAL                   3500
+#define RENEW_SLACK                      60
 #define SUBSCRIPTION_DURATION            3600
 #define CONNECTING_TIMEOUT               60
 #define REASON_TIMEOUT                   15000
 #define CUPS_CONNECTION_TEST_INTERVAL    300
+/* below the default KeepAliveTimeout of cupsd, so a kept connection
+ * is dropped by us before the server drops it under us */
+#define CUPS_CONNECTION_IDLE_TIMEOUT     25
 
 #if (CUPS_VERSION_MAJOR > 1) || (CUPS_VERSION_MINOR > 5)
 #define HAVE_CUPS_1_6 1
@@ -67,14 +73,20 @@ struct GsdPrintNotificationsManagerPrivate
 {
         GDBusConnection              *cups_bus_connection;
         gint                          subscription_id;
-        cups_dest_t                  *dests;
-        gint                          num_dests;
+        GsdCupsDestCache             *dest_cache;
         gboolean                      scp_handler_spawned;
         GPid                          scp_handler_pid;
         GList                        *timeouts;
         GHashTable                   *printing_printers;
         GList                        *active_notifications;
         guint                         cups_connection_timeout_id;
+        guint                         renew_job_id;
+        GThreadPool                  *cups_request_pool;
+        GCancellable                 *cups_cancellable;
+        http_t                       *cups_http;
+        gint64                        cups_http_last_used;
+        guint                         pending_notifications;
+        gboolean                      subscription_requested;
 };
 
 enum {
@@ -90,60 +102,6 @@ G_DEFINE_TYPE (GsdPrintNotificationsManager, gsd_print_notifications_manager, G_
 
 static gpointer manager_object = NULL;
 
-static char *
-get_dest_attr (const char *dest_name,
-               const char *attr,
-               cups_dest_t *dests,
-               int          num_dests)
-{
-        cups_dest_t *dest;
-        const char  *value;
-        char        *ret;
-
-        if (dest_name == NULL)
-                return NULL;
-
-        ret = NULL;
-
-        dest = cupsGetDest (dest_name, NULL, num_dests, dests);
-        if (dest == NULL) {
-                g_debug ("Unable to find a printer named '%s'", dest_name);
-                goto out;
-        }
-
-        value = cupsGetOption (attr, dest->num_options, dest->options);
-        if (value == NULL) {
-                g_debug ("Unable to get %s for '%s'", attr, dest_name);
-                goto out;
-        }
-        ret = g_strdup (value);
- out:
-        return ret;
-}
-
-static gboolean
-is_local_dest (const char  *name,
-               cups_dest_t *dests,
-               int          num_dests)
-{
-        char        *type_str;
-        cups_ptype_t type;
-        gboolean     is_remote;
-
-        is_remote = TRUE;
-
-        type_str = get_dest_attr (name, "printer-type", dests, num_dests);
-        if (type_str == NULL) {
-                goto out;
-        }
-
-        type = atoi (type_str);
-        is_remote = type & (CUPS_PRINTER_REMOTE | CUPS_PRINTER_IMPLICIT);
-        g_free (type_str);
- out:
-        return !is_remote;
-}
-
 static int
 strcmp0(const void *a, const void *b)
 {
@@ -262,6 +220,161 @@ show_notification (gpointer user_data)
         return FALSE;
 }
 
+typedef void (*CupsRequestCallback) (GsdPrintNotificationsManager *manager,
+                                     ipp_t                        *response,
+                                     gpointer                      user_data);
+
+struct
+{
+        ipp_t                        *request;
+        ipp_t                        *response;
+        CupsRequestCallback           callback;
+        gpointer                      user_data;
+        GDestroyNotify                destroy;
+        GsdPrintNotificationsManager *manager;
+        GCancellable                 *cancellable;
+} typedef CupsRequestData;
+
+struct
+{
+        gchar    *signal_name;
+        GVariant *parameters;
+} typedef NotificationData;
+
+static void
+free_cups_request_data (gpointer user_data)
+{
+        CupsRequestData *data = (CupsRequestData *) user_data;
+
+        if (data->request)
+                ippDelete (data->request);
+        if (data->response)
+                ippDelete (data->response);
+        if (data->destroy)
+                data->destroy (data->user_data);
+        g_object_unref (data->cancellable);
+        g_free (data);
+}
+
+static void
+free_notification_data (gpointer user_data)
+{
+        NotificationData *data = (NotificationData *) user_data;
+
+        g_free (data->signal_name);
+        g_variant_unref (data->parameters);
+        g_free (data);
+}
+
+/* Only called from the request pool thread, or once the pool is gone */
+static http_t *
+get_cups_connection (GsdPrintNotificationsManager *manager)
+{
+        GsdPrintNotificationsManagerPrivate *priv = manager->priv;
+        gint64                               now;
+
+        now = g_get_monotonic_time ();
+        if (priv->cups_http != NULL &&
+            now - priv->cups_http_last_used > CUPS_CONNECTION_IDLE_TIMEOUT * G_USEC_PER_SEC) {
+                httpClose (priv->cups_http);
+                priv->cups_http = NULL;
+        }
+
+        if (priv->cups_http == NULL) {
+                priv->cups_http = httpConnectEncrypt (cupsServer (), ippPort (),
+                                                      cupsEncryption ());
+                if (priv->cups_http == NULL)
+                        g_debug ("Connection to CUPS server \'%s\' failed.", cupsServer ());
+        }
+
+        priv->cups_http_last_used = now;
+
+        return priv->cups_http;
+}
+
+static ipp_t *
+do_cups_request (GsdPrintNotificationsManager *manager,
+                 ipp_t                        *request)
+{
+        http_t *http;
+        ipp_t  *response;
+
+        http = get_cups_connection (manager);
+        if (http == NULL) {
+                ippDelete (request);
+                return NULL;
+        }
+
+        response = cupsDoRequest (http, request, "/");
+        if (response == NULL) {
+                /* start over with a new connection next time */
+                httpClose (manager->priv->cups_http);
+                manager->priv->cups_http = NULL;
+        }
+
+        return response;
+}
+
+static gboolean
+cups_request_done (gpointer user_data)
+{
+        CupsRequestData *data = (CupsRequestData *) user_data;
+
+        if (!g_cancellable_is_cancelled (data->cancellable) && data->callback)
+                data->callback (data->manager, data->response, data->user_data);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+cups_request_thread_func (gpointer task_data,
+                          gpointer pool_data)
+{
+        CupsRequestData *data = (CupsRequestData *) task_data;
+
+        if (data->request != NULL &&
+            !g_cancellable_is_cancelled (data->cancellable)) {
+                data->response = do_cups_request (data->manager, data->request);
+                data->request = NULL;
+        }
+
+        g_idle_add_full (G_PRIORITY_DEFAULT,
+                         cups_request_done,
+                         data,
+                         free_cups_request_data);
+}
+
+/* Requests are sent one at a time, in order, over a single connection
+ * kept by the pool thread; the callback is called from the main loop.
+ * A NULL request just goes through the queue, to keep things in order.
+ */
+static void
+queue_cups_request (GsdPrintNotificationsManager *manager,
+                    ipp_t                        *request,
+                    CupsRequestCallback           callback,
+                    gpointer                      user_data,
+                    GDestroyNotify                destroy)
+{
+        CupsRequestData *data;
+
+        if (manager->priv->cups_request_pool == NULL) {
+                ippDelete (request);
+                if (destroy)
+                        destroy (user_data);
+                return;
+        }
+
+        data = g_new0 (CupsRequestData, 1);
+        data->request = request;
+        data->callback = callback;
+        data->user_data = user_data;
+        data->destroy = destroy;
+        data->manager = manager;
+        data->cancellable = g_object_ref (manager->priv->cups_cancellable);
+
+        g_thread_pool_push (manager->priv->cups_request_pool, data, NULL);
+}
+
 static gboolean
 reason_is_blacklisted (const gchar *reason) {
         if (g_str_equal (reason, "none"))
@@ -277,19 +390,13 @@ reason_is_blacklisted (const gchar *reason) {
 }
 
 static void
-on_cups_notification (GDBusConnection *connection,
-                      const char      *sender_name,
-                      const char      *object_path,
-                      const char      *interface_name,
-                      const char      *signal_name,
-                      GVariant        *parameters,
-                      gpointer         user_data)
+process_cups_notification (GsdPrintNotificationsManager *manager,
+                           const char                   *signal_name,
+                           GVariant                     *parameters,
+                           gboolean                      my_job)
 {
-        GsdPrintNotificationsManager *manager = (GsdPrintNotificationsManager *) user_data;
         gboolean                     printer_is_accepting_jobs;
-        gboolean                     my_job = FALSE;
         gboolean                     known_reason;
-        http_t                      *http;
         gchar                       *printer_name = NULL;
         gchar                       *primary_text = NULL;
         gchar                       *secondary_text = NULL;
@@ -298,9 +405,7 @@ on_cups_notification (GDBusConnection *connection,
         gchar                       *printer_state_reasons = NULL;
         gchar                       *job_state_reasons = NULL;
         gchar                       *job_name = NULL;
-        gchar                       *job_uri = NULL;
         guint                        job_id;
-        ipp_t                       *request, *response;
         gint                         printer_state;
         gint                         job_state;
         gint                         job_impressions_completed;
@@ -371,14 +476,6 @@ on_cups_notification (GDBusConnection *connection,
                 /* Translators: The printer has detected an error (same as in system-config-printer) */
                 N_("There is a problem on printer '%s'.") };
 
-        if (g_strcmp0 (signal_name, "PrinterAdded") != 0 &&
-            g_strcmp0 (signal_name, "PrinterDeleted") != 0 &&
-            g_strcmp0 (signal_name, "PrinterStateChanged") != 0 &&
-            g_strcmp0 (signal_name, "JobCompleted") != 0 &&
-            g_strcmp0 (signal_name, "JobState") != 0 &&
-            g_strcmp0 (signal_name, "JobCreated") != 0)
-                return;
-
         if (g_variant_n_children (parameters) == 1) {
                 g_variant_get (parameters, "(&s)", &text);
         } else if (g_variant_n_children (parameters) == 6) {
@@ -390,8 +487,6 @@ on_cups_notification (GDBusConnection *connection,
                                &printer_state_reasons,
                                &printer_is_accepting_jobs);
         } else if (g_variant_n_children (parameters) == 11) {
-                ipp_attribute_t *attr;
-
                 g_variant_get (parameters, "(&s&s&su&sbuu&s&su)",
                                &text,
                                &printer_uri,
@@ -404,34 +499,6 @@ on_cups_notification (GDBusConnection *connection,
                                &job_state_reasons,
                                &job_name,
                                &job_impressions_completed);
-
-                if ((http = httpConnectEncrypt (cupsServer (), ippPort (),
-                                                cupsEncryption ())) == NULL) {
-                        g_debug ("Connection to CUPS server \'%s\' failed.", cupsServer ());
-                }
-                else {
-                        job_uri = g_strdup_printf ("ipp://localhost/jobs/%d", job_id);
-
-                        request = ippNewRequest (IPP_GET_JOB_ATTRIBUTES);
-                        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-                                      "job-uri", NULL, job_uri);
-                        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-                                     "requesting-user-name", NULL, cupsUser ());
-                        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
-                                     "requested-attributes", NULL, "job-originating-user-name");
-                        response = cupsDoRequest (http, request, "/");
-
-                        if (response) {
-                                if (ippGetStatusCode (response) <= IPP_OK_CONFLICT &&
-                                    (attr = ippFindAttribute(response, "job-originating-user-name",
-                                                             IPP_TAG_NAME))) {
-                                        if (g_strcmp0 (ippGetString (attr, 0, NULL), cupsUser ()) == 0)
-                                                my_job = TRUE;
-                                }
-                                ippDelete(response);
-                        }
-                        g_free (job_uri);
-                }
         }
         else {
                 g_warning ("Invalid number of parameters for signal '%s'", signal_name);
@@ -439,27 +506,21 @@ on_cups_notification (GDBusConnection *connection,
         }
 
         if (g_strcmp0 (signal_name, "PrinterAdded") == 0) {
-                cupsFreeDests (manager->priv->num_dests, manager->priv->dests);
-                manager->priv->num_dests = cupsGetDests (&manager->priv->dests);
+                gsd_cups_dest_cache_update_dest (manager->priv->dest_cache, printer_name);
 
                 /* Translators: New printer has been added */
-                if (is_local_dest (printer_name,
-                                   manager->priv->dests,
-                                   manager->priv->num_dests)) {
+                if (gsd_cups_dest_cache_is_local (manager->priv->dest_cache, printer_name)) {
                         primary_text = g_strdup (_("Printer added"));
                         secondary_text = g_strdup (printer_name);
                 }
         } else if (g_strcmp0 (signal_name, "PrinterDeleted") == 0) {
                 /* Translators: A printer has been removed */
-                if (is_local_dest (printer_name,
-                                   manager->priv->dests,
-                                   manager->priv->num_dests)) {
+                if (gsd_cups_dest_cache_is_local (manager->priv->dest_cache, printer_name)) {
                         primary_text = g_strdup (_("Printer removed"));
                         secondary_text = g_strdup (printer_name);
                 }
 
-                cupsFreeDests (manager->priv->num_dests, manager->priv->dests);
-                manager->priv->num_dests = cupsGetDests (&manager->priv->dests);
+                gsd_cups_dest_cache_remove_dest (manager->priv->dest_cache, printer_name);
         } else if (g_strcmp0 (signal_name, "JobCompleted") == 0 && my_job) {
                 g_hash_table_remove (manager->priv->printing_printers,
                                      printer_name);
@@ -526,8 +587,8 @@ on_cups_notification (GDBusConnection *connection,
                         secondary_text = g_strdup_printf (_("\"%s\" on %s"), job_name, printer_name);
                 }
         } else if (g_strcmp0 (signal_name, "PrinterStateChanged") == 0) {
-                cups_dest_t  *dest = NULL;
                 const gchar  *tmp_printer_state_reasons = NULL;
+                gchar        *printer_state_str;
                 GSList       *added_reasons = NULL;
                 GSList       *tmp_list = NULL;
                 GList        *tmp;
@@ -580,34 +641,29 @@ on_cups_notification (GDBusConnection *connection,
                         }
                 }
 
+                /* The notification carries the new state, so keep the cached
+                 * printer up to date from it rather than fetching it again.
+                 */
+                tmp_printer_state_reasons = gsd_cups_dest_cache_get_attr (manager->priv->dest_cache,
+                                                                          printer_name,
+                                                                          "printer-state-reasons");
+                if (tmp_printer_state_reasons)
+                        old_state_reasons = g_strsplit (tmp_printer_state_reasons, ",", -1);
+
+                printer_state_str = g_strdup_printf ("%d", printer_state);
+                gsd_cups_dest_cache_set_attr (manager->priv->dest_cache, printer_name,
+                                              "printer-state", printer_state_str);
+                g_free (printer_state_str);
+                gsd_cups_dest_cache_set_attr (manager->priv->dest_cache, printer_name,
+                                              "printer-is-accepting-jobs",
+                                              printer_is_accepting_jobs ? "true" : "false");
+                gsd_cups_dest_cache_set_attr (manager->priv->dest_cache, printer_name,
+                                              "printer-state-reasons", printer_state_reasons);
+
                 /* Check whether we are printing on this printer right now. */
                 if (g_hash_table_lookup_extended (manager->priv->printing_printers, printer_name, NULL, NULL)) {
-                        dest = cupsGetDest (printer_name,
-                                            NULL,
-                                            manager->priv->num_dests,
-                                            manager->priv->dests);
-                        if (dest)
-                                tmp_printer_state_reasons = cupsGetOption ("printer-state-reasons",
-                                                                           dest->num_options,
-                                                                           dest->options);
-
-                        if (tmp_printer_state_reasons)
-                                old_state_reasons = g_strsplit (tmp_printer_state_reasons, ",", -1);
-
-                        cupsFreeDests (manager->priv->num_dests, manager->priv->dests);
-                        manager->priv->num_dests = cupsGetDests (&manager->priv->dests);
-
-                        dest = cupsGetDest (printer_name,
-                                            NULL,
-                                            manager->priv->num_dests,
-                                            manager->priv->dests);
-                        if (dest)
-                                tmp_printer_state_reasons = cupsGetOption ("printer-state-reasons",
-                                                                           dest->num_options,
-                                                                           dest->options);
-
-                        if (tmp_printer_state_reasons)
-                                new_state_reasons = g_strsplit (tmp_printer_state_reasons, ",", -1);
+                        if (printer_state_reasons)
+                                new_state_reasons = g_strsplit (printer_state_reasons, ",", -1);
 
                         if (new_state_reasons)
                                 qsort (new_state_reasons,
@@ -811,6 +867,84 @@ on_cups_notification (GDBusConnection *connection,
         }
 }
 
+static void
+cups_notification_request_done (GsdPrintNotificationsManager *manager,
+                                ipp_t                        *response,
+                                gpointer                      user_data)
+{
+        NotificationData *data = (NotificationData *) user_data;
+        ipp_attribute_t  *attr;
+        gboolean          my_job = FALSE;
+
+        manager->priv->pending_notifications--;
+
+        if (response &&
+            ippGetStatusCode (response) <= IPP_OK_CONFLICT &&
+            (attr = ippFindAttribute (response, "job-originating-user-name",
+                                      IPP_TAG_NAME))) {
+                if (g_strcmp0 (ippGetString (attr, 0, NULL), cupsUser ()) == 0)
+                        my_job = TRUE;
+        }
+
+        process_cups_notification (manager, data->signal_name, data->parameters, my_job);
+}
+
+static void
+on_cups_notification (GDBusConnection *connection,
+                      const char      *sender_name,
+                      const char      *object_path,
+                      const char      *interface_name,
+                      const char      *signal_name,
+                      GVariant        *parameters,
+                      gpointer         user_data)
+{
+        GsdPrintNotificationsManager *manager = (GsdPrintNotificationsManager *) user_data;
+        NotificationData             *data;
+        ipp_t                        *request = NULL;
+        gchar                        *job_uri;
+        guint                         job_id;
+
+        if (g_strcmp0 (signal_name, "PrinterAdded") != 0 &&
+            g_strcmp0 (signal_name, "PrinterDeleted") != 0 &&
+            g_strcmp0 (signal_name, "PrinterStateChanged") != 0 &&
+            g_strcmp0 (signal_name, "JobCompleted") != 0 &&
+            g_strcmp0 (signal_name, "JobState") != 0 &&
+            g_strcmp0 (signal_name, "JobCreated") != 0)
+                return;
+
+        /* Job notifications need to know whose job it is first; anything
+         * arriving while such a lookup is pending waits behind it, so that
+         * notifications are still handled in the order they came in.
+         */
+        if (g_variant_n_children (parameters) == 11) {
+                g_variant_get_child (parameters, 6, "u", &job_id);
+                job_uri = g_strdup_printf ("ipp://localhost/jobs/%d", job_id);
+
+                request = ippNewRequest (IPP_GET_JOB_ATTRIBUTES);
+                ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+                              "job-uri", NULL, job_uri);
+                ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                             "requesting-user-name", NULL, cupsUser ());
+                ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+                             "requested-attributes", NULL, "job-originating-user-name");
+                g_free (job_uri);
+        } else if (manager->priv->pending_notifications == 0) {
+                process_cups_notification (manager, signal_name, parameters, FALSE);
+                return;
+        }
+
+        data = g_new0 (NotificationData, 1);
+        data->signal_name = g_strdup (signal_name);
+        data->parameters = g_variant_ref (parameters);
+
+        manager->priv->pending_notifications++;
+        queue_cups_request (manager,
+                            request,
+                            cups_notification_request_done,
+                            data,
+                            free_notification_data);
+}
+
 static void
 scp_handler (GsdPrintNotificationsManager *manager,
              gboolean                      start)
@@ -844,23 +978,39 @@ scp_handler (GsdPrintNotificationsManager *manager,
         }
 }
 
+/* Must only be called once the request pool has been shut down */
 static void
-cancel_subscription (gint id)
+cancel_subscription (GsdPrintNotificationsManager *manager)
 {
-        http_t *http;
         ipp_t  *request;
 
-        if (id >= 0 &&
-            ((http = httpConnectEncrypt (cupsServer (), ippPort (),
-                                        cupsEncryption ())) != NULL)) {
+        if (manager->priv->subscription_id >= 0) {
                 request = ippNewRequest (IPP_CANCEL_SUBSCRIPTION);
                 ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
                              "printer-uri", NULL, "/");
                 ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
                              "requesting-user-name", NULL, cupsUser ());
                 ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-                              "notify-subscription-id", id);
-                ippDelete (cupsDoRequest (http, request, "/"));
+                              "notify-subscription-id", manager->priv->subscription_id);
+                ippDelete (do_cups_request (manager, request));
+        }
+}
+
+static void
+create_subscription_cb (GsdPrintNotificationsManager *manager,
+                        ipp_t                        *response,
+                        gpointer                      user_data)
+{
+        ipp_attribute_t *attr = NULL;
+
+        manager->priv->subscription_requested = FALSE;
+
+        if (response != NULL && ippGetStatusCode (response) <= IPP_OK_CONFLICT) {
+                if ((attr = ippFindAttribute (response, "notify-subscription-id",
+                                              IPP_TAG_INTEGER)) == NULL)
+                        g_debug ("No notify-subscription-id in response!\n");
+                else
+                        manager->priv->subscription_id = ippGetInteger (attr, 0);
         }
 }
 
@@ -868,10 +1018,7 @@ static gboolean
 renew_subscription (gpointer data)
 {
         GsdPrintNotificationsManager *manager = (GsdPrintNotificationsManager *) data;
-        ipp_attribute_t              *attr = NULL;
-        http_t                       *http;
         ipp_t                        *request;
-        ipp_t                        *response;
         gint                          num_events = 7;
         static const char * const events[] = {
                 "job-created",
@@ -882,52 +1029,36 @@ renew_subscription (gpointer data)
                 "printer-deleted",
                 "printer-state-changed"};
 
-        if ((http = httpConnectEncrypt (cupsServer (), ippPort (),
-                                        cupsEncryption ())) == NULL) {
-                g_debug ("Connection to CUPS server \'%s\' failed.", cupsServer ());
+        if (manager->priv->subscription_id >= 0) {
+                request = ippNewRequest (IPP_RENEW_SUBSCRIPTION);
+                ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+                             "printer-uri", NULL, "/");
+                ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                             "requesting-user-name", NULL, cupsUser ());
+                ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+                              "notify-subscription-id", manager->priv->subscription_id);
+                ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
+                              "notify-lease-duration", SUBSCRIPTION_DURATION);
+                queue_cups_request (manager, request, NULL, NULL, NULL);
         }
-        else {
-                if (manager->priv->subscription_id >= 0) {
-                        request = ippNewRequest (IPP_RENEW_SUBSCRIPTION);
-                        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-                                     "printer-uri", NULL, "/");
-                        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-                                     "requesting-user-name", NULL, cupsUser ());
-                        ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-                                      "notify-subscription-id", manager->priv->subscription_id);
-                        ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
-                                      "notify-lease-duration", SUBSCRIPTION_DURATION);
-                        ippDelete (cupsDoRequest (http, request, "/"));
-                }
-                else {
-                        request = ippNewRequest (IPP_CREATE_PRINTER_SUBSCRIPTION);
-                        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-                                      "printer-uri", NULL,
-                                      "/");
-                        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-                                      "requesting-user-name", NULL, cupsUser ());
-                        ippAddStrings (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
-                                       "notify-events", num_events, NULL, events);
-                        ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
-                                      "notify-pull-method", NULL, "ippget");
-                        ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI,
-                                      "notify-recipient-uri", NULL, "dbus://");
-                        ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
-                                       "notify-lease-duration", SUBSCRIPTION_DURATION);
-                        response = cupsDoRequest (http, request, "/");
-
-                        if (response != NULL && ippGetStatusCode (response) <= IPP_OK_CONFLICT) {
-                                if ((attr = ippFindAttribute (response, "notify-subscription-id",
-                                                              IPP_TAG_INTEGER)) == NULL)
-                                        g_debug ("No notify-subscription-id in response!\n");
-                                else
-                                        manager->priv->subscription_id = ippGetInteger (attr, 0);
-                        }
-
-                        if (response)
-                                ippDelete (response);
-                }
-                httpClose (http);
+        else if (!manager->priv->subscription_requested) {
+                request = ippNewRequest (IPP_CREATE_PRINTER_SUBSCRIPTION);
+                ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+                              "printer-uri", NULL,
+                              "/");
+                ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                              "requesting-user-name", NULL, cupsUser ());
+                ippAddStrings (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
+                               "notify-events", num_events, NULL, events);
+                ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
+                              "notify-pull-method", NULL, "ippget");
+                ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI,
+                              "notify-recipient-uri", NULL, "dbus://");
+                ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
+                               "notify-lease-duration", SUBSCRIPTION_DURATION);
+
+                manager->priv->subscription_requested = TRUE;
+                queue_cups_request (manager, request, create_subscription_cb, NULL, NULL);
         }
         return TRUE;
 }
@@ -988,6 +1119,22 @@ renew_subscription_with_connection_test (gpointer user_data)
         return TRUE;
 }
 
+static void
+start_renewing_subscription (GsdPrintNotificationsManager *manager)
+{
+        if (manager->priv->renew_job_id != 0)
+                return;
+
+        /* The slack has to stay within the lease duration */
+        manager->priv->renew_job_id =
+                gnome_settings_scheduler_add_job ("print-notifications: renew subscription",
+                                                  RENEW_INTERVAL,
+                                                  RENEW_SLACK,
+                                                  GNOME_SETTINGS_JOB_ALWAYS,
+                                                  renew_subscription_with_connection_test,
+                                                  manager, NULL);
+}
+
 static void
 cups_connection_test_cb (GObject      *source_object,
                          GAsyncResult *res,
@@ -1007,11 +1154,11 @@ cups_connection_test_cb (GObject      *source_object,
                 g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
                 g_object_unref (connection);
 
-                manager->priv->num_dests = cupsGetDests (&manager->priv->dests);
+                gsd_cups_dest_cache_refresh (manager->priv->dest_cache);
                 gnome_settings_profile_msg ("got dests");
 
                 renew_subscription (user_data);
-                g_timeout_add_seconds (RENEW_INTERVAL, renew_subscription_with_connection_test, manager);
+                start_renewing_subscription (manager);
         }
         else {
                 g_debug ("Test connection to CUPS server \'%s:%d\' failed.", cupsServer (), ippPort ());
@@ -1028,7 +1175,7 @@ cups_connection_test (gpointer user_data)
         GSocketClient                *client;
         gchar                        *address;
 
-        if (!manager->priv->dests) {
+        if (gsd_cups_dest_cache_get_size (manager->priv->dest_cache) == 0) {
                 address = g_strdup_printf ("%s:%d", cupsServer (), ippPort ());
 
                 if (address && address[0] != '/') {
@@ -1046,17 +1193,17 @@ cups_connection_test (gpointer user_data)
                         g_object_unref (client);
                 }
                 else {
-                        manager->priv->num_dests = cupsGetDests (&manager->priv->dests);
+                        gsd_cups_dest_cache_refresh (manager->priv->dest_cache);
                         gnome_settings_profile_msg ("got dests");
 
                         renew_subscription (user_data);
-                        g_timeout_add_seconds (RENEW_INTERVAL, renew_subscription_with_connection_test, manager);
+                        start_renewing_subscription (manager);
                 }
 
                 g_free (address);
         }
 
-        if (manager->priv->dests) {
+        if (gsd_cups_dest_cache_get_size (manager->priv->dest_cache) > 0) {
                 manager->priv->cups_connection_timeout_id = 0;
 
                 return FALSE;
@@ -1106,14 +1253,20 @@ gsd_print_notifications_manager_start (GsdPrintNotificationsManager *manager,
         gnome_settings_profile_start (NULL);
 
         manager->priv->subscription_id = -1;
-        manager->priv->dests = NULL;
-        manager->priv->num_dests = 0;
+        manager->priv->dest_cache = gsd_cups_dest_cache_new ();
         manager->priv->scp_handler_spawned = FALSE;
         manager->priv->timeouts = NULL;
         manager->priv->printing_printers = NULL;
         manager->priv->active_notifications = NULL;
         manager->priv->cups_bus_connection = NULL;
         manager->priv->cups_connection_timeout_id = 0;
+        manager->priv->renew_job_id = 0;
+        manager->priv->cups_http = NULL;
+        manager->priv->pending_notifications = 0;
+        manager->priv->subscription_requested = FALSE;
+        manager->priv->cups_cancellable = g_cancellable_new ();
+        manager->priv->cups_request_pool = g_thread_pool_new (cups_request_thread_func,
+                                                              NULL, 1, FALSE, NULL);
 
         g_idle_add (gsd_print_notifications_manager_start_idle, manager);
 
@@ -1131,12 +1284,32 @@ gsd_print_notifications_manager_stop (GsdPrintNotificationsManager *manager)
 
         g_debug ("Stopping print-notifications manager");
 
-        cupsFreeDests (manager->priv->num_dests, manager->priv->dests);
-        manager->priv->num_dests = 0;
-        manager->priv->dests = NULL;
+        gsd_cups_dest_cache_free (manager->priv->dest_cache);
+        manager->priv->dest_cache = NULL;
+
+        gnome_settings_scheduler_remove_job (manager->priv->renew_job_id);
+        manager->priv->renew_job_id = 0;
+
+        /* Let the pool thread skip whatever is left in the queue, and
+         * wait for it so that the connection can be used from here */
+        if (manager->priv->cups_cancellable)
+                g_cancellable_cancel (manager->priv->cups_cancellable);
 
-        if (manager->priv->subscription_id >= 0)
-                cancel_subscription (manager->priv->subscription_id);
+        if (manager->priv->cups_request_pool) {
+                g_thread_pool_free (manager->priv->cups_request_pool, FALSE, TRUE);
+                manager->priv->cups_request_pool = NULL;
+        }
+        g_clear_object (&manager->priv->cups_cancellable);
+        manager->priv->pending_notifications = 0;
+        manager->priv->subscription_requested = FALSE;
+
+        cancel_subscription (manager);
+        manager->priv->subscription_id = -1;
+
+        if (manager->priv->cups_http) {
+                httpClose (manager->priv->cups_http);
+                manager->priv->cups_http = NULL;
+        }
 
         if (manager->priv->printing_printers)
                 g_hash_table_destroy (manager->priv->printing_printers);
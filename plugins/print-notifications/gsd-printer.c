@@ -28,6 +28,8 @@
 #include <cups/cups.h>
 #include <cups/ppd.h>
 
+#include "gsd-cups-dest-cache.h"
+
 static GDBusNodeInfo *npn_introspection_data = NULL;
 static GDBusNodeInfo *pdi_introspection_data = NULL;
 
@@ -112,6 +114,8 @@ static guint      pdi_registration_id;
 static guint      npn_owner_id;
 static guint      pdi_owner_id;
 
+static GsdCupsDestCache *dest_cache;
+
 static GHashTable *
 get_missing_executables (const gchar *ppd_file_name)
 {
@@ -404,13 +408,10 @@ get_tag_value (const gchar *tag_string,
 static gchar *
 create_name (gchar *device_id)
 {
-        cups_dest_t *dests;
         gboolean     already_present = FALSE;
         gchar       *name = NULL;
         gchar       *new_name = NULL;
-        gint         num_dests;
         gint         name_index = 2;
-        gint         j;
 
         g_return_val_if_fail (device_id != NULL, NULL);
 
@@ -421,7 +422,6 @@ create_name (gchar *device_id)
         if (name)
                 name = g_strcanon (name, ALLOWED_CHARACTERS, '-');
 
-        num_dests = cupsGetDests (&dests);
         do {
                 if (already_present) {
                         new_name = g_strdup_printf ("%s-%d", name, name_index);
@@ -430,10 +430,7 @@ create_name (gchar *device_id)
                         new_name = g_strdup (name);
                 }
 
-                already_present = FALSE;
-                for (j = 0; j < num_dests; j++)
-                        if (g_strcmp0 (dests[j].name, new_name) == 0)
-                                already_present = TRUE;
+                already_present = gsd_cups_dest_cache_has_dest (dest_cache, new_name);
 
                 if (already_present) {
                         g_free (new_name);
@@ -442,7 +439,6 @@ create_name (gchar *device_id)
                         name = new_name;
                 }
         } while (already_present);
-        cupsFreeDests (num_dests, dests);
 
         return name;
 }
@@ -454,13 +450,10 @@ add_printer (gchar *printer_name,
              gchar *info,
              gchar *location)
 {
-        cups_dest_t *dests;
         GDBusProxy  *proxy;
         gboolean     success = FALSE;
         GVariant    *output;
         GError      *error = NULL;
-        gint         num_dests;
-        gint         i;
 
         if (!printer_name || !device_uri || !ppd_name)
                 return FALSE;
@@ -502,11 +495,7 @@ add_printer (gchar *printer_name,
 
         g_object_unref (proxy);
 
-        num_dests = cupsGetDests (&dests);
-        for (i = 0; i < num_dests; i++)
-                if (g_strcmp0 (dests[i].name, printer_name) == 0)
-                        success = TRUE;
-        cupsFreeDests (num_dests, dests);
+        success = gsd_cups_dest_cache_update_dest (dest_cache, printer_name);
 
         return success;
 }
@@ -676,56 +665,20 @@ execute_maintenance_command (const char *printer_name,
         return response;
 }
 
-static char *
-get_dest_attr (const char *dest_name,
-               const char *attr)
-{
-        cups_dest_t *dests;
-        int          num_dests;
-        cups_dest_t *dest;
-        const char  *value;
-        char        *ret;
-
-        if (dest_name == NULL)
-                return NULL;
-
-        ret = NULL;
-
-        num_dests = cupsGetDests (&dests);
-        if (num_dests < 1) {
-                g_debug ("Unable to get printer destinations");
-                return NULL;
-        }
-
-        dest = cupsGetDest (dest_name, NULL, num_dests, dests);
-        if (dest == NULL) {
-                g_debug ("Unable to find a printer named '%s'", dest_name);
-                goto out;
-        }
-
-        value = cupsGetOption (attr, dest->num_options, dest->options);
-        if (value == NULL) {
-                g_debug ("Unable to get %s for '%s'", attr, dest_name);
-                goto out;
-        }
-        ret = g_strdup (value);
-out:
-        cupsFreeDests (num_dests, dests);
-
-        return ret;
-}
-
 static void
 printer_autoconfigure (gchar *printer_name)
 {
-        gchar *commands;
+        const gchar *commands;
         gchar *commands_lowercase;
         ipp_t *response = NULL;
 
         if (!printer_name)
                 return;
 
-        commands = get_dest_attr (printer_name, "printer-commands");
+        commands = gsd_cups_dest_cache_get_attr (dest_cache, printer_name, "printer-commands");
+        if (!commands)
+                return;
+
         commands_lowercase = g_ascii_strdown (commands, -1);
 
         if (g_strrstr (commands_lowercase, "autoconfigure")) {
@@ -738,7 +691,6 @@ printer_autoconfigure (gchar *printer_name)
                         ippDelete (response);
                 }
         }
-        g_free (commands);
         g_free (commands_lowercase);
 }
 
@@ -818,6 +770,9 @@ setup_printer (gchar *device_id,
         gchar    *ppd_name;
         gchar    *printer_name;
 
+        /* Printers may have come and gone since the last setup */
+        gsd_cups_dest_cache_invalidate (dest_cache);
+
         ppd_name = get_best_ppd (device_id, device_make_and_model, device_uri);
         printer_name = create_name (device_id);
 
@@ -1304,6 +1259,8 @@ main (int argc, char *argv[])
 
   notify_init ("gnome-settings-daemon-printer");
 
+  dest_cache = gsd_cups_dest_cache_new ();
+
   npn_introspection_data =
           g_dbus_node_info_new_for_xml (npn_introspection_xml, &error);
 
@@ -1389,6 +1346,8 @@ main (int argc, char *argv[])
   g_dbus_node_info_unref (npn_introspection_data);
   g_dbus_node_info_unref (pdi_introspection_data);
 
+  gsd_cups_dest_cache_free (dest_cache);
+
   return 0;
 
 error:
@@ -1399,5 +1358,7 @@ error:
   if (pdi_introspection_data)
           g_dbus_node_info_unref (pdi_introspection_data);
 
+  gsd_cups_dest_cache_free (dest_cache);
+
   return 1;
 }
@@ -99,10 +99,23 @@ struct GsdScreensaverProxyManagerPrivate
         GDBusNodeInfo           *introspection_data;
         guint                    name_id;
 
-        GHashTable              *watch_ht;  /* key = sender, value = name watch id */
+        GCancellable            *session_cancellable;
+
+        GHashTable              *sender_ht; /* key = sender, value = SenderData */
         GHashTable              *cookie_ht; /* key = cookie, value = sender */
 };
 
+typedef struct {
+        guint       watch_id;
+        GHashTable *cookies;   /* set of this sender's cookies */
+} SenderData;
+
+typedef struct {
+        GsdScreensaverProxyManager *manager;
+        GDBusMethodInvocation      *invocation;
+        gchar                      *sender;
+} InhibitData;
+
 static void     gsd_screensaver_proxy_manager_class_init  (GsdScreensaverProxyManagerClass *klass);
 static void     gsd_screensaver_proxy_manager_init        (GsdScreensaverProxyManager      *screensaver_proxy_manager);
 static void     gsd_screensaver_proxy_manager_finalize    (GObject             *object);
@@ -111,34 +124,166 @@ G_DEFINE_TYPE (GsdScreensaverProxyManager, gsd_screensaver_proxy_manager, G_TYPE
 
 static gpointer manager_object = NULL;
 
+static void
+sender_data_free (SenderData *data)
+{
+        g_bus_unwatch_name (data->watch_id);
+        g_hash_table_destroy (data->cookies);
+        g_free (data);
+}
+
 static void
 name_vanished_cb (GDBusConnection            *connection,
                   const gchar                *name,
                   GsdScreensaverProxyManager *manager)
 {
+        SenderData *data;
         GHashTableIter iter;
         gpointer cookie_ptr;
+
+        data = g_hash_table_lookup (manager->priv->sender_ht, name);
+        if (data == NULL)
+                return;
+
+        /* Uninhibit all the cookies under that name */
+        g_hash_table_iter_init (&iter, data->cookies);
+        while (g_hash_table_iter_next (&iter, &cookie_ptr, NULL)) {
+                guint cookie = GPOINTER_TO_UINT (cookie_ptr);
+
+                g_dbus_proxy_call (manager->priv->session,
+                                   "Uninhibit",
+                                   g_variant_new ("(u)", cookie),
+                                   G_DBUS_CALL_FLAGS_NONE,
+                                   -1,
+                                   manager->priv->session_cancellable,
+                                   NULL, NULL);
+                g_debug ("Removing cookie %u for sender %s",
+                         cookie, name);
+                g_hash_table_remove (manager->priv->cookie_ht, cookie_ptr);
+        }
+
+        g_hash_table_remove (manager->priv->sender_ht, name);
+}
+
+static void
+add_cookie (GsdScreensaverProxyManager *manager,
+            const char                 *sender,
+            guint                       cookie)
+{
+        SenderData *data;
+
+        data = g_hash_table_lookup (manager->priv->sender_ht, sender);
+        if (data == NULL) {
+                data = g_new0 (SenderData, 1);
+                data->cookies = g_hash_table_new (g_direct_hash, g_direct_equal);
+                /* If the sender is already gone, this will call
+                 * name_vanished_cb() straight away and clean up */
+                data->watch_id = g_bus_watch_name_on_connection (manager->priv->connection,
+                                                                 sender,
+                                                                 G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                                 NULL,
+                                                                 (GBusNameVanishedCallback) name_vanished_cb,
+                                                                 manager,
+                                                                 NULL);
+                g_hash_table_insert (manager->priv->sender_ht,
+                                     g_strdup (sender), data);
+        }
+
+        g_hash_table_add (data->cookies, GUINT_TO_POINTER (cookie));
+        g_hash_table_insert (manager->priv->cookie_ht,
+                             GUINT_TO_POINTER (cookie),
+                             g_strdup (sender));
+}
+
+static void
+remove_cookie (GsdScreensaverProxyManager *manager,
+               guint                       cookie)
+{
+        SenderData *data;
         const char *sender;
 
-        /* Look for all the cookies under that name,
-         * and call uninhibit for them */
-        g_hash_table_iter_init (&iter, manager->priv->cookie_ht);
-        while (g_hash_table_iter_next (&iter, &cookie_ptr, (gpointer *) &sender)) {
-                if (g_strcmp0 (sender, name) == 0) {
-                        guint cookie = GPOINTER_TO_UINT (cookie_ptr);
-
-                        g_dbus_proxy_call_sync (manager->priv->session,
-                                                "Uninhibit",
-                                                g_variant_new ("(u)", cookie),
-                                                G_DBUS_CALL_FLAGS_NONE,
-                                                -1, NULL, NULL);
-                        g_debug ("Removing cookie %u for sender %s",
-                                 cookie, sender);
-                        g_hash_table_iter_remove (&iter);
-                }
+        sender = g_hash_table_lookup (manager->priv->cookie_ht, GUINT_TO_POINTER (cookie));
+        if (sender == NULL)
+                return;
+
+        data = g_hash_table_lookup (manager->priv->sender_ht, sender);
+        if (data != NULL)
+                g_hash_table_remove (data->cookies, GUINT_TO_POINTER (cookie));
+
+        g_hash_table_remove (manager->priv->cookie_ht, GUINT_TO_POINTER (cookie));
+}
+
+static void
+inhibit_data_free (InhibitData *data)
+{
+        g_object_unref (data->manager);
+        g_object_unref (data->invocation);
+        g_free (data->sender);
+        g_free (data);
+}
+
+static void
+inhibit_cb (GObject      *source_object,
+            GAsyncResult *res,
+            InhibitData  *data)
+{
+        GVariant *ret;
+        GError *error = NULL;
+        guint cookie;
+
+        ret = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+        if (ret == NULL) {
+                g_warning ("Failed to inhibit the session for %s: %s",
+                           data->sender, error->message);
+                g_dbus_method_invocation_return_gerror (data->invocation, error);
+                g_error_free (error);
+                goto out;
+        }
+
+        g_variant_get (ret, "(u)", &cookie);
+
+        /* stopped while the call was in flight, so nothing would
+         * drop the inhibition when the sender goes away */
+        if (data->manager->priv->sender_ht == NULL) {
+                g_dbus_proxy_call (G_DBUS_PROXY (source_object),
+                                   "Uninhibit",
+                                   g_variant_new ("(u)", cookie),
+                                   G_DBUS_CALL_FLAGS_NONE,
+                                   -1, NULL, NULL, NULL);
+                g_dbus_method_invocation_return_error_literal (data->invocation,
+                                                               G_DBUS_ERROR,
+                                                               G_DBUS_ERROR_FAILED,
+                                                               "The screensaver proxy was stopped");
+                g_variant_unref (ret);
+                goto out;
         }
 
-        g_hash_table_remove (manager->priv->watch_ht, sender);
+        add_cookie (data->manager, data->sender, cookie);
+        g_dbus_method_invocation_return_value (data->invocation, ret);
+        g_variant_unref (ret);
+out:
+        inhibit_data_free (data);
+}
+
+static void
+uninhibit_cb (GObject               *source_object,
+              GAsyncResult          *res,
+              GDBusMethodInvocation *invocation)
+{
+        GVariant *ret;
+        GError *error = NULL;
+
+        ret = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+        if (ret == NULL) {
+                g_debug ("Failed to uninhibit the session: %s", error->message);
+                g_error_free (error);
+        } else {
+                g_variant_unref (ret);
+        }
+
+        /* Nothing the caller can do about a failure */
+        g_dbus_method_invocation_return_value (invocation, NULL);
+        g_object_unref (invocation);
 }
 
 static void
@@ -163,51 +308,45 @@ handle_method_call (GDBusConnection       *connection,
                  interface_name, method_name);
 
         if (g_strcmp0 (method_name, "Inhibit") == 0) {
-                GVariant *ret;
+                InhibitData *data;
                 const char *app_id;
                 const char *reason;
-                guint cookie;
 
                 g_variant_get (parameters,
-                               "(ss)", &app_id, &reason);
-
-                ret = g_dbus_proxy_call_sync (manager->priv->session,
-                                              "Inhibit",
-                                              g_variant_new ("(susu)",
-                                                             app_id, 0, reason, GSM_INHIBITOR_FLAG_IDLE),
-                                              G_DBUS_CALL_FLAGS_NONE,
-                                              -1, NULL, NULL);
-                g_variant_get (ret, "(u)", &cookie);
-                g_hash_table_insert (manager->priv->cookie_ht,
-                                     GUINT_TO_POINTER (cookie),
-                                     g_strdup (sender));
-                if (g_hash_table_lookup (manager->priv->watch_ht, sender) == NULL) {
-                        guint watch_id;
-
-                        watch_id = g_bus_watch_name_on_connection (manager->priv->connection,
-                                                                   sender,
-                                                                   G_BUS_NAME_WATCHER_FLAGS_NONE,
-                                                                   NULL,
-                                                                   (GBusNameVanishedCallback) name_vanished_cb,
-                                                                   manager,
-                                                                   NULL);
-                        g_hash_table_insert (manager->priv->watch_ht,
-                                             g_strdup (sender),
-                                             GUINT_TO_POINTER (watch_id));
-                }
-                g_dbus_method_invocation_return_value (invocation, ret);
+                               "(&s&s)", &app_id, &reason);
+
+                data = g_new0 (InhibitData, 1);
+                /* keeps the manager around until gnome-session replies */
+                data->manager = g_object_ref (manager);
+                data->invocation = g_object_ref (invocation);
+                data->sender = g_strdup (sender);
+
+                g_dbus_proxy_call (manager->priv->session,
+                                   "Inhibit",
+                                   g_variant_new ("(susu)",
+                                                  app_id, 0, reason, GSM_INHIBITOR_FLAG_IDLE),
+                                   G_DBUS_CALL_FLAGS_NONE,
+                                   -1,
+                                   /* not cancellable: gnome-session might
+                                    * create the inhibitor anyway, and we
+                                    * need the cookie to remove it */
+                                   NULL,
+                                   (GAsyncReadyCallback) inhibit_cb,
+                                   data);
         } else if (g_strcmp0 (method_name, "UnInhibit") == 0) {
                 guint cookie;
 
                 g_variant_get (parameters, "(u)", &cookie);
-                g_dbus_proxy_call_sync (manager->priv->session,
-                                        "Uninhibit",
-                                        parameters,
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        -1, NULL, NULL);
                 g_debug ("Removing cookie %u from the list for %s", cookie, sender);
-                g_hash_table_remove (manager->priv->cookie_ht, GUINT_TO_POINTER (cookie));
-                g_dbus_method_invocation_return_value (invocation, NULL);
+                remove_cookie (manager, cookie);
+                g_dbus_proxy_call (manager->priv->session,
+                                   "Uninhibit",
+                                   parameters,
+                                   G_DBUS_CALL_FLAGS_NONE,
+                                   -1,
+                                   manager->priv->session_cancellable,
+                                   (GAsyncReadyCallback) uninhibit_cb,
+                                   g_object_ref (invocation));
         } else if (g_strcmp0 (method_name, "Throttle") == 0) {
                 g_dbus_method_invocation_return_value (invocation, NULL);
         } else if (g_strcmp0 (method_name, "UnThrottle") == 0) {
@@ -302,10 +441,11 @@ gsd_screensaver_proxy_manager_start (GsdScreensaverProxyManager *manager,
         gnome_settings_profile_start (NULL);
         manager->priv->session =
                 gnome_settings_session_get_session_proxy ();
-        manager->priv->watch_ht = g_hash_table_new_full (g_str_hash,
-                                                         g_str_equal,
-                                                         (GDestroyNotify) g_free,
-                                                         (GDestroyNotify) g_bus_unwatch_name);
+        manager->priv->session_cancellable = g_cancellable_new ();
+        manager->priv->sender_ht = g_hash_table_new_full (g_str_hash,
+                                                          g_str_equal,
+                                                          (GDestroyNotify) g_free,
+                                                          (GDestroyNotify) sender_data_free);
         manager->priv->cookie_ht = g_hash_table_new_full (g_direct_hash,
                                                           g_direct_equal,
                                                           NULL,
@@ -318,8 +458,12 @@ void
 gsd_screensaver_proxy_manager_stop (GsdScreensaverProxyManager *manager)
 {
         g_debug ("Stopping screensaver_proxy manager");
+        if (manager->priv->session_cancellable != NULL) {
+                g_cancellable_cancel (manager->priv->session_cancellable);
+                g_clear_object (&manager->priv->session_cancellable);
+        }
         g_clear_object (&manager->priv->session);
-        g_clear_pointer (&manager->priv->watch_ht, g_hash_table_destroy);
+        g_clear_pointer (&manager->priv->sender_ht, g_hash_table_destroy);
         g_clear_pointer (&manager->priv->cookie_ht, g_hash_table_destroy);
 }
 
@@ -47,6 +47,7 @@
 #include <prinit.h>
 #include <nss.h>
 #include <pk11func.h>
+#include <pkcs11.h>
 #include <secmod.h>
 #include <secerr.h>
 
@@ -66,8 +67,24 @@
 #define GSD_OPEN_FILE_DESCRIPTORS_DIR "/proc/self/fd"
 #endif
 
+/* Modules that can't block in C_WaitForSlotEvent are checked by the
+ * worker, which then sleeps for an interval that doubles while nothing
+ * happens, and goes back to the minimum as soon as a card is inserted
+ * or removed
+ */
+#ifndef GSD_SMARTCARD_MANAGER_MIN_POLL_INTERVAL
+#define GSD_SMARTCARD_MANAGER_MIN_POLL_INTERVAL (250 * G_TIME_SPAN_MILLISECOND)
+#endif
+
+#ifndef GSD_SMARTCARD_MANAGER_MAX_POLL_INTERVAL
+#define GSD_SMARTCARD_MANAGER_MAX_POLL_INTERVAL (4 * G_TIME_SPAN_SECOND)
+#endif
+
 typedef enum _GsdSmartcardManagerState GsdSmartcardManagerState;
+typedef enum _GsdSmartcardManagerEventType GsdSmartcardManagerEventType;
 typedef struct _GsdSmartcardManagerWorker GsdSmartcardManagerWorker;
+typedef struct _GsdSmartcardManagerWatcher GsdSmartcardManagerWatcher;
+typedef struct _GsdSmartcardManagerEvent GsdSmartcardManagerEvent;
 
 enum _GsdSmartcardManagerState {
         GSD_SMARTCARD_MANAGER_STATE_STOPPED = 0,
@@ -81,9 +98,8 @@ struct _GsdSmartcardManagerPrivate {
         GList        *modules;
         char        *module_path;
 
-        GList        *workers;
+        GsdSmartcardManagerWorker *worker;
 
-        GPid smartcard_event_watcher_pid;
         GHashTable *smartcards;
 
         guint poll_timeout_id;
@@ -92,17 +108,57 @@ struct _GsdSmartcardManagerPrivate {
         guint32 nss_is_loaded : 1;
 };
 
+enum _GsdSmartcardManagerEventType {
+        GSD_SMARTCARD_MANAGER_EVENT_INSERTED = 0,
+        GSD_SMARTCARD_MANAGER_EVENT_REMOVED,
+        GSD_SMARTCARD_MANAGER_EVENT_ERROR,
+};
+
+/* Handed from the worker thread to the main loop through
+ * the worker's event queue
+ */
+struct _GsdSmartcardManagerEvent {
+        GsdSmartcardManagerEventType type;
+        SECMODModule *module;
+        char *card_name;
+        GError *error;
+};
+
+/* The single event source for all modules.  The manager is only
+ * touched from the main thread, and the watchers list doesn't change
+ * while the threads run; the queue, the reference count and the
+ * cancellation are shared with the threads.  The worker's own thread
+ * only exists if some modules have to be polled.
+ */
 struct _GsdSmartcardManagerWorker {
+        volatile gint ref_count;
+
         GsdSmartcardManager *manager;
-        int manager_fd;
+        GList *watchers;
+        GThread *thread;
+
+        GMutex lock;
+        GCond cond;
+        gboolean cancelled;
 
-        GThread      *thread;
+        GAsyncQueue *events;
+        volatile gint dispatch_queued;
+};
+
+/* PKCS #11 has no way to wait on several modules at once, so modules
+ * that can block in C_WaitForSlotEvent get a thread of their own that
+ * sleeps until a slot changes, or the wait is cancelled.  The others
+ * are polled by the worker thread.
+ */
+struct _GsdSmartcardManagerWatcher {
         SECMODModule *module;
-        GHashTable *smartcards;
-        int fd;
-        GSource *event_source;
+        gboolean can_block;
+        GThread *thread;
 
-        guint32 nss_is_loaded : 1;
+        /* only used by the thread watching the module */
+        GHashTable *smartcards;
+        gboolean has_pending_slot;
+        CK_SLOT_ID pending_slot;
 };
 
 static void gsd_smartcard_manager_finalize (GObject *object);
@@ -125,19 +181,13 @@ static void gsd_smartcard_manager_card_inserted_handler (GsdSmartcardManager *ma
 static gboolean gsd_smartcard_manager_stop_now (GsdSmartcardManager *manager);
 static void gsd_smartcard_manager_queue_stop (GsdSmartcardManager *manager);
 
-static GsdSmartcardManagerWorker *gsd_smartcard_manager_create_worker (GsdSmartcardManager  *manager,
-                                                                       SECMODModule         *module);
-
-static GsdSmartcardManagerWorker * gsd_smartcard_manager_worker_new (GsdSmartcardManager *manager,
-                                                                     int                  worker_fd,
-                                                                     int                  manager_fd,
-                                                                     SECMODModule        *module);
-static void gsd_smartcard_manager_worker_free (GsdSmartcardManagerWorker *worker);
-static gboolean open_pipe (int *write_fd, int *read_fd);
-static gboolean read_bytes (int fd, gpointer bytes, gsize num_bytes);
-static gboolean write_bytes (int fd, gconstpointer bytes, gsize num_bytes);
-static GsdSmartcard *read_smartcard (int fd, SECMODModule *module);
-static gboolean write_smartcard (int fd, GsdSmartcard *card);
+static GsdSmartcardManagerWorker *gsd_smartcard_manager_worker_new (GsdSmartcardManager *manager);
+static GsdSmartcardManagerWorker *gsd_smartcard_manager_worker_ref (GsdSmartcardManagerWorker *worker);
+static void gsd_smartcard_manager_worker_unref (GsdSmartcardManagerWorker *worker);
+static gboolean gsd_smartcard_manager_worker_start (GsdSmartcardManagerWorker *worker);
+static void gsd_smartcard_manager_worker_stop (GsdSmartcardManagerWorker *worker);
+static GsdSmartcardManagerWatcher *gsd_smartcard_manager_watcher_new (SECMODModule *module);
+static void gsd_smartcard_manager_watcher_free (GsdSmartcardManagerWatcher *watcher);
 
 enum {
         PROP_0 = 0,
@@ -439,102 +489,72 @@ gsd_smartcard_manager_emit_smartcard_removed (GsdSmartcardManager *manager,
         manager->priv->is_unstoppable = FALSE;
 }
 
-static gboolean
-gsd_smartcard_manager_check_for_and_process_events (GIOChannel          *io_channel,
-                                                    GIOCondition         condition,
-                                                    GsdSmartcardManagerWorker *worker)
+static void
+gsd_smartcard_manager_process_event (GsdSmartcardManager      *manager,
+                                     GsdSmartcardManagerEvent *event)
 {
         GsdSmartcard *card;
-        GsdSmartcardManager *manager;
-        gboolean should_stop;
-        guchar event_type;
         char *card_name;
-        int fd;
-
-        manager = worker->manager;
 
-        g_debug ("event!");
-        card = NULL;
-        should_stop = (condition & G_IO_HUP) || (condition & G_IO_ERR);
-
-        if (should_stop) {
-                g_debug ("received %s on event socket, stopping "
-                          "manager...",
-                          (condition & G_IO_HUP) && (condition & G_IO_ERR)?
-                          "error and hangup" :
-                          (condition & G_IO_HUP)?
-                          "hangup" : "error");
-        }
-
-        if (!(condition & G_IO_IN)) {
-                g_debug ("nevermind outta here!");
-                goto out;
+        if (event->type == GSD_SMARTCARD_MANAGER_EVENT_ERROR) {
+                g_debug ("could not process card event - %s", event->error->message);
+                gsd_smartcard_manager_emit_error (manager, event->error);
+                gsd_smartcard_manager_stop_now (manager);
+                return;
         }
 
-        fd = g_io_channel_unix_get_fd (io_channel);
+        card = _gsd_smartcard_new_from_name (event->module, event->card_name);
+        card_name = gsd_smartcard_get_name (card);
+        g_debug ("card '%s' had event %s", card_name,
+                 event->type == GSD_SMARTCARD_MANAGER_EVENT_INSERTED ? "insertion" : "removal");
 
-        event_type = '\0';
-        if (!read_bytes (fd, &event_type, 1)) {
-                g_debug ("could not read event type, stopping");
-                should_stop = TRUE;
-                goto out;
+        if (event->type == GSD_SMARTCARD_MANAGER_EVENT_INSERTED) {
+                g_hash_table_replace (manager->priv->smartcards,
+                                      card_name, card);
+                gsd_smartcard_manager_emit_smartcard_inserted (manager, card);
+        } else {
+                gsd_smartcard_manager_emit_smartcard_removed (manager, card);
+                if (!g_hash_table_remove (manager->priv->smartcards, card_name)) {
+                        g_debug ("got removal event of unknown card!");
+                }
+                g_free (card_name);
         }
+}
 
-        card = read_smartcard (fd, worker->module);
-
-        if (card == NULL) {
-                g_debug ("could not read card, stopping");
-                should_stop = TRUE;
-                goto out;
+static void
+gsd_smartcard_manager_event_free (GsdSmartcardManagerEvent *event)
+{
+        if (event->module != NULL) {
+                SECMOD_DestroyModule (event->module);
         }
-
-        card_name = gsd_smartcard_get_name (card);
-        g_debug ("card '%s' had event %c", card_name, event_type);
-
-        switch (event_type) {
-                case 'I':
-                        g_hash_table_replace (manager->priv->smartcards,
-                                              card_name, card);
-                        card_name = NULL;
-
-                        gsd_smartcard_manager_emit_smartcard_inserted (manager, card);
-                        card = NULL;
-                        break;
-
-                case 'R':
-                        gsd_smartcard_manager_emit_smartcard_removed (manager, card);
-                        if (!g_hash_table_remove (manager->priv->smartcards, card_name)) {
-                                g_debug ("got removal event of unknown card!");
-                        }
-                        g_free (card_name);
-                        card_name = NULL;
-                        card = NULL;
-                        break;
-
-                default:
-                        g_free (card_name);
-                        card_name = NULL;
-                        g_object_unref (card);
-
-                        should_stop = TRUE;
-                        break;
+        g_free (event->card_name);
+        if (event->error != NULL) {
+                g_error_free (event->error);
         }
+        g_slice_free (GsdSmartcardManagerEvent, event);
+}
 
-out:
-        if (should_stop) {
-                GError *error;
+static gboolean
+gsd_smartcard_manager_dispatch_events (GsdSmartcardManagerWorker *worker)
+{
+        GsdSmartcardManagerEvent *event;
 
-                error = g_error_new (GSD_SMARTCARD_MANAGER_ERROR,
-                                     GSD_SMARTCARD_MANAGER_ERROR_WATCHING_FOR_EVENTS,
-                                     "%s", (condition & G_IO_IN) ? g_strerror (errno) : _("received error or hang up from event source"));
+        /* clear the flag first, so that an event queued while we
+         * drain the queue is guaranteed another dispatch
+         */
+        g_atomic_int_set (&worker->dispatch_queued, 0);
 
-                gsd_smartcard_manager_emit_error (manager, error);
-                g_error_free (error);
-                gsd_smartcard_manager_stop_now (manager);
-                return FALSE;
+        while ((event = g_async_queue_try_pop (worker->events)) != NULL) {
+                /* the manager goes away when it's stopped, which can
+                 * happen while processing one of the events
+                 */
+                if (worker->manager != NULL) {
+                        gsd_smartcard_manager_process_event (worker->manager, event);
+                }
+                gsd_smartcard_manager_event_free (event);
         }
 
-        return TRUE;
+        return FALSE;
 }
 
 static void
@@ -550,88 +570,31 @@ stop_manager (GsdSmartcardManager *manager)
 }
 
 static void
-stop_worker (GsdSmartcardManagerWorker *worker)
+gsd_smartcard_manager_stop_watching_for_events (GsdSmartcardManager  *manager)
 {
-        GsdSmartcardManager *manager;
+        GsdSmartcardManagerWorker *worker;
 
-        manager = worker->manager;
+        worker = manager->priv->worker;
+        if (worker != NULL) {
+                manager->priv->worker = NULL;
 
-        if (worker->event_source != NULL) {
-                g_source_destroy (worker->event_source);
-                worker->event_source = NULL;
-        }
+                /* waits for the threads, so NSS isn't in use when it's
+                 * shut down below
+                 */
+                gsd_smartcard_manager_worker_stop (worker);
+                g_list_free_full (worker->watchers,
+                                  (GDestroyNotify) gsd_smartcard_manager_watcher_free);
+                worker->watchers = NULL;
+                worker->manager = NULL;
 
-        if (worker->thread != NULL) {
-                SECMOD_CancelWait (worker->module);
-                worker->thread = NULL;
+                gsd_smartcard_manager_worker_unref (worker);
         }
 
-        SECMOD_DestroyModule (worker->module);
-        manager->priv->workers = g_list_remove (manager->priv->workers, worker);
-
-        if (manager->priv->workers == NULL && manager->priv->state != GSD_SMARTCARD_MANAGER_STATE_STOPPED) {
+        if (manager->priv->state != GSD_SMARTCARD_MANAGER_STATE_STOPPED) {
                 stop_manager (manager);
         }
 }
 
-static void
-gsd_smartcard_manager_event_processing_stopped_handler (GsdSmartcardManagerWorker *worker)
-{
-        worker->event_source = NULL;
-
-        stop_worker (worker);
-}
-
-static gboolean
-open_pipe (int *write_fd,
-           int *read_fd)
-{
-        int pipe_fds[2] = { -1, -1 };
-
-        g_assert (write_fd != NULL);
-        g_assert (read_fd != NULL);
-
-        if (pipe (pipe_fds) < 0) {
-                return FALSE;
-        }
-
-        if (fcntl (pipe_fds[0], F_SETFD, FD_CLOEXEC) < 0) {
-                close (pipe_fds[0]);
-                close (pipe_fds[1]);
-                return FALSE;
-        }
-
-        if (fcntl (pipe_fds[1], F_SETFD, FD_CLOEXEC) < 0) {
-                close (pipe_fds[0]);
-                close (pipe_fds[1]);
-                return FALSE;
-        }
-
-        *read_fd = pipe_fds[0];
-        *write_fd = pipe_fds[1];
-
-        return TRUE;
-}
-
-static void
-gsd_smartcard_manager_stop_watching_for_events (GsdSmartcardManager  *manager)
-{
-        GList *node;
-
-        node = manager->priv->workers;
-        while (node != NULL) {
-                GsdSmartcardManagerWorker *worker;
-                GList *next_node;
-
-                worker = (GsdSmartcardManagerWorker *) node->data;
-                next_node = node->next;
-
-                stop_worker (worker);
-
-                node = next_node;
-        }
-}
-
 static gboolean
 load_nss (GError **error)
 {
@@ -831,23 +794,23 @@ gsd_smartcard_manager_get_all_cards (GsdSmartcardManager *manager)
         GList *node;
         int i;
 
-        node = manager->priv->workers;
+        node = manager->priv->worker->watchers;
         while (node != NULL) {
 
-                GsdSmartcardManagerWorker *worker;
+                GsdSmartcardManagerWatcher *watcher;
 
-                worker = (GsdSmartcardManagerWorker *) node->data;
+                watcher = (GsdSmartcardManagerWatcher *) node->data;
 
-                for (i = 0; i < worker->module->slotCount; i++) {
+                for (i = 0; i < watcher->module->slotCount; i++) {
                         GsdSmartcard *card;
                         CK_SLOT_ID    slot_id;
                         int          slot_series;
                         char         *card_name;
 
-                        slot_id = PK11_GetSlotID (worker->module->slots[i]);
-                        slot_series = PK11_GetSlotSeries (worker->module->slots[i]);
+                        slot_id = PK11_GetSlotID (watcher->module->slots[i]);
+                        slot_series = PK11_GetSlotSeries (watcher->module->slots[i]);
 
-                        card = _gsd_smartcard_new (worker->module,
+                        card = _gsd_smartcard_new (watcher->module,
                                                    slot_id, slot_series);
 
                         card_name = gsd_smartcard_get_name (card);
@@ -859,71 +822,29 @@ gsd_smartcard_manager_get_all_cards (GsdSmartcardManager *manager)
         }
 }
 
-static GsdSmartcardManagerWorker *
-start_worker (GsdSmartcardManager  *manager,
-              SECMODModule         *module,
-              GError              **error)
-{
-        GIOChannel *io_channel;
-        GSource *source;
-        GsdSmartcardManagerWorker *worker;
-
-        worker = gsd_smartcard_manager_create_worker (manager, module);
-
-        if (worker == NULL) {
-                g_set_error (error,
-                             GSD_SMARTCARD_MANAGER_ERROR,
-                             GSD_SMARTCARD_MANAGER_ERROR_WATCHING_FOR_EVENTS,
-                             _("could not watch for incoming card events - %s"),
-                             g_strerror (errno));
-
-                goto out;
-        }
-
-        io_channel = g_io_channel_unix_new (worker->manager_fd);
-
-        source = g_io_create_watch (io_channel, G_IO_IN | G_IO_HUP);
-        g_io_channel_unref (io_channel);
-        io_channel = NULL;
-
-        worker->event_source = source;
-
-        g_source_set_callback (worker->event_source,
-                               (GSourceFunc) (GIOFunc)
-                               gsd_smartcard_manager_check_for_and_process_events,
-                               worker,
-                               (GDestroyNotify)
-                               gsd_smartcard_manager_event_processing_stopped_handler);
-        g_source_attach (worker->event_source, NULL);
-        g_source_unref (worker->event_source);
-out:
-        return worker;
-}
-
 static void
-start_workers (GsdSmartcardManager *manager)
+start_worker (GsdSmartcardManager *manager)
 {
+        GsdSmartcardManagerWorker *worker;
         GList        *node;
 
+        worker = gsd_smartcard_manager_worker_new (manager);
+        manager->priv->worker = worker;
+
         node = manager->priv->modules;
         while (node != NULL) {
                 SECMODModule *module;
-                GsdSmartcardManagerWorker *worker;
-                GError *error;
 
                 module = (SECMODModule *) node->data;
-
-                error = NULL;
-                worker = start_worker (manager, module, &error);
-                if (worker == NULL) {
-                        g_warning ("%s", error->message);
-                        g_error_free (error);
-                } else {
-                        manager->priv->workers = g_list_prepend (manager->priv->workers,
-                                                                 worker);
-                }
+                worker->watchers = g_list_prepend (worker->watchers,
+                                                   gsd_smartcard_manager_watcher_new (module));
                 node = node->next;
         }
+
+        if (!gsd_smartcard_manager_worker_start (worker)) {
+                g_warning (_("could not watch for incoming card events - %s"),
+                           g_strerror (errno));
+        }
 }
 
 gboolean
@@ -953,7 +874,7 @@ gsd_smartcard_manager_start (GsdSmartcardManager  *manager,
                 }
         }
 
-        start_workers (manager);
+        start_worker (manager);
 
         /* populate the hash with cards that are already inserted
          */
@@ -1038,233 +959,201 @@ gsd_smartcard_manager_login_card_is_inserted (GsdSmartcardManager *manager)
 }
 
 static GsdSmartcardManagerWorker *
-gsd_smartcard_manager_worker_new (GsdSmartcardManager *manager,
-                                  int                 worker_fd,
-                                  int                 manager_fd,
-                                  SECMODModule        *module)
+gsd_smartcard_manager_worker_new (GsdSmartcardManager *manager)
 {
         GsdSmartcardManagerWorker *worker;
 
         worker = g_slice_new0 (GsdSmartcardManagerWorker);
+        worker->ref_count = 1;
         worker->manager = manager;
-        worker->fd = worker_fd;
-        worker->manager_fd = manager_fd;
-        worker->module = module;
+        g_mutex_init (&worker->lock);
+        g_cond_init (&worker->cond);
+        worker->events = g_async_queue_new_full ((GDestroyNotify) gsd_smartcard_manager_event_free);
 
-        worker->smartcards =
-                g_hash_table_new_full ((GHashFunc) slot_id_hash,
-                                       (GEqualFunc) slot_id_equal,
-                                       (GDestroyNotify) g_free,
-                                       (GDestroyNotify) g_object_unref);
+        return worker;
+}
 
+static GsdSmartcardManagerWorker *
+gsd_smartcard_manager_worker_ref (GsdSmartcardManagerWorker *worker)
+{
+        g_atomic_int_inc (&worker->ref_count);
         return worker;
 }
 
 static void
-gsd_smartcard_manager_worker_free (GsdSmartcardManagerWorker *worker)
+gsd_smartcard_manager_worker_unref (GsdSmartcardManagerWorker *worker)
 {
-        if (worker->smartcards != NULL) {
-                g_hash_table_destroy (worker->smartcards);
-                worker->smartcards = NULL;
+        if (!g_atomic_int_dec_and_test (&worker->ref_count)) {
+                return;
         }
 
+        g_assert (worker->watchers == NULL);
+        g_assert (worker->thread == NULL);
+        g_mutex_clear (&worker->lock);
+        g_cond_clear (&worker->cond);
+        g_async_queue_unref (worker->events);
         g_slice_free (GsdSmartcardManagerWorker, worker);
 }
 
-static gboolean
-read_bytes (int      fd,
-            gpointer bytes,
-            gsize    num_bytes)
+/* Called from the worker thread */
+static void
+gsd_smartcard_manager_worker_queue_event (GsdSmartcardManagerWorker    *worker,
+                                          GsdSmartcardManagerEventType  type,
+                                          SECMODModule                 *module,
+                                          GsdSmartcard                 *card,
+                                          GError                       *error)
 {
-        size_t bytes_left;
-        size_t total_bytes_read;
-        ssize_t bytes_read;
-
-        bytes_left = (size_t) num_bytes;
-        total_bytes_read = 0;
-
-        do {
-                bytes_read = read (fd,
-                                   (char *) bytes + total_bytes_read,
-                                   bytes_left);
-                g_assert (bytes_read <= (ssize_t) bytes_left);
-
-                if (bytes_read <= 0) {
-                        if ((bytes_read < 0) && (errno == EINTR || errno == EAGAIN)) {
-                                continue;
-                        }
-
-                        bytes_left = 0;
-                } else {
-                        bytes_left -= bytes_read;
-                        total_bytes_read += bytes_read;
-                }
-        } while (bytes_left > 0);
+        GsdSmartcardManagerEvent *event;
+        GSource *source;
 
-        if (total_bytes_read <  (size_t) num_bytes) {
-                return FALSE;
+        event = g_slice_new0 (GsdSmartcardManagerEvent);
+        event->type = type;
+        if (module != NULL) {
+                event->module = SECMOD_ReferenceModule (module);
+        }
+        if (card != NULL) {
+                event->card_name = gsd_smartcard_get_name (card);
+        }
+        event->error = error;
+
+        g_async_queue_push (worker->events, event);
+
+        /* a burst of events only wakes up the main loop once */
+        if (g_atomic_int_compare_and_exchange (&worker->dispatch_queued, 0, 1)) {
+                source = g_idle_source_new ();
+                g_source_set_priority (source, G_PRIORITY_DEFAULT);
+                g_source_set_callback (source,
+                                       (GSourceFunc) gsd_smartcard_manager_dispatch_events,
+                                       gsd_smartcard_manager_worker_ref (worker),
+                                       (GDestroyNotify) gsd_smartcard_manager_worker_unref);
+                g_source_set_name (source, "[gnome-settings-daemon] gsd_smartcard_manager_dispatch_events");
+                g_source_attach (source, NULL);
+                g_source_unref (source);
         }
-
-        return TRUE;
 }
 
-static gboolean
-write_bytes (int           fd,
-             gconstpointer bytes,
-             gsize         num_bytes)
+/* Asks the module whether it supports waiting for slot events.  The
+ * only way to find out is to check for an event, so one that happens
+ * to be pending is kept for the watcher to process first.
+ */
+static void
+gsd_smartcard_manager_watcher_probe (GsdSmartcardManagerWatcher *watcher)
 {
-        size_t bytes_left;
-        size_t total_bytes_written;
-        ssize_t bytes_written;
-
-        bytes_left = (size_t) num_bytes;
-        total_bytes_written = 0;
-
-        do {
-                bytes_written = write (fd,
-                                       (char *) bytes + total_bytes_written,
-                                       bytes_left);
-                g_assert (bytes_written <= (ssize_t) bytes_left);
+        CK_FUNCTION_LIST_PTR functions;
+        CK_RV rv;
 
-                if (bytes_written <= 0) {
-                        if ((bytes_written < 0) && (errno == EINTR || errno == EAGAIN)) {
-                                continue;
-                        }
-
-                        bytes_left = 0;
-                } else {
-                        bytes_left -= bytes_written;
-                        total_bytes_written += bytes_written;
-                }
-        } while (bytes_left > 0);
+        functions = (CK_FUNCTION_LIST_PTR) watcher->module->functionList;
+        if (functions == NULL || functions->C_WaitForSlotEvent == NULL) {
+                return;
+        }
 
-        if (total_bytes_written <  (size_t) num_bytes) {
-                return FALSE;
+        rv = functions->C_WaitForSlotEvent (CKF_DONT_BLOCK, &watcher->pending_slot, NULL);
+        if (rv == CKR_OK) {
+                watcher->has_pending_slot = TRUE;
         }
+        watcher->can_block = (rv == CKR_OK || rv == CKR_NO_EVENT);
 
-        return TRUE;
+        g_debug ("module '%s' %s wait for slot events",
+                 watcher->module->commonName,
+                 watcher->can_block ? "can" : "can't");
 }
 
-static GsdSmartcard *
-read_smartcard (int           fd,
-                SECMODModule *module)
+static GsdSmartcardManagerWatcher *
+gsd_smartcard_manager_watcher_new (SECMODModule *module)
 {
-        GsdSmartcard *card;
-        char *card_name;
-        gsize card_name_size;
+        GsdSmartcardManagerWatcher *watcher;
 
-        card_name_size = 0;
-        if (!read_bytes (fd, &card_name_size, sizeof (card_name_size))) {
-                return NULL;
-        }
+        watcher = g_slice_new0 (GsdSmartcardManagerWatcher);
+        watcher->module = SECMOD_ReferenceModule (module);
+        gsd_smartcard_manager_watcher_probe (watcher);
 
-        card_name = g_slice_alloc0 (card_name_size);
-        if (!read_bytes (fd, card_name, card_name_size)) {
-                g_slice_free1 (card_name_size, card_name);
-                return NULL;
-        }
-        card = _gsd_smartcard_new_from_name (module, card_name);
-        g_slice_free1 (card_name_size, card_name);
+        watcher->smartcards =
+                g_hash_table_new_full ((GHashFunc) slot_id_hash,
+                                       (GEqualFunc) slot_id_equal,
+                                       (GDestroyNotify) g_free,
+                                       (GDestroyNotify) g_object_unref);
 
-        return card;
+        return watcher;
 }
 
-static gboolean
-write_smartcard (int          fd,
-                    GsdSmartcard *card)
+static void
+gsd_smartcard_manager_watcher_free (GsdSmartcardManagerWatcher *watcher)
 {
-        gsize card_name_size;
-        char *card_name;
-
-        card_name = gsd_smartcard_get_name (card);
-        card_name_size = strlen (card_name) + 1;
-
-        if (!write_bytes (fd, &card_name_size, sizeof (card_name_size))) {
-                g_free (card_name);
-                return FALSE;
-        }
-
-        if (!write_bytes (fd, card_name, card_name_size)) {
-                g_free (card_name);
-                return FALSE;
-        }
-        g_free (card_name);
+        g_hash_table_destroy (watcher->smartcards);
+        SECMOD_DestroyModule (watcher->module);
 
-        return TRUE;
+        g_slice_free (GsdSmartcardManagerWatcher, watcher);
 }
 
-static gboolean
-gsd_smartcard_manager_worker_emit_smartcard_removed (GsdSmartcardManagerWorker  *worker,
-                                                     GsdSmartcard               *card,
-                                                     GError                    **error)
+static void
+gsd_smartcard_manager_watcher_emit_smartcard_removed (GsdSmartcardManagerWorker  *worker,
+                                                      GsdSmartcardManagerWatcher *watcher,
+                                                      GsdSmartcard               *card)
 {
         g_debug ("card '%s' removed!", gsd_smartcard_get_name (card));
 
-        if (!write_bytes (worker->fd, "R", 1)) {
-                goto error_out;
-        }
-
-        if (!write_smartcard (worker->fd, card)) {
-                goto error_out;
-        }
-
-        return TRUE;
-
-error_out:
-        g_set_error (error, GSD_SMARTCARD_MANAGER_ERROR,
-                     GSD_SMARTCARD_MANAGER_ERROR_REPORTING_EVENTS,
-                     "%s", g_strerror (errno));
-        return FALSE;
+        gsd_smartcard_manager_worker_queue_event (worker,
+                                                  GSD_SMARTCARD_MANAGER_EVENT_REMOVED,
+                                                  watcher->module, card, NULL);
 }
 
-static gboolean
-gsd_smartcard_manager_worker_emit_smartcard_inserted (GsdSmartcardManagerWorker  *worker,
-                                                      GsdSmartcard               *card,
-                                                      GError                    **error)
+static void
+gsd_smartcard_manager_watcher_emit_smartcard_inserted (GsdSmartcardManagerWorker  *worker,
+                                                       GsdSmartcardManagerWatcher *watcher,
+                                                       GsdSmartcard               *card)
 {
         g_debug ("card '%s' inserted!", gsd_smartcard_get_name (card));
-        if (!write_bytes (worker->fd, "I", 1)) {
-                goto error_out;
-        }
 
-        if (!write_smartcard (worker->fd, card)) {
-                goto error_out;
-        }
-
-        return TRUE;
-
-error_out:
-        g_set_error (error, GSD_SMARTCARD_MANAGER_ERROR,
-                     GSD_SMARTCARD_MANAGER_ERROR_REPORTING_EVENTS,
-                     "%s", g_strerror (errno));
-        return FALSE;
+        gsd_smartcard_manager_worker_queue_event (worker,
+                                                  GSD_SMARTCARD_MANAGER_EVENT_INSERTED,
+                                                  watcher->module, card, NULL);
 }
 
+static gboolean gsd_smartcard_manager_worker_is_cancelled (GsdSmartcardManagerWorker *worker);
+
+/* Returns TRUE if there was an event on one of the module's slots,
+ * FALSE if there was none, the wait was cancelled, or on error
+ */
 static gboolean
-gsd_smartcard_manager_worker_watch_for_and_process_event (GsdSmartcardManagerWorker  *worker,
-                                                          GError                    **error)
+gsd_smartcard_manager_watcher_process_event (GsdSmartcardManagerWorker   *worker,
+                                             GsdSmartcardManagerWatcher  *watcher,
+                                             gboolean                     block,
+                                             GError                     **error)
 {
-        PK11SlotInfo *slot;
+        PK11SlotInfo *slot = NULL;
         CK_SLOT_ID slot_id, *key = NULL;
         int slot_series, card_slot_series;
         GsdSmartcard *card;
-        GError *processing_error;
-        gboolean ret;
 
-        g_debug ("waiting for card event");
-        ret = FALSE;
+        if (watcher->has_pending_slot) {
+                watcher->has_pending_slot = FALSE;
+                slot = SECMOD_LookupSlot (watcher->module->moduleID,
+                                          watcher->pending_slot);
+        }
 
-        slot = SECMOD_WaitForAnyTokenEvent (worker->module, 0, PR_SecondsToInterval (1));
+        if (slot == NULL && block) {
+                /* this only returns when a slot changes or the wait
+                 * is cancelled
+                 */
+                slot = SECMOD_WaitForAnyTokenEvent (watcher->module, 0,
+                                                    PR_SecondsToInterval (1));
 
-        processing_error = NULL;
+                if (gsd_smartcard_manager_worker_is_cancelled (worker)) {
+                        if (slot != NULL) {
+                                PK11_FreeSlot (slot);
+                        }
+                        return FALSE;
+                }
+        } else if (slot == NULL) {
+                slot = SECMOD_WaitForAnyTokenEvent (watcher->module, CKF_DONT_BLOCK, 0);
+        }
 
         if (slot == NULL) {
                 int error_code;
 
                 error_code = PORT_GetError ();
                 if ((error_code == 0) || (error_code == SEC_ERROR_NO_EVENT)) {
-                        g_debug ("spurrious event occurred");
-                        return TRUE;
+                        return FALSE;
                 }
 
                 /* FIXME: is there a function to convert from a PORT error
@@ -1274,7 +1163,7 @@ gsd_smartcard_manager_worker_watch_for_and_process_event (GsdSmartcardManagerWor
                              GSD_SMARTCARD_MANAGER_ERROR_WITH_NSS,
                              _("encountered unexpected error while "
                                "waiting for smartcard events"));
-                goto out;
+                return FALSE;
         }
 
         /* the slot id and series together uniquely identify a card.
@@ -1289,7 +1178,7 @@ gsd_smartcard_manager_worker_watch_for_and_process_event (GsdSmartcardManagerWor
          */
         key = g_new (CK_SLOT_ID, 1);
         *key = slot_id;
-        card = g_hash_table_lookup (worker->smartcards, key);
+        card = g_hash_table_lookup (watcher->smartcards, key);
 
         if (card != NULL) {
                 card_slot_series = gsd_smartcard_get_slot_series (card);
@@ -1305,23 +1194,17 @@ gsd_smartcard_manager_worker_watch_for_and_process_event (GsdSmartcardManagerWor
                  */
                 if ((card != NULL) &&
                     card_slot_series != slot_series) {
-                        if (!gsd_smartcard_manager_worker_emit_smartcard_removed (worker, card, &processing_error)) {
-                                g_propagate_error (error, processing_error);
-                                goto out;
-                        }
+                        gsd_smartcard_manager_watcher_emit_smartcard_removed (worker, watcher, card);
                 }
 
-                card = _gsd_smartcard_new (worker->module,
+                card = _gsd_smartcard_new (watcher->module,
                                            slot_id, slot_series);
 
-                g_hash_table_replace (worker->smartcards,
+                g_hash_table_replace (watcher->smartcards,
                                       key, card);
                 key = NULL;
 
-                if (!gsd_smartcard_manager_worker_emit_smartcard_inserted (worker, card, &processing_error)) {
-                        g_propagate_error (error, processing_error);
-                        goto out;
-                }
+                gsd_smartcard_manager_watcher_emit_smartcard_inserted (worker, watcher, card);
         } else {
                 /* if we aren't tracking the card, just discard the event.
                  * We don't want unpaired remove events.  Note on startup
@@ -1337,93 +1220,213 @@ gsd_smartcard_manager_worker_watch_for_and_process_event (GsdSmartcardManagerWor
                          */
                         if ((slot_series - card_slot_series) > 1) {
 
-                                if (!gsd_smartcard_manager_worker_emit_smartcard_removed (worker, card, &processing_error)) {
-                                        g_propagate_error (error, processing_error);
-                                        goto out;
-                                }
-                                g_hash_table_remove (worker->smartcards, key);
+                                gsd_smartcard_manager_watcher_emit_smartcard_removed (worker, watcher, card);
+                                g_hash_table_remove (watcher->smartcards, key);
 
-                                card = _gsd_smartcard_new (worker->module,
+                                card = _gsd_smartcard_new (watcher->module,
                                                                 slot_id, slot_series);
-                                g_hash_table_replace (worker->smartcards,
+                                g_hash_table_replace (watcher->smartcards,
                                                       key, card);
-                                key = NULL;
-                                if (!gsd_smartcard_manager_worker_emit_smartcard_inserted (worker, card, &processing_error)) {
-                                        g_propagate_error (error, processing_error);
-                                        goto out;
-                                }
+                                key = g_new (CK_SLOT_ID, 1);
+                                *key = slot_id;
+                                gsd_smartcard_manager_watcher_emit_smartcard_inserted (worker, watcher, card);
                         }
 
-                        if (!gsd_smartcard_manager_worker_emit_smartcard_removed (worker, card, &processing_error)) {
-                                g_propagate_error (error, processing_error);
-                                goto out;
-                        }
+                        gsd_smartcard_manager_watcher_emit_smartcard_removed (worker, watcher, card);
 
-                        g_hash_table_remove (worker->smartcards, key);
+                        g_hash_table_remove (watcher->smartcards, key);
                         card = NULL;
                 } else {
                         g_debug ("got spurious remove event");
                 }
         }
 
-        ret = TRUE;
-
-out:
         g_free (key);
         PK11_FreeSlot (slot);
 
-        return ret;
+        return TRUE;
 }
 
-static void
+static gboolean
+gsd_smartcard_manager_worker_is_cancelled (GsdSmartcardManagerWorker *worker)
+{
+        gboolean cancelled;
+
+        g_mutex_lock (&worker->lock);
+        cancelled = worker->cancelled;
+        g_mutex_unlock (&worker->lock);
+
+        return cancelled;
+}
+
+static gpointer
 gsd_smartcard_manager_worker_run (GsdSmartcardManagerWorker *worker)
 {
         GError *error;
-        gboolean should_continue;
+        GList *node;
+        gboolean had_event;
+        gint64 interval;
+        gint64 end_time;
+
+        error = NULL;
+        interval = GSD_SMARTCARD_MANAGER_MIN_POLL_INTERVAL;
+
+        while (!gsd_smartcard_manager_worker_is_cancelled (worker)) {
+                had_event = FALSE;
 
-        do
-        {
-                error = NULL;
-                should_continue = gsd_smartcard_manager_worker_watch_for_and_process_event (worker, &error);
+                for (node = worker->watchers; node != NULL; node = node->next) {
+                        GsdSmartcardManagerWatcher *watcher;
+
+                        watcher = (GsdSmartcardManagerWatcher *) node->data;
+                        if (watcher->can_block) {
+                                continue;
+                        }
+
+                        /* drain everything the module has for us */
+                        while (gsd_smartcard_manager_watcher_process_event (worker, watcher, FALSE, &error)) {
+                                had_event = TRUE;
+                        }
+
+                        if (error != NULL) {
+                                goto out;
+                        }
+                }
+
+                if (had_event) {
+                        interval = GSD_SMARTCARD_MANAGER_MIN_POLL_INTERVAL;
+                } else {
+                        interval = MIN (interval * 2, GSD_SMARTCARD_MANAGER_MAX_POLL_INTERVAL);
+                }
+
+                end_time = g_get_monotonic_time () + interval;
+                g_mutex_lock (&worker->lock);
+                while (!worker->cancelled) {
+                        if (!g_cond_wait_until (&worker->cond, &worker->lock, end_time)) {
+                                break;
+                        }
+                }
+                g_mutex_unlock (&worker->lock);
         }
-        while (should_continue);
 
+        g_debug ("stopped waiting for card events");
+
+out:
+        /* the main loop stops the manager when it gets this */
         if (error != NULL)  {
-                g_debug ("could not process card event - %s", error->message);
-                g_error_free (error);
+                gsd_smartcard_manager_worker_queue_event (worker,
+                                                          GSD_SMARTCARD_MANAGER_EVENT_ERROR,
+                                                          NULL, NULL, error);
         }
 
-        gsd_smartcard_manager_worker_free (worker);
+        return NULL;
 }
 
-static GsdSmartcardManagerWorker *
-gsd_smartcard_manager_create_worker (GsdSmartcardManager  *manager,
-                                     SECMODModule         *module)
-{
+typedef struct {
         GsdSmartcardManagerWorker *worker;
-        int write_fd, read_fd;
+        GsdSmartcardManagerWatcher *watcher;
+} GsdSmartcardManagerWatcherThread;
+
+static gpointer
+gsd_smartcard_manager_watcher_run (GsdSmartcardManagerWatcherThread *data)
+{
+        GsdSmartcardManagerWorker *worker = data->worker;
+        GsdSmartcardManagerWatcher *watcher = data->watcher;
+        GError *error;
+
+        g_free (data);
 
-        write_fd = -1;
-        read_fd = -1;
-        if (!open_pipe (&write_fd, &read_fd)) {
-                return NULL;
+        error = NULL;
+        while (!gsd_smartcard_manager_worker_is_cancelled (worker)) {
+                gsd_smartcard_manager_watcher_process_event (worker, watcher, TRUE, &error);
+                if (error != NULL) {
+                        break;
+                }
         }
 
-        worker = gsd_smartcard_manager_worker_new (manager,
-                                                   write_fd,
-                                                   read_fd,
-                                                   module);
+        g_debug ("stopped waiting for card events from '%s'",
+                 watcher->module->commonName);
+
+        /* the main loop stops the manager when it gets this */
+        if (error != NULL)  {
+                gsd_smartcard_manager_worker_queue_event (worker,
+                                                          GSD_SMARTCARD_MANAGER_EVENT_ERROR,
+                                                          NULL, NULL, error);
+        }
 
-        worker->thread = g_thread_create ((GThreadFunc)
-                                          gsd_smartcard_manager_worker_run,
-                                          worker, FALSE, NULL);
+        return NULL;
+}
 
-        if (worker->thread == NULL) {
-                gsd_smartcard_manager_worker_free (worker);
-                return NULL;
+static gboolean
+gsd_smartcard_manager_worker_start (GsdSmartcardManagerWorker *worker)
+{
+        GsdSmartcardManagerWatcherThread *data;
+        GList *node;
+        gboolean needs_polling = FALSE;
+        gboolean ret = TRUE;
+
+        for (node = worker->watchers; node != NULL; node = node->next) {
+                GsdSmartcardManagerWatcher *watcher;
+
+                watcher = (GsdSmartcardManagerWatcher *) node->data;
+                if (!watcher->can_block) {
+                        needs_polling = TRUE;
+                        continue;
+                }
+
+                data = g_new0 (GsdSmartcardManagerWatcherThread, 1);
+                data->worker = worker;
+                data->watcher = watcher;
+                watcher->thread = g_thread_create ((GThreadFunc)
+                                                   gsd_smartcard_manager_watcher_run,
+                                                   data, TRUE, NULL);
+                if (watcher->thread == NULL) {
+                        g_free (data);
+                        ret = FALSE;
+                }
         }
 
-        return worker;
+        if (needs_polling) {
+                worker->thread = g_thread_create ((GThreadFunc)
+                                                  gsd_smartcard_manager_worker_run,
+                                                  worker, TRUE, NULL);
+                if (worker->thread == NULL) {
+                        ret = FALSE;
+                }
+        }
+
+        return ret;
+}
+
+static void
+gsd_smartcard_manager_worker_stop (GsdSmartcardManagerWorker *worker)
+{
+        GList *node;
+
+        g_mutex_lock (&worker->lock);
+        worker->cancelled = TRUE;
+        g_cond_signal (&worker->cond);
+        g_mutex_unlock (&worker->lock);
+
+        /* wake up the threads blocked in NSS, and wait for all of
+         * them, so that NSS isn't in use when it's shut down
+         */
+        for (node = worker->watchers; node != NULL; node = node->next) {
+                GsdSmartcardManagerWatcher *watcher;
+
+                watcher = (GsdSmartcardManagerWatcher *) node->data;
+                if (watcher->thread == NULL) {
+                        continue;
+                }
+
+                SECMOD_CancelWait (watcher->module);
+                g_thread_join (watcher->thread);
+                watcher->thread = NULL;
+        }
+
+        if (worker->thread != NULL) {
+                g_thread_join (worker->thread);
+                worker->thread = NULL;
+        }
 }
 
 #ifdef GSD_SMARTCARD_MANAGER_ENABLE_TEST
@@ -35,19 +35,41 @@
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <pulse/pulseaudio.h>
+#include <pulse/glib-mainloop.h>
 
 #include "gsd-sound-manager.h"
 #include "gnome-settings-profile.h"
 
 #define GSD_SOUND_MANAGER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), GSD_TYPE_SOUND_MANAGER, GsdSoundManagerPrivate))
 
+/* Past this many pending changes, matching them against every sample
+ * costs more than reloading the samples */
+#define MAX_PENDING_CHANGES 64
+
 struct GsdSoundManagerPrivate
 {
-        GSettings *settings;
-        GList     *monitors;
-        guint      timeout;
+        GSettings        *settings;
+        GList            *monitors;
+        guint             timeout;
+
+        pa_glib_mainloop *pa_mainloop;
+        pa_context       *pa_context;
+
+        /* Theme samples currently in the server's cache */
+        GHashTable       *samples; /* key = sample name, value = SampleEntry */
+        gboolean          samples_loaded;
+
+        /* What the next flush needs to drop */
+        gboolean          flush_all;
+        GPtrArray        *changed_paths;
+        GPtrArray        *created_paths; /* relative to the sounds dir */
 };
 
+typedef struct {
+        guint32  index;
+        char    *filename; /* NULL if the uploader did not say */
+} SampleEntry;
+
 static void gsd_sound_manager_class_init (GsdSoundManagerClass *klass);
 static void gsd_sound_manager_init (GsdSoundManager *sound_manager);
 static void gsd_sound_manager_finalize (GObject *object);
@@ -57,136 +79,347 @@ G_DEFINE_TYPE (GsdSoundManager, gsd_sound_manager, G_TYPE_OBJECT)
 static gpointer manager_object = NULL;
 
 static void
-sample_info_cb (pa_context *c, const pa_sample_info *i, int eol, void *userdata)
+sample_entry_free (SampleEntry *entry)
 {
-        pa_operation *o;
-
-        if (!i)
-                return;
+        g_free (entry->filename);
+        g_free (entry);
+}
 
-        g_debug ("Found sample %s", i->name);
+static void
+index_sample (GsdSoundManager      *manager,
+              const pa_sample_info *i)
+{
+        SampleEntry *entry;
 
-        /* We only flush those samples which have an XDG sound name
+        /* We only track those samples which have an XDG sound name
          * attached, because only those originate from themeing  */
-        if (!(pa_proplist_gets (i->proplist, PA_PROP_EVENT_ID)))
+        if (!(pa_proplist_gets (i->proplist, PA_PROP_EVENT_ID))) {
+                g_hash_table_remove (manager->priv->samples, i->name);
                 return;
+        }
 
-        g_debug ("Dropping sample %s from cache", i->name);
+        entry = g_new0 (SampleEntry, 1);
+        entry->index = i->index;
+        entry->filename = g_strdup (pa_proplist_gets (i->proplist, PA_PROP_MEDIA_FILENAME));
 
-        if (!(o = pa_context_remove_sample (c, i->name, NULL, NULL))) {
-                g_debug ("pa_context_remove_sample (): %s", pa_strerror (pa_context_errno (c)));
-                return;
-        }
+        g_debug ("Indexing sample %s (%s)", i->name,
+                 entry->filename ? entry->filename : "unknown file");
 
-        pa_operation_unref (o);
+        g_hash_table_replace (manager->priv->samples, g_strdup (i->name), entry);
+}
+
+static gboolean
+path_has_prefix (const char *path,
+                 const char *prefix)
+{
+        gsize len = strlen (prefix);
 
-        /* We won't wait until the operation is actually executed to
-         * speed things up a bit.*/
+        return strncmp (path, prefix, len) == 0 &&
+               (path[len] == '\0' || path[len] == '/');
 }
 
-static void
-flush_cache (void)
+/* Whether something created at @created, relative to one of the
+ * sounds dirs, takes precedence over the file the sample came from */
+static gboolean
+sample_is_shadowed (const char  *name,
+                    SampleEntry *entry,
+                    const char  *created)
 {
-        pa_mainloop *ml = NULL;
-        pa_context *c = NULL;
-        pa_proplist *pl = NULL;
-        pa_operation *o = NULL;
+        const char *rel;
+        const char *basename;
+        const char *dot;
+        gsize len;
+
+        /* the same theme, or part of it, in a dir that comes first */
+        rel = g_strrstr (entry->filename, "/sounds/");
+        if (rel != NULL && path_has_prefix (rel + strlen ("/sounds/"), created))
+                return TRUE;
+
+        /* a sound file for the sample's event, or one it falls back to */
+        basename = strrchr (created, '/');
+        basename = basename ? basename + 1 : created;
+        dot = strrchr (basename, '.');
+        if (dot == NULL)
+                return FALSE;
+        len = dot - basename;
+
+        return strncmp (name, basename, len) == 0 &&
+               (name[len] == '\0' || name[len] == '-');
+}
 
-        g_debug ("Flushing sample cache");
+static gboolean
+sample_is_stale (GsdSoundManager *manager,
+                 const char      *name,
+                 SampleEntry     *entry)
+{
+        guint i;
 
-        if (!(ml = pa_mainloop_new ())) {
-                g_debug ("Failed to allocate pa_mainloop");
-                goto fail;
+        if (manager->priv->flush_all)
+                return TRUE;
+
+        /* We cannot tell where it came from, so play it safe */
+        if (entry->filename == NULL)
+                return manager->priv->changed_paths->len > 0 ||
+                       manager->priv->created_paths->len > 0;
+
+        for (i = 0; i < manager->priv->created_paths->len; i++) {
+                if (sample_is_shadowed (name, entry,
+                                        g_ptr_array_index (manager->priv->created_paths, i)))
+                        return TRUE;
         }
 
-        if (!(pl = pa_proplist_new ())) {
-                g_debug ("Failed to allocate pa_proplist");
-                goto fail;
+        for (i = 0; i < manager->priv->changed_paths->len; i++) {
+                if (path_has_prefix (entry->filename,
+                                     g_ptr_array_index (manager->priv->changed_paths, i)))
+                        return TRUE;
         }
 
-        pa_proplist_sets (pl, PA_PROP_APPLICATION_NAME, PACKAGE_NAME);
-        pa_proplist_sets (pl, PA_PROP_APPLICATION_VERSION, PACKAGE_VERSION);
-        pa_proplist_sets (pl, PA_PROP_APPLICATION_ID, "org.gnome.SettingsDaemon");
+        return FALSE;
+}
 
-        if (!(c = pa_context_new_with_proplist (pa_mainloop_get_api (ml), PACKAGE_NAME, pl))) {
-                g_debug ("Failed to allocate pa_context");
-                goto fail;
-        }
+static void
+flush_cache (GsdSoundManager *manager)
+{
+        GHashTableIter iter;
+        const char *name;
+        SampleEntry *entry;
+        pa_operation *o;
+        guint n_dropped = 0;
 
-        pa_proplist_free (pl);
-        pl = NULL;
+        /* Applied once the sample list has been fetched */
+        if (!manager->priv->samples_loaded)
+                return;
 
-        if (pa_context_connect (c, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0) {
-                g_debug ("pa_context_connect(): %s", pa_strerror (pa_context_errno (c)));
-                goto fail;
-        }
+        if (!manager->priv->flush_all &&
+            manager->priv->changed_paths->len == 0 &&
+            manager->priv->created_paths->len == 0)
+                return;
+
+        g_debug ("Flushing sample cache");
 
-        /* Wait until the connection is established */
-        while (pa_context_get_state (c) != PA_CONTEXT_READY) {
+        g_hash_table_iter_init (&iter, manager->priv->samples);
+        while (g_hash_table_iter_next (&iter, (gpointer *) &name, (gpointer *) &entry)) {
+                if (!sample_is_stale (manager, name, entry))
+                        continue;
 
-                if (!PA_CONTEXT_IS_GOOD (pa_context_get_state (c))) {
-                        g_debug ("Connection failed: %s", pa_strerror (pa_context_errno (c)));
-                        goto fail;
-                }
+                g_debug ("Dropping sample %s from cache", name);
 
-                if (pa_mainloop_iterate (ml, TRUE, NULL) < 0) {
-                        g_debug ("pa_mainloop_iterate() failed");
-                        goto fail;
+                if (!(o = pa_context_remove_sample (manager->priv->pa_context, name, NULL, NULL))) {
+                        g_debug ("pa_context_remove_sample (): %s",
+                                 pa_strerror (pa_context_errno (manager->priv->pa_context)));
+                        continue;
                 }
+
+                /* We won't wait until the operation is actually executed to
+                 * speed things up a bit.*/
+                pa_operation_unref (o);
+
+                g_hash_table_iter_remove (&iter);
+                n_dropped++;
         }
 
-        /* Enumerate all cached samples */
-        if (!(o = pa_context_get_sample_info_list (c, sample_info_cb, NULL))) {
+        g_debug ("Sample cache flushed, %u samples dropped, %u kept",
+                 n_dropped, g_hash_table_size (manager->priv->samples));
+
+        manager->priv->flush_all = FALSE;
+        g_ptr_array_set_size (manager->priv->changed_paths, 0);
+        g_ptr_array_set_size (manager->priv->created_paths, 0);
+}
+
+static void
+sample_list_cb (pa_context           *c,
+                const pa_sample_info *i,
+                int                   eol,
+                void                 *userdata)
+{
+        GsdSoundManager *manager = userdata;
+
+        if (eol < 0) {
                 g_debug ("pa_context_get_sample_info_list(): %s", pa_strerror (pa_context_errno (c)));
-                goto fail;
+                return;
         }
 
-        /* Wait until our operation is finished and there's nothing
-         * more queued to send to the server */
-        while (pa_operation_get_state (o) == PA_OPERATION_RUNNING || pa_context_is_pending (c)) {
+        if (eol > 0) {
+                g_debug ("Found %u theme samples in cache",
+                         g_hash_table_size (manager->priv->samples));
+                manager->priv->samples_loaded = TRUE;
+                flush_cache (manager);
+                return;
+        }
 
-                if (!PA_CONTEXT_IS_GOOD (pa_context_get_state (c))) {
-                        g_debug ("Connection failed: %s", pa_strerror (pa_context_errno (c)));
-                        goto fail;
-                }
+        index_sample (manager, i);
+}
 
-                if (pa_mainloop_iterate (ml, TRUE, NULL) < 0) {
-                        g_debug ("pa_mainloop_iterate() failed");
-                        goto fail;
-                }
+static void
+sample_info_cb (pa_context           *c,
+                const pa_sample_info *i,
+                int                   eol,
+                void                 *userdata)
+{
+        if (eol != 0)
+                return;
+
+        index_sample (GSD_SOUND_MANAGER (userdata), i);
+}
+
+static gboolean
+sample_has_index (gpointer key,
+                  gpointer value,
+                  gpointer user_data)
+{
+        SampleEntry *entry = value;
+
+        return entry->index == GPOINTER_TO_UINT (user_data);
+}
+
+static void
+subscribe_cb (pa_context                   *c,
+              pa_subscription_event_type_t  t,
+              uint32_t                      idx,
+              void                         *userdata)
+{
+        GsdSoundManager *manager = userdata;
+        pa_operation *o;
+
+        if ((t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) != PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE)
+                return;
+
+        if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE) {
+                g_hash_table_foreach_remove (manager->priv->samples,
+                                             sample_has_index,
+                                             GUINT_TO_POINTER (idx));
+                return;
         }
 
-        g_debug ("Sample cache flushed");
+        if (!(o = pa_context_get_sample_info_by_index (c, idx, sample_info_cb, manager))) {
+                g_debug ("pa_context_get_sample_info_by_index(): %s", pa_strerror (pa_context_errno (c)));
+                return;
+        }
+        pa_operation_unref (o);
+}
 
-fail:
-        if (o) {
-                pa_operation_cancel (o);
-                pa_operation_unref (o);
+static void
+context_state_cb (pa_context *c,
+                  void       *userdata)
+{
+        GsdSoundManager *manager = userdata;
+        pa_operation *o;
+
+        switch (pa_context_get_state (c)) {
+        case PA_CONTEXT_READY:
+                g_debug ("Connected to the sound server");
+
+                pa_context_set_subscribe_callback (c, subscribe_cb, manager);
+                if ((o = pa_context_subscribe (c, PA_SUBSCRIPTION_MASK_SAMPLE_CACHE, NULL, NULL)))
+                        pa_operation_unref (o);
+                else
+                        g_debug ("pa_context_subscribe(): %s", pa_strerror (pa_context_errno (c)));
+
+                /* Enumerate all cached samples */
+                if ((o = pa_context_get_sample_info_list (c, sample_list_cb, manager)))
+                        pa_operation_unref (o);
+                else
+                        g_debug ("pa_context_get_sample_info_list(): %s", pa_strerror (pa_context_errno (c)));
+                break;
+        case PA_CONTEXT_FAILED:
+        case PA_CONTEXT_TERMINATED:
+                /* We will reconnect on the next flush */
+                g_debug ("Connection failed: %s", pa_strerror (pa_context_errno (c)));
+                g_hash_table_remove_all (manager->priv->samples);
+                manager->priv->samples_loaded = FALSE;
+                break;
+        default:
+                break;
         }
+}
+
+static void
+disconnect_pulse (GsdSoundManager *manager)
+{
+        if (manager->priv->pa_context == NULL)
+                return;
 
-        if (c) {
-                pa_context_disconnect (c);
-                pa_context_unref (c);
+        pa_context_set_state_callback (manager->priv->pa_context, NULL, NULL);
+        pa_context_set_subscribe_callback (manager->priv->pa_context, NULL, NULL);
+        pa_context_disconnect (manager->priv->pa_context);
+        pa_context_unref (manager->priv->pa_context);
+        manager->priv->pa_context = NULL;
+
+        g_hash_table_remove_all (manager->priv->samples);
+        manager->priv->samples_loaded = FALSE;
+}
+
+static void
+connect_pulse (GsdSoundManager *manager)
+{
+        pa_proplist *pl;
+
+        if (manager->priv->pa_context != NULL) {
+                if (PA_CONTEXT_IS_GOOD (pa_context_get_state (manager->priv->pa_context)))
+                        return;
+                disconnect_pulse (manager);
         }
 
-        if (pl)
-                pa_proplist_free (pl);
+        if (!(pl = pa_proplist_new ())) {
+                g_debug ("Failed to allocate pa_proplist");
+                return;
+        }
 
-        if (ml)
-                pa_mainloop_free (ml);
+        pa_proplist_sets (pl, PA_PROP_APPLICATION_NAME, PACKAGE_NAME);
+        pa_proplist_sets (pl, PA_PROP_APPLICATION_VERSION, PACKAGE_VERSION);
+        pa_proplist_sets (pl, PA_PROP_APPLICATION_ID, "org.gnome.SettingsDaemon");
+
+        manager->priv->pa_context = pa_context_new_with_proplist (pa_glib_mainloop_get_api (manager->priv->pa_mainloop),
+                                                                  PACKAGE_NAME, pl);
+        pa_proplist_free (pl);
+
+        if (manager->priv->pa_context == NULL) {
+                g_debug ("Failed to allocate pa_context");
+                return;
+        }
+
+        pa_context_set_state_callback (manager->priv->pa_context, context_state_cb, manager);
+
+        /* Wait for the server to show up rather than failing straight away */
+        if (pa_context_connect (manager->priv->pa_context, NULL,
+                                PA_CONTEXT_NOAUTOSPAWN | PA_CONTEXT_NOFAIL, NULL) < 0) {
+                g_debug ("pa_context_connect(): %s", pa_strerror (pa_context_errno (manager->priv->pa_context)));
+                disconnect_pulse (manager);
+        }
 }
 
 static gboolean
 flush_cb (GsdSoundManager *manager)
 {
-        flush_cache ();
         manager->priv->timeout = 0;
+        connect_pulse (manager);
+        flush_cache (manager);
         return FALSE;
 }
 
+/* @changed is an absolute path, or @created is relative to the sounds
+ * dir, or neither for everything; takes ownership of the path */
 static void
-trigger_flush (GsdSoundManager *manager)
+trigger_flush (GsdSoundManager *manager,
+               char            *changed,
+               char            *created)
 {
+        if (changed != NULL)
+                g_ptr_array_add (manager->priv->changed_paths, changed);
+        else if (created != NULL)
+                g_ptr_array_add (manager->priv->created_paths, created);
+        else
+                manager->priv->flush_all = TRUE;
+
+        /* Changes pile up while PulseAudio is away */
+        if (manager->priv->changed_paths->len +
+            manager->priv->created_paths->len > MAX_PENDING_CHANGES)
+                manager->priv->flush_all = TRUE;
+
+        if (manager->priv->flush_all) {
+                g_ptr_array_set_size (manager->priv->changed_paths, 0);
+                g_ptr_array_set_size (manager->priv->created_paths, 0);
+        }
 
         if (manager->priv->timeout)
                 g_source_remove (manager->priv->timeout);
@@ -194,6 +427,7 @@ trigger_flush (GsdSoundManager *manager)
         /* We delay the flushing a bit so that we can coalesce
          * multiple changes into a single cache flush */
         manager->priv->timeout = g_timeout_add (500, (GSourceFunc) flush_cb, manager);
+        g_source_set_name_by_id (manager->priv->timeout, "[gnome-settings-daemon] flush_cb");
 }
 
 static void
@@ -201,7 +435,11 @@ settings_changed_cb (GSettings       *settings,
 		     const char      *key,
 		     GsdSoundManager *manager)
 {
-        trigger_flush (manager);
+        /* Only the theme decides which files samples come from */
+        if (g_strcmp0 (key, "theme-name") != 0)
+                return;
+
+        trigger_flush (manager, NULL, NULL);
 }
 
 static void
@@ -219,8 +457,33 @@ file_monitor_changed_cb (GFileMonitor *monitor,
                          GFileMonitorEvent event,
                          GsdSoundManager *manager)
 {
+        char *theme;
+        char *basename;
+
+        if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
+                return;
+
         g_debug ("Theme dir changed");
-        trigger_flush (manager);
+
+        if (event != G_FILE_MONITOR_EVENT_CREATED) {
+                trigger_flush (manager, g_file_get_path (file), NULL);
+                return;
+        }
+
+        /* We only monitor the sounds dirs themselves, so anything new
+         * is a theme, or a file for the theme-less fallback, which
+         * takes precedence over what's in the dirs after it */
+        basename = g_file_get_basename (file);
+        theme = g_settings_get_string (manager->priv->settings, "theme-name");
+
+        /* samples might come from a fallback theme until now */
+        if (g_strcmp0 (basename, theme) == 0) {
+                g_free (basename);
+                basename = NULL;
+        }
+        trigger_flush (manager, NULL, basename);
+
+        g_free (theme);
 }
 
 static gboolean
@@ -262,6 +525,15 @@ gsd_sound_manager_start (GsdSoundManager *manager,
         g_debug ("Starting sound manager");
         gnome_settings_profile_start (NULL);
 
+        manager->priv->samples = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                        g_free, (GDestroyNotify) sample_entry_free);
+        manager->priv->changed_paths = g_ptr_array_new_with_free_func (g_free);
+        manager->priv->created_paths = g_ptr_array_new_with_free_func (g_free);
+
+        /* Keep track of what is in the sample cache ... */
+        manager->priv->pa_mainloop = pa_glib_mainloop_new (g_main_context_default ());
+        connect_pulse (manager);
+
         /* We listen for change of the selected theme ... */
         register_config_callback (manager);
 
@@ -306,6 +578,18 @@ gsd_sound_manager_stop (GsdSoundManager *manager)
                 g_object_unref (manager->priv->monitors->data);
                 manager->priv->monitors = g_list_delete_link (manager->priv->monitors, manager->priv->monitors);
         }
+
+        disconnect_pulse (manager);
+
+        if (manager->priv->pa_mainloop != NULL) {
+                pa_glib_mainloop_free (manager->priv->pa_mainloop);
+                manager->priv->pa_mainloop = NULL;
+        }
+
+        g_clear_pointer (&manager->priv->samples, g_hash_table_destroy);
+        g_clear_pointer (&manager->priv->changed_paths, g_ptr_array_unref);
+        g_clear_pointer (&manager->priv->created_paths, g_ptr_array_unref);
+        manager->priv->flush_all = FALSE;
 }
 
 static GObject *
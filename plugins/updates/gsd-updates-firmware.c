@@ -53,6 +53,9 @@ static void     gsd_updates_firmware_finalize   (GObject          *object);
 #define GSD_UPDATES_FIRMWARE_PROCESS_DELAY              2 /* seconds */
 #define GSD_UPDATES_FIRMWARE_INSERT_DELAY               2 /* seconds */
 #define GSD_UPDATES_FIRMWARE_DEVICE_REBIND_PROGRAM      "/usr/sbin/pk-device-rebind"
+#define GSD_UPDATES_FIRMWARE_CACHE_FILENAME             "firmware-requests"
+#define GSD_UPDATES_FIRMWARE_CACHE_FOUND_TTL            (24 * 60 * 60) /* seconds */
+#define GSD_UPDATES_FIRMWARE_CACHE_MISSING_TTL          (7 * 24 * 60 * 60) /* seconds */
 
 struct GsdUpdatesFirmwarePrivate
 {
@@ -60,8 +63,14 @@ struct GsdUpdatesFirmwarePrivate
         GFileMonitor            *monitor;
         GPtrArray               *array_requested;
         PkTask                  *task;
-        GPtrArray               *packages_found;
+        GHashTable              *packages_found;
         guint                    timeout_id;
+        guint                    process_id;
+        gboolean                 coldplugged;
+        GHashTable              *names_seen;
+        GHashTable              *names_pending;
+        GHashTable              *cache;
+        GCancellable            *search_cancellable;
 };
 
 typedef enum {
@@ -78,6 +87,19 @@ typedef struct {
         FirmwareSubsystem        subsystem;
 } GsdUpdatesFirmwareRequest;
 
+/* what PackageKit told us about a firmware file */
+typedef struct {
+        gchar                   *package_id;    /* NULL if not provided */
+        gint64                   timestamp;     /* seconds */
+} FirmwareCacheItem;
+
+typedef struct {
+        GsdUpdatesFirmware      *firmware;
+        GPtrArray               *filenames;
+        guint                    index;
+        GCancellable            *cancellable;
+} FirmwareSearch;
+
 G_DEFINE_TYPE (GsdUpdatesFirmware, gsd_updates_firmware, G_TYPE_OBJECT)
 
 static void install_package_ids (GsdUpdatesFirmware *firmware);
@@ -386,25 +408,23 @@ install_packages_cb (GObject *object,
 out:
         if (error_code != NULL)
                 g_object_unref (error_code);
-        if (array != NULL)
-                g_ptr_array_unref (array);
         if (results != NULL)
                 g_object_unref (results);
 }
 
 static gchar **
-package_array_to_strv (GPtrArray *array)
+package_set_to_strv (GHashTable *set)
 {
-	PkPackage *item;
-	gchar **results;
-	guint i;
-
-	results = g_new0 (gchar *, array->len+1);
-	for (i=0; i<array->len; i++) {
-		item = g_ptr_array_index (array, i);
-		results[i] = g_strdup (pk_package_get_id (item));
-	}
-	return results;
+        GHashTableIter iter;
+        gpointer key;
+        gchar **results;
+        guint i = 0;
+
+        results = g_new0 (gchar *, g_hash_table_size (set) + 1);
+        g_hash_table_iter_init (&iter, set);
+        while (g_hash_table_iter_next (&iter, &key, NULL))
+                results[i++] = g_strdup (key);
+        return results;
 }
 
 static void
@@ -413,7 +433,7 @@ install_package_ids (GsdUpdatesFirmware *firmware)
         gchar **package_ids;
 
         /* install all of the firmware files */
-        package_ids = package_array_to_strv (firmware->priv->packages_found);
+        package_ids = package_set_to_strv (firmware->priv->packages_found);
         pk_client_install_packages_async (PK_CLIENT(firmware->priv->task),
                                           TRUE, package_ids,
                                           NULL,
@@ -461,120 +481,163 @@ ignore_devices (GsdUpdatesFirmware *firmware)
         g_string_free (string, TRUE);
 }
 
-static PkPackage *
-check_available (GsdUpdatesFirmware *firmware, const gchar *filename)
+static void
+cache_item_free (FirmwareCacheItem *item)
 {
-        guint length = 0;
-        GPtrArray *array = NULL;
-        GError *error = NULL;
-        PkPackage *item = NULL;
-        PkBitfield filter;
-        PkResults *results;
-        gchar **values = NULL;
-        PkError *error_code = NULL;
+        g_free (item->package_id);
+        g_free (item);
+}
 
-        /* search for newest not installed package */
-        filter = pk_bitfield_from_enums (PK_FILTER_ENUM_NOT_INSTALLED,
-                                         PK_FILTER_ENUM_NEWEST, -1);
-        values = g_strsplit (filename, "&", -1);
-        results = pk_client_search_files (PK_CLIENT(firmware->priv->task),
-                                          filter,
-                                          values,
-                                          NULL,
-                                          NULL, NULL,
-                                          &error);
-        if (results == NULL) {
-                g_warning ("failed to search file %s: %s",
-                           filename, error->message);
-                g_error_free (error);
-                goto out;
-        }
+static gchar *
+cache_get_filename (void)
+{
+        return g_build_filename (g_get_user_cache_dir (),
+                                 "gnome-settings-daemon",
+                                 GSD_UPDATES_FIRMWARE_CACHE_FILENAME,
+                                 NULL);
+}
 
-        /* check error code */
-        error_code = pk_results_get_error_code (results);
-        if (error_code != NULL) {
-                g_warning ("failed to search file: %s, %s",
-                           pk_error_enum_to_string (pk_error_get_code (error_code)),
-                           pk_error_get_details (error_code));
+static gboolean
+cache_item_is_valid (const FirmwareCacheItem *item, gint64 now)
+{
+        gint64 ttl;
+
+        ttl = item->package_id != NULL ? GSD_UPDATES_FIRMWARE_CACHE_FOUND_TTL :
+                                         GSD_UPDATES_FIRMWARE_CACHE_MISSING_TTL;
+        return item->timestamp <= now && now - item->timestamp < ttl;
+}
+
+static void
+cache_load (GsdUpdatesFirmware *firmware)
+{
+        FirmwareCacheItem *item;
+        GKeyFile *keyfile;
+        gchar **groups = NULL;
+        gchar *filename;
+        gint64 now;
+        guint i;
+
+        filename = cache_get_filename ();
+        keyfile = g_key_file_new ();
+        if (!g_key_file_load_from_file (keyfile, filename, G_KEY_FILE_NONE, NULL))
                 goto out;
-        }
 
-        /* make sure we have one package */
-        array = pk_results_get_package_array (results);
-        if (array->len == 0)
-                g_debug ("no package providing %s found", filename);
-        else if (array->len != 1)
-                g_warning ("not one package providing %s found (%i)", filename, length);
-        else
-                item = g_object_ref (g_ptr_array_index (array, 0));
+        /* one group per firmware file */
+        now = g_get_real_time () / G_USEC_PER_SEC;
+        groups = g_key_file_get_groups (keyfile, NULL);
+        for (i = 0; groups[i] != NULL; i++) {
+                item = g_new0 (FirmwareCacheItem, 1);
+                item->timestamp = g_key_file_get_int64 (keyfile, groups[i], "Timestamp", NULL);
+                item->package_id = g_key_file_get_string (keyfile, groups[i], "PackageId", NULL);
+                if (!cache_item_is_valid (item, now)) {
+                        cache_item_free (item);
+                        continue;
+                }
+                g_hash_table_insert (firmware->priv->cache, g_strdup (groups[i]), item);
+        }
+        g_debug ("loaded %u cached firmware searches",
+                 g_hash_table_size (firmware->priv->cache));
 out:
-        g_strfreev (values);
-        if (error_code != NULL)
-                g_object_unref (error_code);
-        if (array != NULL)
-                g_ptr_array_unref (array);
-        if (results != NULL)
-                g_object_unref (results);
-        return item;
+        g_strfreev (groups);
+        g_key_file_free (keyfile);
+        g_free (filename);
 }
 
 static void
-remove_duplicate (GPtrArray *array)
+cache_save (GsdUpdatesFirmware *firmware)
 {
-        guint i, j;
-        const gchar *val;
-        const gchar *val_tmp;
+        FirmwareCacheItem *item;
+        GHashTableIter iter;
+        GKeyFile *keyfile;
+        GError *error = NULL;
+        gchar *data = NULL;
+        gchar *dirname = NULL;
+        gchar *filename;
+        gpointer key, value;
+        gsize length;
+
+        keyfile = g_key_file_new ();
+        g_hash_table_iter_init (&iter, firmware->priv->cache);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                item = value;
+                g_key_file_set_int64 (keyfile, key, "Timestamp", item->timestamp);
+                if (item->package_id != NULL)
+                        g_key_file_set_string (keyfile, key, "PackageId", item->package_id);
+        }
 
-        /* remove each duplicate entry */
-        for (i=0; i<array->len; i++) {
-                val = g_ptr_array_index (array, i);
-                for (j=i+1; j<array->len; j++) {
-                        val_tmp = g_ptr_array_index (array, j);
-                        if (g_strcmp0 (val_tmp, val) == 0)
-                                g_ptr_array_remove_index_fast (array, j);
-                }
+        filename = cache_get_filename ();
+        dirname = g_path_get_dirname (filename);
+        if (g_mkdir_with_parents (dirname, 0700) != 0) {
+                g_warning ("failed to create %s", dirname);
+                goto out;
         }
+        data = g_key_file_to_data (keyfile, &length, NULL);
+        if (!g_file_set_contents (filename, data, length, &error)) {
+                g_warning ("failed to save firmware cache: %s", error->message);
+                g_error_free (error);
+        }
+out:
+        g_free (data);
+        g_free (dirname);
+        g_free (filename);
+        g_key_file_free (keyfile);
 }
 
+/* returns TRUE if we already know if a package provides @filename */
 static gboolean
-delay_timeout_cb (gpointer data)
+cache_lookup (GsdUpdatesFirmware *firmware,
+              const gchar *filename,
+              const gchar **package_id)
+{
+        FirmwareCacheItem *item;
+
+        item = g_hash_table_lookup (firmware->priv->cache, filename);
+        if (item == NULL)
+                return FALSE;
+        if (!cache_item_is_valid (item, g_get_real_time () / G_USEC_PER_SEC)) {
+                g_hash_table_remove (firmware->priv->cache, filename);
+                return FALSE;
+        }
+        *package_id = item->package_id;
+        return TRUE;
+}
+
+static void
+cache_add (GsdUpdatesFirmware *firmware,
+           const gchar *filename,
+           const gchar *package_id)
+{
+        FirmwareCacheItem *item;
+
+        item = g_new0 (FirmwareCacheItem, 1);
+        item->package_id = g_strdup (package_id);
+        item->timestamp = g_get_real_time () / G_USEC_PER_SEC;
+        g_hash_table_insert (firmware->priv->cache, g_strdup (filename), item);
+}
+
+static void
+show_notification (GsdUpdatesFirmware *firmware)
 {
         guint i;
         gboolean ret;
         GString *string;
-        GsdUpdatesFirmware *firmware = GSD_UPDATES_FIRMWARE (data);
         NotifyNotification *notification;
         GPtrArray *array;
         GError *error = NULL;
-        PkPackage *item = NULL;
         const GsdUpdatesFirmwareRequest *req;
         gboolean has_data = FALSE;
 
-        /* message string */
-        string = g_string_new ("");
-
-        /* try to find each firmware file in an available package */
-        array = firmware->priv->array_requested;
-        for (i=0; i<array->len; i++) {
-                req = g_ptr_array_index (array, i);
-                /* save to new array if we found one package for this file */
-                item = check_available (firmware, req->filename);
-                if (item != NULL) {
-                        g_ptr_array_add (firmware->priv->packages_found, item);
-                        g_object_unref (item);
-                }
-        }
-
         /* nothing to do */
-        if (firmware->priv->packages_found->len == 0) {
+        if (g_hash_table_size (firmware->priv->packages_found) == 0) {
                 g_debug ("no packages providing any of the missing firmware");
-                goto out;
+                return;
         }
 
-        /* check we don't want the same package more than once */
-        remove_duplicate (firmware->priv->packages_found);
+        /* message string */
+        string = g_string_new ("");
 
         /* have we got any models to array */
+        array = firmware->priv->array_requested;
         for (i=0; i<array->len; i++) {
                 req = g_ptr_array_index (array, i);
                 if (req->model != NULL) {
@@ -618,8 +681,243 @@ delay_timeout_cb (gpointer data)
                 g_error_free (error);
         }
 
-out:
         g_string_free (string, TRUE);
+}
+
+static void
+firmware_search_free (FirmwareSearch *search)
+{
+        g_ptr_array_unref (search->filenames);
+        g_object_unref (search->cancellable);
+        g_free (search);
+}
+
+/* a firmware request can be for several files, separated with '&' */
+static gchar **
+firmware_search_get_values (FirmwareSearch *search, gint index)
+{
+        GPtrArray *values;
+        gchar **split;
+        guint i, j;
+
+        values = g_ptr_array_new ();
+        for (i = 0; i < search->filenames->len; i++) {
+                if (index >= 0 && i != (guint) index)
+                        continue;
+                split = g_strsplit (g_ptr_array_index (search->filenames, i), "&", -1);
+                for (j = 0; split[j] != NULL; j++)
+                        g_ptr_array_add (values, split[j]);
+                g_free (split);
+        }
+        g_ptr_array_add (values, NULL);
+        return (gchar **) g_ptr_array_free (values, FALSE);
+}
+
+/* returns the packages, or NULL if the search failed */
+static GPtrArray *
+firmware_search_finish (GObject *object, GAsyncResult *res)
+{
+        GError *error = NULL;
+        GPtrArray *array = NULL;
+        PkResults *results;
+        PkError *error_code = NULL;
+
+        results = pk_client_generic_finish (PK_CLIENT (object), res, &error);
+        if (results == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("failed to search for firmware: %s", error->message);
+                g_error_free (error);
+                goto out;
+        }
+
+        /* check error code */
+        error_code = pk_results_get_error_code (results);
+        if (error_code != NULL) {
+                g_warning ("failed to search for firmware: %s, %s",
+                           pk_error_enum_to_string (pk_error_get_code (error_code)),
+                           pk_error_get_details (error_code));
+                goto out;
+        }
+
+        array = pk_results_get_package_array (results);
+out:
+        if (error_code != NULL)
+                g_object_unref (error_code);
+        if (results != NULL)
+                g_object_unref (results);
+        return array;
+}
+
+static void firmware_search_next (FirmwareSearch *search);
+
+static void
+firmware_search_file_cb (GObject *object,
+                         GAsyncResult *res,
+                         FirmwareSearch *search)
+{
+        GsdUpdatesFirmware *firmware = search->firmware;
+        const gchar *filename;
+        const gchar *package_id = NULL;
+        GPtrArray *array;
+
+        array = firmware_search_finish (object, res);
+        if (g_cancellable_is_cancelled (search->cancellable)) {
+                firmware_search_free (search);
+                goto out;
+        }
+
+        /* don't remember failures, we'll try again next time */
+        filename = g_ptr_array_index (search->filenames, search->index);
+        if (array != NULL) {
+                /* make sure we have one package */
+                if (array->len == 0) {
+                        g_debug ("no package providing %s found", filename);
+                } else if (array->len != 1) {
+                        g_warning ("not one package providing %s found (%u)",
+                                   filename, array->len);
+                } else {
+                        package_id = pk_package_get_id (g_ptr_array_index (array, 0));
+                        g_hash_table_add (firmware->priv->packages_found,
+                                          g_strdup (package_id));
+                }
+                cache_add (firmware, filename, package_id);
+        }
+
+        search->index++;
+        firmware_search_next (search);
+out:
+        if (array != NULL)
+                g_ptr_array_unref (array);
+}
+
+static void
+firmware_search_next (FirmwareSearch *search)
+{
+        GsdUpdatesFirmware *firmware = search->firmware;
+        PkBitfield filter;
+        gchar **values;
+
+        /* all done */
+        if (search->index >= search->filenames->len) {
+                cache_save (firmware);
+                show_notification (firmware);
+                firmware_search_free (search);
+                return;
+        }
+
+        /* search for newest not installed package */
+        filter = pk_bitfield_from_enums (PK_FILTER_ENUM_NOT_INSTALLED,
+                                         PK_FILTER_ENUM_NEWEST, -1);
+        values = firmware_search_get_values (search, search->index);
+        pk_client_search_files_async (PK_CLIENT(firmware->priv->task),
+                                      filter,
+                                      values,
+                                      search->cancellable,
+                                      NULL, NULL,
+                                      (GAsyncReadyCallback) firmware_search_file_cb,
+                                      search);
+        g_strfreev (values);
+}
+
+static void
+firmware_search_batch_cb (GObject *object,
+                          GAsyncResult *res,
+                          FirmwareSearch *search)
+{
+        GsdUpdatesFirmware *firmware = search->firmware;
+        GPtrArray *array;
+        guint i;
+
+        array = firmware_search_finish (object, res);
+        if (g_cancellable_is_cancelled (search->cancellable)) {
+                firmware_search_free (search);
+                goto out;
+        }
+
+        /* show what we already know about */
+        if (array == NULL) {
+                show_notification (firmware);
+                firmware_search_free (search);
+                goto out;
+        }
+
+        /* the common case: nothing provides any of them */
+        if (array->len == 0) {
+                g_debug ("no package providing any of the %u missing firmware files",
+                         search->filenames->len);
+                for (i = 0; i < search->filenames->len; i++)
+                        cache_add (firmware, g_ptr_array_index (search->filenames, i), NULL);
+                search->index = search->filenames->len;
+        }
+
+        /* otherwise find out which package provides which file */
+        firmware_search_next (search);
+out:
+        if (array != NULL)
+                g_ptr_array_unref (array);
+}
+
+static gboolean
+delay_timeout_cb (gpointer data)
+{
+        guint i;
+        GsdUpdatesFirmware *firmware = GSD_UPDATES_FIRMWARE (data);
+        FirmwareSearch *search;
+        GPtrArray *array;
+        PkBitfield filter;
+        gchar **values;
+        const gchar *package_id;
+        const GsdUpdatesFirmwareRequest *req;
+
+        firmware->priv->process_id = 0;
+        g_hash_table_remove_all (firmware->priv->packages_found);
+
+        /* only one search at a time */
+        if (firmware->priv->search_cancellable != NULL) {
+                g_cancellable_cancel (firmware->priv->search_cancellable);
+                g_object_unref (firmware->priv->search_cancellable);
+        }
+        firmware->priv->search_cancellable = g_cancellable_new ();
+
+        search = g_new0 (FirmwareSearch, 1);
+        search->firmware = firmware;
+        search->filenames = g_ptr_array_new_with_free_func (g_free);
+        search->cancellable = g_object_ref (firmware->priv->search_cancellable);
+
+        /* only ask PackageKit about what we don't know already */
+        array = firmware->priv->array_requested;
+        for (i=0; i<array->len; i++) {
+                req = g_ptr_array_index (array, i);
+                if (cache_lookup (firmware, req->filename, &package_id)) {
+                        g_debug ("%s is %sprovided (cached)", req->filename,
+                                 package_id != NULL ? "" : "not ");
+                        if (package_id != NULL)
+                                g_hash_table_add (firmware->priv->packages_found,
+                                                  g_strdup (package_id));
+                        continue;
+                }
+                g_ptr_array_add (search->filenames, g_strdup (req->filename));
+        }
+
+        if (search->filenames->len == 0) {
+                show_notification (firmware);
+                firmware_search_free (search);
+                return FALSE;
+        }
+
+        /* search for all of them at once */
+        filter = pk_bitfield_from_enums (PK_FILTER_ENUM_NOT_INSTALLED,
+                                         PK_FILTER_ENUM_NEWEST, -1);
+        values = firmware_search_get_values (search, -1);
+        pk_client_search_files_async (PK_CLIENT(firmware->priv->task),
+                                      filter,
+                                      values,
+                                      search->cancellable,
+                                      NULL, NULL,
+                                      (GAsyncReadyCallback) firmware_search_batch_cb,
+                                      search);
+        g_strfreev (values);
+
         /* never repeat */
         return FALSE;
 }
@@ -703,8 +1001,10 @@ remove_ignored (GsdUpdatesFirmware *firmware, GPtrArray *array)
         while (i < array->len) {
                 ret = FALSE;
                 req = g_ptr_array_index (array, i);
-                if (req->id == NULL)
+                if (req->id == NULL) {
+                        i++;
                         continue;
+                }
                 for (j=0; ignored[j] != NULL; j++) {
                         ret = g_pattern_match_simple (ignored[j], req->id);
                         if (ret) {
@@ -799,7 +1099,8 @@ out:
         return target;
 }
 
-static void
+/* returns TRUE if a new request was added */
+static gboolean
 add_filename (GsdUpdatesFirmware *firmware, const gchar *filename_no_path)
 {
         gboolean ret;
@@ -809,6 +1110,7 @@ add_filename (GsdUpdatesFirmware *firmware, const gchar *filename_no_path)
         GsdUpdatesFirmwareRequest *req;
         GPtrArray *array;
         guint i;
+        gboolean added = FALSE;
 
         /* this is the file we want to load */
         filename_path = g_build_filename (GSD_UPDATES_FIRMWARE_LOADING_DIR,
@@ -848,10 +1150,29 @@ add_filename (GsdUpdatesFirmware *firmware, const gchar *filename_no_path)
         /* create new request object */
         req = request_new (filename_path, sysfs_path);
         g_ptr_array_add (firmware->priv->array_requested, req);
+        added = TRUE;
 out:
         g_free (missing_path);
         g_free (filename_path);
         g_free (sysfs_path);
+        return added;
+}
+
+/* only looks at each request udev makes once */
+static gboolean
+add_name (GsdUpdatesFirmware *firmware, const gchar *name)
+{
+        gchar *filename_decoded;
+        gboolean ret;
+
+        if (g_hash_table_contains (firmware->priv->names_seen, name))
+                return FALSE;
+        g_hash_table_add (firmware->priv->names_seen, g_strdup (name));
+
+        filename_decoded = udev_text_decode (name);
+        ret = add_filename (firmware, filename_decoded);
+        g_free (filename_decoded);
+        return ret;
 }
 
 static void
@@ -861,20 +1182,31 @@ scan_directory (GsdUpdatesFirmware *firmware)
         GError *error = NULL;
         GDir *dir;
         const gchar *filename;
-        gchar *filename_decoded;
+        GHashTableIter iter;
+        gpointer key;
         guint i;
         GPtrArray *array;
         const GsdUpdatesFirmwareRequest *req;
-        guint scan_id = 0;
+        gboolean added = FALSE;
 
         /* should we check and show the user */
         ret = g_settings_get_boolean (firmware->priv->settings,
                                       GSD_SETTINGS_ENABLE_CHECK_FIRMWARE);
         if (!ret) {
                 g_debug ("not showing thanks to GSettings");
+                g_hash_table_remove_all (firmware->priv->names_pending);
                 return;
         }
 
+        /* the monitor tells us what changed after the first scan */
+        if (firmware->priv->coldplugged) {
+                g_hash_table_iter_init (&iter, firmware->priv->names_pending);
+                while (g_hash_table_iter_next (&iter, &key, NULL))
+                        added |= add_name (firmware, key);
+                g_hash_table_remove_all (firmware->priv->names_pending);
+                goto out;
+        }
+
         /* open the directory of requests */
         dir = g_dir_open (GSD_UPDATES_FIRMWARE_MISSING_DIR, 0, &error);
         if (dir == NULL) {
@@ -885,19 +1217,22 @@ scan_directory (GsdUpdatesFirmware *firmware)
                 g_error_free (error);
                 return;
         }
+        firmware->priv->coldplugged = TRUE;
+        g_hash_table_remove_all (firmware->priv->names_pending);
 
         /* find all the firmware requests */
         filename = g_dir_read_name (dir);
         while (filename != NULL) {
-
-                filename_decoded = udev_text_decode (filename);
-                add_filename (firmware, filename_decoded);
-                g_free (filename_decoded);
+                added |= add_name (firmware, filename);
 
                 /* next file */
                 filename = g_dir_read_name (dir);
         }
         g_dir_close (dir);
+out:
+        /* nothing new, we've already told the user */
+        if (!added)
+                return;
 
         /* debugging */
         array = firmware->priv->array_requested;
@@ -920,11 +1255,13 @@ scan_directory (GsdUpdatesFirmware *firmware)
         }
 
         /* don't spam the user at startup, so wait a little delay */
-        if (array->len > 0) {
-                scan_id = g_timeout_add_seconds (GSD_UPDATES_FIRMWARE_PROCESS_DELAY,
-                                                 delay_timeout_cb,
-                                                 firmware);
-                g_source_set_name_by_id (scan_id, "[GsdUpdatesFirmware] process");
+        if (array->len > 0 && firmware->priv->process_id == 0) {
+                firmware->priv->process_id =
+                        g_timeout_add_seconds (GSD_UPDATES_FIRMWARE_PROCESS_DELAY,
+                                               delay_timeout_cb,
+                                               firmware);
+                g_source_set_name_by_id (firmware->priv->process_id,
+                                         "[GsdUpdatesFirmware] process");
         }
 }
 
@@ -943,6 +1280,18 @@ monitor_changed_cb (GFileMonitor *monitor,
                     GFileMonitorEvent event_type,
                     GsdUpdatesFirmware *firmware)
 {
+        gchar *name;
+
+        /* udev removes the request once it's been dealt with */
+        name = g_file_get_basename (file);
+        if (event_type == G_FILE_MONITOR_EVENT_DELETED) {
+                g_hash_table_remove (firmware->priv->names_seen, name);
+                g_hash_table_remove (firmware->priv->names_pending, name);
+                g_free (name);
+                return;
+        }
+        g_hash_table_add (firmware->priv->names_pending, name);
+
         if (firmware->priv->timeout_id > 0) {
                 g_debug ("clearing timeout as device changed");
                 g_source_remove (firmware->priv->timeout_id);
@@ -973,7 +1322,15 @@ gsd_updates_firmware_init (GsdUpdatesFirmware *firmware)
 
         firmware->priv = GSD_UPDATES_FIRMWARE_GET_PRIVATE (firmware);
         firmware->priv->timeout_id = 0;
-        firmware->priv->packages_found = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+        firmware->priv->packages_found = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                g_free, NULL);
+        firmware->priv->names_seen = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                            g_free, NULL);
+        firmware->priv->names_pending = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                               g_free, NULL);
+        firmware->priv->cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                       g_free, (GDestroyNotify) cache_item_free);
+        cache_load (firmware);
         firmware->priv->array_requested = g_ptr_array_new_with_free_func ((GDestroyNotify) request_free);
         firmware->priv->settings = g_settings_new (GSD_SETTINGS_SCHEMA);
         firmware->priv->task = pk_task_new ();
@@ -1020,13 +1377,22 @@ gsd_updates_firmware_finalize (GObject *object)
 
         g_return_if_fail (firmware->priv != NULL);
         g_ptr_array_unref (firmware->priv->array_requested);
-        g_ptr_array_unref (firmware->priv->packages_found);
+        g_hash_table_unref (firmware->priv->packages_found);
+        g_hash_table_unref (firmware->priv->names_seen);
+        g_hash_table_unref (firmware->priv->names_pending);
+        g_hash_table_unref (firmware->priv->cache);
+        if (firmware->priv->search_cancellable != NULL) {
+                g_cancellable_cancel (firmware->priv->search_cancellable);
+                g_object_unref (firmware->priv->search_cancellable);
+        }
         g_object_unref (PK_CLIENT(firmware->priv->task));
         g_object_unref (firmware->priv->settings);
         if (firmware->priv->monitor != NULL)
                 g_object_unref (firmware->priv->monitor);
         if (firmware->priv->timeout_id > 0)
                 g_source_remove (firmware->priv->timeout_id);
+        if (firmware->priv->process_id > 0)
+                g_source_remove (firmware->priv->process_id);
 
         G_OBJECT_CLASS (gsd_updates_firmware_parent_class)->finalize (object);
 }
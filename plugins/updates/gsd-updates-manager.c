@@ -261,6 +261,17 @@ on_notification_closed (NotifyNotification *notification, gpointer data)
         g_object_unref (notification);
 }
 
+/* the plugin may have been stopped while PackageKit was busy */
+static void
+refresh_action_finished (GsdUpdatesManager *manager,
+                         GsdUpdatesRefreshAction action,
+                         gboolean success)
+{
+        if (manager->priv->refresh != NULL)
+                gsd_updates_refresh_action_finished (manager->priv->refresh,
+                                                     action, success);
+}
+
 static void
 get_distro_upgrades_finished_cb (GObject *object,
                                  GAsyncResult *res,
@@ -291,6 +302,9 @@ get_distro_upgrades_finished_cb (GObject *object,
                     error->code != PK_CLIENT_ERROR_NOT_SUPPORTED) {
                         g_warning ("failed to get upgrades: %s",
                                    error->message);
+                        refresh_action_finished (manager,
+                                                 GSD_UPDATES_REFRESH_ACTION_GET_UPGRADES,
+                                                 FALSE);
                 }
                 g_error_free (error);
                 goto out;
@@ -302,8 +316,14 @@ get_distro_upgrades_finished_cb (GObject *object,
                 g_warning ("failed to get upgrades: %s, %s",
                            pk_error_enum_to_string (pk_error_get_code (error_code)),
                            pk_error_get_details (error_code));
+                refresh_action_finished (manager,
+                                         GSD_UPDATES_REFRESH_ACTION_GET_UPGRADES,
+                                         FALSE);
                 goto out;
         }
+        refresh_action_finished (manager,
+                                 GSD_UPDATES_REFRESH_ACTION_GET_UPGRADES,
+                                 TRUE);
 
         /* process results */
         array = pk_results_get_distro_upgrade_array (results);
@@ -404,6 +424,9 @@ refresh_cache_finished_cb (GObject *object, GAsyncResult *res, GsdUpdatesManager
                 g_warning ("failed to refresh the cache: %s",
                            error->message);
                 g_error_free (error);
+                refresh_action_finished (manager,
+                                         GSD_UPDATES_REFRESH_ACTION_REFRESH_CACHE,
+                                         FALSE);
                 return;
         }
 
@@ -414,6 +437,9 @@ refresh_cache_finished_cb (GObject *object, GAsyncResult *res, GsdUpdatesManager
                            pk_error_enum_to_string (pk_error_get_code (error_code)),
                            pk_error_get_details (error_code));
         }
+        refresh_action_finished (manager,
+                                 GSD_UPDATES_REFRESH_ACTION_REFRESH_CACHE,
+                                 error_code == NULL);
 
         if (error_code != NULL)
                 g_object_unref (error_code);
@@ -745,6 +771,9 @@ get_updates_finished_cb (GObject *object,
                            error->message);
                 g_error_free (error);
                 notify_failed_get_updates_maybe (manager);
+                refresh_action_finished (manager,
+                                         GSD_UPDATES_REFRESH_ACTION_GET_UPDATES,
+                                         FALSE);
                 goto out;
         }
 
@@ -761,6 +790,9 @@ get_updates_finished_cb (GObject *object,
                         break;
                 default:
                         notify_failed_get_updates_maybe (manager);
+                        refresh_action_finished (manager,
+                                                 GSD_UPDATES_REFRESH_ACTION_GET_UPDATES,
+                                                 FALSE);
                         break;
                 }
                 goto out;
@@ -768,6 +800,9 @@ get_updates_finished_cb (GObject *object,
 
         /* we succeeded, so clear the count */
         manager->priv->failed_get_updates_count = 0;
+        refresh_action_finished (manager,
+                                 GSD_UPDATES_REFRESH_ACTION_GET_UPDATES,
+                                 TRUE);
 
         /* so we can download or check for important & security updates */
         if (manager->priv->update_packages != NULL)
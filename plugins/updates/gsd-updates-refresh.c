@@ -25,6 +25,7 @@
 #include <packagekit-glib2/packagekit.h>
 #include <libupower-glib/upower.h>
 
+#include "gnome-settings-scheduler.h"
 #include "gnome-settings-session.h"
 
 #include "gsd-updates-common.h"
@@ -35,8 +36,24 @@ static void     gsd_updates_refresh_finalize    (GObject            *object);
 #define GSD_UPDATES_REFRESH_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), GSD_TYPE_UPDATES_REFRESH, GsdUpdatesRefreshPrivate))
 
 #define PERIODIC_CHECK_TIME     60*60   /* poke PackageKit every hour */
+#define PERIODIC_CHECK_SLACK    15*60   /* give or take */
 #define LOGIN_TIMEOUT           3       /* seconds */
 #define SESSION_STARTUP_TIMEOUT 10      /* seconds */
+#define HOST_JITTER_MAX         30*60   /* spread machines over half an hour */
+#define BACKOFF_MIN             15*60   /* first retry after a failure */
+#define BACKOFF_MAX             24*60*60
+
+#define NM_DBUS_NAME            "org.freedesktop.NetworkManager"
+#define NM_DBUS_PATH            "/org/freedesktop/NetworkManager"
+#define NM_DBUS_INTERFACE       "org.freedesktop.NetworkManager"
+
+enum {
+        NM_METERED_UNKNOWN = 0,
+        NM_METERED_YES,
+        NM_METERED_NO,
+        NM_METERED_GUESS_YES,
+        NM_METERED_GUESS_NO
+};
 
 enum {
         PRESENCE_STATUS_AVAILABLE = 0,
@@ -53,6 +70,10 @@ enum {
      since we refreshed then RefreshCache
    - if we are online and it's been longer than the timeout since
      getting the updates period then GetUpdates
+ * metered connections count as mobile ones, each machine waits for its
+ * own fixed share of HOST_JITTER_MAX before acting so that a fleet
+ * waking up together doesn't hit the mirror at once, and an action
+ * that failed backs off exponentially before being tried again
 */
 
 struct GsdUpdatesRefreshPrivate
@@ -60,11 +81,18 @@ struct GsdUpdatesRefreshPrivate
         gboolean                 session_idle;
         gboolean                 on_battery;
         gboolean                 network_active;
+        gboolean                 network_metered;
         guint                    timeout_id;
         guint                    periodic_id;
+        guint                    retry_id;
+        guint                    host_jitter;
+        guint                    failures[GSD_UPDATES_REFRESH_ACTION_LAST];
+        gint64                   retry_time[GSD_UPDATES_REFRESH_ACTION_LAST];
         UpClient                *client;
         GSettings               *settings;
         GDBusProxy              *proxy_session;
+        GDBusProxy              *proxy_nm;
+        GCancellable            *cancellable;
         PkControl               *control;
 };
 
@@ -102,6 +130,47 @@ gsd_updates_refresh_class_init (GsdUpdatesRefreshClass *klass)
                               G_TYPE_NONE, 0);
 }
 
+static const gchar *
+action_to_string (GsdUpdatesRefreshAction action)
+{
+        if (action == GSD_UPDATES_REFRESH_ACTION_REFRESH_CACHE)
+                return "refresh-cache";
+        if (action == GSD_UPDATES_REFRESH_ACTION_GET_UPDATES)
+                return "get-updates";
+        return "get-upgrades";
+}
+
+static gboolean
+action_is_backing_off (GsdUpdatesRefresh *refresh, GsdUpdatesRefreshAction action)
+{
+        gint64 now;
+
+        now = g_get_monotonic_time ();
+        if (refresh->priv->retry_time[action] <= now)
+                return FALSE;
+
+        g_debug ("not retrying %s for another %" G_GINT64_FORMAT "s",
+                 action_to_string (action),
+                 (refresh->priv->retry_time[action] - now) / G_USEC_PER_SEC);
+        return TRUE;
+}
+
+/* the same on every boot, but different on each machine */
+static guint
+get_host_jitter (void)
+{
+        gchar *machine_id = NULL;
+        guint hash;
+
+        if (!g_file_get_contents ("/etc/machine-id", &machine_id, NULL, NULL))
+                machine_id = g_strdup (g_get_host_name ());
+        g_strstrip (machine_id);
+        hash = g_str_hash (machine_id);
+        g_free (machine_id);
+
+        return hash % HOST_JITTER_MAX;
+}
+
 static void
 get_time_refresh_cache_cb (GObject *object,
                            GAsyncResult *res,
@@ -162,6 +231,9 @@ maybe_refresh_cache (GsdUpdatesRefresh *refresh)
                 return;
         }
 
+        if (action_is_backing_off (refresh, GSD_UPDATES_REFRESH_ACTION_REFRESH_CACHE))
+                return;
+
         /* get the time since the last refresh */
         pk_control_get_time_since_action_async (refresh->priv->control,
                                                 PK_ROLE_ENUM_REFRESH_CACHE,
@@ -214,6 +286,9 @@ maybe_get_updates (GsdUpdatesRefresh *refresh)
                 return;
         }
 
+        if (action_is_backing_off (refresh, GSD_UPDATES_REFRESH_ACTION_GET_UPDATES))
+                return;
+
         /* get the time since the last refresh */
         pk_control_get_time_since_action_async (refresh->priv->control,
                                                 PK_ROLE_ENUM_GET_UPDATES,
@@ -269,6 +344,9 @@ maybe_get_upgrades (GsdUpdatesRefresh *refresh)
                 return;
         }
 
+        if (action_is_backing_off (refresh, GSD_UPDATES_REFRESH_ACTION_GET_UPGRADES))
+                return;
+
         /* get the time since the last refresh */
         pk_control_get_time_since_action_async (refresh->priv->control,
                                                 PK_ROLE_ENUM_GET_DISTRO_UPGRADES,
@@ -278,28 +356,24 @@ maybe_get_upgrades (GsdUpdatesRefresh *refresh)
 }
 
 static gboolean
-change_state_cb (GsdUpdatesRefresh *refresh)
-{
-        /* check all actions */
-        maybe_refresh_cache (refresh);
-        maybe_get_updates (refresh);
-        maybe_get_upgrades (refresh);
-        return FALSE;
-}
-
-static gboolean
-change_state (GsdUpdatesRefresh *refresh)
+can_use_network (GsdUpdatesRefresh *refresh)
 {
         gboolean ret;
 
-        g_return_val_if_fail (GSD_IS_UPDATES_REFRESH (refresh), FALSE);
-
         /* no point continuing if we have no network */
         if (!refresh->priv->network_active) {
                 g_debug ("not when no network");
                 return FALSE;
         }
 
+        /* metered connections are treated like mobile broadband */
+        if (refresh->priv->network_metered &&
+            !g_settings_get_boolean (refresh->priv->settings,
+                                     GSD_SETTINGS_CONNECTION_USE_MOBILE)) {
+                g_debug ("not when on a metered connection");
+                return FALSE;
+        }
+
         /* not on battery unless overridden */
         ret = g_settings_get_boolean (refresh->priv->settings,
                                       GSD_SETTINGS_UPDATE_BATTERY);
@@ -308,13 +382,43 @@ change_state (GsdUpdatesRefresh *refresh)
                 return FALSE;
         }
 
-        /* wait a little time for things to settle down */
+        return TRUE;
+}
+
+static gboolean
+change_state_cb (GsdUpdatesRefresh *refresh)
+{
+        refresh->priv->timeout_id = 0;
+
+        /* things might have changed while we waited */
+        if (!can_use_network (refresh))
+                return FALSE;
+
+        /* check all actions */
+        maybe_refresh_cache (refresh);
+        maybe_get_updates (refresh);
+        maybe_get_upgrades (refresh);
+        return FALSE;
+}
+
+static gboolean
+change_state (GsdUpdatesRefresh *refresh)
+{
+        g_return_val_if_fail (GSD_IS_UPDATES_REFRESH (refresh), FALSE);
+
+        if (!can_use_network (refresh))
+                return FALSE;
+
+        /* already waiting, don't push it back */
         if (refresh->priv->timeout_id != 0)
-                g_source_remove (refresh->priv->timeout_id);
-        g_debug ("defering action for %i seconds",
-                 SESSION_STARTUP_TIMEOUT);
+                return TRUE;
+
+        /* wait a little time for things to settle down, and for our
+         * turn amongst the other machines */
+        g_debug ("defering action for %u seconds",
+                 SESSION_STARTUP_TIMEOUT + refresh->priv->host_jitter);
         refresh->priv->timeout_id =
-                g_timeout_add_seconds (SESSION_STARTUP_TIMEOUT,
+                g_timeout_add_seconds (SESSION_STARTUP_TIMEOUT + refresh->priv->host_jitter,
                                        (GSourceFunc) change_state_cb,
                                        refresh);
         g_source_set_name_by_id (refresh->priv->timeout_id,
@@ -323,6 +427,71 @@ change_state (GsdUpdatesRefresh *refresh)
         return TRUE;
 }
 
+static gboolean
+retry_timeout_cb (gpointer user_data)
+{
+        GsdUpdatesRefresh *refresh = GSD_UPDATES_REFRESH (user_data);
+
+        refresh->priv->retry_id = 0;
+        change_state (refresh);
+        return FALSE;
+}
+
+/**
+ * gsd_updates_refresh_action_finished:
+ * @refresh: a #GsdUpdatesRefresh
+ * @action: the action that was emitted
+ * @success: whether it worked
+ *
+ * Tells @refresh how an action it asked for went, so that failing ones
+ * are retried less and less often.
+ **/
+void
+gsd_updates_refresh_action_finished (GsdUpdatesRefresh *refresh,
+                                     GsdUpdatesRefreshAction action,
+                                     gboolean success)
+{
+        GsdUpdatesRefreshPrivate *priv;
+        gint64 now, earliest = G_MAXINT64;
+        guint delay;
+        guint i;
+
+        g_return_if_fail (GSD_IS_UPDATES_REFRESH (refresh));
+        g_return_if_fail (action < GSD_UPDATES_REFRESH_ACTION_LAST);
+
+        priv = refresh->priv;
+        if (success) {
+                priv->failures[action] = 0;
+                priv->retry_time[action] = 0;
+                return;
+        }
+
+        /* double the wait each time, plus our share of a quarter of it
+         * so that machines failing together don't retry together */
+        delay = BACKOFF_MIN;
+        for (i = 0; i < priv->failures[action] && delay < BACKOFF_MAX; i++)
+                delay *= 2;
+        delay = MIN (delay, BACKOFF_MAX);
+        delay += priv->host_jitter % (delay / 4);
+        now = g_get_monotonic_time ();
+        priv->failures[action]++;
+        priv->retry_time[action] = now + (gint64) delay * G_USEC_PER_SEC;
+        g_debug ("%s failed %u times, retrying in %us",
+                 action_to_string (action), priv->failures[action], delay);
+
+        /* the periodic check may not come soon enough, so wake up
+         * for the first action that can be retried */
+        for (i = 0; i < GSD_UPDATES_REFRESH_ACTION_LAST; i++) {
+                if (priv->retry_time[i] > now)
+                        earliest = MIN (earliest, priv->retry_time[i]);
+        }
+        if (priv->retry_id != 0)
+                g_source_remove (priv->retry_id);
+        priv->retry_id = g_timeout_add_seconds ((earliest - now + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC,
+                                                retry_timeout_cb, refresh);
+        g_source_set_name_by_id (priv->retry_id, "[GsdUpdatesRefresh] retry");
+}
+
 static void
 settings_key_changed_cb (GSettings *client,
                          const gchar *key,
@@ -442,6 +611,50 @@ out:
         return;
 }
 
+static void
+nm_properties_changed_cb (GDBusProxy *proxy,
+                          GVariant *changed_properties,
+                          GStrv invalidated_properties,
+                          GsdUpdatesRefresh *refresh)
+{
+        GVariant *v;
+        guint metered;
+
+        v = g_dbus_proxy_get_cached_property (proxy, "Metered");
+        if (v == NULL)
+                return;
+        metered = g_variant_get_uint32 (v);
+        g_variant_unref (v);
+
+        refresh->priv->network_metered = (metered == NM_METERED_YES ||
+                                          metered == NM_METERED_GUESS_YES);
+        g_debug ("setting metered %i", refresh->priv->network_metered);
+        if (!refresh->priv->network_metered)
+                change_state (refresh);
+}
+
+static void
+nm_proxy_ready_cb (GObject *source_object,
+                   GAsyncResult *res,
+                   GsdUpdatesRefresh *refresh)
+{
+        GDBusProxy *proxy;
+        GError *error = NULL;
+
+        proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+        if (proxy == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_debug ("no metered state available: %s", error->message);
+                g_error_free (error);
+                return;
+        }
+
+        refresh->priv->proxy_nm = proxy;
+        g_signal_connect (proxy, "g-properties-changed",
+                          G_CALLBACK (nm_properties_changed_cb), refresh);
+        nm_properties_changed_cb (proxy, NULL, NULL, refresh);
+}
+
 static void
 session_presence_signal_cb (GDBusProxy *proxy,
                             gchar *sender_name,
@@ -477,6 +690,9 @@ gsd_updates_refresh_init (GsdUpdatesRefresh *refresh)
         refresh->priv->network_active = FALSE;
         refresh->priv->timeout_id = 0;
         refresh->priv->periodic_id = 0;
+        refresh->priv->host_jitter = get_host_jitter ();
+        refresh->priv->cancellable = g_cancellable_new ();
+        g_debug ("using a host jitter of %u seconds", refresh->priv->host_jitter);
 
         /* we need to know the updates frequency */
         refresh->priv->settings = g_settings_new (GSD_SETTINGS_SCHEMA);
@@ -495,6 +711,17 @@ gsd_updates_refresh_init (GsdUpdatesRefresh *refresh)
                                          (GAsyncReadyCallback) get_properties_cb,
                                          refresh);
 
+        /* NetworkManager knows if the connection is metered */
+        g_dbus_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
+                                  G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                                  NULL,
+                                  NM_DBUS_NAME,
+                                  NM_DBUS_PATH,
+                                  NM_DBUS_INTERFACE,
+                                  refresh->priv->cancellable,
+                                  (GAsyncReadyCallback) nm_proxy_ready_cb,
+                                  refresh);
+
         /* use a UpClient */
         refresh->priv->client = up_client_new ();
         g_signal_connect (refresh->priv->client, "changed",
@@ -526,10 +753,12 @@ gsd_updates_refresh_init (GsdUpdatesRefresh *refresh)
 
         /* we check this in case we miss one of the async signals */
         refresh->priv->periodic_id =
-                g_timeout_add_seconds (PERIODIC_CHECK_TIME,
-                                       periodic_timeout_cb, refresh);
-        g_source_set_name_by_id (refresh->priv->periodic_id,
-                                 "[GsdUpdatesRefresh] periodic check");
+                gnome_settings_scheduler_add_job ("updates: periodic check",
+                                                  PERIODIC_CHECK_TIME,
+                                                  PERIODIC_CHECK_SLACK,
+                                                  GNOME_SETTINGS_JOB_ALWAYS,
+                                                  periodic_timeout_cb,
+                                                  refresh, NULL);
 
         /* check system state */
         change_state (refresh);
@@ -547,8 +776,16 @@ gsd_updates_refresh_finalize (GObject *object)
 
         if (refresh->priv->timeout_id != 0)
                 g_source_remove (refresh->priv->timeout_id);
-        if (refresh->priv->periodic_id != 0)
-                g_source_remove (refresh->priv->periodic_id);
+        if (refresh->priv->retry_id != 0)
+                g_source_remove (refresh->priv->retry_id);
+        gnome_settings_scheduler_remove_job (refresh->priv->periodic_id);
+
+        g_cancellable_cancel (refresh->priv->cancellable);
+        g_object_unref (refresh->priv->cancellable);
+        if (refresh->priv->proxy_nm != NULL) {
+                g_signal_handlers_disconnect_by_data (refresh->priv->proxy_nm, refresh);
+                g_object_unref (refresh->priv->proxy_nm);
+        }
 
         g_signal_handlers_disconnect_by_data (refresh->priv->client, refresh);
         g_signal_handlers_disconnect_by_data (refresh->priv->proxy_session, refresh);
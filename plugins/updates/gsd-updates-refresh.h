@@ -33,6 +33,13 @@ G_BEGIN_DECLS
 
 typedef struct GsdUpdatesRefreshPrivate GsdUpdatesRefreshPrivate;
 
+typedef enum {
+        GSD_UPDATES_REFRESH_ACTION_REFRESH_CACHE,
+        GSD_UPDATES_REFRESH_ACTION_GET_UPDATES,
+        GSD_UPDATES_REFRESH_ACTION_GET_UPGRADES,
+        GSD_UPDATES_REFRESH_ACTION_LAST
+} GsdUpdatesRefreshAction;
+
 typedef struct
 {
          GObject                         parent;
@@ -46,6 +53,9 @@ typedef struct
 
 GType                    gsd_updates_refresh_get_type           (void);
 GsdUpdatesRefresh       *gsd_updates_refresh_new                (void);
+void                     gsd_updates_refresh_action_finished    (GsdUpdatesRefresh       *refresh,
+                                                                 GsdUpdatesRefreshAction  action,
+                                                                 gboolean                 success);
 
 G_END_DECLS
 
@@ -47,6 +47,11 @@
 #define WACOM_ERASER_SCHEMA "org.gnome.settings-daemon.peripherals.wacom.eraser"
 #define WACOM_BUTTON_SCHEMA "org.gnome.settings-daemon.peripherals.wacom.tablet-button"
 
+/* Button settings */
+#define KEY_ACTION_TYPE         "action-type"
+#define KEY_CUSTOM_ACTION       "custom-action"
+#define KEY_CUSTOM_ELEVATOR_ACTION "custom-elevator-action"
+
 static struct {
 	GnomeRRRotation  rotation;
 	GsdWacomRotation rotation_wacom;
@@ -250,6 +255,36 @@ gsd_wacom_stylus_get_id (GsdWacomStylus *stylus)
 }
 
 /* Tablet buttons */
+static void
+gsd_wacom_tablet_button_settings_changed (GSettings            *settings,
+					  const char           *key,
+					  GsdWacomTabletButton *button)
+{
+	if (key == NULL || g_str_equal (key, KEY_ACTION_TYPE))
+		button->action_type = g_settings_get_enum (settings, KEY_ACTION_TYPE);
+	if (key == NULL || g_str_equal (key, KEY_CUSTOM_ACTION)) {
+		g_free (button->custom_action);
+		button->custom_action = g_settings_get_string (settings, KEY_CUSTOM_ACTION);
+	}
+	if (key == NULL || g_str_equal (key, KEY_CUSTOM_ELEVATOR_ACTION)) {
+		g_strfreev (button->custom_elevator_action);
+		button->custom_elevator_action = g_settings_get_strv (settings, KEY_CUSTOM_ELEVATOR_ACTION);
+	}
+}
+
+/* Button events are frequent, so don't read the settings for each one */
+static void
+gsd_wacom_tablet_button_watch_settings (GsdWacomTabletButton *button)
+{
+	if (button->settings == NULL)
+		return;
+
+	gsd_wacom_tablet_button_settings_changed (button->settings, NULL, button);
+	button->changed_id = g_signal_connect (button->settings, "changed",
+					       G_CALLBACK (gsd_wacom_tablet_button_settings_changed),
+					       button);
+}
+
 static GsdWacomTabletButton *
 gsd_wacom_tablet_button_new (const char               *name,
 			     const char               *id,
@@ -277,6 +312,7 @@ gsd_wacom_tablet_button_new (const char               *name,
 	ret->type = type;
 	ret->pos = pos;
 	ret->status_led = status_led;
+	gsd_wacom_tablet_button_watch_settings (ret);
 
 	return ret;
 }
@@ -286,8 +322,12 @@ gsd_wacom_tablet_button_free (GsdWacomTabletButton *button)
 {
 	g_return_if_fail (button != NULL);
 
-	if (button->settings != NULL)
+	if (button->settings != NULL) {
+		g_signal_handler_disconnect (button->settings, button->changed_id);
 		g_object_unref (button->settings);
+	}
+	g_free (button->custom_action);
+	g_strfreev (button->custom_elevator_action);
 	g_free (button->name);
 	g_free (button->id);
 	g_free (button);
@@ -307,6 +347,7 @@ gsd_wacom_tablet_button_copy (GsdWacomTabletButton *button)
 	ret->id = button->id;
 	ret->type = button->type;
 	ret->group_id = button->group_id;
+	gsd_wacom_tablet_button_watch_settings (ret);
 
 	return ret;
 }
@@ -321,6 +362,18 @@ gsd_wacom_tablet_button_copy (GsdWacomTabletButton *button)
 #define SETTINGS_STYLUS_DIR        "stylus"
 #define SETTINGS_ERASER_DIR        "eraser"
 
+/* X button numbers, see gsd_wacom_device_get_button() */
+#define MAX_X_BUTTON               26
+#define FIRST_ELEVATOR_X_BUTTON    90
+#define NUM_ELEVATORS              4
+
+static const char *elevator_ids[NUM_ELEVATORS] = {
+	"left-ring",
+	"right-ring",
+	"left-strip",
+	"right-strip"
+};
+
 struct GsdWacomDevicePrivate
 {
 	GdkDevice *gdk_device;
@@ -345,6 +398,9 @@ struct GsdWacomDevicePrivate
 	gint num_strips;
 	GHashTable *modes; /* key = int (group), value = int (index) */
 	GHashTable *num_modes; /* key = int (group), value = int (index) */
+	GHashTable *buttons_by_id; /* key = button id, value = GsdWacomTabletButton */
+	GsdWacomTabletButton *buttons_by_number[MAX_X_BUTTON + 1];
+	GPtrArray *elevator_buttons[NUM_ELEVATORS]; /* index = mode index */
 	GSettings *wacom_settings;
 };
 
@@ -1324,6 +1380,51 @@ gsd_wacom_device_add_buttons_dir (WacomDevice      *wacom_device,
 	return l;
 }
 
+/* Pre-compute the X button number to button mapping, which is looked
+ * up for every pad event */
+static void
+gsd_wacom_device_index_buttons (GsdWacomDevice *device)
+{
+	GsdWacomDevicePrivate *p = device->priv;
+	GsdWacomTabletButton *button;
+	GList *l;
+	char *id;
+	int physical_button;
+	int i, j;
+
+	p->buttons_by_id = g_hash_table_new (g_str_hash, g_str_equal);
+	for (l = p->buttons; l != NULL; l = l->next) {
+		button = l->data;
+		g_hash_table_insert (p->buttons_by_id, button->id, button);
+	}
+
+	for (i = 0; i <= MAX_X_BUTTON; i++) {
+		/* mouse_button = physical_button < 4 ? physical_button : physical_button + 4 */
+		if (i > 4)
+			physical_button = i - 4;
+		else
+			physical_button = i;
+
+		id = g_strdup_printf ("button%c", 'A' + physical_button - 1);
+		p->buttons_by_number[i] = g_hash_table_lookup (p->buttons_by_id, id);
+		g_free (id);
+	}
+
+	/* Index 0 is never a valid mode, modes start at 1 */
+	for (i = 0; i < NUM_ELEVATORS; i++) {
+		p->elevator_buttons[i] = g_ptr_array_new ();
+		g_ptr_array_add (p->elevator_buttons[i], NULL);
+		for (j = 1; ; j++) {
+			id = g_strdup_printf ("%s-mode-%d", elevator_ids[i], j);
+			button = g_hash_table_lookup (p->buttons_by_id, id);
+			g_free (id);
+			if (button == NULL)
+				break;
+			g_ptr_array_add (p->elevator_buttons[i], button);
+		}
+	}
+}
+
 static void
 gsd_wacom_device_add_buttons (GsdWacomDevice *device,
 			      WacomDevice    *wacom_device,
@@ -1347,6 +1448,7 @@ gsd_wacom_device_add_buttons (GsdWacomDevice *device,
 		ret = g_list_concat (ret, l);
 
 	device->priv->buttons = ret;
+	gsd_wacom_device_index_buttons (device);
 }
 
 static void
@@ -1619,6 +1721,7 @@ gsd_wacom_device_finalize (GObject *object)
 {
         GsdWacomDevice *device;
         GsdWacomDevicePrivate *p;
+        guint i;
 
         g_return_if_fail (object != NULL);
         g_return_if_fail (GSD_IS_WACOM_DEVICE (object));
@@ -1637,6 +1740,9 @@ gsd_wacom_device_finalize (GObject *object)
         g_list_foreach (p->styli, (GFunc) g_object_unref, NULL);
         g_list_free (p->styli);
 
+        g_clear_pointer (&p->buttons_by_id, g_hash_table_destroy);
+        for (i = 0; i < NUM_ELEVATORS; i++)
+                g_clear_pointer (&p->elevator_buttons[i], g_ptr_array_unref);
         g_list_foreach (p->buttons, (GFunc) gsd_wacom_tablet_button_free, NULL);
         g_list_free (p->buttons);
 
@@ -1933,99 +2039,40 @@ gsd_wacom_device_get_buttons (GsdWacomDevice *device)
 	return g_list_copy (device->priv->buttons);
 }
 
-static GsdWacomTabletButton *
-find_button_with_id (GsdWacomDevice *device,
-		     const char     *id)
-{
-	GList *l;
-
-	for (l = device->priv->buttons; l != NULL; l = l->next) {
-		GsdWacomTabletButton *button = l->data;
-
-		if (g_strcmp0 (button->id, id) == 0)
-			return button;
-	}
-	return NULL;
-}
-
-static GsdWacomTabletButton *
-find_button_with_index (GsdWacomDevice *device,
-			const char     *id,
-			int             index)
-{
-	GsdWacomTabletButton *button;
-	char *str;
-
-	str = g_strdup_printf ("%s-mode-%d", id, index);
-	button = find_button_with_id (device, str);
-	g_free (str);
-
-	return button;
-}
-
 GsdWacomTabletButton *
 gsd_wacom_device_get_button (GsdWacomDevice   *device,
 			     int               button,
 			     GtkDirectionType *dir)
 {
+	GPtrArray *array;
+	int elevator;
 	int index;
 
-	if (button <= 26) {
-		char *id;
-		GsdWacomTabletButton *ret;
-		int physical_button;
-
-		/* mouse_button = physical_button < 4 ? physical_button : physical_button + 4 */
-		if (button > 4)
-			physical_button = button - 4;
-		else
-			physical_button = button;
-
-		id = g_strdup_printf ("button%c", 'A' + physical_button - 1);
-		ret = find_button_with_id (device, id);
-		g_free (id);
-
-		return ret;
+	if (button <= MAX_X_BUTTON) {
+		if (button < 0)
+			return NULL;
+		return device->priv->buttons_by_number[button];
 	}
 
-	switch (button) {
-	case 90:
-	case 92:
-	case 94:
-	case 96:
+	if (button < FIRST_ELEVATOR_X_BUTTON ||
+	    button >= FIRST_ELEVATOR_X_BUTTON + 2 * NUM_ELEVATORS)
+		return NULL;
+
+	/* Even buttons go up, odd ones go down */
+	elevator = (button - FIRST_ELEVATOR_X_BUTTON) / 2;
+	if ((button - FIRST_ELEVATOR_X_BUTTON) % 2 == 0)
 		*dir = GTK_DIR_UP;
-		break;
-	case 91:
-	case 93:
-	case 95:
-	case 97:
+	else
 		*dir = GTK_DIR_DOWN;
-		break;
-	default:
-		;;
-	}
 
 	/* The group ID is implied by the button number */
-	switch (button) {
-	case 90:
-	case 91:
-		index = GPOINTER_TO_INT (g_hash_table_lookup (device->priv->modes, GINT_TO_POINTER (1)));
-		return find_button_with_index (device, "left-ring", index);
-	case 92:
-	case 93:
-		index = GPOINTER_TO_INT (g_hash_table_lookup (device->priv->modes, GINT_TO_POINTER (2)));
-		return find_button_with_index (device, "right-ring", index);
-	case 94:
-	case 95:
-		index = GPOINTER_TO_INT (g_hash_table_lookup (device->priv->modes, GINT_TO_POINTER (3)));
-		return find_button_with_index (device, "left-strip", index);
-	case 96:
-	case 97:
-		index = GPOINTER_TO_INT (g_hash_table_lookup (device->priv->modes, GINT_TO_POINTER (4)));
-		return find_button_with_index (device, "right-strip", index);
-	default:
+	array = device->priv->elevator_buttons[elevator];
+	if (array == NULL)
 		return NULL;
-	}
+	index = GPOINTER_TO_INT (g_hash_table_lookup (device->priv->modes, GINT_TO_POINTER (elevator + 1)));
+	if (index < 0 || (guint) index >= array->len)
+		return NULL;
+	return g_ptr_array_index (array, index);
 }
 
 GsdWacomRotation
@@ -123,6 +123,12 @@ typedef struct
 	GsdWacomTabletButtonPos   pos;
 	int                       group_id, idx;
 	int                       status_led;
+
+	/* Cached from settings, kept up-to-date on change */
+	GsdWacomActionType        action_type;
+	char                     *custom_action;
+	char                    **custom_elevator_action;
+	gulong                    changed_id;
 } GsdWacomTabletButton;
 
 void                  gsd_wacom_tablet_button_free (GsdWacomTabletButton *button);
@@ -64,11 +64,6 @@
 #define KEY_PRESSURETHRESHOLD   "pressurethreshold"
 #define KEY_PRESSURECURVE       "pressurecurve"
 
-/* Button settings */
-#define KEY_ACTION_TYPE         "action-type"
-#define KEY_CUSTOM_ACTION       "custom-action"
-#define KEY_CUSTOM_ELEVATOR_ACTION "custom-elevator-action"
-
 /* See "Wacom Pressure Threshold" */
 #define DEFAULT_PRESSURE_THRESHOLD 27
 
@@ -79,6 +74,7 @@ struct GsdWacomManagerPrivate
         guint device_added_id;
         guint device_removed_id;
         GHashTable *devices; /* key = GdkDevice, value = GsdWacomDevice */
+        GHashTable *device_ids; /* key = int (XI device id), value = GsdWacomDevice */
         GList *rr_screens;
 
         /* button capture */
@@ -968,6 +964,9 @@ device_added_cb (GdkDeviceManager *device_manager,
 		 gsd_wacom_device_get_tool_name (device),
 		 gsd_wacom_device_type_to_string (gsd_wacom_device_get_device_type (device)));
 	g_hash_table_insert (manager->priv->devices, (gpointer) gdk_device, device);
+	g_hash_table_insert (manager->priv->device_ids,
+			     GINT_TO_POINTER (gdk_x11_device_get_id (gdk_device)),
+			     device);
 
 	settings = gsd_wacom_device_get_settings (device);
 	g_signal_connect (G_OBJECT (settings), "changed",
@@ -1001,6 +1000,8 @@ device_removed_cb (GdkDeviceManager *device_manager,
 {
 	g_debug ("Removing device '%s' from known devices list",
 		 gdk_device_get_name (gdk_device));
+	g_hash_table_remove (manager->priv->device_ids,
+			     GINT_TO_POINTER (gdk_x11_device_get_id (gdk_device)));
 	g_hash_table_remove (manager->priv->devices, gdk_device);
 
 	/* Enable this chunk of code if you want to valgrind
@@ -1015,25 +1016,8 @@ static GsdWacomDevice *
 device_id_to_device (GsdWacomManager *manager,
 		     int              deviceid)
 {
-	GList *devices, *l;
-	GsdWacomDevice *ret;
-
-	ret = NULL;
-	devices = g_hash_table_get_keys (manager->priv->devices);
-
-	for (l = devices; l != NULL; l = l->next) {
-		GdkDevice *device = l->data;
-		int id;
-
-		g_object_get (device, "device-id", &id, NULL);
-		if (id == deviceid) {
-			ret = g_hash_table_lookup (manager->priv->devices, device);
-			break;
-		}
-	}
-
-	g_list_free (devices);
-	return ret;
+	return g_hash_table_lookup (manager->priv->device_ids,
+				    GINT_TO_POINTER (deviceid));
 }
 
 struct {
@@ -1066,26 +1050,22 @@ send_modifiers (Display *display,
 	}
 }
 
-static char *
-get_elevator_shortcut_string (GSettings        *settings,
-			      GtkDirectionType  dir)
+static const char *
+get_elevator_shortcut_string (GsdWacomTabletButton *wbutton,
+			      GtkDirectionType      dir)
 {
-	char **strv, *str;
+	char **strv;
 
-	strv = g_settings_get_strv (settings, KEY_CUSTOM_ELEVATOR_ACTION);
+	strv = wbutton->custom_elevator_action;
 	if (strv == NULL)
 		return NULL;
 
 	if (g_strv_length (strv) >= 1 && dir == GTK_DIR_UP)
-		str = g_strdup (strv[0]);
+		return strv[0];
 	else if (g_strv_length (strv) >= 2 && dir == GTK_DIR_DOWN)
-		str = g_strdup (strv[1]);
-	else
-		str = NULL;
-
-	g_strfreev (strv);
+		return strv[1];
 
-	return str;
+	return NULL;
 }
 
 static void
@@ -1095,7 +1075,7 @@ generate_key (GsdWacomTabletButton *wbutton,
 	      GtkDirectionType      dir,
 	      gboolean              is_press)
 {
-	char                 *str;
+	const char           *str;
 	guint                 keyval;
 	guint                *keycodes;
 	guint                 keycode;
@@ -1106,9 +1086,9 @@ generate_key (GsdWacomTabletButton *wbutton,
 
 	if (wbutton->type == WACOM_TABLET_BUTTON_TYPE_STRIP ||
 	    wbutton->type == WACOM_TABLET_BUTTON_TYPE_RING)
-		str = get_elevator_shortcut_string (wbutton->settings, dir);
+		str = get_elevator_shortcut_string (wbutton, dir);
 	else
-		str = g_settings_get_string (wbutton->settings, KEY_CUSTOM_ACTION);
+		str = wbutton->custom_action;
 
 	if (str == NULL)
 		return;
@@ -1116,7 +1096,6 @@ generate_key (GsdWacomTabletButton *wbutton,
 	gtk_accelerator_parse_with_keycode (str, &keyval, &keycodes, &mods);
 	if (keycodes == NULL) {
 		g_warning ("Failed to find a keycode for shortcut '%s'", str);
-		g_free (str);
 		return;
 	}
 	g_free (keycodes);
@@ -1124,7 +1103,6 @@ generate_key (GsdWacomTabletButton *wbutton,
 	/* Now look for our own keycode, in the group as us */
 	if (!gdk_keymap_get_entries_for_keyval (gdk_keymap_get_default (), keyval, &keys, &n_keys)) {
 		g_warning ("Failed to find a keycode for keyval '%s' (0x%x)", gdk_keyval_name (keyval), keyval);
-		g_free (str);
 		return;
 	}
 
@@ -1149,7 +1127,6 @@ generate_key (GsdWacomTabletButton *wbutton,
 	if (keycode == 0) {
 		g_warning ("Not emitting '%s' (keyval: %d, keycode: %d mods: 0x%x), invalid keycode",
 			   str, keyval, keycode, mods);
-		g_free (str);
 		return;
 	} else {
 		g_debug ("Emitting '%s' (keyval: %d, keycode: %d mods: 0x%x)",
@@ -1167,7 +1144,6 @@ generate_key (GsdWacomTabletButton *wbutton,
 	if (gdk_error_trap_pop ())
 		g_warning ("Failed to generate fake key event '%s'", str);
 
-	g_free (str);
 }
 
 static void
@@ -1241,7 +1217,8 @@ filter_button_events (XEvent          *xevent,
 
 	deviceid = xev->sourceid;
 	device = device_id_to_device (manager, deviceid);
-	if (gsd_wacom_device_get_device_type (device) != WACOM_TYPE_PAD)
+	if (device == NULL ||
+	    gsd_wacom_device_get_device_type (device) != WACOM_TYPE_PAD)
 		return GDK_FILTER_CONTINUE;
 
 	if ((manager->priv->osd_window != NULL) &&
@@ -1287,11 +1264,11 @@ filter_button_events (XEvent          *xevent,
 	emulate = osd_window_update_viewable (manager, wbutton, dir, xiev);
 
 	/* Nothing to do */
-	if (g_settings_get_enum (wbutton->settings, KEY_ACTION_TYPE) == GSD_WACOM_ACTION_TYPE_NONE)
+	if (wbutton->action_type == GSD_WACOM_ACTION_TYPE_NONE)
 		return GDK_FILTER_REMOVE;
 
 	/* Show OSD window when requested */
-	if (g_settings_get_enum (wbutton->settings, KEY_ACTION_TYPE) == GSD_WACOM_ACTION_TYPE_HELP) {
+	if (wbutton->action_type == GSD_WACOM_ACTION_TYPE_HELP) {
 		if (xiev->evtype == XI_ButtonRelease)
 			osd_window_toggle_visibility (manager, device);
 		return GDK_FILTER_REMOVE;
@@ -1301,7 +1278,7 @@ filter_button_events (XEvent          *xevent,
 		return GDK_FILTER_REMOVE;
 
 	/* Switch monitor */
-	if (g_settings_get_enum (wbutton->settings, KEY_ACTION_TYPE) == GSD_WACOM_ACTION_TYPE_SWITCH_MONITOR) {
+	if (wbutton->action_type == GSD_WACOM_ACTION_TYPE_SWITCH_MONITOR) {
 		if (xiev->evtype == XI_ButtonRelease)
 			switch_monitor (device);
 		return GDK_FILTER_REMOVE;
@@ -1344,6 +1321,7 @@ gsd_wacom_manager_idle_cb (GsdWacomManager *manager)
         gnome_settings_profile_start (NULL);
 
         manager->priv->devices = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_object_unref);
+        manager->priv->device_ids = g_hash_table_new (g_direct_hash, g_direct_equal);
 
         set_devicepresence_handler (manager);
 
@@ -1524,6 +1502,11 @@ gsd_wacom_manager_finalize (GObject *object)
 
         g_return_if_fail (wacom_manager->priv != NULL);
 
+        if (wacom_manager->priv->device_ids) {
+                g_hash_table_destroy (wacom_manager->priv->device_ids);
+                wacom_manager->priv->device_ids = NULL;
+        }
+
         if (wacom_manager->priv->devices) {
                 g_hash_table_destroy (wacom_manager->priv->devices);
                 wacom_manager->priv->devices = NULL;
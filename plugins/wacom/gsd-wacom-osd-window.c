@@ -23,6 +23,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <cairo.h>
@@ -139,6 +140,48 @@ get_sub_location (RsvgHandle *handle,
 	return TRUE;
 }
 
+static gboolean
+get_sub_area (RsvgHandle   *handle,
+              const char   *sub,
+              cairo_t      *cr,
+              GdkRectangle *area)
+{
+	RsvgPositionData  position;
+	RsvgDimensionData dimensions;
+	double x1, y1, x2, y2;
+	double cx[4], cy[4];
+	guint i;
+
+	if (sub == NULL ||
+	    !rsvg_handle_get_position_sub (handle, &position, sub) ||
+	    !rsvg_handle_get_dimensions_sub (handle, &dimensions, sub))
+		return FALSE;
+
+	cx[0] = cx[2] = position.x;
+	cx[1] = cx[3] = position.x + dimensions.width;
+	cy[0] = cy[1] = position.y;
+	cy[2] = cy[3] = position.y + dimensions.height;
+
+	/* The layout may be rotated, so transform all corners */
+	x1 = y1 = G_MAXDOUBLE;
+	x2 = y2 = -G_MAXDOUBLE;
+	for (i = 0; i < G_N_ELEMENTS (cx); i++) {
+		cairo_user_to_device (cr, &cx[i], &cy[i]);
+		x1 = MIN (x1, cx[i]);
+		y1 = MIN (y1, cy[i]);
+		x2 = MAX (x2, cx[i]);
+		y2 = MAX (y2, cy[i]);
+	}
+
+	/* Leave room for the stroke */
+	area->x = (int) floor (x1) - 2;
+	area->y = (int) floor (y1) - 2;
+	area->width = (int) ceil (x2) - area->x + 2;
+	area->height = (int) ceil (y2) - area->y + 2;
+
+	return TRUE;
+}
+
 static gboolean
 get_image_size (const char *filename, int *width, int *height)
 {
@@ -236,8 +279,12 @@ struct GsdWacomOSDButtonPrivate {
 	char                     *id;
 	char                     *class;
 	char                     *label;
+	char                     *sub_shape;
+	char                     *sub_leader;
 	double                    label_x;
 	double                    label_y;
+	GdkRectangle              shape_area;
+	GdkRectangle              label_area;
 	GsdWacomTabletButtonType  type;
 	GsdWacomTabletButtonPos   position;
 	gboolean                  active;
@@ -319,6 +366,28 @@ gsd_wacom_osd_button_set_location (GsdWacomOSDButton        *osd_button,
 	osd_button->priv->label_y = y;
 }
 
+/* The SVG elements rendered in the active colour for this button */
+static void
+gsd_wacom_osd_button_set_subs (GsdWacomOSDButton        *osd_button)
+{
+	GsdWacomOSDButtonPrivate *priv;
+
+	g_return_if_fail (GSD_IS_WACOM_OSD_BUTTON (osd_button));
+
+	priv = osd_button->priv;
+	g_clear_pointer (&priv->sub_shape, g_free);
+	g_clear_pointer (&priv->sub_leader, g_free);
+	if (priv->class == NULL)
+		return;
+
+	if (priv->type == WACOM_TABLET_BUTTON_TYPE_NORMAL ||
+	    priv->type == WACOM_TABLET_BUTTON_TYPE_HARDCODED)
+		priv->sub_shape = g_strconcat ("#Button", priv->class, NULL);
+	else
+		priv->sub_shape = g_strconcat ("#", priv->class, NULL);
+	priv->sub_leader = g_strconcat ("#Leader", priv->class, NULL);
+}
+
 static void
 gsd_wacom_osd_button_set_auto_off (GsdWacomOSDButton        *osd_button,
 				   guint                     timeout)
@@ -331,12 +400,25 @@ gsd_wacom_osd_button_set_auto_off (GsdWacomOSDButton        *osd_button,
 static void
 gsd_wacom_osd_button_redraw (GsdWacomOSDButton *osd_button)
 {
-	GdkWindow *window;
+	GsdWacomOSDButtonPrivate *priv;
+	GdkWindow                *window;
+	GdkRectangle              area;
 
 	g_return_if_fail (GTK_IS_WIDGET (osd_button->priv->widget));
 
-	window = gtk_widget_get_window (GTK_WIDGET (osd_button->priv->widget));
-	gdk_window_invalidate_rect (window, NULL, FALSE);
+	priv = osd_button->priv;
+	window = gtk_widget_get_window (GTK_WIDGET (priv->widget));
+	if (window == NULL)
+		return;
+
+	/* Only the button and its label change with the state,
+	 * fall back to the whole window if we don't know where they are */
+	if (priv->shape_area.width == 0 || priv->label_area.width == 0) {
+		gdk_window_invalidate_rect (window, NULL, FALSE);
+		return;
+	}
+	gdk_rectangle_union (&priv->shape_area, &priv->label_area, &area);
+	gdk_window_invalidate_rect (window, &area, FALSE);
 }
 
 static gboolean
@@ -553,6 +635,8 @@ gsd_wacom_osd_button_finalize (GObject *object)
 	g_clear_pointer (&priv->id, g_free);
 	g_clear_pointer (&priv->class, g_free);
 	g_clear_pointer (&priv->label, g_free);
+	g_clear_pointer (&priv->sub_shape, g_free);
+	g_clear_pointer (&priv->sub_leader, g_free);
 
 	G_OBJECT_CLASS (gsd_wacom_osd_button_parent_class)->finalize (object);
 }
@@ -644,6 +728,10 @@ gsd_wacom_osd_button_draw_label (GsdWacomOSDButton *osd_button,
 		ly = priv->label_y + logical_rect.y - logical_rect.height / 2;
 		break;
 	}
+	priv->label_area.x = (int) floor (lx) - 1;
+	priv->label_area.y = (int) floor (ly) - 1;
+	priv->label_area.width = logical_rect.width + 2;
+	priv->label_area.height = logical_rect.height + 2;
 	gtk_render_layout (style_context, cr, lx, ly, layout);
 	g_object_unref (layout);
 }
@@ -661,6 +749,12 @@ enum {
 struct GsdWacomOSDWindowPrivate
 {
 	RsvgHandle               *handle;
+	RsvgHandle               *active_handle;
+	gchar                    *layout_template;
+	gboolean                  layout_has_subs;
+	cairo_surface_t          *base_surface;
+	int                       base_width;
+	int                       base_height;
 	GsdWacomDevice           *pad;
 	GsdWacomRotation          rotation;
 	GdkRectangle              screen_area;
@@ -676,20 +770,17 @@ static void     gsd_wacom_osd_window_finalize    (GObject                *object
 
 G_DEFINE_TYPE (GsdWacomOSDWindow, gsd_wacom_osd_window, GTK_TYPE_WINDOW)
 
-static void
-gsd_wacom_osd_window_update (GsdWacomOSDWindow *osd_window)
+/* Builds the SVG with everything but the button styles filled in,
+ * none of which changes during the lifetime of the window */
+static gchar *
+gsd_wacom_osd_window_get_layout_template (GsdWacomOSDWindow *osd_window)
 {
 	GError      *error = NULL;
 	gchar       *width, *height;
-	gchar       *buttons_section;
 	gchar       *css_string;
 	const gchar *layout_file;
 	GBytes      *css_data;
         guint i;
-	GList *l;
-
-	g_return_if_fail (GSD_IS_WACOM_OSD_WINDOW (osd_window));
-	g_return_if_fail (GSD_IS_WACOM_DEVICE (osd_window->priv->pad));
 
 	css_data = g_resources_lookup_data (RES_PATH "tablet-layout.css", 0, &error);
 	if (error != NULL) {
@@ -697,7 +788,7 @@ gsd_wacom_osd_window_update (GsdWacomOSDWindow *osd_window)
 		g_clear_pointer (&error, g_error_free);
 	}
 	if (css_data == NULL)
-		return;
+		return NULL;
 	css_string = g_strdup ((gchar *) g_bytes_get_data (css_data, NULL));
 	g_bytes_unref(css_data);
 
@@ -709,26 +800,6 @@ gsd_wacom_osd_window_update (GsdWacomOSDWindow *osd_window)
 	replace_string (&css_string, "layout_height", height);
 	g_free (height);
 
-	/* Build the buttons section */
-	buttons_section = g_strdup ("");
-	for (l = osd_window->priv->buttons; l != NULL; l = l->next) {
-		GsdWacomOSDButton *osd_button = l->data;
-
-		if (osd_button->priv->visible == FALSE)
-			continue;
-
-		if (osd_button->priv->active) {
-			buttons_section = g_strconcat (buttons_section,
-			                               ".", osd_button->priv->class, " {\n"
-			                               "      stroke:   active_color !important;\n"
-			                               "      fill:     active_color !important;\n"
-			                               "    }\n",
-			                               NULL);
-		}
-	}
-	replace_string (&css_string, "buttons_section", buttons_section);
-	g_free (buttons_section);
-
         for (i = 0; i < G_N_ELEMENTS (css_color_table); i++)
 		replace_string (&css_string,
 		                css_color_table[i].color_name,
@@ -737,18 +808,118 @@ gsd_wacom_osd_window_update (GsdWacomOSDWindow *osd_window)
 	layout_file = gsd_wacom_device_get_layout_path (osd_window->priv->pad);
 	replace_string (&css_string, "layout_file", layout_file);
 
+	return css_string;
+}
+
+/* Parses the layout, styling as active the buttons that are currently
+ * active if @include_active is set, and the other ones if
+ * @include_inactive is set */
+static RsvgHandle *
+gsd_wacom_osd_window_new_handle (GsdWacomOSDWindow *osd_window,
+                                 gboolean           include_inactive,
+                                 gboolean           include_active)
+{
+	GError      *error = NULL;
+	GString     *buttons_section;
+	gchar       *css_string;
+	RsvgHandle  *handle;
+	GList       *l;
+
+	/* Build the buttons section */
+	buttons_section = g_string_new ("");
+	for (l = osd_window->priv->buttons; l != NULL; l = l->next) {
+		GsdWacomOSDButton *osd_button = l->data;
+
+		if (osd_button->priv->class == NULL)
+			continue;
+		if (osd_button->priv->active && osd_button->priv->visible) {
+			if (!include_active)
+				continue;
+		} else {
+			if (!include_inactive)
+				continue;
+		}
+
+		g_string_append_printf (buttons_section,
+		                        ".%s {\n"
+		                        "      stroke:   " ACTIVE_COLOR " !important;\n"
+		                        "      fill:     " ACTIVE_COLOR " !important;\n"
+		                        "    }\n",
+		                        osd_button->priv->class);
+	}
+	css_string = g_strdup (osd_window->priv->layout_template);
+	replace_string (&css_string, "buttons_section", buttons_section->str);
+	g_string_free (buttons_section, TRUE);
+
 	/* Render the SVG with the CSS applied */
-	if (osd_window->priv->handle)
-		g_object_unref (osd_window->priv->handle);
-	osd_window->priv->handle = rsvg_handle_new_from_data ((guint8 *) css_string,
-	                                                      strlen (css_string),
-	                                                      &error);
+	handle = rsvg_handle_new_from_data ((guint8 *) css_string,
+	                                    strlen (css_string),
+	                                    &error);
 	if (error != NULL) {
 		g_debug ("CSS applied:\n%s\n", css_string);
 		g_printerr ("RSVG error: %s\n", error->message);
 		g_clear_pointer (&error, g_error_free);
 	}
 	g_free (css_string);
+
+	return handle;
+}
+
+static void
+gsd_wacom_osd_window_invalidate_layout (GsdWacomOSDWindow *osd_window)
+{
+	GsdWacomOSDWindowPrivate *priv = osd_window->priv;
+
+	g_clear_object (&priv->handle);
+	g_clear_object (&priv->active_handle);
+	g_clear_pointer (&priv->layout_template, g_free);
+	g_clear_pointer (&priv->base_surface, cairo_surface_destroy);
+	priv->layout_has_subs = FALSE;
+}
+
+/* Parses the layout once: one handle with all buttons inactive used
+ * for the background, and one with every button active from which the
+ * active buttons are drawn on top */
+static gboolean
+gsd_wacom_osd_window_update (GsdWacomOSDWindow *osd_window)
+{
+	GsdWacomOSDWindowPrivate *priv;
+	GList                    *l;
+
+	g_return_val_if_fail (GSD_IS_WACOM_OSD_WINDOW (osd_window), FALSE);
+	g_return_val_if_fail (GSD_IS_WACOM_DEVICE (osd_window->priv->pad), FALSE);
+
+	priv = osd_window->priv;
+	if (priv->handle != NULL)
+		return TRUE;
+
+	if (priv->layout_template == NULL)
+		priv->layout_template = gsd_wacom_osd_window_get_layout_template (osd_window);
+	if (priv->layout_template == NULL)
+		return FALSE;
+
+	priv->handle = gsd_wacom_osd_window_new_handle (osd_window, FALSE, FALSE);
+	if (priv->handle == NULL)
+		return FALSE;
+
+	/* Layouts which don't follow the usual element naming get the
+	 * whole layout re-parsed for every state change instead */
+	priv->layout_has_subs = TRUE;
+	for (l = priv->buttons; l != NULL; l = l->next) {
+		GsdWacomOSDButton *osd_button = l->data;
+
+		if (osd_button->priv->sub_shape == NULL ||
+		    !rsvg_handle_has_sub (priv->handle, osd_button->priv->sub_shape)) {
+			g_debug ("No element '%s' in the layout, not caching the OSD",
+			         osd_button->priv->sub_shape);
+			priv->layout_has_subs = FALSE;
+			break;
+		}
+	}
+	if (priv->layout_has_subs)
+		priv->active_handle = gsd_wacom_osd_window_new_handle (osd_window, TRUE, TRUE);
+
+	return TRUE;
 }
 
 static void
@@ -806,6 +977,7 @@ gsd_wacom_osd_window_draw_labels (GsdWacomOSDWindow   *osd_window,
 
 static void
 gsd_wacom_osd_window_place_buttons (GsdWacomOSDWindow *osd_window,
+				    RsvgHandle        *handle,
 				    cairo_t           *cr)
 {
 	GList            *l;
@@ -814,17 +986,30 @@ gsd_wacom_osd_window_place_buttons (GsdWacomOSDWindow *osd_window,
 
 	for (l = osd_window->priv->buttons; l != NULL; l = l->next) {
 		GsdWacomOSDButton *osd_button = l->data;
+		GdkRectangle       area;
 		double             label_x, label_y;
 		gchar             *sub;
 
 		sub = gsd_wacom_osd_button_get_label_class (osd_button);
-		if (!get_sub_location (osd_window->priv->handle, sub, cr, &label_x, &label_y)) {
+		if (!get_sub_location (handle, sub, cr, &label_x, &label_y)) {
 			g_warning ("Failed to retrieve %s position", sub);
 			g_free (sub);
 			continue;
 		}
 		g_free (sub);
 		gsd_wacom_osd_button_set_location (osd_button, label_x, label_y);
+
+		/* Remember where the button is so that state changes
+		 * only need that part of the window redrawn */
+		memset (&osd_button->priv->shape_area, 0, sizeof (GdkRectangle));
+		if (!osd_window->priv->layout_has_subs)
+			continue;
+		if (!get_sub_area (handle, osd_button->priv->sub_shape, cr,
+		                   &osd_button->priv->shape_area))
+			continue;
+		if (get_sub_area (handle, osd_button->priv->sub_leader, cr, &area))
+			gdk_rectangle_union (&osd_button->priv->shape_area, &area,
+			                     &osd_button->priv->shape_area);
 	}
 }
 
@@ -861,6 +1046,86 @@ gsd_wacom_osd_window_adjust_cairo (GsdWacomOSDWindow *osd_window,
 	cairo_translate (cr, twidth, theight);
 }
 
+static void
+gsd_wacom_osd_window_render_layout (GsdWacomOSDWindow *osd_window,
+				    RsvgHandle        *handle,
+				    cairo_t           *cr)
+{
+	cairo_set_source_rgba (cr, 0, 0, 0, BACK_OPACITY);
+	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+	cairo_paint (cr);
+	cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+
+	/* Save original matrix */
+	cairo_save (cr);
+
+	/* Apply new cairo transformation matrix */
+	gsd_wacom_osd_window_adjust_cairo (osd_window, cr);
+
+	/* And render the tablet layout */
+	rsvg_handle_render_cairo (handle, cr);
+
+	gsd_wacom_osd_window_place_buttons (osd_window, handle, cr);
+
+	/* Reset to original matrix */
+	cairo_restore (cr);
+}
+
+/* The background and the layout with all buttons inactive, only
+ * rendered again when the window size changes */
+static cairo_surface_t *
+gsd_wacom_osd_window_get_base_surface (GsdWacomOSDWindow *osd_window,
+				       cairo_t           *cr,
+				       int                width,
+				       int                height)
+{
+	GsdWacomOSDWindowPrivate *priv = osd_window->priv;
+	cairo_t                  *base_cr;
+
+	if (priv->base_surface != NULL &&
+	    priv->base_width == width &&
+	    priv->base_height == height)
+		return priv->base_surface;
+
+	g_clear_pointer (&priv->base_surface, cairo_surface_destroy);
+	priv->base_surface = cairo_surface_create_similar (cairo_get_target (cr),
+	                                                   CAIRO_CONTENT_COLOR_ALPHA,
+	                                                   width, height);
+	priv->base_width = width;
+	priv->base_height = height;
+
+	base_cr = cairo_create (priv->base_surface);
+	gsd_wacom_osd_window_render_layout (osd_window, priv->handle, base_cr);
+	cairo_destroy (base_cr);
+
+	return priv->base_surface;
+}
+
+static void
+gsd_wacom_osd_window_draw_active_buttons (GsdWacomOSDWindow *osd_window,
+					  cairo_t           *cr)
+{
+	RsvgHandle *handle = osd_window->priv->active_handle;
+	GList      *l;
+
+	cairo_save (cr);
+	gsd_wacom_osd_window_adjust_cairo (osd_window, cr);
+
+	for (l = osd_window->priv->buttons; l != NULL; l = l->next) {
+		GsdWacomOSDButton *osd_button = l->data;
+
+		if (osd_button->priv->visible == FALSE ||
+		    osd_button->priv->active == FALSE)
+			continue;
+
+		rsvg_handle_render_cairo_sub (handle, cr, osd_button->priv->sub_shape);
+		if (rsvg_handle_has_sub (handle, osd_button->priv->sub_leader))
+			rsvg_handle_render_cairo_sub (handle, cr, osd_button->priv->sub_leader);
+	}
+
+	cairo_restore (cr);
+}
+
 static gboolean
 gsd_wacom_osd_window_draw (GtkWidget *widget,
 			   cairo_t   *cr)
@@ -873,29 +1138,34 @@ gsd_wacom_osd_window_draw (GtkWidget *widget,
 	if (gtk_cairo_should_draw_window (cr, gtk_widget_get_window (widget))) {
 		GtkStyleContext     *style_context;
 		PangoContext        *pango_context;
+		cairo_surface_t     *surface;
+		RsvgHandle          *handle;
 
 		style_context = gtk_widget_get_style_context (widget);
 		pango_context = gtk_widget_get_pango_context (widget);
 
-		cairo_set_source_rgba (cr, 0, 0, 0, BACK_OPACITY);
-		cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
-		cairo_paint (cr);
-		cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
-
-		/* Save original matrix */
-		cairo_save (cr);
-
-		/* Apply new cairo transformation matrix */
-		gsd_wacom_osd_window_adjust_cairo (osd_window, cr);
-
-		/* And render the tablet layout */
-		gsd_wacom_osd_window_update (osd_window);
-		rsvg_handle_render_cairo (osd_window->priv->handle, cr);
-
-		gsd_wacom_osd_window_place_buttons (osd_window, cr);
-
-		/* Reset to original matrix */
-		cairo_restore (cr);
+		if (!gsd_wacom_osd_window_update (osd_window))
+			return FALSE;
+
+		if (osd_window->priv->active_handle != NULL) {
+			/* Cached background, with only the active buttons on top */
+			surface = gsd_wacom_osd_window_get_base_surface (osd_window, cr,
+			                                                 gtk_widget_get_allocated_width (widget),
+			                                                 gtk_widget_get_allocated_height (widget));
+			cairo_set_source_surface (cr, surface, 0, 0);
+			cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+			cairo_paint (cr);
+			cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+
+			gsd_wacom_osd_window_draw_active_buttons (osd_window, cr);
+		} else {
+			/* Render the whole layout with the current state */
+			handle = gsd_wacom_osd_window_new_handle (osd_window, FALSE, TRUE);
+			if (handle == NULL)
+				return FALSE;
+			gsd_wacom_osd_window_render_layout (osd_window, handle, cr);
+			g_object_unref (handle);
+		}
 
 		/* Draw button labels and message */
 		gsd_wacom_osd_window_draw_labels (osd_window,
@@ -1132,6 +1402,7 @@ gsd_wacom_osd_window_add_button_with_dir (GsdWacomOSDWindow    *osd_window,
 	g_free (str);
 
 	gsd_wacom_osd_button_set_button_type (osd_button, tablet_button->type);
+	gsd_wacom_osd_button_set_subs (osd_button);
 	gsd_wacom_osd_button_set_position (osd_button, tablet_button->pos);
 	gsd_wacom_osd_button_set_auto_off (osd_button, timeout);
 	osd_window->priv->buttons = g_list_append (osd_window->priv->buttons, osd_button);
@@ -1307,9 +1578,7 @@ gsd_wacom_osd_window_set_device (GsdWacomOSDWindow *osd_window,
 	g_return_if_fail (GSD_IS_WACOM_DEVICE (device));
 
 	/* If we had a layout previously handled, get rid of it */
-	if (osd_window->priv->handle)
-		g_object_unref (osd_window->priv->handle);
-	osd_window->priv->handle = NULL;
+	gsd_wacom_osd_window_invalidate_layout (osd_window);
 
 	/* Bind the device with the OSD window */
 	if (osd_window->priv->pad)
@@ -1465,6 +1734,9 @@ gsd_wacom_osd_window_set_mode (GsdWacomOSDWindow    *osd_window,
 
 	}
 	g_list_free (list);
+
+	/* The visible labels changed, the layout itself did not */
+	gtk_widget_queue_draw (GTK_WIDGET (osd_window));
 }
 
 GtkWidget *
@@ -1556,7 +1828,7 @@ gsd_wacom_osd_window_finalize (GObject *object)
 	g_return_if_fail (osd_window->priv != NULL);
 
 	priv = osd_window->priv;
-	g_clear_object (&priv->handle);
+	gsd_wacom_osd_window_invalidate_layout (osd_window);
 	g_clear_pointer (&priv->message, g_free);
 	if (priv->buttons) {
 		g_list_free_full (priv->buttons, g_object_unref);
@@ -20,7 +20,10 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 
 #include "gsd-xsettings-gtk.h"
@@ -35,15 +38,24 @@ enum {
         PROP_GTK_MODULES
 };
 
+/* What a file in the modules directory says, valid as long as the file
+ * keeps the same mtime and size */
+typedef struct {
+        gint64             mtime;
+        goffset            size;
+        char              *module_name;         /* NULL if not a module */
+        char              *key;                 /* NULL if unconditional */
+        GSettings         *settings;
+} ModuleDescriptor;
+
 struct GsdXSettingsGtkPrivate {
         char              *modules;
-        GHashTable        *dir_modules;
 
         GSettings         *settings;
 
-        guint64            dir_mtime;
         GFileMonitor      *monitor;
-        GList             *cond_settings;
+        GHashTable        *descriptors;         /* file name -> ModuleDescriptor */
+        GHashTable        *cond_settings;       /* schema -> GSettings */
 };
 
 #define GSD_XSETTINGS_GTK_GET_PRIVATE(object) (G_TYPE_INSTANCE_GET_PRIVATE ((object), GSD_TYPE_XSETTINGS_GTK, GsdXSettingsGtkPrivate))
@@ -53,15 +65,13 @@ G_DEFINE_TYPE(GsdXSettingsGtk, gsd_xsettings_gtk, G_TYPE_OBJECT)
 static void update_gtk_modules (GsdXSettingsGtk *gtk);
 
 static void
-empty_cond_settings_list (GsdXSettingsGtk *gtk)
+module_descriptor_free (ModuleDescriptor *desc)
 {
-        if (gtk->priv->cond_settings == NULL)
-                return;
-
-        /* Empty the list of settings */
-        g_list_foreach (gtk->priv->cond_settings, (GFunc) g_object_unref, NULL);
-        g_list_free (gtk->priv->cond_settings);
-        gtk->priv->cond_settings = NULL;
+        g_free (desc->module_name);
+        g_free (desc->key);
+        if (desc->settings != NULL)
+                g_object_unref (desc->settings);
+        g_free (desc);
 }
 
 static void
@@ -69,36 +79,72 @@ cond_setting_changed (GSettings       *settings,
                       const char      *key,
                       GsdXSettingsGtk *gtk)
 {
-        gboolean enabled;
-        const char *module_name;
-
-        module_name = g_object_get_data (G_OBJECT (settings), "module-name");
-
-        enabled = g_settings_get_boolean (settings, key);
-        if (enabled != FALSE) {
-                if (gtk->priv->dir_modules == NULL)
-                        gtk->priv->dir_modules = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-                g_hash_table_insert (gtk->priv->dir_modules, g_strdup (module_name), NULL);
-        } else if (gtk->priv->dir_modules != NULL) {
-                g_hash_table_remove (gtk->priv->dir_modules, module_name);
+        update_gtk_modules (gtk);
+}
+
+/* One GSettings per schema, however many modules use it */
+static GSettings *
+get_cond_settings (GsdXSettingsGtk *gtk,
+                   const char      *schema)
+{
+        GSettingsSchemaSource *source;
+        GSettingsSchema *settings_schema;
+        GSettings *settings;
+
+        settings = g_hash_table_lookup (gtk->priv->cond_settings, schema);
+        if (settings != NULL)
+                return g_object_ref (settings);
+
+        /* a module can be installed before its schema is */
+        source = g_settings_schema_source_get_default ();
+        settings_schema = g_settings_schema_source_lookup (source, schema, TRUE);
+        if (settings_schema == NULL) {
+                g_warning ("GTK module schema '%s' is not installed", schema);
+                return NULL;
         }
+        g_settings_schema_unref (settings_schema);
 
-        update_gtk_modules (gtk);
+        settings = g_settings_new (schema);
+        g_signal_connect_object (G_OBJECT (settings), "changed",
+                                 G_CALLBACK (cond_setting_changed), gtk, 0);
+        g_hash_table_insert (gtk->priv->cond_settings, g_strdup (schema), settings);
+
+        return g_object_ref (settings);
+}
+
+/* Drops the settings of schemas no module uses anymore */
+static void
+prune_cond_settings (GsdXSettingsGtk *gtk)
+{
+        GHashTableIter iter;
+        GHashTable *used;
+        ModuleDescriptor *desc;
+        GSettings *settings;
+
+        used = g_hash_table_new (g_direct_hash, g_direct_equal);
+        g_hash_table_iter_init (&iter, gtk->priv->descriptors);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &desc)) {
+                if (desc->settings != NULL)
+                        g_hash_table_add (used, desc->settings);
+        }
+
+        g_hash_table_iter_init (&iter, gtk->priv->cond_settings);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &settings)) {
+                if (!g_hash_table_contains (used, settings))
+                        g_hash_table_iter_remove (&iter);
+        }
+        g_hash_table_destroy (used);
 }
 
-static char *
+static ModuleDescriptor *
 process_desktop_file (const char      *path,
                       GsdXSettingsGtk *gtk)
 {
         GKeyFile *keyfile;
-        char *retval;
-        char *module_name;
+        ModuleDescriptor *desc;
+        char *schema;
 
-        retval = NULL;
-
-        if (g_str_has_suffix (path, ".desktop") == FALSE &&
-            g_str_has_suffix (path, ".gtk-module") == FALSE)
-                return retval;
+        desc = g_new0 (ModuleDescriptor, 1);
 
         keyfile = g_key_file_new ();
         if (g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL) == FALSE)
@@ -107,114 +153,104 @@ process_desktop_file (const char      *path,
         if (g_key_file_has_group (keyfile, "GTK Module") == FALSE)
                 goto bail;
 
-        module_name = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Name", NULL);
-        if (module_name == NULL)
+        desc->module_name = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Name", NULL);
+        if (desc->module_name == NULL)
                 goto bail;
 
-        if (g_key_file_has_key (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL) != FALSE) {
-                char *schema;
-                char *key;
-                gboolean enabled;
-                GSettings *settings;
-                char *signal;
+        schema = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL);
+        if (schema != NULL) {
+                desc->key = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Key", NULL);
+                desc->settings = get_cond_settings (gtk, schema);
+                g_free (schema);
 
-                schema = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL);
-                key = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Key", NULL);
+                /* can't tell if it's enabled, so it isn't */
+                if (desc->key == NULL || desc->settings == NULL) {
+                        g_clear_pointer (&desc->module_name, g_free);
+                        g_clear_pointer (&desc->key, g_free);
+                        g_clear_object (&desc->settings);
+                }
+        }
 
-                settings = g_settings_new (schema);
-                enabled = g_settings_get_boolean (settings, key);
+bail:
+        g_key_file_free (keyfile);
+        return desc;
+}
 
-                gtk->priv->cond_settings = g_list_prepend (gtk->priv->cond_settings, settings);
+/* Returns TRUE if what the file says changed */
+static gboolean
+update_module_file (GsdXSettingsGtk *gtk,
+                    const char      *name)
+{
+        ModuleDescriptor *desc, *old;
+        GStatBuf buf;
+        char *path;
 
-                g_object_set_data_full (G_OBJECT (settings), "module-name", g_strdup (module_name), (GDestroyNotify) g_free);
+        if (g_str_has_suffix (name, ".desktop") == FALSE &&
+            g_str_has_suffix (name, ".gtk-module") == FALSE)
+                return FALSE;
 
-                signal = g_strdup_printf ("changed::%s", key);
-                g_signal_connect_object (G_OBJECT (settings), signal, G_CALLBACK (cond_setting_changed), gtk, 0);
-                g_free (signal);
-                g_free (schema);
-                g_free (key);
+        path = g_build_filename (GTK_MODULES_DIRECTORY, name, NULL);
+        old = g_hash_table_lookup (gtk->priv->descriptors, name);
 
-                if (enabled != FALSE)
-                        retval = g_strdup (module_name);
-        } else {
-                retval = g_strdup (module_name);
+        if (g_stat (path, &buf) != 0) {
+                g_free (path);
+                return g_hash_table_remove (gtk->priv->descriptors, name);
         }
 
-	g_free (module_name);
+        /* nothing to do if the file is the same */
+        if (old != NULL &&
+            old->mtime == buf.st_mtime &&
+            old->size == buf.st_size) {
+                g_free (path);
+                return FALSE;
+        }
 
-bail:
-        g_key_file_free (keyfile);
-        return retval;
+        desc = process_desktop_file (path, gtk);
+        desc->mtime = buf.st_mtime;
+        desc->size = buf.st_size;
+        g_hash_table_insert (gtk->priv->descriptors, g_strdup (name), desc);
+        g_free (path);
+
+        return TRUE;
 }
 
 static void
 get_gtk_modules_from_dir (GsdXSettingsGtk *gtk)
 {
-        GFile *file;
-        GFileInfo *info;
-        GHashTable *ht;
-
-        file = g_file_new_for_path (GTK_MODULES_DIRECTORY);
-        info = g_file_query_info (file,
-                                  G_FILE_ATTRIBUTE_TIME_MODIFIED,
-                                  G_FILE_QUERY_INFO_NONE,
-                                  NULL,
-                                  NULL);
-        if (info != NULL) {
-                guint64 dir_mtime;
-
-                dir_mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
-                if (gtk->priv->dir_mtime == 0 ||
-                    dir_mtime > gtk->priv->dir_mtime) {
-                        GDir *dir;
-                        const char *name;
-
-                        empty_cond_settings_list (gtk);
-
-                        gtk->priv->dir_mtime = dir_mtime;
-
-                        if (gtk->priv->dir_modules != NULL) {
-                                g_hash_table_destroy (gtk->priv->dir_modules);
-                                gtk->priv->dir_modules = NULL;
-                        }
-
-                        dir = g_dir_open (GTK_MODULES_DIRECTORY, 0, NULL);
-                        if (dir == NULL)
-                                goto bail;
-
-                        ht = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-
-                        while ((name = g_dir_read_name (dir)) != NULL) {
-                                char *path;
-                                char *module;
-
-                                path = g_build_filename (GTK_MODULES_DIRECTORY, name, NULL);
-                                module = process_desktop_file (path, gtk);
-                                if (module != NULL)
-                                        g_hash_table_insert (ht, module, NULL);
-                                g_free (path);
-                        }
-                        g_dir_close (dir);
-
-                        gtk->priv->dir_modules = ht;
+        GHashTableIter iter;
+        GHashTable *present;
+        const char *name;
+        GDir *dir;
+
+        /* g_dir_read_name() reuses its buffer */
+        present = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+        dir = g_dir_open (GTK_MODULES_DIRECTORY, 0, NULL);
+        if (dir != NULL) {
+                while ((name = g_dir_read_name (dir)) != NULL) {
+                        update_module_file (gtk, name);
+                        g_hash_table_add (present, g_strdup (name));
                 }
-                g_object_unref (info);
-        } else {
-                empty_cond_settings_list (gtk);
         }
 
-bail:
-        g_object_unref (file);
+        /* forget about the files that went away */
+        g_hash_table_iter_init (&iter, gtk->priv->descriptors);
+        while (g_hash_table_iter_next (&iter, (gpointer *) &name, NULL)) {
+                if (!g_hash_table_contains (present, name))
+                        g_hash_table_iter_remove (&iter);
+        }
+        g_hash_table_destroy (present);
+        if (dir != NULL)
+                g_dir_close (dir);
+
+        prune_cond_settings (gtk);
 }
 
-static void
-stringify_gtk_modules (gpointer key,
-                       gpointer value,
-                       GString *str)
+static int
+compare_modules (gconstpointer a,
+                 gconstpointer b)
 {
-        if (str->len != 0)
-                g_string_append_c (str, ':');
-        g_string_append (str, key);
+        return strcmp (*(const char **) a, *(const char **) b);
 }
 
 static void
@@ -222,6 +258,10 @@ update_gtk_modules (GsdXSettingsGtk *gtk)
 {
         char **enabled, **disabled;
         GHashTable *ht;
+        GHashTableIter iter;
+        ModuleDescriptor *desc;
+        GPtrArray *array;
+        gpointer key;
         guint i;
         GString *str;
         char *modules;
@@ -231,30 +271,41 @@ update_gtk_modules (GsdXSettingsGtk *gtk)
 
         ht = g_hash_table_new (g_str_hash, g_str_equal);
 
-        if (gtk->priv->dir_modules != NULL) {
-                GList *list, *l;
-
-                list = g_hash_table_get_keys (gtk->priv->dir_modules);
-                for (l = list; l != NULL; l = l->next) {
-                        g_hash_table_insert (ht, l->data, NULL);
-                }
-                g_list_free (list);
+        g_hash_table_iter_init (&iter, gtk->priv->descriptors);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &desc)) {
+                if (desc->module_name == NULL)
+                        continue;
+                if (desc->settings != NULL &&
+                    g_settings_get_boolean (desc->settings, desc->key) == FALSE)
+                        continue;
+                g_hash_table_add (ht, desc->module_name);
         }
 
         for (i = 0; enabled[i] != NULL; i++)
-                g_hash_table_insert (ht, enabled[i], NULL);
+                g_hash_table_add (ht, enabled[i]);
 
         for (i = 0; disabled[i] != NULL; i++)
                 g_hash_table_remove (ht, disabled[i]);
 
+        /* sorted, so that the same modules always give the same string */
+        array = g_ptr_array_new ();
+        g_hash_table_iter_init (&iter, ht);
+        while (g_hash_table_iter_next (&iter, &key, NULL))
+                g_ptr_array_add (array, key);
+        g_ptr_array_sort (array, compare_modules);
+
         str = g_string_new (NULL);
-        g_hash_table_foreach (ht, (GHFunc) stringify_gtk_modules, str);
+        for (i = 0; i < array->len; i++) {
+                if (str->len != 0)
+                        g_string_append_c (str, ':');
+                g_string_append (str, g_ptr_array_index (array, i));
+        }
+        g_ptr_array_unref (array);
         g_hash_table_destroy (ht);
 
         modules = g_string_free (str, FALSE);
 
-        if (modules == NULL ||
-            gtk->priv->modules == NULL ||
+        if (gtk->priv->modules == NULL ||
             g_str_equal (modules, gtk->priv->modules) == FALSE) {
                 g_free (gtk->priv->modules);
                 gtk->priv->modules = modules;
@@ -267,6 +318,24 @@ update_gtk_modules (GsdXSettingsGtk *gtk)
 	g_strfreev (disabled);
 }
 
+static gboolean
+update_module_gfile (GsdXSettingsGtk *gtk,
+                     GFile           *dir,
+                     GFile           *file)
+{
+        gboolean changed;
+        char *name;
+
+        if (file == NULL || !g_file_has_parent (file, dir))
+                return FALSE;
+
+        name = g_file_get_basename (file);
+        changed = update_module_file (gtk, name);
+        g_free (name);
+
+        return changed;
+}
+
 static void
 gtk_modules_dir_changed_cb (GFileMonitor     *monitor,
                             GFile            *file,
@@ -274,8 +343,25 @@ gtk_modules_dir_changed_cb (GFileMonitor     *monitor,
                             GFileMonitorEvent event_type,
                             GsdXSettingsGtk  *gtk)
 {
-        get_gtk_modules_from_dir (gtk);
-        update_gtk_modules (gtk);
+        GFile *dir;
+        gboolean changed;
+
+        /* only the files that changed need looking at, unless it's
+         * the directory itself that came or went */
+        dir = g_file_new_for_path (GTK_MODULES_DIRECTORY);
+        if (g_file_equal (file, dir)) {
+                get_gtk_modules_from_dir (gtk);
+                changed = TRUE;
+        } else {
+                changed = update_module_gfile (gtk, dir, file);
+                changed |= update_module_gfile (gtk, dir, other_file);
+                if (changed)
+                        prune_cond_settings (gtk);
+        }
+        g_object_unref (dir);
+
+        if (changed)
+                update_gtk_modules (gtk);
 }
 
 static void
@@ -288,6 +374,16 @@ gsd_xsettings_gtk_init (GsdXSettingsGtk *gtk)
         g_debug ("GsdXSettingsGtk initializing");
 
         gtk->priv->settings = g_settings_new (XSETTINGS_PLUGIN_SCHEMA);
+        g_signal_connect_swapped (gtk->priv->settings, "changed::" GTK_MODULES_ENABLED_KEY,
+                                  G_CALLBACK (update_gtk_modules), gtk);
+        g_signal_connect_swapped (gtk->priv->settings, "changed::" GTK_MODULES_DISABLED_KEY,
+                                  G_CALLBACK (update_gtk_modules), gtk);
+
+        gtk->priv->descriptors = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                        g_free,
+                                                        (GDestroyNotify) module_descriptor_free);
+        gtk->priv->cond_settings = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                          g_free, g_object_unref);
 
         get_gtk_modules_from_dir (gtk);
 
@@ -320,17 +416,13 @@ gsd_xsettings_gtk_finalize (GObject *object)
         g_free (gtk->priv->modules);
         gtk->priv->modules = NULL;
 
-        if (gtk->priv->dir_modules != NULL) {
-                g_hash_table_destroy (gtk->priv->dir_modules);
-                gtk->priv->dir_modules = NULL;
-        }
-
         g_object_unref (gtk->priv->settings);
 
         if (gtk->priv->monitor != NULL)
                 g_object_unref (gtk->priv->monitor);
 
-        empty_cond_settings_list (gtk);
+        g_hash_table_destroy (gtk->priv->descriptors);
+        g_hash_table_destroy (gtk->priv->cond_settings);
 
         G_OBJECT_CLASS (gsd_xsettings_gtk_parent_class)->finalize (object);
 }
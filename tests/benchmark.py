@@ -0,0 +1,486 @@
+#!/usr/bin/env python
+'''GNOME settings daemon performance benchmarks
+
+This runs the plugin test programs in the same environment as the plugin
+tests (dummy X.org server, private D-BUSes, mock services) and measures:
+
+ - startup: time from spawning gsd-test-<plugin> until its start-up work has
+   been dispatched (ms)
+ - wakeups: context switches of an idle plugin, per minute
+ - hotplug.input: time for the keyboard plugin to react to a new keyboard (ms)
+ - hotplug.output: time for the power plugin to react to an output change (ms)
+ - media-keys.dispatch: time from the shell activating the "play"
+   accelerator to the MediaPlayerKeyPressed signal (ms)
+ - xsettings.propagation: time from changing a GSettings key to GTK seeing
+   the new XSETTINGS value (ms)
+
+All metrics are "lower is better". The results are written as JSON to
+$BENCHMARK_OUTPUT (default: benchmark.json), and compared against
+$BENCHMARK_BASELINE if that file exists; the script fails if any metric got
+worse than the baseline by more than $BENCHMARK_TOLERANCE (default: 0.2, that
+is 20%). Baselines are only meaningful on the machine they were recorded on.
+'''
+
+__license__ = 'GPL v2 or later'
+
+import unittest
+import subprocess
+import sys
+import time
+import os
+import os.path
+import json
+import signal
+import re
+import platform
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import gsdtestcase
+
+from gi.repository import GLib
+from gi.repository import Gio
+
+top_builddir = gsdtestcase.top_builddir
+
+iterations = int(os.environ.get('BENCHMARK_ITERATIONS', '5'))
+idle_time = float(os.environ.get('BENCHMARK_IDLE_TIME', '10'))
+tolerance = float(os.environ.get('BENCHMARK_TOLERANCE', '0.2'))
+output_file = os.environ.get('BENCHMARK_OUTPUT', 'benchmark.json')
+baseline_file = os.environ.get('BENCHMARK_BASELINE',
+                               os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                            'benchmark-baseline.json'))
+
+# plugin name -> schema name, for the plugins with a test program
+plugins = {
+    'a11y-keyboard': 'a11y-keyboard',
+    'a11y-settings': 'a11y-settings',
+    'cursor': 'cursor',
+    'housekeeping': 'housekeeping',
+    'keyboard': 'keyboard',
+    'media-keys': 'media-keys',
+    'mouse': 'mouse',
+    'orientation': 'orientation',
+    'power': 'power',
+    'print-notifications': 'print-notifications',
+    'remote-display': 'remote-display',
+    'screensaver-proxy': 'screensaver-proxy',
+    'smartcard': 'smartcard',
+    'sound': 'sound',
+    'wacom': 'gsdwacom',
+    'xrandr': 'xrandr',
+    'xsettings': 'xsettings',
+}
+
+ready_re = re.compile(r"Plugin '[^']*' ready after (\d+) us")
+
+results = {}
+
+
+def median(values):
+    values = sorted(values)
+    if not values:
+        return None
+    mid = len(values) // 2
+    if len(values) % 2:
+        return values[mid]
+    return (values[mid - 1] + values[mid]) / 2.0
+
+
+def context_switches(pid):
+    '''Return the number of context switches of all threads of a process'''
+
+    total = 0
+    for task in os.listdir('/proc/%i/task' % pid):
+        try:
+            with open('/proc/%i/task/%s/status' % (pid, task)) as f:
+                for line in f:
+                    if line.startswith('voluntary_ctxt_switches') or \
+                       line.startswith('nonvoluntary_ctxt_switches'):
+                        total += int(line.split()[1])
+        except IOError:
+            # thread exited
+            pass
+    return total
+
+
+class Plugin:
+    '''A running plugin test program'''
+
+    def __init__(self, workdir, name):
+        self.name = name
+        self.settings = None
+        schema = 'org.gnome.settings-daemon.plugins.' + plugins[name]
+        if schema in Gio.Settings.list_schemas():
+            self.settings = Gio.Settings(schema)
+            self.settings['active'] = False
+            Gio.Settings.sync()
+
+        self.log_write = open(os.path.join(workdir, 'plugin_%s.log' % name), 'wb')
+        env = os.environ.copy()
+        env['GSD_DISABLE_BACKLIGHT_HELPER'] = '1'
+        self.start = time.time()
+        self.daemon = subprocess.Popen(
+            [os.path.join(top_builddir, 'plugins', name, 'gsd-test-' + name)],
+            stdout=self.log_write,
+            stderr=subprocess.STDOUT,
+            env=env)
+        self.log = open(self.log_write.name)
+        self.buffer = ''
+
+    def wait_for_log(self, regex, timeout=10):
+        '''Wait for a log line matching regex
+
+        Return the match and the time it was seen, or (None, None) on timeout.
+        Only log output written after the previous call is considered.
+        '''
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            self.buffer += self.log.read()
+            m = regex.search(self.buffer)
+            if m:
+                self.buffer = self.buffer[m.end():]
+                return (m, time.time())
+            if self.daemon.poll() is not None:
+                break
+            time.sleep(0.001)
+        return (None, None)
+
+    def stop(self):
+        if self.daemon.poll() is None:
+            self.daemon.terminate()
+            self.daemon.wait()
+        self.log.close()
+        self.log_write.close()
+        if self.settings:
+            self.settings.reset('active')
+            Gio.Settings.sync()
+
+
+class BenchmarkTest(gsdtestcase.GSDTestCase):
+    '''Benchmark the plugins'''
+
+    @classmethod
+    def setUpClass(klass):
+        gsdtestcase.GSDTestCase.setUpClass()
+
+        klass.session_log = open(os.path.join(klass.workdir, 'gnome-session.log'), 'wb')
+        klass.session = subprocess.Popen(['gnome-session', '-f',
+                                          '-a', os.path.join(klass.workdir, 'autostart'),
+                                          '--session=dummy', '--debug'],
+                                         stdout=klass.session_log,
+                                         stderr=subprocess.STDOUT)
+        klass.wait_for_bus_object('org.gnome.SessionManager',
+                                  '/org/gnome/SessionManager')
+
+        # the services the plugins talk to, so that they all start in the
+        # same conditions
+        klass.mocks = []
+        (p, klass.obj_upower) = klass.spawn_server_template(
+            'upower', {'OnBattery': False, 'LidIsClosed': False}, stdout=subprocess.PIPE)
+        klass.mocks.append(p)
+        (p, obj) = klass.spawn_server_template('gnome_screensaver', stdout=subprocess.PIPE)
+        klass.mocks.append(p)
+
+        p = klass.spawn_server('org.freedesktop.login1', '/org/freedesktop/login1',
+                               'org.freedesktop.login1.Manager',
+                               system_bus=True, stdout=subprocess.PIPE)
+        klass.mocks.append(p)
+        obj = klass.system_bus_con.get_object('org.freedesktop.login1', '/org/freedesktop/login1')
+        obj.AddMethods('', [
+            ('PowerOff', 'b', '', ''),
+            ('Suspend', 'b', '', ''),
+            ('Hibernate', 'b', '', ''),
+            ('Inhibit', 'ssss', 'h', 'ret = 5'),
+        ], dbus_interface='org.freedesktop.DBus.Mock')
+
+        # the shell's key grabber hands out consecutive action ids, starting
+        # at 1, in the order the accelerators are grabbed
+        p = klass.spawn_server('org.gnome.Shell', '/org/gnome/Shell',
+                               'org.gnome.Shell', stdout=subprocess.PIPE)
+        klass.mocks.append(p)
+        obj = klass.session_bus_con.get_object('org.gnome.Shell', '/org/gnome/Shell')
+        obj.AddMethods('', [
+            ('GrabAccelerator', 'su', 'u',
+             'self.next_action = getattr(self, "next_action", 1) + 1\n'
+             'ret = self.next_action - 1'),
+            ('GrabAccelerators', 'a(su)', 'au',
+             'first = getattr(self, "next_action", 1)\n'
+             'self.next_action = first + len(args[0])\n'
+             'ret = list(range(first, self.next_action))'),
+            ('UngrabAccelerator', 'u', 'b', 'ret = True'),
+        ], dbus_interface='org.freedesktop.DBus.Mock')
+        klass.obj_shell = obj
+
+        for p in klass.mocks:
+            gsdtestcase.set_nonblock(p.stdout)
+
+        klass.bus = Gio.bus_get_sync(Gio.BusType.SESSION, None)
+
+    @classmethod
+    def tearDownClass(klass):
+        for p in klass.mocks:
+            p.terminate()
+            p.wait()
+        klass.session.terminate()
+        klass.session.wait()
+        klass.session_log.close()
+        gsdtestcase.GSDTestCase.tearDownClass()
+
+    def setUp(self):
+        self.plugin = None
+
+    def tearDown(self):
+        if self.plugin:
+            self.plugin.stop()
+
+    def start_plugin(self, name):
+        '''Start a plugin test program and wait until it is ready
+
+        Return the time to ready in ms, or None if the plugin did not get ready.
+        '''
+        if not os.path.exists(os.path.join(top_builddir, 'plugins', name, 'gsd-test-' + name)):
+            return None
+        self.plugin = Plugin(self.workdir, name)
+        (m, when) = self.plugin.wait_for_log(ready_re, timeout=30)
+        if not m:
+            return None
+        return (when - self.plugin.start) * 1000
+
+    def stop_plugin(self):
+        self.plugin.stop()
+        self.plugin = None
+
+    def spin(self, condition, timeout=10):
+        '''Run the main loop until condition() is true
+
+        Return the time it became true, or None on timeout.
+        '''
+        context = GLib.MainContext.default()
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            while context.iteration(False):
+                pass
+            if condition():
+                return time.time()
+            time.sleep(0.001)
+        return None
+
+    def test_startup_and_wakeups(self):
+        '''startup time and idle wakeups of each plugin'''
+
+        for name in sorted(plugins):
+            times = []
+            wakeups = None
+            for i in range(iterations):
+                t = self.start_plugin(name)
+                if t is None:
+                    sys.stderr.write('[%s did not get ready, skipping] ' % name)
+                    if self.plugin:
+                        self.stop_plugin()
+                    break
+                times.append(t)
+
+                # measure the steady state on the last run only
+                if i == iterations - 1:
+                    time.sleep(2)
+                    before = context_switches(self.plugin.daemon.pid)
+                    time.sleep(idle_time)
+                    after = context_switches(self.plugin.daemon.pid)
+                    wakeups = (after - before) * 60.0 / idle_time
+                self.stop_plugin()
+
+            if times:
+                results['startup.%s' % name] = median(times)
+            if wakeups is not None:
+                results['wakeups.%s' % name] = wakeups
+
+    def test_hotplug_input(self):
+        '''keyboard plugin reaction to a new keyboard'''
+
+        if subprocess.call(['which', 'xinput'], stdout=subprocess.PIPE) != 0:
+            self.skipTest('xinput not installed')
+        if self.start_plugin('keyboard') is None:
+            self.skipTest('keyboard plugin did not start')
+
+        # creating a master device pair announces a new keyboard, which is
+        # the closest to a hotplug the dummy driver can do
+        added_re = re.compile('New keyboard plugged in')
+        times = []
+        for i in range(iterations):
+            start = time.time()
+            subprocess.check_call(['xinput', 'create-master', 'benchmark'])
+            (m, when) = self.plugin.wait_for_log(added_re)
+            subprocess.check_call(['xinput', 'remove-master', 'benchmark pointer'])
+            self.assertTrue(m, 'keyboard plugin did not notice the new keyboard')
+            times.append((when - start) * 1000)
+            time.sleep(0.5)
+
+        results['hotplug.input'] = median(times)
+
+    def test_hotplug_output(self):
+        '''power plugin reaction to an output change'''
+
+        if self.start_plugin('power') is None:
+            self.skipTest('power plugin did not start')
+
+        # the dummy driver cannot hotplug outputs; the power test program
+        # re-reads the outputs on SIGUSR2, faking an external monitor
+        changed_re = re.compile('lid switch system inhibitor|already inhibited lid-switch')
+        times = []
+        try:
+            for i in range(iterations):
+                with open('GSD_MOCK_EXTERNAL_MONITOR', 'w') as f:
+                    f.write('1')
+                start = time.time()
+                os.kill(self.plugin.daemon.pid, signal.SIGUSR2)
+                (m, when) = self.plugin.wait_for_log(changed_re)
+                self.assertTrue(m, 'power plugin did not handle the output change')
+                times.append((when - start) * 1000)
+        finally:
+            os.unlink('GSD_MOCK_EXTERNAL_MONITOR')
+
+        results['hotplug.output'] = median(times)
+
+    def play_action(self):
+        '''Return the shell action id of the "play" accelerator, or None'''
+
+        action = 1
+        for (timestamp, method, args) in self.obj_shell.GetCalls(dbus_interface='org.freedesktop.DBus.Mock'):
+            if method == 'GrabAccelerator':
+                if args[0] == 'XF86AudioPlay':
+                    return action
+                action += 1
+            elif method == 'GrabAccelerators':
+                for (accel, flags) in args[0]:
+                    if accel == 'XF86AudioPlay':
+                        return action
+                    action += 1
+        return None
+
+    def test_media_keys_dispatch(self):
+        '''media-keys dispatch of an activated accelerator'''
+
+        self.obj_shell.ClearCalls(dbus_interface='org.freedesktop.DBus.Mock')
+        if self.start_plugin('media-keys') is None:
+            self.skipTest('media-keys plugin did not start')
+
+        action = None
+        deadline = time.time() + 10
+        while action is None and time.time() < deadline:
+            time.sleep(0.1)
+            action = self.play_action()
+        self.assertTrue(action, 'media-keys did not grab the play key')
+
+        pressed = []
+
+        def on_signal(connection, sender, path, iface, signal, params):
+            pressed.append(params[1])
+
+        sub = self.bus.signal_subscribe(None, 'org.gnome.SettingsDaemon.MediaKeys',
+                                        'MediaPlayerKeyPressed',
+                                        '/org/gnome/SettingsDaemon/MediaKeys',
+                                        None, Gio.DBusSignalFlags.NONE, on_signal)
+        self.bus.call_sync('org.gnome.SettingsDaemon.MediaKeys',
+                           '/org/gnome/SettingsDaemon/MediaKeys',
+                           'org.gnome.SettingsDaemon.MediaKeys',
+                           'GrabMediaPlayerKeys',
+                           GLib.Variant('(su)', ('gsd-benchmark', 0)),
+                           None, Gio.DBusCallFlags.NONE, -1, None)
+
+        times = []
+        try:
+            for i in range(iterations):
+                del pressed[:]
+                start = time.time()
+                self.bus.call_sync('org.gnome.Shell', '/org/gnome/Shell',
+                                   'org.freedesktop.DBus.Mock', 'EmitSignal',
+                                   GLib.Variant('(sssav)', ('org.gnome.Shell',
+                                                            'AcceleratorActivated', 'uu',
+                                                            [GLib.Variant('u', action),
+                                                             GLib.Variant('u', 0)])),
+                                   None, Gio.DBusCallFlags.NONE, -1, None)
+                when = self.spin(lambda: 'Play' in pressed)
+                self.assertTrue(when, 'MediaPlayerKeyPressed was not emitted')
+                times.append((when - start) * 1000)
+        finally:
+            self.bus.signal_unsubscribe(sub)
+
+        results['media-keys.dispatch'] = median(times)
+
+    def test_xsettings_propagation(self):
+        '''xsettings propagation of a GSettings change to GTK'''
+
+        try:
+            from gi.repository import Gtk
+        except ImportError:
+            self.skipTest('Gtk GIR not available')
+
+        if self.start_plugin('xsettings') is None:
+            self.skipTest('xsettings plugin did not start')
+
+        gtk_settings = Gtk.Settings.get_default()
+        interface = Gio.Settings('org.gnome.desktop.interface')
+        times = []
+        try:
+            for i in range(iterations):
+                value = 1000 + 100 * (i % 2 + 1)
+                start = time.time()
+                interface['cursor-blink-time'] = value
+                Gio.Settings.sync()
+                when = self.spin(lambda: gtk_settings.props.gtk_cursor_blink_time == value)
+                self.assertTrue(when, 'GTK did not see the new cursor blink time')
+                times.append((when - start) * 1000)
+        finally:
+            interface.reset('cursor-blink-time')
+            Gio.Settings.sync()
+
+        results['xsettings.propagation'] = median(times)
+
+
+def compare(results, baseline):
+    '''Print a comparison against the baseline; return the regressed metrics'''
+
+    regressions = []
+    for key in sorted(set(results) | set(baseline)):
+        new = results.get(key)
+        old = baseline.get(key)
+        if new is None or old is None:
+            mark = ''
+            # a metric that stopped being measured hides any regression
+            if new is None:
+                mark = '  MISSING'
+                regressions.append(key)
+            print('%-35s %10s %10s%s' % (key,
+                                         '-' if old is None else '%.1f' % old,
+                                         '-' if new is None else '%.1f' % new,
+                                         mark))
+            continue
+        mark = ''
+        # ignore noise on metrics that are close to zero
+        if new > old * (1 + tolerance) and new - old > 1:
+            mark = '  REGRESSION'
+            regressions.append(key)
+        print('%-35s %10.1f %10.1f%s' % (key, old, new, mark))
+    return regressions
+
+
+if __name__ == '__main__':
+    program = unittest.main(exit=False, testRunner=unittest.TextTestRunner(stream=sys.stdout, verbosity=2))
+    success = program.result.wasSuccessful()
+
+    with open(output_file, 'w') as f:
+        json.dump({'host': platform.node(),
+                   'time': int(time.time()),
+                   'iterations': iterations,
+                   'metrics': results}, f, indent=2, sort_keys=True)
+    print('Results written to %s' % output_file)
+
+    if os.path.exists(baseline_file):
+        with open(baseline_file) as f:
+            baseline = json.load(f)['metrics']
+        print('\n%-35s %10s %10s' % ('metric', 'baseline', 'current'))
+        if compare(results, baseline):
+            success = False
+
+    if not success:
+        sys.exit(1)